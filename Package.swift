@@ -11,6 +11,10 @@ let package = Package(
             name: "SWNotify",
             targets: ["SWNotify", "CNotify"]
         ),
+        .library(
+            name: "CNotifyCxx",
+            targets: ["CNotifyCxx", "CNotify"]
+        ),
     ],
     targets: [
         // Targets are the basic building blocks of a package, defining a module or a test suite.
@@ -24,11 +28,26 @@ let package = Package(
             name: "SWNotify",
             dependencies: ["CNotify"]
         ),
+        .executableTarget(
+            name: "WatchScaleBenchmark",
+            dependencies: ["SWNotify"]
+        ),
+        .target(
+            name: "CNotifyCxx",
+            dependencies: ["CNotify"],
+            path: "Sources/cnotifycxx",
+            publicHeadersPath: "include"
+        ),
+        .executableTarget(
+            name: "ContextBenchmark",
+            dependencies: ["CNotifyCxx"]
+        ),
         .testTarget(
             name: "PackageTests",
             dependencies: ["SWNotify"]
         )
     ],
     swiftLanguageVersions: [.v5],
-    cLanguageStandard: .c18
+    cLanguageStandard: .c18,
+    cxxLanguageStandard: .cxx17
 )
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cnotify.hpp"
+
+extern "C" {
+#include "source.h"
+}
+
+// Measures what the C++ wrapper costs per event, delivered through a callback and drained in batches, with the
+// in-memory event source so the kernel isn't measured. Prints one JSON object per mode on stdout; progress goes to stderr.
+//
+// Usage: ContextBenchmark [--events count] [--root path]
+
+namespace {
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Generates count creates, deletes and modifies in the watch's directory
+void generate(int watch, uint64_t count) {
+    synthetic_mix mix = { 1, 1, 1, 0, 0 };
+    if (source_use_synthetic(watch, &mix, 1000, count, 1) != 0) {
+        std::fprintf(stderr, "Failed to start the synthetic source\n");
+        std::exit(1);
+    }
+}
+
+void report(const char* mode, uint64_t events, double seconds, uint64_t name_bytes, int batches, uint64_t dropped) {
+    std::printf("{\"batches\":%d,\"dropped\":%llu,\"events\":%llu,\"mode\":\"%s\",\"name_bytes\":%llu,\"ns_per_event\":%.1f,\"seconds\":%.3f}\n",
+                batches, (unsigned long long) dropped, (unsigned long long) events, mode, (unsigned long long) name_bytes,
+                seconds * 1e9 / (double) (events ? events : 1), seconds);
+    std::fflush(stdout);
+}
+
+}
+
+int main(int argc, char** argv) {
+    uint64_t event_count = 1000000;
+    std::string root = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+            event_count = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+            root = argv[++i];
+        }
+    }
+
+    std::string directory = root + "/SWNotifyContextBenchmark";
+    mkdir(directory.c_str(), 0755);
+
+    cnotify::Context context;
+    cnotify::Watch watch = context.watch(directory, IN_CREATE | IN_DELETE | IN_MODIFY);
+
+    // Callback mode: the work a consumer does per event is reading its fields
+    {
+        std::fprintf(stderr, "Dispatching %llu events to a callback\n", (unsigned long long) event_count);
+        uint64_t seen = 0;
+        uint64_t name_bytes = 0;
+        context.on_event([&](const cnotify::Event& event) {
+            name_bytes += event.name().size();
+            __atomic_add_fetch(&seen, 1, __ATOMIC_RELEASE);
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        generate(watch.id(), event_count);
+        while (__atomic_load_n(&seen, __ATOMIC_ACQUIRE) < event_count && seconds_since(start) < 120) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        double seconds = seconds_since(start);
+        source_use_inotify();
+
+        report("callback", seen, seconds, name_bytes, 0, context.dropped());
+        context.on_event(nullptr);
+    }
+
+    // Batch mode: events pile up in the context and are iterated in place a drain at a time
+    {
+        std::fprintf(stderr, "Draining %llu events in batches\n", (unsigned long long) event_count);
+        context.set_max_pending(64 * 1024 * 1024);
+        uint64_t seen = 0;
+        uint64_t name_bytes = 0;
+        int batches = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        generate(watch.id(), event_count);
+        while (seen + context.dropped() < event_count && seconds_since(start) < 120) {
+            cnotify::Batch batch = context.drain();
+            if (batch.empty()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+
+            for (const cnotify::Event& event : batch) {
+                name_bytes += event.name().size();
+                seen++;
+            }
+            batches++;
+        }
+        double seconds = seconds_since(start);
+        source_use_inotify();
+
+        report("batch", seen, seconds, name_bytes, batches, context.dropped());
+    }
+
+    watch.reset();
+    rmdir(directory.c_str());
+    return 0;
+}
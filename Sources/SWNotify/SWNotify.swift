@@ -7,23 +7,341 @@ public enum NotifierError: Error {
     case invalidTarget
     case failedToAddNotifier
     case failedToRemoveNotifier
+    case recordingFailed
+    case sharedMemoryUnavailable
+    case pumpUnavailable
 }
 
-public enum FileSystemEvent: Int32 {
+public enum FileSystemEvent: Int32, CaseIterable {
     case create = 0x0100
     case delete = 0x0200
     case modify = 0x0002
     case moveFrom = 0x0040
     case moveTo = 0x0080
     case rename = 0x00C0
+    case closeWrite = 0x0008
+    case attrib = 0x0004
+    case open = 0x0020
+    case deleteSelf = 0x0400
+    case moveSelf = 0x0800
 }
 
+/// A single event as reported by the kernel, with every event bit it carried.
+public struct FileSystemEventInfo {
+    /// The path of the file the event is about, following `includeAbsolutePathsInEvents` (always absolute for subtree callbacks).
+    public let path: String
+    /// Every event that was set on the record. `.rename` is never included; renames are reported as `.moveFrom` and `.moveTo`.
+    public let events: Set<FileSystemEvent>
+    /// Whether the subject of the event is a directory (`IN_ISDIR`).
+    public let isDirectory: Bool
+}
+
+/// A net change to one file over a settled changeset (see `Notifier.addOnChangesetCallback`).
+public struct FileChange {
+    public enum Kind {
+        case created
+        case modified
+        case deleted
+        /// Moved from `oldPath` to `path`. A chain of renames is reported as a single rename from the first path to the last.
+        case renamed
+    }
+
+    /// What happened to the file over the changeset.
+    public let kind: Kind
+    /// The path of the file, following `includeAbsolutePathsInEvents`.
+    public let path: String
+    /// Where the file was before it was renamed. Only set for `.renamed`.
+    public let oldPath: String?
+    /// Whether the file's content changed. For `.renamed`, whether it was also written before or after the rename, in which
+    /// case it can't just be relinked from `oldPath`.
+    public let isModified: Bool
+    /// Whether the file is a directory.
+    public let isDirectory: Bool
+}
+
+/// A file that was moved, within a watched directory or from one to another (see `Notifier.addOnFileMoveCallback`).
+public struct FileMove {
+    /// Where the file was, following `includeAbsolutePathsInEvents`.
+    public let oldPath: String
+    /// Where the file is now, following `includeAbsolutePathsInEvents`.
+    public let newPath: String
+    /// The watched directory the file was moved out of, following `includeAbsolutePathsInEvents`.
+    public let sourceDirectory: String
+    /// The watched directory the file was moved into. The same as `sourceDirectory` for a rename in place.
+    public let destinationDirectory: String
+
+    /// Whether the file moved from one watched directory to another.
+    public var crossesDirectories: Bool { sourceDirectory != destinationDirectory }
+}
+
+/// Which parts of a file changed since it was last written (see `Notifier.addOnFileDeltaCallback`).
+public struct FileDelta {
+    /// The path of the file, following `includeAbsolutePathsInEvents`.
+    public let path: String
+    /// The byte ranges whose content changed, in whole blocks of `Notifier.deltaBlockSize`, in order and never touching.
+    /// A file that's seen for the first time is reported as changed throughout.
+    public let changedRanges: [Range<Int>]
+    /// The file's size now. Anything past it that was there before was truncated away.
+    public let size: Int
+    /// The file's size when it was last written, or nil if this is the first time it's been seen.
+    public let previousSize: Int?
+}
+
+/// How a watched directory is observed.
+public enum NotifierBackend {
+    /// An inotify watch, falling back to polling only when watches run out (see `Notifier.watchBudget`).
+    case inotify
+    /// Rescanning the directory every `Notifier.pollInterval`. For filesystems where inotify doesn't see every change,
+    /// such as network mounts, FUSE filesystems and some container overlays. Renames within the directory are detected
+    /// by inode and reported like inotify would report them.
+    case polling
+}
+
+/// Relative weights of each kind of event `Notifier.startSyntheticEvents` generates.
+public struct SyntheticEventMix {
+    public var create: Int
+    public var delete: Int
+    public var modify: Int
+    /// A rename within the directory.
+    public var move: Int
+    /// A file moved out of the directory, which is reported as `.moveFrom` once the 500 ms rename window expires.
+    public var moveOut: Int
+
+    public init(create: Int = 1, delete: Int = 1, modify: Int = 1, move: Int = 1, moveOut: Int = 0) {
+        self.create = create
+        self.delete = delete
+        self.modify = modify
+        self.move = move
+        self.moveOut = moveOut
+    }
+}
+
+/// How a recording is replayed.
+public enum ReplayTiming {
+    /// Events are spaced as they were when they were recorded.
+    case original
+    /// Events are handed to the notifier as fast as it takes them, for measuring how fast callbacks keep up.
+    case asFastAsPossible
+}
+
+/// What happens to a watched directory's events once it goes over its rate limit.
+public enum OverflowPolicy {
+    /// Events over the limit are dropped and counted (see `Notifier.suppressedEventCount(for:)`).
+    case drop
+    /// Events over the limit are dropped, and the callbacks added with `addOnEventsSuppressedCallback(_:)` are called
+    /// about once a second with the number of events that were dropped.
+    case coalesce
+    /// One in every `every` events over the limit is let through; the rest are dropped and counted.
+    case sample(every: Int)
+}
+
+/// Which lane a watched directory's events are dispatched from when the notifier is falling behind.
+/// Higher lanes are drained first, in proportion to `Notifier.priorityWeights`.
+public enum NotifierPriority: Int32, CaseIterable {
+    case low = 0
+    case normal = 1
+    case high = 2
+}
+
+/// Queueing and latency counters for one priority lane.
+public struct LaneStatistics {
+    /// How many events are waiting in the lane right now.
+    public let depth: Int
+    /// The most events that have waited in the lane at once.
+    public let maximumDepth: Int
+    /// How many events the lane has dispatched.
+    public let dispatched: Int
+    /// The average time an event waited in the lane before being dispatched, in seconds.
+    public let averageLatency: TimeInterval
+    /// The longest time an event waited in the lane before being dispatched, in seconds.
+    public let maximumLatency: TimeInterval
+}
+
+/// What page-cache warming has done so far, across every watched directory.
+public struct CacheWarmingStatistics {
+    /// How many files have been read ahead.
+    public let filesWarmed: Int
+    /// How many bytes readahead was asked for in total.
+    public let bytesWarmed: Int
+    /// How many files were skipped because they were warmed recently and haven't changed since.
+    public let filesRepeated: Int
+    /// How many files were skipped because they weren't regular files or were gone by the time they were reached.
+    public let filesSkipped: Int
+    /// How many files weren't warmed because the warming thread had fallen behind.
+    public let filesDropped: Int
+}
+
+/// The attributes of a file in a directory whose attributes are being cached (see `Notifier.cachedAttributes(ofFile:in:)`).
+public struct FileMetadata {
+    /// The file's size in bytes.
+    public let size: Int
+    /// When the file's content last changed.
+    public let modificationDate: Date
+    /// The file's inode number.
+    public let inode: UInt64
+    /// The file's type and permission bits, as in `stat`'s `st_mode`.
+    public let mode: UInt32
+    /// Whether the entry is a directory.
+    public var isDirectory: Bool { return mode & UInt32(S_IFMT) == UInt32(S_IFDIR) }
+}
+
+/// How well the attribute cache has been doing, across every directory it caches.
+public struct StatCacheStatistics {
+    /// How many lookups were answered from the cache.
+    public let hits: Int
+    /// How many lookups had to ask the filesystem.
+    public let misses: Int
+    /// How many cached files were dropped because an event said they changed.
+    public let invalidations: Int
+    /// How many files are cached right now.
+    public let entries: Int
+}
+
+/// How long one callback has been taking (see `Notifier.callbackStatistics(forCallbackId:)`).
+public struct CallbackStatistics {
+    /// How many times the callback has been called.
+    public let invocations: Int
+    /// The average time a call took, in seconds.
+    public let averageDuration: TimeInterval
+    /// The longest a call took, in seconds.
+    public let maximumDuration: TimeInterval
+    /// How many calls took longer than `Notifier.callbackLatencyBudget`.
+    public let overBudget: Int
+    /// Whether the callback has been moved to a queue of its own for going over budget too often.
+    public let isIsolated: Bool
+}
+
+/// What the poller's most recent scan cycle cost, for tuning `Notifier.pollInterval`.
+public struct PollStatistics {
+    /// How many scan cycles have run.
+    public let cycles: Int
+    /// How long the last cycle took, in seconds.
+    public let lastCycleDuration: TimeInterval
+    /// The average duration of a cycle, in seconds.
+    public let averageCycleDuration: TimeInterval
+    /// How many directories the last cycle scanned.
+    public let directoriesScanned: Int
+    /// How many directory entries the last cycle looked at.
+    public let entriesScanned: Int
+    /// How many syscalls the last cycle made.
+    public let syscalls: Int
+}
+
+/// A directory or file that's been getting a lot of events recently (see `Notifier.hotDirectories(top:)`).
+public struct HotSpot {
+    /// The path of the directory or file, following `includeAbsolutePathsInEvents`.
+    public let path: String
+    /// Roughly how many events per second it has been getting, averaged over about the last ten seconds.
+    public let eventsPerSecond: Double
+    /// How much of `eventsPerSecond` may be overestimated because its counter was taken over from a quieter path.
+    public let maximumOverestimate: Double
+}
+
+/// Roughly how much memory the notifier's bookkeeping takes up (see `Notifier.memoryUsage`).
+public struct MemoryUsage {
+    /// The C watch table: an entry and a path per watch, indexed by id, inotify wd and path.
+    public let watchTableBytes: Int
+    /// Moves waiting for their other half.
+    public let pendingMoveBytes: Int
+    /// The Swift path and watch id lookup tables.
+    public let swiftTableBytes: Int
+}
+
+fileprivate let isDirectoryEventFlag: UInt32 = 0x40000000
+
 fileprivate func expandPath(_ path: String) -> String {
     let expandedTildePath = NSString(string: path).expandingTildeInPath
     let absolutePath = URL(fileURLWithPath: expandedTildePath).standardizedFileURL.path
     return absolutePath
 }
 
+/// Times every callback call against `Notifier.callbackLatencyBudget`, and moves callbacks that keep going over it onto
+/// a serial queue of their own, so one slow closure stops holding up the thread that reads events.
+fileprivate final class CallbackWatchdog {
+    private struct Timing {
+        var invocations = 0
+        var totalNanoseconds: UInt64 = 0
+        var maximumNanoseconds: UInt64 = 0
+        var overBudget = 0
+    }
+
+    private let lock = NSLock()
+    private var timings: [UUID: Timing] = [:]
+    private var isolated: [UUID: DispatchQueue] = [:]
+
+    var budgetNanoseconds: UInt64 = 100_000_000
+    var isolationThreshold = 3
+
+    /// Calls body for the callback registered as identifier, on the caller's thread, or on the callback's own queue if
+    /// it's been isolated.
+    func call(_ identifier: UUID, _ body: @escaping () -> Void) {
+        lock.lock()
+        let queue = isolated[identifier]
+        lock.unlock()
+
+        if let queue = queue {
+            queue.async { self.time(identifier, body) }
+        }
+        else {
+            time(identifier, body)
+        }
+    }
+
+    private func time(_ identifier: UUID, _ body: () -> Void) {
+        let start = DispatchTime.now().uptimeNanoseconds
+        body()
+        let elapsed = DispatchTime.now().uptimeNanoseconds - start
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        // Removed while it ran
+        guard var timing = timings[identifier] else { return }
+
+        timing.invocations += 1
+        timing.totalNanoseconds += elapsed
+        timing.maximumNanoseconds = max(timing.maximumNanoseconds, elapsed)
+
+        if budgetNanoseconds > 0 && elapsed > budgetNanoseconds {
+            timing.overBudget += 1
+
+            if timing.overBudget >= isolationThreshold && isolated[identifier] == nil {
+                isolated[identifier] = DispatchQueue(label: "SWNotify.callback.\(identifier.uuidString)")
+            }
+        }
+
+        timings[identifier] = timing
+    }
+
+    func register(_ identifier: UUID) {
+        lock.lock()
+        timings[identifier] = Timing()
+        lock.unlock()
+    }
+
+    func unregister(_ identifier: UUID) {
+        lock.lock()
+        timings.removeValue(forKey: identifier)
+        isolated.removeValue(forKey: identifier)
+        lock.unlock()
+    }
+
+    func statistics(for identifier: UUID) -> CallbackStatistics? {
+        lock.lock()
+        defer { lock.unlock() }
+
+        guard let timing = timings[identifier] else { return nil }
+
+        return CallbackStatistics(
+            invocations: timing.invocations,
+            averageDuration: timing.invocations > 0 ? TimeInterval(timing.totalNanoseconds) / TimeInterval(timing.invocations) / 1_000_000_000 : 0,
+            maximumDuration: TimeInterval(timing.maximumNanoseconds) / 1_000_000_000,
+            overBudget: timing.overBudget,
+            isIsolated: isolated[identifier] != nil
+        )
+    }
+}
+
 public class Notifier {
     private static let _default = Notifier()
     private var watches: [String: Int32] = [:]
@@ -35,37 +353,198 @@ public class Notifier {
     private var moveFromCallbacks: [UUID : (String) -> Void] = [:]
     private var moveToCallbacks: [UUID : (String) -> Void] = [:]
     private var renameCallbacks: [UUID : (String, String) -> Void] = [:]
+    private var moveCallbacks: [UUID : (FileMove) -> Void] = [:]
+
+    private var closeWriteCallbacks: [UUID : (String) -> Void] = [:]
+    private var attribCallbacks: [UUID : (String) -> Void] = [:]
+    private var openCallbacks: [UUID : (String) -> Void] = [:]
+    private var deleteSelfCallbacks: [UUID : (String) -> Void] = [:]
+    private var moveSelfCallbacks: [UUID : (String) -> Void] = [:]
+    private var eventCallbacks: [UUID : (FileSystemEventInfo) -> Void] = [:]
+    private var suppressedCallbacks: [UUID : (String, Int) -> Void] = [:]
+    private var subtreeCallbacks: [Int32 : (identifier: UUID, callback: (FileSystemEventInfo) -> Void)] = [:]
+    private var subtreeSubscriptions: [UUID : Int32] = [:]
+    private var changesetCallbacks: [UUID : ([FileChange]) -> Void] = [:]
+    private var deltaCallbacks: [UUID : (FileDelta) -> Void] = [:]
+    private let watchdog = CallbackWatchdog()
+
+    /// Builds the path passed to callbacks for a file in the directory watched by wd.
+    /// Events about the watched directory itself have no filename, so the directory's own path is used.
+    /// Returns nil if the watch was removed while the event was on its way, since there's no longer a path to report.
+    fileprivate static func eventPath(_ filename: UnsafePointer<CChar>?, wd: Int32) -> String? {
+        guard let filename = filename, let directory = _default.watchesReversed[wd] else {
+            return nil
+        }
+
+        let name = String(cString: filename)
+
+        if name.isEmpty {
+            return _default.includeAbsolutePathsInEvents ? expandPath(directory) : directory
+        }
+
+        return (_default.includeAbsolutePathsInEvents ? "\(expandPath(directory))/" : "") + name
+    }
 
     private let onFileCreated: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
-       let filepath = (_default.includeAbsolutePathsInEvents ? "\(expandPath(_default.watchesReversed[wd]!))/" : "") + String(cString: filename!)
-        _default.createCallbacks.values.forEach { $0(filepath) }
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.createCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
     }
 
     private let onFileDeleted: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
-        let filepath = (_default.includeAbsolutePathsInEvents ? "\(expandPath(_default.watchesReversed[wd]!))/" : "") + String(cString: filename!)
-        _default.deleteCallbacks.values.forEach { $0(filepath) }
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.deleteCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
     }
 
     private let onFileModified: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
-        let filepath = (_default.includeAbsolutePathsInEvents ? "\(expandPath(_default.watchesReversed[wd]!))/" : "") + String(cString: filename!)
-        _default.modifyCallbacks.values.forEach { $0(filepath) }
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.modifyCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
     }
 
     private let onFileMovedFrom: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
-        let filepath = (_default.includeAbsolutePathsInEvents ? "\(expandPath(_default.watchesReversed[wd]!))/" : "") + String(cString: filename!)
-        _default.moveFromCallbacks.values.forEach { $0(filepath) }
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.moveFromCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
     }
 
     private let onFileMovedTo: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
-        let filepath = (_default.includeAbsolutePathsInEvents ? "\(expandPath(_default.watchesReversed[wd]!))/" : "") + String(cString: filename!)
-        _default.moveToCallbacks.values.forEach { $0(filepath) }
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.moveToCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
     }
 
-    private let onFileRenamed: @convention(c) (UnsafePointer<CChar>?, UnsafePointer<CChar>?, Int32) -> Void = { oldFilename, newFilename, wd in
-        let fullPath = expandPath(_default.watchesReversed[wd]!)
-        let oldFilepath = (_default.includeAbsolutePathsInEvents ? "\(fullPath)/" : "") + String(cString: oldFilename!)
-        let newFilepath = (_default.includeAbsolutePathsInEvents ? "\(fullPath)/" : "") + String(cString: newFilename!)
-        _default.renameCallbacks.values.forEach { $0(oldFilepath, newFilepath) }
+    private let onFileRenamed: @convention(c) (UnsafePointer<CChar>?, Int32, UnsafePointer<CChar>?, Int32) -> Void = { oldFilename, oldWd, newFilename, newWd in
+        guard let newDirectory = _default.watchesReversed[newWd] else {
+            return
+        }
+
+        // The directory it came from was removed before the move was paired up, so all that's known is where it went
+        guard let oldDirectory = _default.watchesReversed[oldWd] else {
+            _default.onFileMovedTo(newFilename, newWd)
+            return
+        }
+
+        guard let oldFilepath = Notifier.eventPath(oldFilename, wd: oldWd), let newFilepath = Notifier.eventPath(newFilename, wd: newWd) else {
+            return
+        }
+        _default.renameCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(oldFilepath, newFilepath) }
+        }
+
+        guard !_default.moveCallbacks.isEmpty else {
+            return
+        }
+
+        let move = FileMove(
+            oldPath: oldFilepath,
+            newPath: newFilepath,
+            sourceDirectory: _default.includeAbsolutePathsInEvents ? expandPath(oldDirectory) : oldDirectory,
+            destinationDirectory: _default.includeAbsolutePathsInEvents ? expandPath(newDirectory) : newDirectory
+        )
+        _default.moveCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(move) }
+        }
+    }
+
+    private let onFileClosedAfterWrite: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.closeWriteCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
+    }
+
+    private let onFileAttributesChanged: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.attribCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
+    }
+
+    private let onFileOpened: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.openCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
+    }
+
+    private let onWatchedDirectoryDeleted: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.deleteSelfCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
+    }
+
+    private let onWatchedDirectoryMoved: @convention(c) (UnsafePointer<CChar>?, Int32) -> Void = { filename, wd in
+        guard let filepath = Notifier.eventPath(filename, wd: wd) else { return }
+        _default.moveSelfCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(filepath) }
+        }
+    }
+
+    private let onEvent: @convention(c) (UnsafePointer<CChar>?, Int32, UInt32) -> Void = { filename, wd, mask in
+        guard !_default.eventCallbacks.isEmpty, let path = Notifier.eventPath(filename, wd: wd) else { return }
+
+        let events = Set(FileSystemEvent.allCases.filter { $0 != .rename && mask & UInt32(bitPattern: $0.rawValue) != 0 })
+        let info = FileSystemEventInfo(path: path, events: events, isDirectory: mask & isDirectoryEventFlag != 0)
+        _default.eventCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(info) }
+        }
+    }
+
+    private let onEventsSuppressed: @convention(c) (Int32, UInt64) -> Void = { wd, count in
+        guard let directory = _default.watchesReversed[wd] else { return }
+
+        let path = _default.includeAbsolutePathsInEvents ? expandPath(directory) : directory
+        _default.suppressedCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(path, Int(count)) }
+        }
+    }
+
+    private let onSubtreeEvent: @convention(c) (Int32, UnsafePointer<CChar>?, Int32, UInt32) -> Void = { subscription, filename, wd, mask in
+        guard let (identifier, callback) = _default.subtreeCallbacks[subscription], let directory = _default.watchesReversed[wd] else { return }
+
+        // Always absolute, since one subscription hears from many directories
+        let name = String(cString: filename!)
+        let path = name.isEmpty ? expandPath(directory) : "\(expandPath(directory))/\(name)"
+        let events = Set(FileSystemEvent.allCases.filter { $0 != .rename && mask & UInt32(bitPattern: $0.rawValue) != 0 })
+        let info = FileSystemEventInfo(path: path, events: events, isDirectory: mask & isDirectoryEventFlag != 0)
+        _default.watchdog.call(identifier) { callback(info) }
+    }
+
+    private let onChangeset: @convention(c) (UnsafePointer<changeset_change>?, Int32) -> Void = { changes, count in
+        guard let changes = changes, !_default.changesetCallbacks.isEmpty else { return }
+
+        let kinds: [FileChange.Kind] = [.created, .modified, .deleted, .renamed]
+        let fileChanges = UnsafeBufferPointer(start: changes, count: Int(count)).compactMap { change -> FileChange? in
+            guard let path = Notifier.eventPath(change.name, wd: change.wd) else { return nil }
+
+            let oldPath = Notifier.eventPath(change.old_name, wd: change.old_wd)
+            let kind = kinds[Int(change.kind)]
+            let isModified = kind == .renamed ? change.modified != 0 : kind != .deleted
+            return FileChange(kind: kind, path: path, oldPath: oldPath, isModified: isModified, isDirectory: change.is_directory != 0)
+        }
+
+        _default.changesetCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(fileChanges) }
+        }
+    }
+
+    private let onFileDelta: @convention(c) (UnsafePointer<CChar>?, Int32, UnsafePointer<delta_range>?, Int32, Int64, Int64) -> Void = { filename, wd, ranges, count, size, previousSize in
+        guard let path = Notifier.eventPath(filename, wd: wd) else { return }
+
+        let changedRanges = UnsafeBufferPointer(start: ranges, count: Int(count)).map { Int($0.offset)..<Int($0.offset + $0.length) }
+        let delta = FileDelta(path: path, changedRanges: changedRanges, size: Int(size), previousSize: previousSize < 0 ? nil : Int(previousSize))
+
+        _default.deltaCallbacks.forEach { identifier, callback in
+            _default.watchdog.call(identifier) { callback(delta) }
+        }
     }
 
     /// The default notifier instance. Use this to interact with the notifier.
@@ -78,6 +557,238 @@ public class Notifier {
     /// Whether or not to include full paths in events. If false (the default value), only the filename will be included in events.
     public var includeAbsolutePathsInEvents = false;
 
+    /// Whether or not to suppress modify events for files whose content didn't actually change (false by default).
+    /// When enabled, each modified file is fingerprinted by size and mtime, then by a hash of its content, on a pool of worker threads.
+    /// Modify callbacks are then only called when the content differs from the last time the file was seen.
+    public var suppressUnchangedModifications = false {
+        didSet {
+            guard suppressUnchangedModifications != oldValue else { return }
+
+            if suppressUnchangedModifications {
+                fingerprint_enable(Int32(min(ProcessInfo.processInfo.activeProcessorCount, 4)))
+            }
+            else {
+                fingerprint_disable()
+            }
+        }
+    }
+
+    /// The number of threads callbacks are called on, or 0 (the default) to call them all on the notifier's own thread.
+    /// With more than one, events are sharded by watched directory and file name, so callbacks for any one file are still
+    /// called in order, while callbacks for unrelated files run in parallel. Callbacks must then be safe to call concurrently.
+    public var callbackThreads = 0 {
+        didSet {
+            guard callbackThreads != oldValue else { return }
+            updateExecutor()
+        }
+    }
+
+    /// How many events each shard can hold before the notifier thread waits for the callback threads to catch up (1024 by default).
+    /// Only used when `callbackThreads` is more than 0.
+    public var callbackQueueDepth = 1024 {
+        didSet {
+            guard callbackQueueDepth != oldValue else { return }
+            updateExecutor()
+        }
+    }
+
+    /// How many events each priority lane dispatches per round when events are backed up (`high: 16, normal: 4, low: 1` by default).
+    /// Higher lanes go first in each round, but lower lanes always get their share, so they can't be starved.
+    public var priorityWeights: [NotifierPriority: Int] = [.high: 16, .normal: 4, .low: 1] {
+        didSet {
+            for (priority, weight) in priorityWeights {
+                lanes_set_weight(priority.rawValue, Int32(clamping: max(weight, 1)))
+            }
+        }
+    }
+
+    /// A directory to keep snapshot indexes of watched directories in, or `nil` (the default) to not keep them.
+    /// When set, each watched directory's entries are persisted there and kept current as events arrive.
+    /// The next time the directory is passed to `addNotifier`, it is rescanned in the background and create, delete and modify
+    /// callbacks are called for whatever changed while it wasn't being watched.
+    /// Set this before adding notifiers; watches added earlier won't have snapshots.
+    public var snapshotDirectory: String? = nil {
+        didSet {
+            if snapshot_set_directory(snapshotDirectory) != 0 {
+                print("Failed to use \(snapshotDirectory ?? "") as the snapshot directory")
+            }
+        }
+    }
+
+    /// The most inotify watches this notifier will use. Defaults to the kernel's limit (`/proc/sys/fs/inotify/max_user_watches`).
+    /// Once the budget (or the kernel's limit) is reached, the directories with the fewest recent events are moved to a
+    /// low-frequency poller that calls the same callbacks, and are moved back to inotify when they become active again.
+    public var watchBudget: Int {
+        get {
+            return Int(budget_get())
+        }
+        set {
+            budget_set(Int32(clamping: newValue))
+        }
+    }
+
+    /// How often polled directories are rescanned, in seconds (2 by default). This applies both to directories added with
+    /// the `.polling` backend and to those moved to polling because the watch budget ran out.
+    public var pollInterval: TimeInterval {
+        get {
+            return TimeInterval(poller_interval()) / 1000
+        }
+        set {
+            poller_set_interval(Int32(clamping: Int(newValue * 1000)))
+        }
+    }
+
+    /// What the poller's most recent scan cycle cost.
+    public var pollStatistics: PollStatistics {
+        let stats = poller_get_stats()
+
+        return PollStatistics(
+            cycles: Int(stats.cycles),
+            lastCycleDuration: TimeInterval(stats.last_cycle_us) / 1_000_000,
+            averageCycleDuration: stats.cycles > 0 ? TimeInterval(stats.total_cycle_us) / TimeInterval(stats.cycles) / 1_000_000 : 0,
+            directoriesScanned: Int(stats.last_directories),
+            entriesScanned: Int(stats.last_entries),
+            syscalls: Int(stats.last_syscalls)
+        )
+    }
+
+    /// Returns the queueing and latency counters for a priority lane.
+    public func laneStatistics(for priority: NotifierPriority) -> LaneStatistics {
+        var stats = lane_stats()
+        lanes_get_stats(priority.rawValue, &stats)
+
+        return LaneStatistics(
+            depth: Int(stats.depth),
+            maximumDepth: Int(stats.max_depth),
+            dispatched: Int(stats.dispatched),
+            averageLatency: stats.dispatched > 0 ? TimeInterval(stats.total_latency_ns) / TimeInterval(stats.dispatched) / 1_000_000_000 : 0,
+            maximumLatency: TimeInterval(stats.max_latency_ns) / 1_000_000_000
+        )
+    }
+
+    private func hotSpots(kind: Int32, top count: Int) -> [HotSpot] {
+        var hitters = [heavy_hitter](repeating: heavy_hitter(), count: max(count, 0))
+        let found = Int(heavy_top(kind, &hitters, Int32(clamping: hitters.count)))
+
+        return hitters.prefix(found).compactMap { hitter in
+            var name = hitter.name
+            let path = withUnsafePointer(to: &name) { pointer in
+                Notifier.eventPath(UnsafeRawPointer(pointer).assumingMemoryBound(to: CChar.self), wd: hitter.wd)
+            }
+
+            guard let path = path else { return nil }
+            return HotSpot(path: path, eventsPerSecond: hitter.rate, maximumOverestimate: hitter.error)
+        }
+    }
+
+    /// The watched directories that have been getting the most events recently, busiest first.
+    /// Events are counted as they're read, before rate limits, so directories that are being shed still show up.
+    /// - Parameters:
+    /// top: How many directories to return at most.
+    /// - Returns: The busiest directories with their recent event rates.
+    /// - Discussion: Counting is always on and uses a fixed amount of memory, so rates are estimates: a directory
+    /// that isn't among the busiest 128 may be missing, and each rate may be high by up to its `maximumOverestimate`.
+    public func hotDirectories(top count: Int = 10) -> [HotSpot] {
+        return hotSpots(kind: HEAVY_DIRECTORIES, top: count)
+    }
+
+    /// The files that have been getting the most events recently, busiest first. Like `hotDirectories(top:)`, but
+    /// for individual files, tracking the busiest 256.
+    /// - Parameters:
+    /// top: How many files to return at most.
+    /// - Returns: The busiest files with their recent event rates.
+    public func hotFiles(top count: Int = 10) -> [HotSpot] {
+        return hotSpots(kind: HEAVY_FILES, top: count)
+    }
+
+    /// Roughly how much memory the notifier's bookkeeping takes up. Doesn't include the kernel's own memory for inotify watches.
+    public var memoryUsage: MemoryUsage {
+        let entryBytes = MemoryLayout<String>.stride + MemoryLayout<Int32>.stride
+        // Both tables share each path's storage; paths of up to 15 bytes are stored inline
+        let pathBytes = watches.keys.reduce(0) { $0 + ($1.utf8.count > 15 ? $1.utf8.count + 32 : 0) }
+        let swiftBytes = (watches.capacity + watchesReversed.capacity) * entryBytes + pathBytes
+
+        return MemoryUsage(watchTableBytes: Int(watch_table_memory()), pendingMoveBytes: Int(move_table_memory()), swiftTableBytes: swiftBytes)
+    }
+
+    /// The number of watched directories currently being polled rather than watched through inotify.
+    public var polledDirectoryCount: Int {
+        var kernelCount: Int32 = 0
+        var polledCount: Int32 = 0
+        watch_table_counts(&kernelCount, &polledCount)
+
+        return Int(polledCount)
+    }
+
+    /// How long, in seconds, watched directories must go without changes before a changeset is handed to changeset callbacks (`0.2` by default).
+    public var changesetQuietPeriod: TimeInterval = 0.2 {
+        didSet {
+            updateChangeset()
+        }
+    }
+
+    /// The longest, in seconds, a changeset is held back while changes keep coming (`2` by default).
+    public var changesetMaximumLatency: TimeInterval = 2 {
+        didSet {
+            updateChangeset()
+        }
+    }
+
+    private func updateChangeset() {
+        if changesetCallbacks.isEmpty {
+            changeset_disable()
+        }
+        else {
+            changeset_enable(Int64(changesetQuietPeriod * 1000), Int64(changesetMaximumLatency * 1000))
+        }
+    }
+
+    /// The size of the blocks files are compared in for delta callbacks, in bytes (`65536` by default). Rounded up to a multiple of 4096.
+    /// Smaller blocks report changes more precisely but take more memory per file. Changing it forgets every file's previous contents.
+    public var deltaBlockSize = 65536 {
+        didSet {
+            guard deltaBlockSize != oldValue, !deltaCallbacks.isEmpty else { return }
+            delta_disable()
+            updateDelta()
+        }
+    }
+
+    private func updateDelta() {
+        if deltaCallbacks.isEmpty {
+            delta_disable()
+        }
+        else if delta_enable(Int32(min(ProcessInfo.processInfo.activeProcessorCount, 4)), Int64(deltaBlockSize)) != 0 {
+            print("Failed to start delta threads")
+        }
+    }
+
+    /// How long, in seconds, one call to a callback may take before it counts as slow (`0.1` by default), or 0 to only
+    /// time callbacks. A callback that's slow `callbackIsolationThreshold` times is moved onto a serial queue of its own,
+    /// so it no longer holds up the notifier's thread or the other callbacks. See `callbackStatistics(forCallbackId:)`.
+    public var callbackLatencyBudget: TimeInterval = 0.1 {
+        didSet {
+            watchdog.budgetNanoseconds = UInt64(max(callbackLatencyBudget, 0) * 1_000_000_000)
+        }
+    }
+
+    /// How many slow calls it takes for a callback to be moved onto a queue of its own (`3` by default).
+    public var callbackIsolationThreshold = 3 {
+        didSet {
+            watchdog.isolationThreshold = max(callbackIsolationThreshold, 1)
+        }
+    }
+
+    private func updateExecutor() {
+        if callbackThreads > 0 {
+            if executor_enable(Int32(clamping: callbackThreads), Int32(clamping: callbackQueueDepth)) != 0 {
+                print("Failed to start callback threads")
+            }
+        }
+        else {
+            executor_disable()
+        }
+    }
+
     private init() {
         let result = notifier_init()
         if result != 0 {
@@ -89,7 +800,17 @@ public class Notifier {
             set_callback(onFileModified, FileSystemEvent.modify.rawValue)
             set_callback(onFileMovedFrom, 0x0040)
             set_callback(onFileMovedTo, 0x0080)
+            set_callback(onFileClosedAfterWrite, FileSystemEvent.closeWrite.rawValue)
+            set_callback(onFileAttributesChanged, FileSystemEvent.attrib.rawValue)
+            set_callback(onFileOpened, FileSystemEvent.open.rawValue)
+            set_callback(onWatchedDirectoryDeleted, FileSystemEvent.deleteSelf.rawValue)
+            set_callback(onWatchedDirectoryMoved, FileSystemEvent.moveSelf.rawValue)
             set_rename_callback(onFileRenamed)
+            set_event_callback(onEvent)
+            set_suppressed_callback(onEventsSuppressed)
+            set_subtree_callback(onSubtreeEvent)
+            set_changeset_callback(onChangeset)
+            set_delta_callback(onFileDelta)
 
             start_notifier()
         }
@@ -97,23 +818,43 @@ public class Notifier {
 
     /// Add a notifier for specific events from a given path.
     /// - Parameters:
-    /// for: The path to watch for events.
+    /// for: The path of the directory or file to watch for events.
     /// events: The events to watch for.
+    /// backend: How the directory is observed (`.inotify` by default).
+    /// priority: Which lane the directory's events are dispatched from when events back up (`.normal` by default).
     /// - Throws:
     /// `NotifierError.noSuchDirectory` if the path does not exist.
     /// `NotifierError.accessDenied` if the path is not accessible.
+    /// `NotifierError.invalidTarget` if the path is a file and `backend` is `.polling` or the notifier is subscribed to a publisher.
     /// `NotifierError.failedToAddNotifier` if the notifier could not be added.
-    public func addNotifier(for path: String, events: Set<FileSystemEvent>) throws {
+    /// - Discussion: Running out of inotify watches doesn't cause this to fail; see `watchBudget`.
+    /// While subscribed to a publisher (see `startSubscribing(to:)`), `.inotify` directories are fed from the publisher's
+    /// events instead of their own inotify watches.
+    ///
+    /// A file is watched on its own, without hearing about the rest of its directory; its events are passed to callbacks
+    /// with the path it was added with. If the file is replaced, by renaming another file over it or by an editor that
+    /// moves the old file aside, the watch moves onto the new file and `.modify` and `.closeWrite` are reported for it
+    /// (if they were asked for). A file that's deleted with nothing put in its place has to be added again.
+    public func addNotifier(for path: String, events: Set<FileSystemEvent>, backend: NotifierBackend = .inotify, priority: NotifierPriority = .normal) throws {
         let eventMask = events.reduce(0) { $0 | $1.rawValue }
 
         var isDirectory = false
-        _ = FileManager.default.fileExists(atPath: path, isDirectory: &isDirectory)
+        let exists = FileManager.default.fileExists(atPath: path, isDirectory: &isDirectory)
 
-        if (!isDirectory) {
+        if (!exists || (!isDirectory && (backend == .polling || isSubscriber))) {
             throw NotifierError.invalidTarget
         }
 
-        let watchId = add_watch(path, eventMask);
+        let watchId: Int32
+
+        switch backend {
+        case .polling:
+            watchId = add_watch_polling(path, eventMask)
+        case .inotify where !isDirectory:
+            watchId = add_file_watch(path, eventMask)
+        case .inotify:
+            watchId = isSubscriber ? add_watch_subscribed(path, eventMask) : add_watch(path, eventMask)
+        }
 
         guard watchId >= 0 else {
             switch watchId {
@@ -126,8 +867,80 @@ public class Notifier {
             }
         }
 
+        if priority != .normal {
+            set_watch_priority(watchId, priority.rawValue)
+        }
+
         self.watches[path] = watchId
         self.watchesReversed[watchId] = path
+
+        // Only once the watch is known here, since catching up calls back into Swift
+        if isDirectory {
+            snapshot_track(watchId, path)
+        }
+    }
+
+    /// Add notifiers for specific events from many paths at once.
+    /// - Parameters:
+    /// for: The paths of the directories to watch for events.
+    /// events: The events to watch for.
+    /// - Returns: The error for each path that couldn't be watched, keyed by path. Paths that aren't in the dictionary were added.
+    /// - Discussion: This is much faster than calling `addNotifier(for:events:)` for each path when registering thousands of directories,
+    /// since the paths are validated by the kernel as the watches are added and the C side records them in a single pass.
+    @discardableResult
+    public func addNotifiers(for paths: [String], events: Set<FileSystemEvent>) -> [String: NotifierError] {
+        guard !paths.isEmpty else { return [:] }
+
+        let eventMask = events.reduce(0) { $0 | $1.rawValue }
+
+        // One contiguous buffer for every path rather than one allocation per path
+        var offsets: [Int] = []
+        offsets.reserveCapacity(paths.count)
+        var pathBuffer: [CChar] = []
+        pathBuffer.reserveCapacity(paths.reduce(0) { $0 + $1.utf8.count + 1 })
+
+        for path in paths {
+            offsets.append(pathBuffer.count)
+            pathBuffer.append(contentsOf: path.utf8.map { CChar(bitPattern: $0) })
+            pathBuffer.append(0)
+        }
+
+        var results = [Int32](repeating: 0, count: paths.count)
+        pathBuffer.withUnsafeBufferPointer { buffer in
+            var pathPointers: [UnsafePointer<CChar>?] = offsets.map { buffer.baseAddress! + $0 }
+            if isSubscriber { // Events come from the shared ring; kernel watches of our own would deliver them twice
+                _ = add_watches_subscribed(&pathPointers, Int32(paths.count), eventMask, &results)
+            }
+            else {
+                _ = add_watches(&pathPointers, Int32(paths.count), eventMask, &results)
+            }
+        }
+
+        var errors: [String: NotifierError] = [:]
+        self.watches.reserveCapacity(self.watches.count + paths.count)
+        self.watchesReversed.reserveCapacity(self.watchesReversed.count + paths.count)
+
+        for (path, watchId) in zip(paths, results) {
+            guard watchId >= 0 else {
+                switch watchId {
+                case -1:
+                    errors[path] = .noSuchDirectory
+                case -2:
+                    errors[path] = .accessDenied
+                case -4:
+                    errors[path] = .invalidTarget
+                default:
+                    errors[path] = .failedToAddNotifier
+                }
+                continue
+            }
+
+            self.watches[path] = watchId
+            self.watchesReversed[watchId] = path
+            snapshot_track(watchId, path)
+        }
+
+        return errors
     }
 
     /// Remove a notifier for a given path.
@@ -139,7 +952,7 @@ public class Notifier {
             throw NotifierError.failedToRemoveNotifier
         }
 
-        guard remove_watch(watchId) != 0 else {
+        guard remove_watch(watchId) == 0 else {
             throw NotifierError.failedToRemoveNotifier
         }
 
@@ -147,6 +960,404 @@ public class Notifier {
         self.watchesReversed.removeValue(forKey: watchId)
     }
 
+    /// How a watched directory is being observed right now, or nil if it isn't watched. A directory added with `.inotify`
+    /// reports `.polling` while it's been moved to the poller to stay within `watchBudget`.
+    public func backend(for path: String) -> NotifierBackend? {
+        guard let watchId = self.watches[path] else {
+            return nil
+        }
+
+        switch watch_table_kernel_wd(watchId) {
+        case -2:
+            return nil
+        case -1:
+            return .polling
+        default:
+            return .inotify
+        }
+    }
+
+    /// Limit how many events a watched directory can deliver, so a runaway directory can't flood every callback.
+    /// The limit is enforced before events are dispatched, so shed events cost almost nothing.
+    /// Events about the directory itself (`.deleteSelf`, `.moveSelf`) are never limited.
+    /// - Parameters:
+    /// for: The path of a directory that was added with `addNotifier`.
+    /// eventsPerSecond: The sustained rate of events to allow. Pass 0 to remove the limit.
+    /// burst: How many events can be delivered at once before the rate applies.
+    /// overflow: What to do with events over the limit.
+    /// - Throws: `NotifierError.failedToAddNotifier` if the path isn't being watched.
+    public func setRateLimit(for path: String, eventsPerSecond: Double, burst: Int, overflow: OverflowPolicy = .drop) throws {
+        guard let watchId = self.watches[path] else {
+            throw NotifierError.failedToAddNotifier
+        }
+
+        var policy = RATE_LIMIT_DROP
+        var sampleEvery: Int32 = 0
+
+        switch overflow {
+        case .drop:
+            break
+        case .coalesce:
+            policy = RATE_LIMIT_COALESCE
+        case .sample(let every):
+            policy = RATE_LIMIT_SAMPLE
+            sampleEvery = Int32(clamping: every)
+        }
+
+        guard set_rate_limit(watchId, eventsPerSecond, Int32(clamping: burst), policy, sampleEvery) == 0 else {
+            throw NotifierError.failedToAddNotifier
+        }
+    }
+
+    /// Returns how many of a watched directory's events have been shed by its rate limit, or 0 if it has none.
+    public func suppressedEventCount(for path: String) -> Int {
+        guard let watchId = self.watches[path] else { return 0 }
+
+        var passed: UInt64 = 0
+        var suppressed: UInt64 = 0
+        ratelimit_stats(watchId, &passed, &suppressed)
+
+        return Int(suppressed)
+    }
+
+    /// Pull files in a watched directory into the page cache as soon as they're opened or finished being written,
+    /// so processes that read them next don't wait on the disk. Warming runs on a thread of its own and never delays callbacks.
+    /// - Parameters:
+    /// for: The path of a directory that was added with `addNotifier`.
+    /// maximumBytes: How much of each file to read ahead; only the start of bigger files is warmed. Pass 0 to stop warming.
+    /// - Throws: `NotifierError.failedToAddNotifier` if the path isn't being watched or its watch couldn't be updated.
+    /// - Discussion: The directory's watch also listens for `.open` and `.closeWrite` from then on, but callbacks only see the
+    /// events the directory was added with. Files are warmed again only once they change, or after 30 seconds.
+    /// Warming reads each file by opening it, so a directory also watched for `.open` reports that open as well.
+    /// Polled directories don't see opens, so they're never warmed.
+    public func setCacheWarming(for path: String, maximumBytes: Int) throws {
+        guard let watchId = self.watches[path], set_watch_warming(watchId, Int64(max(maximumBytes, 0))) == 0 else {
+            throw NotifierError.failedToAddNotifier
+        }
+    }
+
+    /// Keep an in-memory copy of a watched directory's entries, so `cachedListing(of:)`, `cachedListing(of:contains:)`
+    /// and `cachedEntryCount(of:)` answer without touching the filesystem. The directory is read once, then kept
+    /// current from its own create, delete and move events.
+    /// - Parameters:
+    /// of: The path of a directory that was added with `addNotifier`.
+    /// - Throws: `NotifierError.failedToAddNotifier` if the path isn't being watched or couldn't be read.
+    /// - Discussion: The directory's watch also listens for `.create`, `.delete` and `.rename` from then on, but callbacks
+    /// only see the events the directory was added with. If the kernel's event queue overflows, the listing is read
+    /// again before it's next queried.
+    public func startCachingListing(of path: String) throws {
+        guard let watchId = self.watches[path], set_watch_listing(watchId, 1) == 0 else {
+            throw NotifierError.failedToAddNotifier
+        }
+    }
+
+    /// Stop keeping a copy of a directory's entries.
+    public func stopCachingListing(of path: String) {
+        if let watchId = self.watches[path] {
+            set_watch_listing(watchId, 0)
+        }
+    }
+
+    /// The names of every entry in a directory whose listing is being cached, in no particular order.
+    /// - Returns: The names, or nil if the directory's listing isn't being cached.
+    public func cachedListing(of path: String) -> [String]? {
+        guard let watchId = self.watches[path] else { return nil }
+
+        var buffer: UnsafeMutablePointer<CChar>? = nil
+        var length = 0
+        let count = listing_names(watchId, &buffer, &length)
+
+        guard count >= 0, let names = buffer else { return nil }
+        defer { free(names) }
+
+        var listing: [String] = []
+        listing.reserveCapacity(count)
+
+        var offset = 0
+        while offset < length {
+            let name = String(cString: names + offset)
+            listing.append(name)
+            offset += strlen(names + offset) + 1
+        }
+
+        return listing
+    }
+
+    /// Whether a directory whose listing is being cached has an entry with a given name.
+    /// - Returns: Whether there's an entry called `name`, or nil if the directory's listing isn't being cached.
+    public func cachedListing(of path: String, contains name: String) -> Bool? {
+        guard let watchId = self.watches[path] else { return nil }
+
+        let found = listing_contains(watchId, name)
+        return found < 0 ? nil : found == 1
+    }
+
+    /// How many entries a directory whose listing is being cached has, or nil if its listing isn't being cached.
+    public func cachedEntryCount(of path: String) -> Int? {
+        guard let watchId = self.watches[path] else { return nil }
+
+        let count = listing_count(watchId)
+        return count < 0 ? nil : count
+    }
+
+    /// Cache the size, modification time, inode and mode of files in a watched directory as they're looked up with
+    /// `cachedAttributes(ofFile:in:)`, so asking again costs no syscalls until an event says the file changed.
+    /// - Parameters:
+    /// of: The path of a directory that was added with `addNotifier`.
+    /// - Throws: `NotifierError.failedToAddNotifier` if the path isn't being watched or its watch couldn't be updated.
+    /// - Discussion: The directory's watch also listens for `.modify`, `.attrib`, `.closeWrite`, `.create`, `.delete` and
+    /// `.rename` from then on, but callbacks only see the events the directory was added with. Subdirectories are never
+    /// cached, since what changes inside them isn't reported to this directory's watch.
+    public func startCachingAttributes(of path: String) throws {
+        guard let watchId = self.watches[path], set_watch_stat_cache(watchId, 1) == 0 else {
+            throw NotifierError.failedToAddNotifier
+        }
+    }
+
+    /// Stop caching the attributes of files in a directory.
+    public func stopCachingAttributes(of path: String) {
+        if let watchId = self.watches[path] {
+            set_watch_stat_cache(watchId, 0)
+        }
+    }
+
+    /// The attributes of a file in a watched directory, without following symlinks. They come from the cache if the
+    /// directory's attributes are being cached and the file hasn't changed since it was last looked up, and from the
+    /// filesystem otherwise.
+    /// - Parameters:
+    /// ofFile: The name of the file within the directory.
+    /// in: The path of a directory that was added with `addNotifier`.
+    /// - Returns: The file's attributes, or nil if the directory isn't being watched or the file doesn't exist.
+    public func cachedAttributes(ofFile name: String, in path: String) -> FileMetadata? {
+        guard let watchId = self.watches[path] else { return nil }
+
+        var stat = cached_stat()
+        guard statcache_lookup(watchId, name, &stat) == 0 else { return nil }
+
+        return FileMetadata(
+            size: Int(stat.size),
+            modificationDate: Date(timeIntervalSince1970: Double(stat.mtime_ns) / 1_000_000_000),
+            inode: stat.inode,
+            mode: stat.mode
+        )
+    }
+
+    /// How the attribute cache has done since it was first turned on.
+    public var statCacheStatistics: StatCacheStatistics {
+        var stats = statcache_stats()
+        statcache_get_stats(&stats)
+
+        return StatCacheStatistics(
+            hits: Int(stats.hits),
+            misses: Int(stats.misses),
+            invalidations: Int(stats.invalidations),
+            entries: Int(stats.entries)
+        )
+    }
+
+    /// How long a callback's calls have been taking, and whether it's been isolated for going over `callbackLatencyBudget`.
+    /// - Parameter identifier: The identifier returned when the callback was added.
+    /// - Returns: The callback's timings, or nil if there's no such callback.
+    /// - Discussion: An isolated callback is still called for every event, in order, but no longer in step with the
+    /// other callbacks or with the notifier's thread. It stays isolated until it's removed.
+    public func callbackStatistics(forCallbackId identifier: UUID) -> CallbackStatistics? {
+        return watchdog.statistics(for: identifier)
+    }
+
+    /// What page-cache warming has done since it was first turned on.
+    public var cacheWarmingStatistics: CacheWarmingStatistics {
+        var stats = warm_stats()
+        warm_get_stats(&stats)
+
+        return CacheWarmingStatistics(
+            filesWarmed: Int(stats.warmed),
+            bytesWarmed: Int(stats.bytes),
+            filesRepeated: Int(stats.repeated),
+            filesSkipped: Int(stats.skipped),
+            filesDropped: Int(stats.dropped)
+        )
+    }
+
+    /// Replace the kernel as the source of events with an in-memory generator, to profile callbacks and the rest of the
+    /// pipeline without disk I/O. Events from the kernel aren't read until `stopSyntheticEvents()` is called.
+    /// - Parameters:
+    /// in: The path of a watched directory to generate events for.
+    /// mix: The proportions of each kind of event to generate.
+    /// fileCount: How many distinct file names events are spread over.
+    /// limit: How many events to generate before stopping, or 0 to keep going until `stopSyntheticEvents()`.
+    /// seed: Seeds the generator, so runs with the same seed produce the same events.
+    /// - Throws: `NotifierError.failedToAddNotifier` if the path isn't being watched or the mix is empty.
+    public func startSyntheticEvents(in path: String, mix: SyntheticEventMix = SyntheticEventMix(), fileCount: Int = 1000, limit: Int = 0, seed: UInt64 = 0) throws {
+        guard let watchId = self.watches[path] else {
+            throw NotifierError.failedToAddNotifier
+        }
+
+        var cMix = synthetic_mix(
+            create: UInt32(clamping: mix.create),
+            remove: UInt32(clamping: mix.delete),
+            modify: UInt32(clamping: mix.modify),
+            move: UInt32(clamping: mix.move),
+            move_out: UInt32(clamping: mix.moveOut)
+        )
+
+        guard source_use_synthetic(watchId, &cMix, Int32(clamping: fileCount), UInt64(max(limit, 0)), seed) == 0 else {
+            throw NotifierError.failedToAddNotifier
+        }
+    }
+
+    /// Go back to reading events from the kernel.
+    public func stopSyntheticEvents() {
+        source_use_inotify()
+    }
+
+    /// How many events the synthetic generator has produced since it was last started.
+    public var syntheticEventCount: Int {
+        return Int(source_synthetic_generated())
+    }
+
+    /// Whether timeouts, such as how long a `.moveFrom` waits for its `.moveTo`, follow a virtual clock that only moves
+    /// when `advanceVirtualClock(by:)` is called (false by default). With synthetic events, this makes timing deterministic.
+    public var usesVirtualClock = false {
+        didSet {
+            if usesVirtualClock {
+                clock_set_virtual(get_current_time_millis())
+            }
+            else {
+                clock_set_real()
+            }
+        }
+    }
+
+    /// Move the virtual clock forward, and run whatever that makes due (such as a `.moveFrom` expiring) straight away.
+    /// Has no effect unless `usesVirtualClock` is set.
+    public func advanceVirtualClock(by interval: TimeInterval) {
+        clock_advance(Int64(interval * 1000))
+    }
+
+    /// Start recording every event the notifier reads to a compact binary file, replacing any recording in progress.
+    /// Events are recorded as they're read, before rate limits, with their timing, so a recording can reproduce an event storm.
+    /// - Parameters:
+    /// to: The path of the file to record to. It's created, or truncated if it exists.
+    /// - Throws: `NotifierError.recordingFailed` if the file couldn't be created.
+    public func startRecording(to path: String) throws {
+        guard recorder_start(path) == 0 else {
+            throw NotifierError.recordingFailed
+        }
+    }
+
+    /// Stop recording and write out any events that are still buffered.
+    public func stopRecording() {
+        recorder_stop()
+    }
+
+    /// Feed a recording back through the notifier, calling the same callbacks as if its events had just happened.
+    /// Directories in the recording are matched by path to the directories currently being watched; events for
+    /// directories that aren't being watched are skipped.
+    /// - Parameters:
+    /// from: The path of a file written by `startRecording(to:)`.
+    /// timing: Whether to space events as they were recorded or replay them as fast as possible.
+    /// - Returns: The number of events that were replayed.
+    /// - Throws: `NotifierError.recordingFailed` if the file couldn't be read or isn't a recording.
+    /// - Discussion: This blocks until every event has been handed to the notifier, so call it from a background queue.
+    /// After `startPumping()`, events are handed over all at once and dispatched by the next `processPendingEvents(maxEvents:)` calls.
+    @discardableResult
+    public func replayRecording(from path: String, timing: ReplayTiming = .original) throws -> Int {
+        let replayed = replay_recording(path, timing == .original ? 1 : 0)
+
+        guard replayed >= 0 else {
+            throw NotifierError.recordingFailed
+        }
+
+        return replayed
+    }
+
+    /// Start publishing every event this notifier reads to a shared-memory ring that other processes can subscribe to,
+    /// so only one process pays for the inotify watches and reading from the kernel.
+    /// - Parameters:
+    /// as: The name of the ring. Subscribers pass the same name to `startSubscribing(to:)`.
+    /// capacity: How many events the ring holds. Subscribers that fall further behind than this lose the oldest events.
+    /// - Throws: `NotifierError.sharedMemoryUnavailable` if the ring couldn't be created.
+    /// - Discussion: Events are published as they're read, before rate limits. Directories are identified by their resolved
+    /// path, so subscribers see events for the same directories whatever path they were added with.
+    public func startPublishing(as name: String, capacity: Int = 16384) throws {
+        guard shmring_publish_start(name, Int32(clamping: capacity)) == 0 else {
+            throw NotifierError.sharedMemoryUnavailable
+        }
+    }
+
+    /// Stop publishing events. The ring is left in place, so subscribers pick up again if publishing restarts under the same name.
+    public func stopPublishing() {
+        shmring_publish_stop()
+    }
+
+    /// Start receiving events from another process's shared-memory ring instead of from the kernel.
+    /// Directories added with `addNotifier` from now on are fed from the ring, and call the same callbacks as if they were
+    /// watched directly. Only events the publisher is watching for reach them.
+    /// - Parameters:
+    /// to: The name the publisher passed to `startPublishing(as:capacity:)`.
+    /// - Throws: `NotifierError.sharedMemoryUnavailable` if there's no ring with that name.
+    public func startSubscribing(to name: String) throws {
+        guard shmring_subscribe_start(name) == 0 else {
+            throw NotifierError.sharedMemoryUnavailable
+        }
+    }
+
+    /// Stop receiving events from the publisher. Directories that were added while subscribed stay quiet until they're re-added.
+    public func stopSubscribing() {
+        shmring_subscribe_stop()
+    }
+
+    /// Whether this notifier is receiving events from a publisher.
+    public var isSubscriber: Bool {
+        return shmring_subscribed() != 0
+    }
+
+    /// How many events this subscriber has lost because the publisher overwrote them before they were read.
+    public var subscriberOverruns: Int {
+        return Int(shmring_overruns())
+    }
+
+    /// Stop the notifier's own thread and hand event processing to the caller's run loop (epoll, libdispatch, SwiftNIO, ...),
+    /// so events are read, moves are paired, timers run and callbacks are called on the caller's thread.
+    /// - Returns: A file descriptor that polls readable whenever there are events to process. When it does, call
+    /// `processPendingEvents(maxEvents:)`. Don't read from or close it.
+    /// - Throws: `NotifierError.pumpUnavailable` if the descriptor couldn't be created, or if this is called from a callback.
+    /// - Discussion: Also wait no longer than `nextTimeout()` between calls, so moves out of watched directories and
+    /// changesets are delivered on time. Callbacks still run on the callback threads if `callbackThreads` is set.
+    @discardableResult
+    public func startPumping() throws -> Int32 {
+        let fd = notifier_pump_start()
+
+        guard fd >= 0 else {
+            throw NotifierError.pumpUnavailable
+        }
+
+        return fd
+    }
+
+    /// Go back to processing events on the notifier's own thread. The descriptor returned by `startPumping()` is closed.
+    /// Called from a callback, this takes effect once the current `processPendingEvents(maxEvents:)` call returns.
+    public func stopPumping() {
+        notifier_pump_stop()
+    }
+
+    /// Process whatever events are waiting, on the calling thread, without blocking. Only has an effect after `startPumping()`.
+    /// - Parameters:
+    /// maxEvents: The most events to handle in this call, or 0 for no limit. Anything left over keeps the descriptor readable.
+    /// - Returns: How many events were handled. Called from a callback that this is already running, it does nothing and returns 0.
+    @discardableResult
+    public func processPendingEvents(maxEvents: Int = 0) -> Int {
+        return max(Int(notifier_process(Int32(clamping: maxEvents))), 0)
+    }
+
+    /// How long, in seconds, the caller's run loop can wait on the pump descriptor before calling `processPendingEvents(maxEvents:)`
+    /// anyway, for pending moves to expire, changesets to settle and rate limit reports to go out.
+    /// - Returns: The longest wait, or nil if nothing is due and the descriptor alone will do.
+    public func nextTimeout() -> TimeInterval? {
+        let timeout = notifier_next_timeout()
+        return timeout < 0 ? nil : TimeInterval(timeout) / 1000
+    }
+
     /// Add a callback to be called when a file is created.
     /// - Parameters:
     /// callback: The callback to be called when a file is created. The callback takes the path of the created file as a parameter.
@@ -155,6 +1366,7 @@ public class Notifier {
     public func addOnFileCreateCallback(_ callback: @escaping (String) -> Void) -> UUID {
         let callbackIdentifier = UUID()
         self.createCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
 
         return callbackIdentifier
     }
@@ -167,6 +1379,7 @@ public class Notifier {
     public func addOnFileDeleteCallback(_ callback: @escaping (String) -> Void) -> UUID {
         let callbackIdentifier = UUID()
         self.deleteCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
 
         return callbackIdentifier
     }
@@ -179,6 +1392,7 @@ public class Notifier {
     public func addOnFileModifyCallback(_ callback: @escaping (String) -> Void) -> UUID {
         let callbackIdentifier = UUID()
         self.modifyCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
 
         return callbackIdentifier
     }
@@ -192,6 +1406,7 @@ public class Notifier {
     public func addOnFileMoveFromCallback(_ callback: @escaping (String) -> Void) -> UUID {
         let callbackIdentifier = UUID()
         self.moveFromCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
 
         return callbackIdentifier
     }
@@ -204,6 +1419,7 @@ public class Notifier {
     public func addOnFileMoveToCallback(_ callback: @escaping (String) -> Void) -> UUID {
         let callbackIdentifier = UUID()
         self.moveToCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
 
         return callbackIdentifier
     }
@@ -216,6 +1432,185 @@ public class Notifier {
     public func addOnFileRenameCallback(_ callback: @escaping (String, String) -> Void) -> UUID {
         let callbackIdentifier = UUID()
         self.renameCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a file is renamed or moved from one watched directory to another.
+    /// - Parameters:
+    /// callback: The callback to be called when a file is moved. The callback takes a `FileMove` with both paths and the directories on either side.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    /// - Discussion: A move between two watched directories is reported here, and to rename callbacks, as one event rather than
+    /// as `.moveFrom` and `.moveTo`, so the file can be relinked rather than copied again. Both directories must be watched for `.rename`.
+    @discardableResult
+    public func addOnFileMoveCallback(_ callback: @escaping (FileMove) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.moveCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a file that was opened for writing is closed.
+    /// - Parameters:
+    /// callback: The callback to be called when a file is closed after writing. The callback takes the path of the file as an argument.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    /// - Discussion: Unlike modify callbacks, which are called for every write, this is called once per write session.
+    @discardableResult
+    public func addOnFileCloseWriteCallback(_ callback: @escaping (String) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.closeWriteCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a file's metadata (permissions, timestamps, ownership, link count, ...) changes.
+    /// - Parameters:
+    /// callback: The callback to be called when a file's attributes change. The callback takes the path of the file as an argument.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    @discardableResult
+    public func addOnFileAttributesChangeCallback(_ callback: @escaping (String) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.attribCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a file is opened.
+    /// - Parameters:
+    /// callback: The callback to be called when a file is opened. The callback takes the path of the file as an argument.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    @discardableResult
+    public func addOnFileOpenCallback(_ callback: @escaping (String) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.openCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a watched directory itself is deleted.
+    /// - Parameters:
+    /// callback: The callback to be called when a watched directory is deleted. The callback takes the path of the watched directory as an argument.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    @discardableResult
+    public func addOnDeleteSelfCallback(_ callback: @escaping (String) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.deleteSelfCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a watched directory itself is moved.
+    /// - Parameters:
+    /// callback: The callback to be called when a watched directory is moved. The callback takes the path the directory was watched at as an argument.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    @discardableResult
+    public func addOnMoveSelfCallback(_ callback: @escaping (String) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.moveSelfCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called once for every event read from the kernel.
+    /// - Parameters:
+    /// callback: The callback to be called for every event. The callback takes a `FileSystemEventInfo` describing every event bit that was set, including whether the subject is a directory.
+    /// - Returns: A `UUID` that can be used to remove the callback.
+    /// - Discussion: This is called for events as they are read, so it isn't affected by `suppressUnchangedModifications`.
+    @discardableResult
+    public func addOnEventCallback(_ callback: @escaping (FileSystemEventInfo) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.eventCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called when a directory with a coalescing rate limit has shed events.
+    /// - Parameters:
+    /// callback: The callback to be called. Takes the path of the watched directory and the number of events that were shed since the last call.
+    /// - Returns: A UUID that can be used to remove the callback.
+    @discardableResult
+    public func addOnEventsSuppressedCallback(_ callback: @escaping (String, Int) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.suppressedCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback for events from every watched directory at or under a path, such as everything under `/data/ingest`.
+    /// Directories still have to be watched with `addNotifier`; watching or unwatching them later doesn't require adding the callback again.
+    /// - Parameters:
+    /// under: The path whose subtree to hear about.
+    /// events: The events to call the callback for.
+    /// callback: The callback to be called. Takes the details of the event; its path is always absolute, whatever `includeAbsolutePathsInEvents` is set to.
+    /// - Returns: A UUID that can be used to remove the callback.
+    /// - Throws: `NotifierError.failedToAddNotifier` if the subscription couldn't be added.
+    /// - Discussion: Each directory's subscribers are worked out once and cached until a subtree callback is added or removed,
+    /// so the cost of an event doesn't grow with the number of subtree callbacks.
+    @discardableResult
+    public func addSubtreeCallback(under path: String, events: Set<FileSystemEvent>, _ callback: @escaping (FileSystemEventInfo) -> Void) throws -> UUID {
+        let eventMask = events.reduce(0) { $0 | $1.rawValue }
+        let subscription = subtree_subscribe(expandPath(path), UInt32(bitPattern: eventMask))
+
+        guard subscription >= 0 else {
+            throw NotifierError.failedToAddNotifier
+        }
+
+        let callbackIdentifier = UUID()
+        self.subtreeCallbacks[subscription] = (callbackIdentifier, callback)
+        self.subtreeSubscriptions[callbackIdentifier] = subscription
+        self.watchdog.register(callbackIdentifier)
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called with everything that changed once watched directories have settled, instead of once per event.
+    /// Creates, modifications, deletions and renames are folded into one entry per file: a file that's created and written
+    /// to is reported as created, one that's created and deleted again isn't reported at all, and a chain of renames is one rename.
+    /// - Parameters:
+    /// callback: The callback to be called. Takes the changes since the last call.
+    /// - Returns: A UUID that can be used to remove the callback.
+    /// - Discussion: A changeset is handed over once nothing has changed for `changesetQuietPeriod`, or after
+    /// `changesetMaximumLatency` if changes keep coming. Only events the directories are watched for are counted, so
+    /// watch for `.create`, `.modify`, `.delete` and `.rename` (and `.closeWrite` if modifications should count once the file is closed).
+    @discardableResult
+    public func addOnChangesetCallback(_ callback: @escaping ([FileChange]) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.changesetCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        if self.changesetCallbacks.count == 1 {
+            updateChangeset()
+        }
+
+        return callbackIdentifier
+    }
+
+    /// Add a callback to be called with the byte ranges that changed whenever a file is closed after being written, so
+    /// large files rewritten in place (database dumps, disk images) can be replicated by shipping only what changed.
+    /// - Parameters:
+    /// callback: The callback to be called. Takes the file's path and which ranges changed.
+    /// - Returns: A UUID that can be used to remove the callback.
+    /// - Discussion: While any delta callback is registered, every close-written file is hashed in blocks of `deltaBlockSize`
+    /// on a pool of worker threads, and its block hashes are kept until it's deleted or moved away. The callback is called
+    /// on those threads, and not at all if the file was rewritten with the same content. Directories must be watched for `.closeWrite`.
+    @discardableResult
+    public func addOnFileDeltaCallback(_ callback: @escaping (FileDelta) -> Void) -> UUID {
+        let callbackIdentifier = UUID()
+        self.deltaCallbacks[callbackIdentifier] = callback
+        self.watchdog.register(callbackIdentifier)
+
+        if self.deltaCallbacks.count == 1 {
+            updateDelta()
+        }
 
         return callbackIdentifier
     }
@@ -223,11 +1618,33 @@ public class Notifier {
     /// Remove a callback for a given identifier.
     /// - Parameter identifier: The identifier of the callback to remove.
     public func removeCallback(forCallbackId identifier: UUID) {
+        self.watchdog.unregister(identifier)
         self.createCallbacks.removeValue(forKey: identifier)
         self.deleteCallbacks.removeValue(forKey: identifier)
         self.modifyCallbacks.removeValue(forKey: identifier)
         self.moveFromCallbacks.removeValue(forKey: identifier)
         self.moveToCallbacks.removeValue(forKey: identifier)
         self.renameCallbacks.removeValue(forKey: identifier)
+        self.moveCallbacks.removeValue(forKey: identifier)
+        self.closeWriteCallbacks.removeValue(forKey: identifier)
+        self.attribCallbacks.removeValue(forKey: identifier)
+        self.openCallbacks.removeValue(forKey: identifier)
+        self.deleteSelfCallbacks.removeValue(forKey: identifier)
+        self.moveSelfCallbacks.removeValue(forKey: identifier)
+        self.eventCallbacks.removeValue(forKey: identifier)
+        self.suppressedCallbacks.removeValue(forKey: identifier)
+
+        if self.changesetCallbacks.removeValue(forKey: identifier) != nil && self.changesetCallbacks.isEmpty {
+            updateChangeset()
+        }
+
+        if self.deltaCallbacks.removeValue(forKey: identifier) != nil && self.deltaCallbacks.isEmpty {
+            updateDelta()
+        }
+
+        if let subscription = self.subtreeSubscriptions.removeValue(forKey: identifier) {
+            subtree_unsubscribe(subscription)
+            self.subtreeCallbacks.removeValue(forKey: subscription)
+        }
     }
 }
@@ -0,0 +1,164 @@
+import Foundation
+import SWNotify
+
+// Measures how registration, memory, dispatch and teardown scale with the number of watched directories.
+// Prints one JSON object per scale on stdout; progress goes to stderr.
+//
+// Usage: WatchScaleBenchmark [directory counts...] [--root path] [--events count]
+
+var scales = [10_000, 100_000, 1_000_000]
+var rootPath = FileManager.default.fileExists(atPath: "/dev/shm") ? "/dev/shm" : FileManager.default.temporaryDirectory.path
+var eventCount = 1_000_000
+
+var arguments = CommandLine.arguments.dropFirst()
+var requestedScales: [Int] = []
+while let argument = arguments.popFirst() {
+    switch argument {
+    case "--root":
+        rootPath = arguments.popFirst() ?? rootPath
+    case "--events":
+        eventCount = arguments.popFirst().flatMap { Int($0) } ?? eventCount
+    default:
+        if let scale = Int(argument) {
+            requestedScales.append(scale)
+        }
+    }
+}
+if !requestedScales.isEmpty {
+    scales = requestedScales
+}
+
+func log(_ message: String) {
+    FileHandle.standardError.write(Data("\(message)\n".utf8))
+}
+
+func now() -> TimeInterval {
+    var ts = timespec()
+    clock_gettime(CLOCK_MONOTONIC, &ts)
+    return TimeInterval(ts.tv_sec) + TimeInterval(ts.tv_nsec) / 1e9
+}
+
+func residentBytes() -> Int {
+    guard let statm = try? String(contentsOfFile: "/proc/self/statm", encoding: .utf8) else { return 0 }
+    let fields = statm.split(separator: " ")
+    return fields.count > 1 ? (Int(fields[1]) ?? 0) * Int(sysconf(Int32(_SC_PAGESIZE))) : 0
+}
+
+// Spreads count directories over branches of at most 1000, so no single directory gets huge
+func buildTree(at path: String, count: Int) -> [String] {
+    var directories: [String] = []
+    directories.reserveCapacity(count)
+
+    for branch in 0..<((count + 999) / 1000) {
+        let branchPath = "\(path)/b\(branch)"
+        mkdir(branchPath, 0o755)
+
+        for leaf in 0..<min(1000, count - branch * 1000) {
+            let leafPath = "\(branchPath)/d\(leaf)"
+            mkdir(leafPath, 0o755)
+            directories.append(leafPath)
+        }
+    }
+
+    return directories
+}
+
+// Incremented from the notifier's thread (or threads) while the main thread waits on it
+final class Counter {
+    private let lock = NSLock()
+    private var count = 0
+
+    var value: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return count
+    }
+
+    func increment() {
+        lock.lock()
+        count += 1
+        lock.unlock()
+    }
+
+    func reset() {
+        lock.lock()
+        count = 0
+        lock.unlock()
+    }
+}
+
+let notifier = Notifier.default
+let dispatched = Counter()
+let callback = notifier.addOnEventCallback { _ in dispatched.increment() }
+
+for scale in scales {
+    let treePath = "\(rootPath)/SWNotifyWatchScale-\(scale)"
+    try? FileManager.default.removeItem(atPath: treePath)
+    mkdir(treePath, 0o755)
+
+    log("Building \(scale) directories under \(treePath)")
+    let directories = buildTree(at: treePath, count: scale)
+
+    let residentBefore = residentBytes()
+    let memoryBefore = notifier.memoryUsage
+
+    log("Registering")
+    var start = now()
+    let errors = notifier.addNotifiers(for: directories, events: [.create, .delete, .modify, .rename])
+    let registrationSeconds = now() - start
+
+    let residentAfter = residentBytes()
+    let memoryAfter = notifier.memoryUsage
+    let registered = max(directories.count - errors.count, 1)
+
+    // Dispatch cost with this many watches in the tables, from the in-memory source so the kernel isn't measured
+    log("Dispatching \(eventCount) events")
+    dispatched.reset()
+    start = now()
+    try notifier.startSyntheticEvents(in: directories[directories.count / 2], mix: SyntheticEventMix(create: 1, delete: 1, modify: 1, move: 0, moveOut: 0), limit: eventCount)
+    while dispatched.value < eventCount && now() - start < 120 {
+        usleep(1000)
+    }
+    let dispatchSeconds = now() - start
+    let eventsDispatched = dispatched.value
+    notifier.stopSyntheticEvents()
+
+    // Through removeNotifier, as an app would tear its watches down, so the Swift tables are emptied too and the next
+    // scale starts from nothing
+    log("Removing")
+    var removeFailures = 0
+    start = now()
+    for directory in directories where errors[directory] == nil {
+        do {
+            try notifier.removeNotifier(for: directory)
+        } catch {
+            removeFailures += 1
+        }
+    }
+    let teardownSeconds = now() - start
+
+    let result: [String: Any] = [
+        "directories": scale,
+        "registered": directories.count - errors.count,
+        "polled": notifier.polledDirectoryCount,
+        "registration_seconds": registrationSeconds,
+        "registration_us_per_watch": registrationSeconds * 1e6 / Double(registered),
+        "resident_bytes_per_watch": Double(residentAfter - residentBefore) / Double(registered),
+        "watch_table_bytes_per_watch": Double(memoryAfter.watchTableBytes - memoryBefore.watchTableBytes) / Double(registered),
+        "swift_table_bytes_per_watch": Double(memoryAfter.swiftTableBytes - memoryBefore.swiftTableBytes) / Double(registered),
+        "pending_move_bytes": memoryAfter.pendingMoveBytes,
+        "dispatch_ns_per_event": dispatchSeconds * 1e9 / Double(max(eventsDispatched, 1)),
+        "events_dispatched": eventsDispatched,
+        "teardown_failures": removeFailures,
+        "teardown_seconds": teardownSeconds,
+        "teardown_us_per_watch": teardownSeconds * 1e6 / Double(registered)
+    ]
+
+    let json = try JSONSerialization.data(withJSONObject: result, options: [.sortedKeys])
+    print(String(decoding: json, as: UTF8.self))
+    fflush(stdout)
+
+    try? FileManager.default.removeItem(atPath: treePath)
+}
+
+notifier.removeCallback(forCallbackId: callback)
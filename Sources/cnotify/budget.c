@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "budget.h"
+#include "notify.h"
+#include "poller.h"
+#include "snapshot.h"
+#include "warm.h"
+#include "listing.h"
+#include "statcache.h"
+#include "filewatch.h"
+#include "watches.h"
+
+// At most this many of the coldest watches are moved to polling at once when the budget runs out
+#define DEMOTE_BATCH 64
+
+static int budget = 0;
+
+// Reads the kernel's per-user watch limit and uses it as the budget
+int budget_init() {
+    FILE* file = fopen("/proc/sys/fs/inotify/max_user_watches", "r");
+    int limit = 0;
+
+    if (file == NULL || fscanf(file, "%d", &limit) != 1 || limit <= 0) {
+        limit = 8192; // The kernel's historical default
+    }
+
+    if (file) {
+        fclose(file);
+    }
+
+    budget = limit;
+    return limit;
+}
+
+int budget_get() {
+    return budget;
+}
+
+void budget_set(int new_budget) {
+    budget = new_budget > 0 ? new_budget : 1;
+}
+
+// How many more inotify watches can be added before the budget is used up
+int budget_room() {
+    int kernel_count, polled_count;
+    watch_table_counts(&kernel_count, &polled_count);
+
+    return budget > kernel_count ? budget - kernel_count : 0;
+}
+
+// The mask actually given to the kernel for a watch the caller asked for flags on
+int watch_kernel_flags(int flags) {
+    return snapshot_enabled() ? flags | SNAPSHOT_EVENTS : flags;
+}
+
+// The events an existing watch's kernel watch (or the poller) has to report: what the caller asked for, plus whatever
+// snapshots, cache warming, its listing and stat caches, and following a replaced file need. Dispatch keeps the extra
+// events from callbacks.
+int watch_wanted_flags(int wd) {
+    int flags = watch_kernel_flags(watch_table_flags(wd));
+
+    if (warm_limit(wd) > 0) {
+        flags |= WARM_EVENTS;
+    }
+
+    if (listing_tracked(wd)) {
+        flags |= LISTING_EVENTS;
+    }
+
+    if (statcache_tracked(wd)) {
+        flags |= STATCACHE_EVENTS;
+    }
+
+    if (filewatch_tracked(wd)) {
+        flags |= FILE_WATCH_EVENTS;
+    }
+
+    return flags;
+}
+
+int watch_error_code(int error) {
+    switch (error) {
+        case ENOENT: // Directory doesn't exist
+            return -1;
+        case EACCES: // Permission denied
+            return -2;
+        case ENOTDIR: // Not a directory
+            return -4;
+        default: // No idea what happened, but it isn't good.
+            return -3;
+    }
+}
+
+// Moves up to count of the coldest inotify watches to the poller. Returns how many were moved.
+static int demote_coldest(int count) {
+    int wds[DEMOTE_BATCH];
+    int demoted = 0;
+    int skipped = 1;
+
+    if (count > DEMOTE_BATCH) {
+        count = DEMOTE_BATCH;
+    }
+
+    // Watches the poller can't take are passed over from then on, so another round finds the next coldest in their place
+    while (demoted < count && skipped > 0) {
+        int found = watch_table_coldest(wds, count - demoted);
+        skipped = 0;
+
+        for (int i = 0; i < found; i++) {
+            char path[4096];
+            int kernel_wd = watch_table_kernel_wd(wds[i]);
+
+            if (kernel_wd < 0 || watch_table_path(wds[i], path, sizeof(path)) != 0) {
+                continue;
+            }
+
+            // The poller takes its first scan before the inotify watch goes away, so nothing falls in between
+            if (poller_add(wds[i], path, 0) != 0) {
+                watch_table_set_unpollable(wds[i]);
+                skipped++;
+                continue;
+            }
+
+            watch_table_set_kernel_wd(wds[i], -1);
+            inotify_rm_watch(notifier_fd(), kernel_wd);
+            demoted++;
+        }
+    }
+
+    return demoted;
+}
+
+// Demoting in batches avoids a scan of the watch table for every add once the budget is reached
+static int demote_batch_size() {
+    int size = budget / 64;
+    return size < 1 ? 1 : size > DEMOTE_BATCH ? DEMOTE_BATCH : size;
+}
+
+// Adds a watch that's served by the poller. Returns the watch's id or an error code.
+int add_polled_watch(const char* filepath, int flags, int pinned) {
+    struct stat st;
+    if (stat(filepath, &st) != 0) {
+        return watch_error_code(errno);
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        return -4;
+    }
+
+    int wd = watch_table_add(-1, filepath, flags);
+    if (wd < 0) {
+        return -3;
+    }
+
+    if (poller_add(wd, filepath, pinned) != 0) {
+        watch_table_remove(wd);
+        return -3;
+    }
+
+    return wd;
+}
+
+// Takes the new flags for a path that's already watched. An inotify watch gets a mask for them plus whatever its
+// features still need; a polled one is promoted if there's room, rather than given an inotify watch alongside the
+// poller that would report every event twice. Returns the watch's id or an error code.
+static int rewatch(int wd, const char* filepath, int flags) {
+    int kernel_wd = watch_table_kernel_wd(wd);
+    watch_table_set_flags(wd, flags);
+
+    if (kernel_wd == -1) {
+        budget_promote(wd); // Otherwise it stays polled, and the poller picks up the flags on its next scan
+        return wd;
+    }
+
+    int new_kernel_wd = inotify_add_watch(notifier_fd(), filepath, watch_wanted_flags(wd));
+    if (new_kernel_wd < 0) {
+        return watch_error_code(errno);
+    }
+
+    // A different wd means the path leads to another directory now
+    if (new_kernel_wd != kernel_wd) {
+        watch_table_set_kernel_wd(wd, new_kernel_wd);
+    }
+
+    return wd;
+}
+
+// Adds an inotify watch, making room by demoting cold watches when the budget or the kernel limit is reached.
+// If there's nothing left to demote, the directory is polled instead of failing. Returns the watch's id or an error code.
+int budget_add_watch(const char* filepath, int flags) {
+    int existing = watch_table_find(filepath);
+    if (existing >= 0 && watch_table_kernel_wd(existing) >= -1) {
+        return rewatch(existing, filepath, flags);
+    }
+
+    if (budget_room() == 0) {
+        demote_coldest(demote_batch_size());
+    }
+
+    int kernel_flags = watch_kernel_flags(flags);
+    int kernel_wd = inotify_add_watch(notifier_fd(), filepath, kernel_flags);
+
+    if (kernel_wd < 0 && errno == ENOSPC && demote_coldest(demote_batch_size()) > 0) {
+        kernel_wd = inotify_add_watch(notifier_fd(), filepath, kernel_flags);
+    }
+
+    if (kernel_wd < 0) {
+        return errno == ENOSPC ? add_polled_watch(filepath, flags, 0) : watch_error_code(errno);
+    }
+
+    int wd = watch_table_add(kernel_wd, filepath, flags);
+    return wd < 0 ? -3 : wd;
+}
+
+// Moves a polled directory that has become active back to inotify, demoting a colder watch if there's no room.
+// Returns 0 if it was promoted.
+int budget_promote(int wd) {
+    if (budget_room() == 0) {
+        int coldest;
+        if (watch_table_coldest(&coldest, 1) == 0 || watch_table_heat(coldest) >= watch_table_heat(wd)) {
+            return -1;
+        }
+
+        if (demote_coldest(1) == 0) {
+            return -1;
+        }
+    }
+
+    char path[4096];
+    if (watch_table_path(wd, path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    int kernel_wd = inotify_add_watch(notifier_fd(), path, watch_wanted_flags(wd));
+    if (kernel_wd < 0) {
+        return -1;
+    }
+
+    watch_table_set_kernel_wd(wd, kernel_wd);
+    poller_remove(wd, 1);
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "changeset.h"
+#include "hashtable.h"
+#include "types.h"
+#include "util.h"
+
+// Internal entry states, alongside the CHANGE_* kinds that are handed out
+#define STATE_UNCHANGED 4   // Untouched so far, or created and deleted again within the window
+#define STATE_MOVED_AWAY 5  // The origin of a rename; reported as part of the rename
+
+#define CHANGESET_EVENTS (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+extern struct callback_collection callbacks;
+
+// Entries are stored densely, so renames can refer to their origin by index, and found through an open-addressing
+// index of entry + 1 (0 for an empty slot) kept at most half full
+struct changeset {
+    struct changeset_entry* entries;
+    int count;
+    int capacity;
+    uint32_t* index;
+    uint32_t index_size;
+    char* names;
+    size_t names_length;
+    size_t names_capacity;
+    int* pending_moves;     // Entries moved away whose IN_MOVED_TO hasn't arrived
+    int pending_count;
+    int pending_capacity;
+    long long first_ms;
+    long long last_ms;
+};
+
+static struct changeset current = { 0 };
+static int enabled = 0;
+static long long quiet_period_ms = 200;
+static long long max_latency = 2000;
+static pthread_mutex_t changeset_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_changeset(struct changeset* changeset) {
+    free(changeset->entries);
+    free(changeset->index);
+    free(changeset->names);
+    free(changeset->pending_moves);
+    memset(changeset, 0, sizeof(struct changeset));
+}
+
+// Starts accumulating changes, handing them to the changeset callback once nothing has changed for quiet_ms, or
+// max_latency_ms after the first change if changes keep coming
+void changeset_enable(long long quiet_ms, long long max_latency_ms) {
+    pthread_mutex_lock(&changeset_lock);
+    quiet_period_ms = quiet_ms < 1 ? 1 : quiet_ms;
+    max_latency = max_latency_ms < quiet_period_ms ? quiet_period_ms : max_latency_ms;
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&changeset_lock);
+}
+
+// Stops accumulating; anything not yet handed out is dropped
+void changeset_disable() {
+    pthread_mutex_lock(&changeset_lock);
+    __atomic_store_n(&enabled, 0, __ATOMIC_RELEASE);
+    free_changeset(&current);
+    pthread_mutex_unlock(&changeset_lock);
+}
+
+int changeset_enabled() {
+    return __atomic_load_n(&enabled, __ATOMIC_ACQUIRE);
+}
+
+static const char* entry_name(const struct changeset* changeset, const struct changeset_entry* entry) {
+    return changeset->names + entry->name_offset;
+}
+
+static int grow_index(struct changeset* changeset) {
+    uint32_t size = changeset->index_size ? changeset->index_size * 2 : 256;
+    uint32_t* index = (uint32_t*) calloc(size, sizeof(uint32_t));
+    if (index == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < changeset->count; i++) {
+        uint32_t slot = (uint32_t) changeset->entries[i].hash & (size - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        index[slot] = (uint32_t) i + 1;
+    }
+
+    free(changeset->index);
+    changeset->index = index;
+    changeset->index_size = size;
+    return 0;
+}
+
+// Returns the index of the entry for (wd, name), adding it in STATE_UNCHANGED if it isn't there, or -1 if out of memory
+static int find_entry(struct changeset* changeset, int wd, const char* name) {
+    size_t length = strnlen(name, UINT16_MAX);
+
+    if ((uint32_t) (changeset->count + 1) * 2 > changeset->index_size && grow_index(changeset) != 0) {
+        return -1;
+    }
+
+    uint64_t hash = watch_name_hash64(wd, name, length);
+    uint32_t slot = (uint32_t) hash & (changeset->index_size - 1);
+
+    for (; changeset->index[slot] != 0; slot = (slot + 1) & (changeset->index_size - 1)) {
+        struct changeset_entry* entry = &changeset->entries[changeset->index[slot] - 1];
+        if (entry->hash == hash && entry->wd == wd && entry->name_length == length && memcmp(entry_name(changeset, entry), name, length) == 0) {
+            return (int) changeset->index[slot] - 1;
+        }
+    }
+
+    if (changeset->count == changeset->capacity) {
+        int capacity = changeset->capacity ? changeset->capacity * 2 : 128;
+        struct changeset_entry* entries = (struct changeset_entry*) realloc(changeset->entries, (size_t) capacity * sizeof(struct changeset_entry));
+        if (entries == NULL) {
+            return -1;
+        }
+        changeset->entries = entries;
+        changeset->capacity = capacity;
+    }
+
+    if (changeset->names_length + length + 1 > changeset->names_capacity) {
+        size_t capacity = changeset->names_capacity ? changeset->names_capacity * 2 : 4096;
+        while (capacity < changeset->names_length + length + 1) {
+            capacity *= 2;
+        }
+
+        char* names = (char*) realloc(changeset->names, capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        changeset->names = names;
+        changeset->names_capacity = capacity;
+    }
+
+    struct changeset_entry* entry = &changeset->entries[changeset->count];
+    entry->hash = hash;
+    entry->wd = wd;
+    entry->name_offset = (uint32_t) changeset->names_length;
+    entry->name_length = (uint16_t) length;
+    entry->state = STATE_UNCHANGED;
+    entry->is_directory = 0;
+    entry->modified = 0;
+    entry->origin = -1;
+    entry->cookie = 0;
+
+    memcpy(changeset->names + changeset->names_length, name, length);
+    changeset->names[changeset->names_length + length] = '\0';
+    changeset->names_length += length + 1;
+
+    changeset->index[slot] = (uint32_t) changeset->count + 1;
+    return changeset->count++;
+}
+
+static void apply_create(struct changeset* changeset, int i) {
+    struct changeset_entry* entry = &changeset->entries[i];
+
+    // Deleted and recreated within the window is a modification as far as anyone outside it can tell
+    entry->state = entry->state == CHANGE_DELETED || entry->state == STATE_MOVED_AWAY ? CHANGE_MODIFIED : CHANGE_CREATED;
+}
+
+static void apply_modify(struct changeset* changeset, int i) {
+    struct changeset_entry* entry = &changeset->entries[i];
+    entry->modified = 1; // Also for a renamed entry, so the rename isn't taken to mean the content is as it was
+
+    if (entry->state == STATE_UNCHANGED || entry->state == CHANGE_DELETED || entry->state == STATE_MOVED_AWAY) {
+        entry->state = CHANGE_MODIFIED;
+    }
+}
+
+static void apply_delete(struct changeset* changeset, int i) {
+    struct changeset_entry* entry = &changeset->entries[i];
+
+    entry->modified = 0;
+
+    switch (entry->state) {
+    case CHANGE_CREATED:
+        entry->state = STATE_UNCHANGED;
+        break;
+    case CHANGE_RENAMED:
+        // What's gone is the file that was renamed, so it's its original name that was deleted
+        if (changeset->entries[entry->origin].state == STATE_MOVED_AWAY) {
+            changeset->entries[entry->origin].state = CHANGE_DELETED;
+        }
+        entry->state = STATE_UNCHANGED;
+        entry->origin = -1;
+        break;
+    default:
+        entry->state = CHANGE_DELETED;
+        break;
+    }
+}
+
+// Collapses a rename of from to to into the changes already recorded for from, so a chain of renames becomes a single
+// rename from the first name to the last
+static void apply_rename(struct changeset* changeset, int from, int to) {
+    struct changeset_entry* source = &changeset->entries[from];
+    struct changeset_entry* destination = &changeset->entries[to];
+
+    // Whatever was renamed onto to before is replaced
+    if (destination->state == CHANGE_RENAMED && changeset->entries[destination->origin].state == STATE_MOVED_AWAY) {
+        changeset->entries[destination->origin].state = CHANGE_DELETED;
+    }
+
+    destination->is_directory = source->is_directory;
+
+    // The content moves with the file, whether it was written before the rename or after it
+    destination->modified = source->modified;
+    source->modified = 0;
+
+    switch (source->state) {
+    case CHANGE_CREATED:
+        source->state = STATE_UNCHANGED;
+        destination->state = CHANGE_CREATED;
+        destination->origin = -1;
+        break;
+    case CHANGE_RENAMED:
+        if (source->origin == to) { // Renamed back to where it started
+            destination->state = CHANGE_MODIFIED;
+            destination->origin = -1;
+        }
+        else {
+            destination->state = CHANGE_RENAMED;
+            destination->origin = source->origin;
+        }
+        source->state = STATE_UNCHANGED;
+        source->origin = -1;
+        break;
+    default:
+        source->state = STATE_MOVED_AWAY;
+        destination->state = CHANGE_RENAMED;
+        destination->origin = from;
+        break;
+    }
+}
+
+static int take_pending_move(struct changeset* changeset, uint32_t cookie) {
+    for (int i = 0; i < changeset->pending_count; i++) {
+        int entry = changeset->pending_moves[i];
+        if (changeset->entries[entry].cookie == cookie) {
+            changeset->pending_moves[i] = changeset->pending_moves[--changeset->pending_count];
+            changeset->entries[entry].cookie = 0;
+            return entry;
+        }
+    }
+
+    return -1;
+}
+
+static void add_pending_move(struct changeset* changeset, int i, uint32_t cookie) {
+    if (changeset->pending_count == changeset->pending_capacity) {
+        int capacity = changeset->pending_capacity ? changeset->pending_capacity * 2 : 16;
+        int* pending = (int*) realloc(changeset->pending_moves, (size_t) capacity * sizeof(int));
+        if (pending == NULL) {
+            apply_delete(changeset, i);
+            return;
+        }
+        changeset->pending_moves = pending;
+        changeset->pending_capacity = capacity;
+    }
+
+    changeset->entries[i].cookie = cookie;
+    changeset->pending_moves[changeset->pending_count++] = i;
+}
+
+// Folds an event's create, modify, delete and move bits into the current window
+void changeset_record(const struct inotify_event* event, uint32_t bits) {
+    bits &= CHANGESET_EVENTS;
+    if (bits == 0 || event->wd < 0) {
+        return;
+    }
+
+    const char* name = event->len > 0 ? event->name : "";
+    long long now = clock_millis();
+    pthread_mutex_lock(&changeset_lock);
+
+    struct changeset* changeset = &current;
+    int i = enabled ? find_entry(changeset, event->wd, name) : -1;
+
+    if (i >= 0) {
+        if (changeset->first_ms == 0) {
+            changeset->first_ms = now;
+        }
+        changeset->last_ms = now;
+
+        if (event->mask & IN_ISDIR) {
+            changeset->entries[i].is_directory = 1;
+        }
+
+        if (bits & IN_CREATE) {
+            apply_create(changeset, i);
+        }
+        if (bits & (IN_MODIFY | IN_CLOSE_WRITE)) {
+            apply_modify(changeset, i);
+        }
+        if (bits & IN_DELETE) {
+            apply_delete(changeset, i);
+        }
+        if (bits & IN_MOVED_FROM) {
+            add_pending_move(changeset, i, event->cookie);
+        }
+        if (bits & IN_MOVED_TO) {
+            int from = take_pending_move(changeset, event->cookie);
+            if (from >= 0) {
+                apply_rename(changeset, from, i);
+            }
+            else { // Moved in from somewhere that isn't watched
+                apply_create(changeset, i);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&changeset_lock);
+}
+
+// Returns how many milliseconds until the current window settles, 0 if it already has, or -1 if nothing has changed
+long long changeset_timeout() {
+    if (!changeset_enabled()) {
+        return -1;
+    }
+
+    long long timeout = -1;
+    long long now = clock_millis();
+    pthread_mutex_lock(&changeset_lock);
+
+    if (current.count > 0) {
+        long long quiet = current.last_ms + quiet_period_ms - now;
+        long long latest = current.first_ms + max_latency - now;
+        timeout = quiet < latest ? quiet : latest;
+        if (timeout < 0) timeout = 0;
+    }
+
+    pthread_mutex_unlock(&changeset_lock);
+    return timeout;
+}
+
+// Hands the current window to the changeset callback if it has settled. Called from the notifier thread's loop.
+void changeset_flush_due() {
+    if (changeset_timeout() != 0 || callbacks.changeset == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&changeset_lock);
+    struct changeset settled = current;
+    memset(&current, 0, sizeof(struct changeset));
+    pthread_mutex_unlock(&changeset_lock);
+
+    // Moves whose other half never arrived left the watched directories
+    for (int i = 0; i < settled.pending_count; i++) {
+        apply_delete(&settled, settled.pending_moves[i]);
+    }
+
+    struct changeset_change* changes = (struct changeset_change*) malloc((size_t) settled.count * sizeof(struct changeset_change));
+    int count = 0;
+
+    for (int i = 0; changes != NULL && i < settled.count; i++) {
+        const struct changeset_entry* entry = &settled.entries[i];
+        if (entry->state > CHANGE_RENAMED) {
+            continue;
+        }
+
+        struct changeset_change* change = &changes[count++];
+        change->kind = entry->state;
+        change->is_directory = entry->is_directory;
+        change->wd = entry->wd;
+        change->name = entry_name(&settled, entry);
+        change->old_wd = entry->state == CHANGE_RENAMED ? settled.entries[entry->origin].wd : -1;
+        change->old_name = entry->state == CHANGE_RENAMED ? entry_name(&settled, &settled.entries[entry->origin]) : NULL;
+        change->modified = entry->modified;
+    }
+
+    if (count > 0) {
+        callbacks.changeset(changes, count);
+    }
+
+    free(changes);
+    free_changeset(&settled);
+}
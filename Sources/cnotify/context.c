@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "context.h"
+#include "budget.h"
+#include "notify.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+// Records queued for a context without a callback past this many bytes are dropped, unless it sets its own limit
+#define DEFAULT_MAX_PENDING (4 * 1024 * 1024)
+
+// Which context each of their watches belongs to. Contexts are independent of each other and of the global callbacks:
+// their watches' events only ever reach them.
+static struct context_watch* context_watches = NULL;
+static int context_watch_count = 0;
+static pthread_rwlock_t context_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Creates a context, starting the notifier thread if nothing has yet. Returns NULL if inotify couldn't be set up.
+struct notify_context* notify_context_create() {
+    if (notifier_init() != 0) {
+        return NULL;
+    }
+
+    struct notify_context* context = (struct notify_context*) calloc(1, sizeof(struct notify_context));
+    if (context == NULL) {
+        return NULL;
+    }
+
+    context->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (context->wake_fd < 0) {
+        free(context);
+        return NULL;
+    }
+
+    pthread_mutex_init(&context->lock, NULL);
+    context->max_pending = DEFAULT_MAX_PENDING;
+
+    start_notifier(); // Does nothing if it's running, or if the host pumps it
+    return context;
+}
+
+// Removes every watch the context added and frees it. Waits for any of its callbacks that are running on other threads,
+// so it mustn't be called from the context's own callback.
+void notify_context_destroy(struct notify_context* context) {
+    if (context == NULL) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&context_lock);
+
+    struct context_watch *current, *tmp;
+    HASH_ITER(hh, context_watches, current, tmp) {
+        if (current->context == context) {
+            remove_watch(current->wd);
+            HASH_DEL(context_watches, current);
+            free(current);
+            __atomic_sub_fetch(&context_watch_count, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_rwlock_unlock(&context_lock);
+
+    while (__atomic_load_n(&context->in_flight, __ATOMIC_ACQUIRE) > 0) {
+        sched_yield();
+    }
+
+    close(context->wake_fd);
+    pthread_mutex_destroy(&context->lock);
+    free(context->pending);
+    free(context->drained);
+    free(context);
+}
+
+// Watches a directory, or a single file (see add_file_watch), for the context alone. Returns the watch's id, or a
+// negative error code as add_watch does; a path that's already watched, by anything else, is -3.
+int notify_context_add_watch(struct notify_context* context, const char* path, int flags) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return watch_error_code(errno);
+    }
+
+    // Held while the watch is added, so none of its events get to dispatch before it's known to be the context's
+    pthread_rwlock_wrlock(&context_lock);
+
+    int existing = watch_table_find(path);
+    struct context_watch* watch = NULL;
+    if (existing >= 0) {
+        HASH_FIND_INT(context_watches, &existing, watch);
+
+        if (watch == NULL || watch->context != context) {
+            pthread_rwlock_unlock(&context_lock);
+            return -3;
+        }
+    }
+
+    int wd = S_ISDIR(st.st_mode) ? add_watch(path, flags) : add_file_watch(path, flags);
+
+    if (wd >= 0 && watch == NULL) {
+        watch = (struct context_watch*) malloc(sizeof(struct context_watch));
+        if (watch == NULL) {
+            remove_watch(wd);
+            pthread_rwlock_unlock(&context_lock);
+            return -3;
+        }
+
+        watch->wd = wd;
+        watch->context = context;
+        HASH_ADD_INT(context_watches, wd, watch);
+        __atomic_add_fetch(&context_watch_count, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_rwlock_unlock(&context_lock);
+    return wd;
+}
+
+// Removes one of the context's watches. Returns 0 on success, or -1 if it isn't the context's.
+int notify_context_remove_watch(struct notify_context* context, int watch) {
+    pthread_rwlock_wrlock(&context_lock);
+
+    struct context_watch* entry;
+    HASH_FIND_INT(context_watches, &watch, entry);
+
+    if (entry == NULL || entry->context != context) {
+        pthread_rwlock_unlock(&context_lock);
+        return -1;
+    }
+
+    remove_watch(watch);
+    HASH_DEL(context_watches, entry);
+    free(entry);
+    __atomic_sub_fetch(&context_watch_count, 1, __ATOMIC_RELAXED);
+
+    pthread_rwlock_unlock(&context_lock);
+    return 0;
+}
+
+// Has the context's events passed to callback, with userdata, on whichever thread dispatches them (the notifier thread,
+// a callback thread, or the host's pump), instead of queueing them to be drained. NULL goes back to queueing.
+void notify_context_set_callback(struct notify_context* context, notify_context_callback callback, void* userdata) {
+    pthread_mutex_lock(&context->lock);
+    context->callback = callback;
+    context->userdata = userdata;
+    pthread_mutex_unlock(&context->lock);
+}
+
+void notify_context_set_max_pending(struct notify_context* context, size_t max_bytes) {
+    pthread_mutex_lock(&context->lock);
+    context->max_pending = max_bytes;
+    pthread_mutex_unlock(&context->lock);
+}
+
+// An eventfd that's readable while the context has records waiting to be drained, for the caller's own event loop
+int notify_context_fd(const struct notify_context* context) {
+    return context->wake_fd;
+}
+
+// Hands over every record queued since the last drain, as inotify_event records laid out back to back the way the
+// kernel returns them. Each record was copied into the context's buffer once, when it was queued; the batch points
+// into that buffer, so draining doesn't copy it again. The batch stays valid until the next drain. Returns how many records the batch holds.
+int notify_context_drain(struct notify_context* context, struct notify_batch* batch) {
+    pthread_mutex_lock(&context->lock);
+
+    // The buffer the previous batch pointed into is free again, and takes the next records
+    char* records = context->pending;
+    size_t capacity = context->pending_capacity;
+    context->pending = context->drained;
+    context->pending_capacity = context->drained_capacity;
+    context->drained = records;
+    context->drained_capacity = capacity;
+
+    batch->records = records;
+    batch->length = context->pending_length;
+    batch->count = context->pending_count;
+    context->pending_length = 0;
+    context->pending_count = 0;
+
+    uint64_t value;
+    if (read(context->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "[SWNotify] Failed to reset context descriptor: %s\n", strerror(errno));
+    }
+
+    pthread_mutex_unlock(&context->lock);
+    return batch->count;
+}
+
+// How many records have been dropped because the context wasn't drained fast enough
+uint64_t notify_context_dropped(struct notify_context* context) {
+    pthread_mutex_lock(&context->lock);
+    uint64_t dropped = context->dropped;
+    pthread_mutex_unlock(&context->lock);
+
+    return dropped;
+}
+
+int contexts_active() {
+    return __atomic_load_n(&context_watch_count, __ATOMIC_RELAXED) > 0;
+}
+
+// Must be called with context->lock held
+static void append(struct notify_context* context, const struct inotify_event* event, uint32_t mask) {
+    size_t size = sizeof(struct inotify_event) + event->len;
+
+    if (context->pending_length + size > context->max_pending) {
+        context->dropped++;
+        return;
+    }
+
+    if (context->pending_length + size > context->pending_capacity) {
+        size_t capacity = context->pending_capacity ? context->pending_capacity : 4096;
+        while (capacity < context->pending_length + size) {
+            capacity *= 2;
+        }
+
+        char* grown = (char*) realloc(context->pending, capacity);
+        if (grown == NULL) {
+            context->dropped++;
+            return;
+        }
+
+        context->pending = grown;
+        context->pending_capacity = capacity;
+    }
+
+    struct inotify_event* record = (struct inotify_event*) (context->pending + context->pending_length);
+    memcpy(record, event, size);
+    record->mask = mask;
+
+    if (context->pending_length == 0) {
+        uint64_t one = 1;
+        if (write(context->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "[SWNotify] Failed to wake context: %s\n", strerror(errno));
+        }
+    }
+
+    context->pending_length += size;
+    context->pending_count++;
+}
+
+// Hands an event to the context that owns its watch, with mask narrowed to what was asked for. Returns 1 if a context
+// took it, in which case the global callbacks never see it, or 0 if the watch isn't a context's.
+int context_dispatch(const struct inotify_event* event, uint32_t mask) {
+    pthread_rwlock_rdlock(&context_lock);
+
+    struct context_watch* watch;
+    HASH_FIND_INT(context_watches, &event->wd, watch);
+
+    if (watch == NULL) {
+        pthread_rwlock_unlock(&context_lock);
+        return 0;
+    }
+
+    // Pinned until the callback returns, so the callback itself can add and remove watches
+    struct notify_context* context = watch->context;
+    __atomic_add_fetch(&context->in_flight, 1, __ATOMIC_ACQ_REL);
+    pthread_rwlock_unlock(&context_lock);
+
+    pthread_mutex_lock(&context->lock);
+    notify_context_callback callback = context->callback;
+    void* userdata = context->userdata;
+
+    if (callback == NULL) {
+        append(context, event, mask);
+    }
+
+    pthread_mutex_unlock(&context->lock);
+
+    if (callback) {
+        callback(userdata, event->wd, event->len > 0 ? event->name : "", mask, event->cookie);
+    }
+
+    __atomic_sub_fetch(&context->in_flight, 1, __ATOMIC_ACQ_REL);
+    return 1;
+}
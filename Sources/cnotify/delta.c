@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "delta.h"
+#include "hashtable.h"
+#include "hash.h"
+#include "types.h"
+#include "util.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define MAX_DELTA_WORKERS 16
+#define MIN_BLOCK_SIZE 4096
+
+// Ranges reported at once on the stack; files with more changed runs than this allocate
+#define INLINE_RANGES 64
+
+extern struct callback_collection callbacks;
+
+// Like the fingerprint workers, each worker owns the block hashes for the paths that hash to it, so reports for one
+// file stay in order and the tables need no lock
+struct delta_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct delta_job* head;
+    struct delta_job* tail;
+    struct delta_file* files;
+};
+
+static struct delta_worker workers[MAX_DELTA_WORKERS];
+static int worker_count = 0;
+static size_t block_size = 65536;
+static int stopping = 0;
+
+// Taken for reading while queueing, and for writing while workers are started or stopped
+static pthread_rwlock_t delta_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void free_file(struct delta_file* file) {
+    free(file->path);
+    free(file->hashes);
+    free(file);
+}
+
+static void forget_file(struct delta_worker* worker, const char* path) {
+    struct delta_file* file;
+    HASH_FIND_STR(worker->files, path, file);
+
+    if (file) {
+        HASH_DEL(worker->files, file);
+        free_file(file);
+    }
+}
+
+// Appends the byte range of blocks [first, last) to ranges, merging it into the previous range if they touch
+static int add_range(struct delta_range** ranges, int count, int* capacity, struct delta_range* inline_ranges, size_t first, size_t last, long long size) {
+    long long offset = (long long) (first * block_size);
+    long long end = (long long) (last * block_size) < size ? (long long) (last * block_size) : size;
+
+    if (count > 0 && (*ranges)[count - 1].offset + (*ranges)[count - 1].length == offset) {
+        (*ranges)[count - 1].length = end - (*ranges)[count - 1].offset;
+        return count;
+    }
+
+    if (count == *capacity) {
+        int grown_capacity = *capacity * 2;
+        struct delta_range* grown = *ranges == inline_ranges ? (struct delta_range*) malloc((size_t) grown_capacity * sizeof(struct delta_range))
+                                                             : (struct delta_range*) realloc(*ranges, (size_t) grown_capacity * sizeof(struct delta_range));
+        if (grown == NULL) {
+            return -1;
+        }
+
+        if (*ranges == inline_ranges) {
+            memcpy(grown, inline_ranges, (size_t) count * sizeof(struct delta_range));
+        }
+
+        *ranges = grown;
+        *capacity = grown_capacity;
+    }
+
+    (*ranges)[count].offset = offset;
+    (*ranges)[count].length = end - offset;
+    return count + 1;
+}
+
+// Rehashes the file and reports which blocks differ from its hashes at the last close-write. A file seen for the first
+// time is reported as changed throughout, with a previous size of -1.
+static void compare(struct delta_worker* worker, const struct delta_job* job) {
+    uint64_t* hashes;
+    size_t count;
+    long long size;
+
+    if (hash_file_blocks(job->path, block_size, &hashes, &count, &size) != 0) {
+        forget_file(worker, job->path); // Gone or truncated underneath us; whatever happens next reports again
+        return;
+    }
+
+    struct delta_file* file;
+    HASH_FIND_STR(worker->files, job->path, file);
+
+    struct delta_range inline_ranges[INLINE_RANGES];
+    struct delta_range* ranges = inline_ranges;
+    int capacity = INLINE_RANGES;
+    int range_count = 0;
+    long long previous_size = file ? file->size : -1;
+
+    // Block hashes take in the block's length, so a short last block that grew or shrank never matches
+    size_t known = file ? file->block_count : 0;
+
+    for (size_t i = 0; i < count && range_count >= 0;) {
+        if (i < known && file->hashes[i] == hashes[i]) {
+            i++;
+            continue;
+        }
+
+        size_t first = i;
+        while (i < count && !(i < known && file->hashes[i] == hashes[i])) {
+            i++;
+        }
+
+        range_count = add_range(&ranges, range_count, &capacity, inline_ranges, first, i, size);
+    }
+
+    if (range_count < 0) { // Out of memory; report the whole file rather than miss a change
+        ranges = inline_ranges;
+        range_count = size > 0 ? 1 : 0;
+        inline_ranges[0].offset = 0;
+        inline_ranges[0].length = size;
+    }
+
+    if (file == NULL) {
+        file = (struct delta_file*) calloc(1, sizeof(struct delta_file));
+        if (file && (file->path = strdup(job->path)) != NULL) {
+            HASH_ADD_KEYPTR(hh, worker->files, file->path, strlen(file->path), file);
+        }
+        else {
+            free(file);
+            file = NULL;
+        }
+    }
+
+    if (file) {
+        free(file->hashes);
+        file->hashes = hashes;
+        file->block_count = count;
+        file->size = size;
+    }
+    else {
+        free(hashes);
+    }
+
+    // Rewritten with identical content: nothing to report
+    if ((range_count > 0 || size != previous_size) && callbacks.delta) {
+        callbacks.delta(job->name, job->wd, ranges, range_count, size, previous_size);
+    }
+
+    if (ranges != inline_ranges) {
+        free(ranges);
+    }
+}
+
+static void* run_worker(void* vargp) {
+    struct delta_worker* worker = (struct delta_worker*) vargp;
+
+    while (1) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->head == NULL && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+
+        struct delta_job* job = worker->head;
+        if (job == NULL) { // Stopping and nothing left to do
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        if (job->forget) {
+            forget_file(worker, job->path);
+        }
+        else {
+            compare(worker, job);
+        }
+
+        free(job->path);
+        free(job);
+    }
+
+    return NULL;
+}
+
+// Must be called with delta_lock held for writing. Workers finish what's queued before they exit.
+static void stop_workers() {
+    int count = worker_count;
+    __atomic_store_n(&worker_count, 0, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&workers[i].lock);
+        pthread_cond_signal(&workers[i].wake);
+        pthread_mutex_unlock(&workers[i].lock);
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct delta_worker* worker = &workers[i];
+        pthread_join(worker->thread, NULL);
+
+        struct delta_file *current, *tmp;
+        HASH_ITER(hh, worker->files, current, tmp) {
+            HASH_DEL(worker->files, current);
+            free_file(current);
+        }
+
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+    }
+}
+
+// Starts count workers that hash close-written files in blocks of block_bytes (rounded up to a multiple of 4096).
+// Returns 0 on success, or if already enabled.
+int delta_enable(int count, long long block_bytes) {
+    pthread_rwlock_wrlock(&delta_lock);
+
+    if (worker_count > 0) {
+        pthread_rwlock_unlock(&delta_lock);
+        return 0;
+    }
+
+    if (count < 1) count = 1;
+    if (count > MAX_DELTA_WORKERS) count = MAX_DELTA_WORKERS;
+
+    block_size = block_bytes < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : (size_t) (block_bytes + MIN_BLOCK_SIZE - 1) / MIN_BLOCK_SIZE * MIN_BLOCK_SIZE;
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < count; i++) {
+        struct delta_worker* worker = &workers[i];
+        worker->head = NULL;
+        worker->tail = NULL;
+        worker->files = NULL;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->wake, NULL);
+
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+            worker_count = i;
+            stop_workers();
+            pthread_rwlock_unlock(&delta_lock);
+            return -1;
+        }
+    }
+
+    __atomic_store_n(&worker_count, count, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&delta_lock);
+    return 0;
+}
+
+// Stops the workers and drops every file's hashes
+void delta_disable() {
+    pthread_rwlock_wrlock(&delta_lock);
+
+    if (worker_count > 0) {
+        stop_workers();
+    }
+
+    pthread_rwlock_unlock(&delta_lock);
+}
+
+int delta_enabled() {
+    return __atomic_load_n(&worker_count, __ATOMIC_RELAXED) > 0;
+}
+
+static void enqueue(int wd, const char* name, int forget) {
+    pthread_rwlock_rdlock(&delta_lock);
+
+    int count = worker_count;
+    char path[4096];
+
+    if (count == 0 || join_watch_path(wd, name, path, sizeof(path)) != 0) {
+        pthread_rwlock_unlock(&delta_lock);
+        return;
+    }
+
+    struct delta_job* job = (struct delta_job*) malloc(sizeof(struct delta_job));
+    if (job == NULL) {
+        pthread_rwlock_unlock(&delta_lock);
+        return;
+    }
+
+    job->path = strdup(path);
+    if (job->path == NULL) {
+        pthread_rwlock_unlock(&delta_lock);
+        free(job);
+        return;
+    }
+
+    job->wd = wd;
+    job->forget = forget;
+    job->next = NULL;
+    terminated_strncpy(job->name, name, sizeof(job->name));
+
+    struct delta_worker* worker = &workers[name_hash64(path) % (uint64_t) count];
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail) {
+        worker->tail->next = job;
+    }
+    else {
+        worker->head = job;
+    }
+    worker->tail = job;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_rwlock_unlock(&delta_lock);
+}
+
+// Queues a file that was just close-written to have its changed ranges reported
+void delta_submit(int wd, const char* name) {
+    enqueue(wd, name, 0);
+}
+
+// Drops the hashes for a file that was deleted or moved away
+void delta_forget(int wd, const char* name) {
+    enqueue(wd, name, 1);
+}
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "dirscan.h"
+#include "hashtable.h"
+#include "types.h"
+#include "util.h"
+
+#define SCAN_MIN_CAPACITY 64
+
+int compare_snapshot_key(uint64_t hash, const char* name, const struct snapshot_entry* entry) {
+    if (hash != entry->name_hash) {
+        return hash < entry->name_hash ? -1 : 1;
+    }
+    return strcmp(name, entry->name);
+}
+
+// qsort comparator ordering entries by (name_hash, name)
+int compare_snapshot_entries(const void* a, const void* b) {
+    const struct snapshot_entry* left = (const struct snapshot_entry*) a;
+    return compare_snapshot_key(left->name_hash, left->name, (const struct snapshot_entry*) b);
+}
+
+void fill_snapshot_entry(struct snapshot_entry* entry, const char* name, uint64_t hash, const struct stat* st) {
+    entry->name_hash = hash;
+    entry->inode = (uint64_t) st->st_ino;
+    entry->size = (int64_t) st->st_size;
+    entry->mtime_ns = (int64_t) st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    terminated_strncpy(entry->name, name, sizeof(entry->name));
+}
+
+// Reads the current state of a directory into a sorted array. Returns the number of entries, or -1 on failure.
+long scan_directory(const char* path, struct snapshot_entry** result) {
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+        return -1;
+    }
+
+    size_t capacity = SCAN_MIN_CAPACITY;
+    size_t count = 0;
+    struct snapshot_entry* entries = (struct snapshot_entry*) malloc(capacity * sizeof(struct snapshot_entry));
+    if (entries == NULL) {
+        closedir(directory);
+        return -1;
+    }
+
+    struct dirent* dirent;
+    while ((dirent = readdir(directory)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(directory), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue; // Gone already
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            struct snapshot_entry* grown = (struct snapshot_entry*) realloc(entries, capacity * sizeof(struct snapshot_entry));
+            if (grown == NULL) {
+                free(entries);
+                closedir(directory);
+                return -1;
+            }
+            entries = grown;
+        }
+
+        fill_snapshot_entry(&entries[count++], dirent->d_name, name_hash64(dirent->d_name), &st);
+    }
+
+    closedir(directory);
+    qsort(entries, count, sizeof(struct snapshot_entry), compare_snapshot_entries);
+
+    *result = entries;
+    return (long) count;
+}
@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <sys/inotify.h>
+#include "dispatch.h"
+#include "types.h"
+#include "moveevents.h"
+#include "fingerprint.h"
+#include "snapshot.h"
+#include "watches.h"
+#include "subtree.h"
+#include "changeset.h"
+#include "warm.h"
+#include "delta.h"
+#include "listing.h"
+#include "statcache.h"
+#include "filewatch.h"
+#include "context.h"
+
+extern struct callback_collection callbacks;
+
+typedef void (*event_handler)(const struct inotify_event* event, const char* name);
+
+static void handle_create(const struct inotify_event* event, const char* name) {
+    if (callbacks.create) {
+        callbacks.create(name, event->wd);
+    }
+}
+
+static void handle_delete(const struct inotify_event* event, const char* name) {
+    if (delta_enabled()) {
+        delta_forget(event->wd, name);
+    }
+
+    if (fingerprint_enabled()) { // Handed back behind any modifications of the file still being hashed
+        fingerprint_forget(event->wd, name, IN_DELETE);
+    }
+    else if (callbacks.remove) {
+        callbacks.remove(name, event->wd);
+    }
+}
+
+static void handle_modify(const struct inotify_event* event, const char* name) {
+    if (fingerprint_enabled()) { // Hashed off-thread, only handed back if the content changed
+        fingerprint_submit(event->wd, name, IN_MODIFY);
+    }
+    else if (callbacks.modify) {
+        callbacks.modify(name, event->wd);
+    }
+}
+
+static void handle_close_write(const struct inotify_event* event, const char* name) {
+    if (delta_enabled() && !(event->mask & IN_ISDIR)) { // Reported separately from the close-write callback
+        delta_submit(event->wd, name);
+    }
+
+    if (fingerprint_enabled()) {
+        fingerprint_submit(event->wd, name, IN_CLOSE_WRITE);
+    }
+    else if (callbacks.close_write) {
+        callbacks.close_write(name, event->wd);
+    }
+}
+
+static void handle_attrib(const struct inotify_event* event, const char* name) {
+    if (callbacks.attrib) {
+        callbacks.attrib(name, event->wd);
+    }
+}
+
+static void handle_open(const struct inotify_event* event, const char* name) {
+    if (callbacks.open) {
+        callbacks.open(name, event->wd);
+    }
+}
+
+static void handle_delete_self(const struct inotify_event* event, const char* name) {
+    if (callbacks.delete_self) {
+        callbacks.delete_self(name, event->wd);
+    }
+}
+
+static void handle_move_self(const struct inotify_event* event, const char* name) {
+    if (callbacks.move_self) {
+        callbacks.move_self(name, event->wd);
+    }
+}
+
+static void handle_moved_from(const struct inotify_event* event, const char* name) {
+    if (fingerprint_enabled()) {
+        fingerprint_forget(event->wd, name, 0);
+    }
+
+    if (delta_enabled()) {
+        delta_forget(event->wd, name);
+    }
+
+    // Track the event so we can dispatch it later
+    track_event(event->wd, event->cookie, name);
+}
+
+static void handle_moved_to(const struct inotify_event* event, const char* name) {
+    char matched_name[1024];
+    int matched_wd;
+    if (find_and_remove_event(event->cookie, matched_name, &matched_wd)) { // Check if this is a rename event - if it is, dispatch it
+        if (callbacks.rename) { // The file may have come from another watched directory
+            callbacks.rename(matched_name, matched_wd, name, event->wd);
+        }
+    }
+    else if (callbacks.move_to) { // Otherwise, it's an IN_MOVE_TO event - dispatch it
+        callbacks.move_to(name, event->wd);
+    }
+}
+
+// Indexed by the bit position of each event in inotify_event.mask
+static const event_handler dispatch_table[32] = {
+    [0] = NULL,                 // IN_ACCESS
+    [1] = handle_modify,        // IN_MODIFY
+    [2] = handle_attrib,        // IN_ATTRIB
+    [3] = handle_close_write,   // IN_CLOSE_WRITE
+    [4] = NULL,                 // IN_CLOSE_NOWRITE
+    [5] = handle_open,          // IN_OPEN
+    [6] = handle_moved_from,    // IN_MOVED_FROM
+    [7] = handle_moved_to,      // IN_MOVED_TO
+    [8] = handle_create,        // IN_CREATE
+    [9] = handle_delete,        // IN_DELETE
+    [10] = handle_delete_self,  // IN_DELETE_SELF
+    [11] = handle_move_self,    // IN_MOVE_SELF
+};
+
+// Queues files that were opened or written for warming if their watch warms files, then runs the handler for every
+// event bit set in the record, and hands the full mask (including IN_ISDIR) to the event callback
+// and to any subtree subscriptions covering the directory, and folds it into the changeset if one is being accumulated.
+// Events for a context's watches go only to that context. Records handed back by the fingerprint workers only go to the
+// callback they were held for; everything else about them was dispatched the first time round.
+void dispatch_event(const struct inotify_event* event) {
+    // Self events (and anything else about the watched directory itself) have no name
+    const char* name = event->len > 0 ? event->name : "";
+
+    // The watch was removed while the event was queued (on a lane, with the workers or being fingerprinted)
+    if (event->wd >= 0 && watch_table_kernel_wd(event->wd) == -2) {
+        return;
+    }
+
+    if (event->mask & FINGERPRINT_CHECKED) {
+        fingerprint_deliver(name, event->wd, event->mask);
+        return;
+    }
+    uint32_t bits = event->mask & IN_ALL_EVENTS;
+
+    if (bits == 0) { // IN_IGNORED, IN_Q_OVERFLOW, IN_UNMOUNT
+        return;
+    }
+
+    uint32_t mask = event->mask;
+    int warming = warm_active();
+
+    if (warming && (bits & WARM_EVENTS) && !(mask & IN_ISDIR)) {
+        warm_submit(event->wd, name);
+    }
+
+    if (snapshot_enabled() || warming || listing_active() || statcache_active() || filewatch_active()) {
+        // The watch may be subscribed to more than the caller asked for; only dispatch what they asked for
+        uint32_t requested = (uint32_t) watch_table_flags(event->wd);
+        bits &= requested;
+        mask &= requested | ~IN_ALL_EVENTS;
+
+        if (bits == 0) {
+            return;
+        }
+    }
+
+    // Watches added through a context belong to it alone
+    if (contexts_active() && context_dispatch(event, mask)) {
+        return;
+    }
+
+    for (uint32_t remaining = bits; remaining != 0; remaining &= remaining - 1) {
+        event_handler handler = dispatch_table[__builtin_ctz(remaining)];
+        if (handler) {
+            handler(event, name);
+        }
+    }
+
+    if (callbacks.event) {
+        callbacks.event(name, event->wd, mask);
+    }
+
+    if (subtree_active()) {
+        subtree_dispatch(event->wd, name, mask);
+    }
+
+    if (changeset_enabled()) {
+        changeset_record(event, bits);
+    }
+}
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "executor.h"
+#include "dispatch.h"
+#include "hashtable.h"
+
+#define MAX_EXECUTOR_WORKERS 64
+#define SHARDS_PER_WORKER 4
+#define DEFAULT_SHARD_DEPTH 1024
+
+// Events a worker dispatches from one shard before letting go of it, so a busy shard can't starve the others
+#define DRAIN_BATCH 64
+
+// Recent IN_MOVED_FROM cookies and the shard they went to, so the matching IN_MOVED_TO lands on the same shard
+#define COOKIE_ROUTES 64
+
+// Files renamed onto a new name whose IN_MOVED_TO hasn't been dispatched yet
+#define RENAME_ROUTES 64
+
+// Events are sharded by (wd, name), and a shard is only ever drained by one worker at a time, so events for one file
+// are dispatched in order. There are more shards than workers; a worker that has nothing in its own shards takes
+// over any other shard that's waiting and unclaimed.
+struct executor_shard {
+    struct inotify_event** slots;
+    size_t head;
+    size_t count;
+    int claimed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+};
+
+struct cookie_route {
+    uint32_t cookie;
+    int shard;
+};
+
+// A renamed file's new (wd, name) hash and the shard its IN_MOVED_TO went to. Until the move is dispatched, later
+// events for the new name follow it there rather than to the shard the name hashes to, so they can't overtake it.
+struct rename_route {
+    uint32_t hash;
+    uint32_t cookie;
+    int shard;
+};
+
+static struct executor_shard* shards = NULL;
+static int shard_count = 0;
+static size_t shard_depth = DEFAULT_SHARD_DEPTH;
+
+static pthread_t workers[MAX_EXECUTOR_WORKERS];
+static int worker_count = 0;
+static volatile int stopping = 0;
+
+// Taken for reading while submitting, and for writing while workers are started or stopped
+static pthread_rwlock_t executor_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static size_t pending = 0;
+
+// Unlike pending, still counts events while their callbacks run
+static size_t outstanding = 0;
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+
+// Only touched by the notifier thread
+static struct cookie_route cookie_routes[COOKIE_ROUTES];
+
+// Set by the notifier thread, and cleared by the worker that dispatches the move
+static struct rename_route rename_routes[RENAME_ROUTES];
+static pthread_mutex_t rename_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t shard_hash(int wd, const char* name) {
+    return (uint32_t) watch_name_hash64(wd, name, strlen(name));
+}
+
+static int shard_for(const struct inotify_event* event) {
+    const char* name = event->len > 0 ? event->name : "";
+    uint32_t hash = shard_hash(event->wd, name);
+    struct cookie_route* route = &cookie_routes[event->cookie % COOKIE_ROUTES];
+    struct rename_route* renamed = &rename_routes[hash % RENAME_ROUTES];
+
+    if ((event->mask & IN_MOVED_TO) && event->cookie != 0 && route->cookie == event->cookie) {
+        // Only needed if the new name lives on another shard. A slot still held by an earlier rename is taken over,
+        // which only loses that rename's ordering guarantee.
+        if (route->shard != (int) (hash % (uint32_t) shard_count)) {
+            pthread_mutex_lock(&rename_lock);
+            renamed->hash = hash;
+            renamed->cookie = event->cookie;
+            renamed->shard = route->shard;
+            pthread_mutex_unlock(&rename_lock);
+        }
+        return route->shard;
+    }
+
+    int shard = (int) (hash % (uint32_t) shard_count);
+
+    pthread_mutex_lock(&rename_lock);
+    if (renamed->cookie != 0 && renamed->hash == hash) {
+        shard = renamed->shard;
+    }
+    pthread_mutex_unlock(&rename_lock);
+
+    if ((event->mask & IN_MOVED_FROM) && event->cookie != 0) {
+        route->cookie = event->cookie;
+        route->shard = shard;
+    }
+
+    return shard;
+}
+
+// Once a rename's IN_MOVED_TO has been dispatched, events for the new name can go back to the shard it hashes to
+static void release_rename(const struct inotify_event* event) {
+    uint32_t hash = shard_hash(event->wd, event->len > 0 ? event->name : "");
+    struct rename_route* renamed = &rename_routes[hash % RENAME_ROUTES];
+
+    pthread_mutex_lock(&rename_lock);
+    if (renamed->cookie == event->cookie && renamed->hash == hash) {
+        renamed->cookie = 0;
+    }
+    pthread_mutex_unlock(&rename_lock);
+}
+
+// Claims the first shard with events waiting, preferring the worker's own. Returns NULL if there's nothing to claim.
+static struct executor_shard* claim_shard(int worker) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < shard_count; i++) {
+            int own = i % worker_count == worker;
+            if (own != (pass == 0)) continue;
+
+            struct executor_shard* shard = &shards[i];
+            if (__atomic_load_n(&shard->count, __ATOMIC_ACQUIRE) == 0) continue;
+
+            if (__atomic_exchange_n(&shard->claimed, 1, __ATOMIC_ACQ_REL) == 0) {
+                // It may have been drained between the check and the claim
+                if (__atomic_load_n(&shard->count, __ATOMIC_ACQUIRE) > 0) {
+                    return shard;
+                }
+                __atomic_store_n(&shard->claimed, 0, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void drain_shard(struct executor_shard* shard) {
+    for (int i = 0; i < DRAIN_BATCH; i++) {
+        pthread_mutex_lock(&shard->lock);
+
+        if (shard->count == 0) {
+            pthread_mutex_unlock(&shard->lock);
+            break;
+        }
+
+        struct inotify_event* event = shard->slots[shard->head];
+        shard->head = (shard->head + 1) % shard_depth;
+        __atomic_sub_fetch(&shard->count, 1, __ATOMIC_RELEASE);
+
+        pthread_cond_signal(&shard->not_full);
+        pthread_mutex_unlock(&shard->lock);
+
+        __atomic_sub_fetch(&pending, 1, __ATOMIC_RELAXED);
+
+        dispatch_event(event);
+
+        if ((event->mask & IN_MOVED_TO) && event->cookie != 0) {
+            release_rename(event);
+        }
+        free(event);
+        __atomic_sub_fetch(&outstanding, 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&shard->claimed, 0, __ATOMIC_RELEASE);
+}
+
+static void* run_worker(void* vargp) {
+    int worker = (int) (intptr_t) vargp;
+
+    while (1) {
+        struct executor_shard* shard = claim_shard(worker);
+
+        if (shard) {
+            drain_shard(shard);
+            continue;
+        }
+
+        pthread_mutex_lock(&idle_lock);
+
+        if (__atomic_load_n(&pending, __ATOMIC_RELAXED) == 0) {
+            if (stopping) {
+                pthread_mutex_unlock(&idle_lock);
+                break;
+            }
+            pthread_cond_wait(&work_available, &idle_lock);
+        }
+        else {
+            // Everything waiting is in shards other workers hold; check back shortly
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 1000000;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&work_available, &idle_lock, &deadline);
+        }
+
+        pthread_mutex_unlock(&idle_lock);
+    }
+
+    return NULL;
+}
+
+static void stop_workers() {
+    pthread_mutex_lock(&idle_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&idle_lock);
+
+    // Workers finish everything that's queued before exiting
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (int i = 0; i < shard_count; i++) {
+        pthread_mutex_destroy(&shards[i].lock);
+        pthread_cond_destroy(&shards[i].not_full);
+        free(shards[i].slots);
+    }
+
+    free(shards);
+    shards = NULL;
+    shard_count = 0;
+    worker_count = 0;
+}
+
+// Starts dispatching callbacks on a pool of workers, with each shard holding at most depth events before the
+// notifier thread waits for room. Replaces the current pool if there is one. Returns 0 on success.
+int executor_enable(int count, int depth) {
+    if (count < 1) count = 1;
+    if (count > MAX_EXECUTOR_WORKERS) count = MAX_EXECUTOR_WORKERS;
+    if (depth < 1) depth = DEFAULT_SHARD_DEPTH;
+
+    pthread_rwlock_wrlock(&executor_lock);
+
+    if (worker_count > 0) {
+        stop_workers();
+    }
+
+    shard_depth = (size_t) depth;
+    shards = (struct executor_shard*) calloc((size_t) count * SHARDS_PER_WORKER, sizeof(struct executor_shard));
+    if (shards == NULL) {
+        pthread_rwlock_unlock(&executor_lock);
+        return -1;
+    }
+
+    shard_count = count * SHARDS_PER_WORKER;
+    int allocated = 1;
+    for (int i = 0; i < shard_count; i++) {
+        shards[i].slots = (struct inotify_event**) malloc(shard_depth * sizeof(struct inotify_event*));
+        allocated &= shards[i].slots != NULL;
+        pthread_mutex_init(&shards[i].lock, NULL);
+        pthread_cond_init(&shards[i].not_full, NULL);
+    }
+
+    memset(cookie_routes, 0, sizeof(cookie_routes));
+    memset(rename_routes, 0, sizeof(rename_routes));
+    stopping = 0;
+    worker_count = count; // Set up front, since workers use it to find their own shards
+
+    for (int i = 0; i < count; i++) {
+        if (!allocated || pthread_create(&workers[i], NULL, run_worker, (void*) (intptr_t) i) != 0) {
+            worker_count = i;
+            stop_workers();
+            pthread_rwlock_unlock(&executor_lock);
+            return -1;
+        }
+    }
+
+    pthread_rwlock_unlock(&executor_lock);
+    return 0;
+}
+
+// Goes back to dispatching callbacks on the notifier thread, once everything already queued has been dispatched
+void executor_disable() {
+    pthread_rwlock_wrlock(&executor_lock);
+
+    if (worker_count > 0) {
+        stop_workers();
+    }
+
+    pthread_rwlock_unlock(&executor_lock);
+}
+
+int executor_enabled() {
+    return __atomic_load_n(&worker_count, __ATOMIC_RELAXED) > 0;
+}
+
+// How many submitted events haven't finished being dispatched
+size_t executor_pending() {
+    return __atomic_load_n(&outstanding, __ATOMIC_ACQUIRE);
+}
+
+// Queues an event for the worker pool. Returns 1 if it was queued, or 0 if there's no pool and the caller should
+// dispatch it itself. Waits for room if the event's shard is full.
+int executor_submit(const struct inotify_event* event) {
+    pthread_rwlock_rdlock(&executor_lock);
+
+    if (worker_count == 0) {
+        pthread_rwlock_unlock(&executor_lock);
+        return 0;
+    }
+
+    size_t size = sizeof(struct inotify_event) + event->len;
+    struct inotify_event* copy = (struct inotify_event*) malloc(size);
+    if (copy == NULL) {
+        pthread_rwlock_unlock(&executor_lock);
+        return 0;
+    }
+    memcpy(copy, event, size);
+
+    struct executor_shard* shard = &shards[shard_for(event)];
+
+    // Counted before it's visible in the shard, so a worker draining it can't take pending below zero
+    __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&outstanding, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&shard->lock);
+    while (shard->count == shard_depth) {
+        pthread_cond_wait(&shard->not_full, &shard->lock);
+    }
+
+    shard->slots[(shard->head + shard->count) % shard_depth] = copy;
+    __atomic_add_fetch(&shard->count, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shard->lock);
+
+    pthread_mutex_lock(&idle_lock);
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&idle_lock);
+
+    pthread_rwlock_unlock(&executor_lock);
+    return 1;
+}
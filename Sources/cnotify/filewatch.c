@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "filewatch.h"
+#include "budget.h"
+#include "notify.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+static struct file_watch* file_watches = NULL;
+static int file_watch_count = 0;
+static pthread_mutex_t filewatch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void remember_inode(int wd, const struct stat* st) {
+    pthread_mutex_lock(&filewatch_lock);
+
+    struct file_watch* watch;
+    HASH_FIND_INT(file_watches, &wd, watch);
+
+    if (watch == NULL) {
+        watch = (struct file_watch*) malloc(sizeof(struct file_watch));
+        if (watch == NULL) {
+            pthread_mutex_unlock(&filewatch_lock);
+            return;
+        }
+
+        watch->wd = wd;
+        HASH_ADD_INT(file_watches, wd, watch);
+        __atomic_add_fetch(&file_watch_count, 1, __ATOMIC_RELAXED);
+    }
+
+    watch->device = (uint64_t) st->st_dev;
+    watch->inode = (uint64_t) st->st_ino;
+
+    pthread_mutex_unlock(&filewatch_lock);
+}
+
+// Watches a single file rather than a directory. Its events have no name, so callbacks get the path it was added with.
+// The inotify watch is on the file's inode, so when the path is replaced (by an atomic rename, or by an editor that
+// moves the old file aside) it's moved onto the new file. File watches always use inotify, whatever the budget.
+// Returns the watch's id, or a negative error code (-4 for a directory).
+int filewatch_add(const char* filepath, int flags) {
+    struct stat st;
+    if (stat(filepath, &st) != 0) {
+        return watch_error_code(errno);
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return -4;
+    }
+
+    int kernel_wd = inotify_add_watch(notifier_fd(), filepath, watch_kernel_flags(flags) | FILE_WATCH_EVENTS);
+    if (kernel_wd < 0) {
+        return watch_error_code(errno);
+    }
+
+    int wd = watch_table_add_file(kernel_wd, filepath, flags);
+    if (wd < 0) {
+        inotify_rm_watch(notifier_fd(), kernel_wd);
+        return -3;
+    }
+
+    // The file the kernel watch ended up on, should it have been replaced since the first stat
+    if (stat(filepath, &st) == 0) {
+        remember_inode(wd, &st);
+    }
+
+    return wd;
+}
+
+int filewatch_tracked(int wd) {
+    if (!filewatch_active()) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&filewatch_lock);
+
+    struct file_watch* watch;
+    HASH_FIND_INT(file_watches, &wd, watch);
+
+    pthread_mutex_unlock(&filewatch_lock);
+    return watch != NULL;
+}
+
+int filewatch_active() {
+    return __atomic_load_n(&file_watch_count, __ATOMIC_RELAXED) > 0;
+}
+
+// Checks whether a file watch's path still leads to the file its inotify watch is on when that file's link count
+// changes, or it's deleted or moved. If another file has taken its place, the watch is moved onto it, and anything
+// the old file reports afterwards is dropped. Returns the events to report for the replacement (those of
+// FILE_REPLACED_EVENTS the watch asked for), or 0.
+uint32_t filewatch_record(const struct inotify_event* event) {
+    if (event->wd < 0 || !(event->mask & FILE_WATCH_EVENTS)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&filewatch_lock);
+
+    struct file_watch* watch;
+    HASH_FIND_INT(file_watches, &event->wd, watch);
+    uint64_t device = watch ? watch->device : 0;
+    uint64_t inode = watch ? watch->inode : 0;
+
+    pthread_mutex_unlock(&filewatch_lock);
+
+    char path[4096];
+    struct stat st;
+
+    // Gone for now (deleted, or moved away with nothing in its place yet), or still the same file
+    if (watch == NULL || watch_table_path(event->wd, path, sizeof(path)) != 0 || stat(path, &st) != 0 || S_ISDIR(st.st_mode)
+        || ((uint64_t) st.st_dev == device && (uint64_t) st.st_ino == inode)) {
+        return 0;
+    }
+
+    int previous_kernel_wd = watch_table_kernel_wd(event->wd);
+    int kernel_wd = inotify_add_watch(notifier_fd(), path, watch_wanted_flags(event->wd));
+    if (kernel_wd < 0) {
+        return 0;
+    }
+
+    watch_table_set_kernel_wd(event->wd, kernel_wd);
+    if (previous_kernel_wd >= 0 && previous_kernel_wd != kernel_wd) {
+        inotify_rm_watch(notifier_fd(), previous_kernel_wd);
+    }
+
+    if (stat(path, &st) == 0) {
+        remember_inode(event->wd, &st);
+    }
+
+    return FILE_REPLACED_EVENTS & (uint32_t) watch_table_flags(event->wd);
+}
+
+// Forgets a file watch that's been removed
+void filewatch_forget(int wd) {
+    if (!filewatch_active()) {
+        return;
+    }
+
+    pthread_mutex_lock(&filewatch_lock);
+
+    struct file_watch* watch;
+    HASH_FIND_INT(file_watches, &wd, watch);
+
+    if (watch) {
+        HASH_DEL(file_watches, watch);
+        free(watch);
+        __atomic_sub_fetch(&file_watch_count, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&filewatch_lock);
+}
+
+void filewatch_stop() {
+    pthread_mutex_lock(&filewatch_lock);
+
+    struct file_watch *current, *tmp;
+    HASH_ITER(hh, file_watches, current, tmp) {
+        HASH_DEL(file_watches, current);
+        free(current);
+    }
+    __atomic_store_n(&file_watch_count, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&filewatch_lock);
+}
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "fingerprint.h"
+#include "hashtable.h"
+#include "notify.h"
+#include "hash.h"
+#include "types.h"
+#include "util.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define MAX_FINGERPRINT_WORKERS 16
+
+// Timestamps are only as fine as the kernel's coarse clock, so a file written twice within one tick can keep
+// the same size and mtime. Fingerprints taken less than this long after the file's mtime are always rehashed.
+#define RACY_WINDOW_NS 50000000LL
+
+extern struct callback_collection callbacks;
+
+// Each worker owns the fingerprints for the paths that hash to it. That keeps events for one file in order
+// and means the fingerprint tables never need a lock.
+struct fingerprint_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct fingerprint_job* head;
+    struct fingerprint_job* tail;
+    struct file_fingerprint* fingerprints;
+};
+
+static struct fingerprint_worker workers[MAX_FINGERPRINT_WORKERS];
+static int worker_count = 0;
+static int stopping = 0;
+
+// Taken for reading while queueing, and for writing while workers are started or stopped, so nothing is queued on a
+// worker that's being torn down
+static pthread_rwlock_t fingerprint_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static long long realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void forget_fingerprint(struct fingerprint_worker* worker, const char* path) {
+    struct file_fingerprint* fingerprint;
+    HASH_FIND_STR(worker->fingerprints, path, fingerprint);
+
+    if (fingerprint) {
+        HASH_DEL(worker->fingerprints, fingerprint);
+        free(fingerprint->path);
+        free(fingerprint);
+    }
+}
+
+// Returns 1 if the file's content differs from the last time an event of the same kind saw it (or none has), 0 otherwise.
+// Modify and close-write keep separate baselines, since the close-write that ends a write always follows its modifies.
+static int content_changed(struct fingerprint_worker* worker, const char* path, uint32_t mask) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        forget_fingerprint(worker, path);
+        return 1;
+    }
+
+    long long mtime_ns = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    struct file_fingerprint* fingerprint;
+    HASH_FIND_STR(worker->fingerprints, path, fingerprint);
+    struct fingerprint_baseline* baseline = fingerprint ? &fingerprint->baselines[mask == IN_CLOSE_WRITE] : NULL;
+
+    // Fast path: nothing has touched the file since it was last hashed
+    if (baseline && baseline->valid && baseline->size == (long long) st.st_size && baseline->mtime_ns == mtime_ns
+        && baseline->checked_ns - mtime_ns > RACY_WINDOW_NS) {
+        return 0;
+    }
+
+    long long checked_ns = realtime_ns();
+    uint64_t hash[2];
+    if (hash_file128(path, hash) != 0) {
+        forget_fingerprint(worker, path);
+        return 1;
+    }
+
+    if (fingerprint == NULL) {
+        fingerprint = (struct file_fingerprint*) calloc(1, sizeof(struct file_fingerprint));
+        if (fingerprint == NULL) {
+            return 1;
+        }
+
+        fingerprint->path = strdup(path);
+        if (fingerprint->path == NULL) {
+            free(fingerprint);
+            return 1;
+        }
+
+        HASH_ADD_KEYPTR(hh, worker->fingerprints, fingerprint->path, strlen(fingerprint->path), fingerprint);
+        baseline = &fingerprint->baselines[mask == IN_CLOSE_WRITE];
+    }
+
+    int changed = !baseline->valid || baseline->size != (long long) st.st_size || memcmp(baseline->hash, hash, sizeof(hash)) != 0;
+
+    baseline->valid = 1;
+    baseline->size = (long long) st.st_size;
+    baseline->mtime_ns = mtime_ns;
+    baseline->checked_ns = checked_ns;
+    memcpy(baseline->hash, hash, sizeof(hash));
+
+    return changed;
+}
+
+// Runs the callback an event was held back for. Called from dispatch for the records the workers hand back, and
+// directly for events that couldn't be queued.
+void fingerprint_deliver(const char* name, int wd, uint32_t mask) {
+    void (*callback)(const char*, int) = NULL;
+
+    switch (mask & IN_ALL_EVENTS) {
+        case IN_MODIFY:
+            callback = callbacks.modify;
+            break;
+        case IN_CLOSE_WRITE:
+            callback = callbacks.close_write;
+            break;
+        case IN_DELETE:
+            callback = callbacks.remove;
+            break;
+    }
+
+    if (callback) {
+        callback(name, wd);
+    }
+}
+
+static void* run_worker(void* vargp) {
+    struct fingerprint_worker* worker = (struct fingerprint_worker*) vargp;
+
+    while (1) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->head == NULL && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+
+        struct fingerprint_job* job = worker->head;
+        if (job == NULL) { // Stopping and nothing left to do
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        int changed = 1;
+        if (job->forget) {
+            forget_fingerprint(worker, job->path);
+        }
+        else {
+            changed = content_changed(worker, job->path, job->mask);
+        }
+
+        // Handed back to the notifier rather than called here, so it goes through the lanes and the executor like
+        // every other event, behind whatever came before it for the same file
+        if (changed && job->mask != 0) {
+            notifier_inject_event(job->wd, job->mask | FINGERPRINT_CHECKED, 0, job->name);
+        }
+
+        free(job->path);
+        free(job);
+    }
+
+    return NULL;
+}
+
+// Must be called with fingerprint_lock held for writing. Workers finish what's queued before they exit.
+static void stop_workers() {
+    int count = worker_count;
+    __atomic_store_n(&worker_count, 0, __ATOMIC_RELAXED); // New events go straight to the modify callback from here on
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&workers[i].lock);
+        pthread_cond_signal(&workers[i].wake);
+        pthread_mutex_unlock(&workers[i].lock);
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct fingerprint_worker* worker = &workers[i];
+        pthread_join(worker->thread, NULL);
+
+        struct file_fingerprint *current, *tmp;
+        HASH_ITER(hh, worker->fingerprints, current, tmp) {
+            HASH_DEL(worker->fingerprints, current);
+            free(current->path);
+            free(current);
+        }
+
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+    }
+}
+
+int fingerprint_enable(int count) {
+    pthread_rwlock_wrlock(&fingerprint_lock);
+
+    if (worker_count > 0) {
+        pthread_rwlock_unlock(&fingerprint_lock);
+        return 0;
+    }
+
+    if (count < 1) count = 1;
+    if (count > MAX_FINGERPRINT_WORKERS) count = MAX_FINGERPRINT_WORKERS;
+
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < count; i++) {
+        struct fingerprint_worker* worker = &workers[i];
+        worker->head = NULL;
+        worker->tail = NULL;
+        worker->fingerprints = NULL;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->wake, NULL);
+
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+            worker_count = i;
+            stop_workers();
+            pthread_rwlock_unlock(&fingerprint_lock);
+            return -1;
+        }
+    }
+
+    __atomic_store_n(&worker_count, count, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&fingerprint_lock);
+    return 0;
+}
+
+void fingerprint_disable() {
+    pthread_rwlock_wrlock(&fingerprint_lock);
+
+    if (worker_count > 0) {
+        stop_workers();
+    }
+
+    pthread_rwlock_unlock(&fingerprint_lock);
+}
+
+int fingerprint_enabled() {
+    return __atomic_load_n(&worker_count, __ATOMIC_RELAXED) > 0;
+}
+
+static void enqueue(int wd, const char* name, uint32_t mask, int forget) {
+    pthread_rwlock_rdlock(&fingerprint_lock);
+
+    int count = worker_count;
+    char path[4096];
+    struct fingerprint_job* job = NULL;
+
+    if (count > 0 && join_watch_path(wd, name, path, sizeof(path)) == 0) {
+        job = (struct fingerprint_job*) malloc(sizeof(struct fingerprint_job));
+        if (job) {
+            job->path = strdup(path);
+        }
+    }
+
+    if (job == NULL || job->path == NULL) {
+        pthread_rwlock_unlock(&fingerprint_lock);
+        free(job);
+
+        // Can't fingerprint a file we can't locate, so don't risk swallowing a real change
+        if (mask != 0) {
+            fingerprint_deliver(name, wd, mask);
+        }
+        return;
+    }
+
+    job->wd = wd;
+    job->forget = forget;
+    job->mask = mask;
+    job->next = NULL;
+    terminated_strncpy(job->name, name, sizeof(job->name));
+
+    struct fingerprint_worker* worker = &workers[name_hash64(path) % (uint64_t) count];
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail) {
+        worker->tail->next = job;
+    }
+    else {
+        worker->head = job;
+    }
+    worker->tail = job;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_rwlock_unlock(&fingerprint_lock);
+}
+
+// Queues an IN_MODIFY or IN_CLOSE_WRITE event to be handed back only if the file's content actually changed
+void fingerprint_submit(int wd, const char* name, uint32_t mask) {
+    enqueue(wd, name, mask, 0);
+}
+
+// Drops the fingerprint for a file that was deleted or moved away, then hands back mask (if it isn't 0) so its callback
+// runs after those of any modifications still being checked
+void fingerprint_forget(int wd, const char* name, uint32_t mask) {
+    enqueue(wd, name, mask, 1);
+}
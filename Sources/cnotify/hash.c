@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+// Two 64-bit lanes per vector, two vectors per stripe. With GCC/Clang vector extensions this compiles to
+// SSE2 on x86_64 (AVX2 when the target allows it) and NEON on aarch64, and to scalar code everywhere else.
+typedef uint64_t hash_lanes __attribute__((vector_size(16)));
+
+#define STRIPE_SIZE 32
+#define STRIPES_PER_BLOCK 16
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME32_1 = 0x9E3779B1ULL;
+
+static const hash_lanes stripe_keys[2] = {
+    { 0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL },
+    { 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL }
+};
+
+static const hash_lanes scramble_keys[2] = {
+    { 0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL },
+    { 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL }
+};
+
+static inline hash_lanes accumulate(hash_lanes acc, hash_lanes input, hash_lanes key) {
+    hash_lanes keyed = input ^ key;
+    // 32x32->64 multiply per lane (pmuludq / umull), plus the input from the neighbouring lane so a
+    // zero half in keyed can't erase the other half
+    acc += (keyed & 0xFFFFFFFFULL) * (keyed >> 32);
+    acc += __builtin_shufflevector(input, input, 1, 0);
+    return acc;
+}
+
+static inline hash_lanes scramble(hash_lanes acc, hash_lanes key) {
+    acc ^= acc >> 47;
+    acc ^= key;
+    acc *= PRIME32_1;
+    return acc;
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// 128-bit non-cryptographic content hash, used to tell whether a file's bytes actually changed
+void content_hash128(const void* data, size_t length, uint64_t out[2]) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    hash_lanes acc[2] = { { PRIME64_1, PRIME64_2 }, { PRIME64_3, PRIME32_1 } };
+
+    size_t stripes = length / STRIPE_SIZE;
+    for (size_t i = 0; i < stripes; i++) {
+        hash_lanes input[2];
+        memcpy(input, bytes + i * STRIPE_SIZE, STRIPE_SIZE);
+        acc[0] = accumulate(acc[0], input[0], stripe_keys[0]);
+        acc[1] = accumulate(acc[1], input[1], stripe_keys[1]);
+
+        if ((i + 1) % STRIPES_PER_BLOCK == 0) {
+            acc[0] = scramble(acc[0], scramble_keys[0]);
+            acc[1] = scramble(acc[1], scramble_keys[1]);
+        }
+    }
+
+    // Zero-padded final stripe; the length is mixed in below so padding can't collide
+    size_t remaining = length % STRIPE_SIZE;
+    if (remaining > 0) {
+        unsigned char tail[STRIPE_SIZE] = { 0 };
+        memcpy(tail, bytes + stripes * STRIPE_SIZE, remaining);
+
+        hash_lanes input[2];
+        memcpy(input, tail, STRIPE_SIZE);
+        acc[0] = accumulate(acc[0], input[0], stripe_keys[0]);
+        acc[1] = accumulate(acc[1], input[1], stripe_keys[1]);
+    }
+
+    acc[0] = scramble(acc[0], scramble_keys[0]);
+    acc[1] = scramble(acc[1], scramble_keys[1]);
+
+    uint64_t lanes[4];
+    memcpy(lanes, acc, sizeof(lanes));
+
+    uint64_t len = (uint64_t) length;
+    out[0] = avalanche(lanes[0] ^ (lanes[1] * PRIME64_1) ^ (len * PRIME64_2));
+    out[1] = avalanche(lanes[2] ^ (lanes[3] * PRIME64_3) ^ (len * PRIME64_1) ^ out[0]);
+}
+
+// A file that is truncated while it's mapped raises SIGBUS on access. Files under watch are being
+// rewritten by definition, so hash_file128 jumps out of the read instead of taking the process down.
+static _Thread_local sigjmp_buf* mapped_read_jump = NULL;
+static struct sigaction previous_sigbus_action;
+static pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+
+static void handle_sigbus(int signal, siginfo_t* info, void* context) {
+    if (mapped_read_jump != NULL) {
+        siglongjmp(*mapped_read_jump, 1);
+    }
+
+    // Not ours, hand it to whoever was installed before us
+    if (previous_sigbus_action.sa_flags & SA_SIGINFO) {
+        previous_sigbus_action.sa_sigaction(signal, info, context);
+    }
+    else if (previous_sigbus_action.sa_handler != SIG_IGN && previous_sigbus_action.sa_handler != SIG_DFL) {
+        previous_sigbus_action.sa_handler(signal);
+    }
+    else {
+        sigaction(SIGBUS, &previous_sigbus_action, NULL);
+        raise(signal);
+    }
+}
+
+static void install_sigbus_handler(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handle_sigbus;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previous_sigbus_action);
+}
+
+// Hashes the contents of a file via mmap. Returns 0 on success, -1 if the file couldn't be read.
+int hash_file128(const char* path, uint64_t out[2]) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        content_hash128(NULL, 0, out);
+        return 0;
+    }
+
+    void* mapped = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+
+    pthread_once(&sigbus_once, install_sigbus_handler);
+    madvise(mapped, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+    int result = 0;
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 1) == 0) {
+        mapped_read_jump = &jump;
+        content_hash128(mapped, (size_t) st.st_size, out);
+    }
+    else {
+        // Truncated underneath us; whatever comes next will trigger another event
+        result = -1;
+    }
+
+    mapped_read_jump = NULL;
+    munmap(mapped, (size_t) st.st_size);
+
+    return result;
+}
+
+// Hashes the file in fixed-size blocks via mmap, the last one possibly short. On success, *hashes is a malloc'd array
+// of *count 64-bit block hashes (NULL for an empty file) and *size is the file's size. Returns 0 on success, -1 if the
+// file couldn't be read.
+int hash_file_blocks(const char* path, size_t block_size, uint64_t** hashes, size_t* count, long long* size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t length = (size_t) st.st_size;
+    size_t blocks = (length + block_size - 1) / block_size;
+
+    *hashes = NULL;
+    *count = 0;
+    *size = (long long) st.st_size;
+
+    if (length == 0) {
+        close(fd);
+        return 0;
+    }
+
+    uint64_t* block_hashes = (uint64_t*) malloc(blocks * sizeof(uint64_t));
+    void* mapped = block_hashes ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        free(block_hashes);
+        return -1;
+    }
+
+    pthread_once(&sigbus_once, install_sigbus_handler);
+    madvise(mapped, length, MADV_SEQUENTIAL);
+
+    int result = 0;
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 1) == 0) {
+        mapped_read_jump = &jump;
+
+        for (size_t i = 0; i < blocks; i++) {
+            size_t offset = i * block_size;
+            uint64_t hash[2];
+            content_hash128((const unsigned char*) mapped + offset, length - offset < block_size ? length - offset : block_size, hash);
+            block_hashes[i] = hash[0] ^ hash[1];
+        }
+    }
+    else {
+        result = -1;
+    }
+
+    mapped_read_jump = NULL;
+    munmap(mapped, length);
+
+    if (result != 0) {
+        free(block_hashes);
+        return -1;
+    }
+
+    *hashes = block_hashes;
+    *count = blocks;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "hashtable.h"
+
+#define FNV64_OFFSET 14695981039346656037ULL
+#define FNV64_PRIME 1099511628211ULL
+
+// 64-bit FNV-1a
+uint64_t name_hash64(const char* string) {
+    uint64_t hash = FNV64_OFFSET;
+    for (const char* c = string; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * FNV64_PRIME;
+    }
+    return hash;
+}
+
+// FNV-1a over the first length bytes of a name, seeded with the watch it's in. The high half is folded into the low one,
+// since tables index by the low bits and FNV mixes those least.
+uint64_t watch_name_hash64(int wd, const char* name, size_t length) {
+    uint64_t hash = FNV64_OFFSET ^ (uint32_t) wd;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) name[i]) * FNV64_PRIME;
+    }
+    return hash ^ (hash >> 32);
+}
+
+// Call once slot has been emptied. Entries after it in the same probe run are moved back into the gap, unless that would
+// put them before their home slot, so lookups never need tombstones.
+void table_backshift(const struct probe_table* table, size_t slot) {
+    uint64_t hash;
+
+    for (size_t next = (slot + 1) & table->mask; table->hash_at(table->context, next, &hash); next = (next + 1) & table->mask) {
+        size_t home = (size_t) hash & table->mask;
+
+        // It stays unless its home lies cyclically in (slot, next]
+        int stays = slot <= next ? (home > slot && home <= next) : (home > slot || home <= next);
+        if (!stays) {
+            table->move(table->context, next, slot);
+            slot = next;
+        }
+    }
+}
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "heavy.h"
+#include "hashtable.h"
+#include "types.h"
+#include "util.h"
+
+#define DIRECTORY_COUNTERS 128
+#define FILE_COUNTERS 256
+
+// Counts decay with a 10 second time constant, so a counter's count divided by 10 is its recent event rate per second
+#define DECAY_TIME_CONSTANT_S 10.0
+#define DECAY_PER_SECOND 0.9048374180359595 // e^(-1/10)
+
+// Space-saving sketch: a fixed set of counters, found through an open-addressing index of counter indices (-1 for an
+// empty slot) four times their number. A key without a counter takes over the one with the smallest count, which is
+// kept at the top of a min-heap so neither a hit nor a replacement has to look at every counter.
+struct heavy_sketch {
+    struct heavy_counter counters[FILE_COUNTERS];
+    char names[FILE_COUNTERS][256];     // Apart from the counters, so the heap and probing stay in cache; empty for directories
+    int heap[FILE_COUNTERS];
+    int capacity;
+    int used;
+    int index[FILE_COUNTERS * 4];
+    int index_size;
+};
+
+static struct heavy_sketch directories = { .capacity = DIRECTORY_COUNTERS, .index_size = DIRECTORY_COUNTERS * 4 };
+static struct heavy_sketch files = { .capacity = FILE_COUNTERS, .index_size = FILE_COUNTERS * 4 };
+static int initialized = 0;
+static long long decayed_ms = 0;
+
+// Updated from the notifier thread only; the lock is so queries see a consistent sketch
+static pthread_mutex_t heavy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void initialize() {
+    memset(directories.index, -1, sizeof(directories.index));
+    memset(files.index, -1, sizeof(files.index));
+    decayed_ms = clock_millis();
+    initialized = 1;
+}
+
+static int find_slot(const struct heavy_sketch* sketch, uint64_t hash, int wd, const char* name) {
+    int mask = sketch->index_size - 1;
+
+    for (int slot = (int) (hash & (uint64_t) mask); sketch->index[slot] >= 0; slot = (slot + 1) & mask) {
+        const struct heavy_counter* counter = &sketch->counters[sketch->index[slot]];
+        if (counter->hash == hash && counter->wd == wd && strcmp(sketch->names[sketch->index[slot]], name) == 0) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+static void insert_slot(struct heavy_sketch* sketch, int counter) {
+    int mask = sketch->index_size - 1;
+    int slot = (int) (sketch->counters[counter].hash & (uint64_t) mask);
+
+    while (sketch->index[slot] >= 0) {
+        slot = (slot + 1) & mask;
+    }
+    sketch->index[slot] = counter;
+}
+
+// The index only holds counter numbers; the hashes they were placed by are on the counters
+static int index_hash_at(void* context, size_t slot, uint64_t* hash) {
+    struct heavy_sketch* sketch = (struct heavy_sketch*) context;
+    int counter = sketch->index[slot];
+
+    if (counter < 0) {
+        return 0;
+    }
+
+    *hash = sketch->counters[counter].hash;
+    return 1;
+}
+
+static void index_move(void* context, size_t from, size_t to) {
+    struct heavy_sketch* sketch = (struct heavy_sketch*) context;
+    sketch->index[to] = sketch->index[from];
+    sketch->index[from] = -1;
+}
+
+// Takes an evicted counter out of the index
+static void remove_slot(struct heavy_sketch* sketch, int slot) {
+    struct probe_table table = { sketch, (size_t) sketch->index_size - 1, index_hash_at, index_move };
+    sketch->index[slot] = -1;
+    table_backshift(&table, (size_t) slot);
+}
+
+static void heap_swap(struct heavy_sketch* sketch, int a, int b) {
+    int counter = sketch->heap[a];
+    sketch->heap[a] = sketch->heap[b];
+    sketch->heap[b] = counter;
+    sketch->counters[sketch->heap[a]].heap_position = a;
+    sketch->counters[sketch->heap[b]].heap_position = b;
+}
+
+// Restores the heap after a counter's count went up. The heap is 4-ary, so a replaced counter sinking past a crowd of
+// equal minimum counts takes half as many levels.
+static void sift_down(struct heavy_sketch* sketch, int position) {
+    while (1) {
+        int smallest = position;
+        double smallest_count = sketch->counters[sketch->heap[position]].count;
+        int first = position * 4 + 1;
+        int last = first + 4 < sketch->used ? first + 4 : sketch->used;
+
+        for (int child = first; child < last; child++) {
+            double count = sketch->counters[sketch->heap[child]].count;
+            if (count < smallest_count) {
+                smallest = child;
+                smallest_count = count;
+            }
+        }
+
+        if (smallest == position) {
+            return;
+        }
+
+        heap_swap(sketch, position, smallest);
+        position = smallest;
+    }
+}
+
+// Restores the heap after a counter's count went down
+static void sift_up(struct heavy_sketch* sketch, int position) {
+    while (position > 0) {
+        int parent = (position - 1) / 4;
+        if (sketch->counters[sketch->heap[parent]].count <= sketch->counters[sketch->heap[position]].count) {
+            return;
+        }
+
+        heap_swap(sketch, position, parent);
+        position = parent;
+    }
+}
+
+static void count(struct heavy_sketch* sketch, int wd, const char* name) {
+    uint64_t hash = watch_name_hash64(wd, name, strlen(name));
+    int slot = find_slot(sketch, hash, wd, name);
+
+    if (slot >= 0) {
+        struct heavy_counter* counter = &sketch->counters[sketch->index[slot]];
+        counter->count += 1.0;
+        sift_down(sketch, counter->heap_position);
+        return;
+    }
+
+    int counter;
+    double inherited = 0.0;
+
+    if (sketch->used < sketch->capacity) {
+        counter = sketch->used;
+        sketch->heap[counter] = counter;
+        sketch->counters[counter].heap_position = counter;
+        sketch->counters[counter].count = 0.0;
+        sketch->used++;
+        sift_up(sketch, counter);
+    }
+    else {
+        counter = sketch->heap[0];
+
+        struct heavy_counter* evicted = &sketch->counters[counter];
+        remove_slot(sketch, find_slot(sketch, evicted->hash, evicted->wd, sketch->names[counter]));
+        inherited = evicted->count;
+    }
+
+    struct heavy_counter* replacement = &sketch->counters[counter];
+    replacement->hash = hash;
+    replacement->wd = wd;
+    replacement->count = inherited + 1.0;
+    replacement->error = inherited;
+    size_t length = strnlen(name, sizeof(sketch->names[counter]) - 1);
+    memcpy(sketch->names[counter], name, length);
+    sketch->names[counter][length] = '\0';
+    insert_slot(sketch, counter);
+    sift_down(sketch, replacement->heap_position);
+}
+
+// Counts an event against its directory and its file. Events a rate limit is about to shed are counted too, since a
+// directory being shed is exactly the kind of hot spot this is meant to find.
+void heavy_record(const struct inotify_event* event) {
+    if (event->wd < 0 || !(event->mask & IN_ALL_EVENTS)) {
+        return;
+    }
+
+    pthread_mutex_lock(&heavy_lock);
+
+    if (!initialized) {
+        initialize();
+    }
+
+    count(&directories, event->wd, "");
+    if (event->len > 0 && event->name[0] != '\0') {
+        count(&files, event->wd, event->name);
+    }
+
+    pthread_mutex_unlock(&heavy_lock);
+}
+
+// How much counts decay over elapsed_ms: whole seconds exactly, linear within the last one
+static double decay_factor(long long elapsed_ms) {
+    double factor = 1.0;
+    for (long long seconds = elapsed_ms / 1000; seconds > 0 && factor > 1e-9; seconds--) {
+        factor *= DECAY_PER_SECOND;
+    }
+
+    double fraction = (double) (elapsed_ms % 1000) / 1000.0;
+    return factor * (1.0 - fraction * (1.0 - DECAY_PER_SECOND));
+}
+
+static void scale(struct heavy_sketch* sketch, double factor) {
+    for (int i = 0; i < sketch->used; i++) {
+        sketch->counters[i].count *= factor;
+        sketch->counters[i].error *= factor;
+    }
+}
+
+// Decays every count by how much time has passed, at most once a second. Called from the notifier thread's loop.
+void heavy_decay() {
+    long long now = clock_millis();
+    if (!initialized || now - decayed_ms < 1000) {
+        return;
+    }
+
+    pthread_mutex_lock(&heavy_lock);
+
+    long long elapsed = (now - decayed_ms) / 1000 * 1000;
+    double factor = decay_factor(elapsed);
+    scale(&directories, factor);
+    scale(&files, factor);
+    decayed_ms += elapsed;
+
+    pthread_mutex_unlock(&heavy_lock);
+}
+
+static int by_rate(const void* a, const void* b) {
+    double difference = ((const struct heavy_hitter*) b)->rate - ((const struct heavy_hitter*) a)->rate;
+    return (difference > 0) - (difference < 0);
+}
+
+// Copies up to max of the busiest directories (HEAVY_DIRECTORIES) or files (HEAVY_FILES), busiest first.
+// Returns how many were copied.
+int heavy_top(int kind, struct heavy_hitter* hitters, int max) {
+    if (kind != HEAVY_DIRECTORIES && kind != HEAVY_FILES) {
+        return 0;
+    }
+
+    struct heavy_sketch* sketch = kind == HEAVY_FILES ? &files : &directories;
+    struct heavy_hitter all[FILE_COUNTERS];
+    int used = 0;
+
+    pthread_mutex_lock(&heavy_lock);
+
+    if (initialized) {
+        // Decayed up to now without touching the sketch
+        double factor = decay_factor(clock_millis() - decayed_ms) / DECAY_TIME_CONSTANT_S;
+
+        for (int i = 0; i < sketch->used; i++) {
+            const struct heavy_counter* counter = &sketch->counters[i];
+            if (counter->count <= 0.0) { // Forgotten
+                continue;
+            }
+
+            struct heavy_hitter* hitter = &all[used++];
+            hitter->wd = counter->wd;
+            hitter->rate = counter->count * factor;
+            hitter->error = counter->error * factor;
+            memcpy(hitter->name, sketch->names[i], sizeof(hitter->name));
+        }
+    }
+
+    pthread_mutex_unlock(&heavy_lock);
+
+    qsort(all, (size_t) used, sizeof(struct heavy_hitter), by_rate);
+
+    int copied = used < max ? used : max;
+    memcpy(hitters, all, (size_t) (copied > 0 ? copied : 0) * sizeof(struct heavy_hitter));
+
+    return copied;
+}
+
+static void forget(struct heavy_sketch* sketch, int wd) {
+    for (int i = 0; i < sketch->used; i++) {
+        if (sketch->counters[i].wd == wd) {
+            sketch->counters[i].count = 0.0; // The first to be replaced
+            sketch->counters[i].error = 0.0;
+            sift_up(sketch, sketch->counters[i].heap_position);
+        }
+    }
+}
+
+// Stops reporting a watch that's been removed
+void heavy_forget(int wd) {
+    pthread_mutex_lock(&heavy_lock);
+    forget(&directories, wd);
+    forget(&files, wd);
+    pthread_mutex_unlock(&heavy_lock);
+}
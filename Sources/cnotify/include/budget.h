@@ -0,0 +1,12 @@
+#pragma once
+
+int budget_init();
+int budget_get();
+void budget_set(int budget);
+int budget_room();
+int watch_kernel_flags(int flags);
+int watch_wanted_flags(int wd);
+int watch_error_code(int error);
+int budget_add_watch(const char* filepath, int flags);
+int add_polled_watch(const char* filepath, int flags, int pinned);
+int budget_promote(int wd);
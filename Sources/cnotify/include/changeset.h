@@ -0,0 +1,15 @@
+#pragma once
+#include <sys/inotify.h>
+#include "types.h"
+
+#define CHANGE_CREATED 0
+#define CHANGE_MODIFIED 1
+#define CHANGE_DELETED 2
+#define CHANGE_RENAMED 3
+
+void changeset_enable(long long quiet_ms, long long max_latency_ms);
+void changeset_disable();
+int changeset_enabled();
+void changeset_record(const struct inotify_event* event, uint32_t bits);
+long long changeset_timeout();
+void changeset_flush_due();
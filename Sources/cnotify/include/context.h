@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/inotify.h>
+#include "types.h"
+
+typedef void (*notify_context_callback)(void* userdata, int watch, const char* name, uint32_t mask, uint32_t cookie);
+
+struct notify_context* notify_context_create();
+void notify_context_destroy(struct notify_context* context);
+int notify_context_add_watch(struct notify_context* context, const char* path, int flags);
+int notify_context_remove_watch(struct notify_context* context, int watch);
+void notify_context_set_callback(struct notify_context* context, notify_context_callback callback, void* userdata);
+void notify_context_set_max_pending(struct notify_context* context, size_t max_bytes);
+int notify_context_fd(const struct notify_context* context);
+int notify_context_drain(struct notify_context* context, struct notify_batch* batch);
+uint64_t notify_context_dropped(struct notify_context* context);
+int contexts_active();
+int context_dispatch(const struct inotify_event* event, uint32_t mask);
@@ -0,0 +1,8 @@
+#pragma once
+#include "types.h"
+
+int delta_enable(int worker_count, long long block_bytes);
+void delta_disable();
+int delta_enabled();
+void delta_submit(int wd, const char* name);
+void delta_forget(int wd, const char* name);
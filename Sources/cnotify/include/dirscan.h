@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+#include <sys/stat.h>
+#include "types.h"
+
+int compare_snapshot_key(uint64_t hash, const char* name, const struct snapshot_entry* entry);
+int compare_snapshot_entries(const void* a, const void* b);
+void fill_snapshot_entry(struct snapshot_entry* entry, const char* name, uint64_t hash, const struct stat* st);
+long scan_directory(const char* path, struct snapshot_entry** result);
@@ -0,0 +1,4 @@
+#pragma once
+#include <sys/inotify.h>
+
+void dispatch_event(const struct inotify_event* event);
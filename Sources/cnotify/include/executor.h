@@ -0,0 +1,9 @@
+#pragma once
+#include <stddef.h>
+#include <sys/inotify.h>
+
+int executor_enable(int count, int depth);
+void executor_disable();
+int executor_enabled();
+size_t executor_pending();
+int executor_submit(const struct inotify_event* event);
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <sys/inotify.h>
+#include "types.h"
+
+// Events a single-file watch always needs, to notice when its path is replaced: the old file's link count dropping
+// (IN_ATTRIB), and it going away or being moved
+#define FILE_WATCH_EVENTS (IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Reported for a file watch whose path was replaced, as if the new content had been written in place
+#define FILE_REPLACED_EVENTS (IN_MODIFY | IN_CLOSE_WRITE)
+
+int filewatch_add(const char* filepath, int flags);
+int filewatch_tracked(int wd);
+int filewatch_active();
+uint32_t filewatch_record(const struct inotify_event* event);
+void filewatch_forget(int wd);
+void filewatch_stop();
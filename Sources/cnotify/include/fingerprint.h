@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// Set on the records the workers hand back to the notifier, which only go to the callback they were held for
+#define FINGERPRINT_CHECKED 0x00100000u
+
+int fingerprint_enable(int worker_count);
+void fingerprint_disable();
+int fingerprint_enabled();
+void fingerprint_submit(int wd, const char* name, uint32_t mask);
+void fingerprint_forget(int wd, const char* name, uint32_t mask);
+void fingerprint_deliver(const char* name, int wd, uint32_t mask);
@@ -0,0 +1,7 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+void content_hash128(const void* data, size_t length, uint64_t out[2]);
+int hash_file128(const char* path, uint64_t out[2]);
+int hash_file_blocks(const char* path, size_t block_size, uint64_t** hashes, size_t* count, long long* size);
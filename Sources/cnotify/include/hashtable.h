@@ -0,0 +1,16 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// How table_backshift sees a linear-probing table: which slots are taken, the hash each entry was placed by, and how
+// to move an entry into an empty slot (leaving the one it came from empty)
+struct probe_table {
+    void* context;
+    size_t mask;
+    int (*hash_at)(void* context, size_t slot, uint64_t* hash);
+    void (*move)(void* context, size_t from, size_t to);
+};
+
+uint64_t name_hash64(const char* string);
+uint64_t watch_name_hash64(int wd, const char* name, size_t length);
+void table_backshift(const struct probe_table* table, size_t slot);
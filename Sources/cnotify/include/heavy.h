@@ -0,0 +1,11 @@
+#pragma once
+#include <sys/inotify.h>
+#include "types.h"
+
+#define HEAVY_DIRECTORIES 0
+#define HEAVY_FILES 1
+
+void heavy_record(const struct inotify_event* event);
+void heavy_decay();
+int heavy_top(int kind, struct heavy_hitter* hitters, int max);
+void heavy_forget(int wd);
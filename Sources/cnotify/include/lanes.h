@@ -0,0 +1,16 @@
+#pragma once
+#include <sys/inotify.h>
+#include "types.h"
+
+#define LANE_LOW 0
+#define LANE_NORMAL 1
+#define LANE_HIGH 2
+#define LANE_COUNT 3
+
+void lanes_activate();
+int lanes_active();
+void lanes_enqueue(const struct inotify_event* event, int lane);
+size_t lanes_pending();
+void lanes_dispatch(size_t budget, void (*deliver)(const struct inotify_event*));
+int lanes_set_weight(int lane, int weight);
+int lanes_get_stats(int lane, struct lane_stats* stats);
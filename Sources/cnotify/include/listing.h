@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+#include <sys/inotify.h>
+#include "types.h"
+
+// Events that keep a directory listing current
+#define LISTING_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+int listing_track(int wd);
+void listing_untrack(int wd);
+int listing_tracked(int wd);
+int listing_active();
+int listing_refresh(int wd);
+void listing_record(const struct inotify_event* event);
+long listing_count(int wd);
+int listing_contains(int wd, const char* name);
+long listing_names(int wd, char** names, size_t* length);
+void listing_stop();
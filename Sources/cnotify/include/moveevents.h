@@ -1,10 +1,14 @@
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
 #include "types.h"
 
 extern int tracked_count;
 extern struct move_event* move_events;
 
 void track_event(uint32_t wd, uint32_t cookie, const char* name);
-int find_and_remove_event(uint32_t cookie, char* matched_name);
+int find_and_remove_event(uint32_t cookie, char* matched_name, int* matched_wd);
 void remove_event(struct move_event* event);
+void expire_events(long long max_age, void (*expired)(const char*, int));
+long long move_events_timeout(long long max_age);
+size_t move_table_memory();
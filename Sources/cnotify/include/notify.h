@@ -1,9 +1,37 @@
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
 
 int notifier_init();
+int notifier_fd();
+void notifier_inject(const char* records, size_t length);
+void notifier_inject_event(int wd, uint32_t mask, uint32_t cookie, const char* name);
+size_t notifier_injected_backlog();
+int notifier_draining();
+void notifier_wake();
 int add_watch(const char* filepath, int flags);
+int add_watch_polling(const char* filepath, int flags);
+int add_file_watch(const char* filepath, int flags);
+int add_watch_subscribed(const char* filepath, int flags);
+int set_watch_priority(int watch, int priority);
+int set_watch_warming(int watch, long long max_bytes);
+int set_watch_listing(int watch, int enabled);
+int set_watch_stat_cache(int watch, int enabled);
+int add_watches(const char** filepaths, int count, int flags, int* results);
+int add_watches_subscribed(const char** filepaths, int count, int flags, int* results);
 int remove_watch(int watch);
 int set_callback(void (*callback)(const char*, int), int flag);
-int set_rename_callback(void (*callback)(const char*, const char*, int));
+int set_rename_callback(void (*callback)(const char*, int, const char*, int));
+int set_event_callback(void (*callback)(const char*, int, uint32_t));
+int set_suppressed_callback(void (*callback)(int, uint64_t));
+int set_subtree_callback(void (*callback)(int, const char*, int, uint32_t));
+int set_changeset_callback(void (*callback)(const struct changeset_change*, int));
+int set_delta_callback(void (*callback)(const char*, int, const struct delta_range*, int, long long, long long));
+int set_rate_limit(int watch, double rate, int burst, int policy, int sample_every);
 void start_notifier();
+int notifier_pump_start();
+void notifier_pump_stop();
+int notifier_process(int max_events);
+int notifier_next_timeout();
 void stop_notifier();
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "types.h"
+
+int poller_add(int wd, const char* path, int pinned);
+void poller_remove(int wd, int flush);
+int poller_pinned(int wd);
+struct poller_stats poller_get_stats();
+void poller_set_interval(int milliseconds);
+int poller_interval();
+void poller_stop();
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include <sys/inotify.h>
+
+#define RATE_LIMIT_DROP 0
+#define RATE_LIMIT_COALESCE 1
+#define RATE_LIMIT_SAMPLE 2
+
+int ratelimit_set(int wd, double rate, int burst, int policy, int sample_every);
+void ratelimit_remove(int wd);
+int ratelimit_admit(const struct inotify_event* event);
+void ratelimit_report();
+long long ratelimit_timeout();
+int ratelimit_stats(int wd, uint64_t* passed, uint64_t* suppressed);
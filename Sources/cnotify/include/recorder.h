@@ -0,0 +1,11 @@
+#pragma once
+#include <sys/inotify.h>
+
+#define RECORDING_EVENT 0
+#define RECORDING_PATH 1
+
+int recorder_start(const char* path);
+void recorder_stop();
+int recorder_active();
+void recorder_record(const struct inotify_event* event);
+long replay_recording(const char* path, int original_timing);
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <sys/inotify.h>
+
+int shmring_publish_start(const char* name, int slot_count);
+void shmring_publish_stop();
+void shmring_publish(const struct inotify_event* event);
+int shmring_subscribe_start(const char* name);
+void shmring_subscribe_stop();
+int shmring_subscribed();
+uint64_t shmring_overruns();
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+#include <sys/inotify.h>
+
+// Events every watch subscribes to while snapshots are enabled, so the index stays accurate whatever the caller asked for
+#define SNAPSHOT_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO)
+
+int snapshot_set_directory(const char* directory);
+int snapshot_enabled();
+void snapshot_track(int wd, const char* path);
+void snapshot_untrack(int wd);
+void snapshot_record(int wd, const char* name, uint32_t mask);
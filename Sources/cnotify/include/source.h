@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include "types.h"
+
+const struct event_source* source_current();
+void source_use_inotify();
+int source_use_synthetic(int wd, const struct synthetic_mix* mix, int name_count, uint64_t limit, uint64_t seed);
+uint64_t source_synthetic_generated();
@@ -0,0 +1,15 @@
+#pragma once
+#include <sys/inotify.h>
+#include "types.h"
+
+// Events that change a file's attributes or what a name refers to
+#define STATCACHE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+int statcache_track(int wd);
+void statcache_untrack(int wd);
+int statcache_tracked(int wd);
+int statcache_active();
+void statcache_record(const struct inotify_event* event);
+int statcache_lookup(int wd, const char* name, struct cached_stat* out);
+void statcache_get_stats(struct statcache_stats* stats);
+void statcache_stop();
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+#include "types.h"
+
+int subtree_subscribe(const char* prefix, uint32_t mask);
+int subtree_unsubscribe(int id);
+int subtree_active();
+void subtree_dispatch(int wd, const char* name, uint32_t mask);
+void subtree_forget(int wd);
@@ -1,7 +1,12 @@
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
 #include "uthash.h"
 
+struct changeset_change;
+struct delta_range;
+
 struct callback_collection {
     // const char* name, int wd
     void (*create)(const char*, int);
@@ -9,8 +14,23 @@ struct callback_collection {
     void (*modify)(const char*, int);
     void (*move_from)(const char*, int);
     void (*move_to)(const char*, int);
-    // const char* old_name, const char* new_name, int wd
-    void (*rename)(const char*, const char*, int);
+    void (*close_write)(const char*, int);
+    void (*attrib)(const char*, int);
+    void (*open)(const char*, int);
+    void (*delete_self)(const char*, int);
+    void (*move_self)(const char*, int);
+    // const char* old_name, int old_wd, const char* new_name, int new_wd
+    void (*rename)(const char*, int, const char*, int);
+    // const char* name, int wd, uint32_t mask
+    void (*event)(const char*, int, uint32_t);
+    // int wd, uint64_t suppressed_count
+    void (*suppressed)(int, uint64_t);
+    // int subscription, const char* name, int wd, uint32_t mask
+    void (*subtree)(int, const char*, int, uint32_t);
+    // const struct changeset_change* changes, int count
+    void (*changeset)(const struct changeset_change*, int);
+    // const char* name, int wd, const struct delta_range* ranges, int count, long long size, long long previous_size
+    void (*delta)(const char*, int, const struct delta_range*, int, long long, long long);
 };
 
 struct move_event {
@@ -20,3 +40,398 @@ struct move_event {
     uint32_t wd;
     UT_hash_handle hh;
 };
+
+struct watch_entry {
+    int wd;         // Stable id handed out to callers; survives moving between inotify and polling
+    int kernel_wd;  // inotify wd, or -1 while the directory is being polled
+    int flags;
+    int priority;   // Dispatch lane, see lanes.h
+    int is_file;    // Watches a single file, which is never demoted to polling
+    int unpollable; // The poller couldn't take it the last time it was demoted, so it's left on inotify
+    char* path;
+    double heat;    // Exponentially decayed event count, used to find cold directories
+    long long heat_updated;
+    UT_hash_handle hh;
+    UT_hash_handle hh_kernel;
+    UT_hash_handle hh_path;
+};
+
+// What a file looked like the last time one kind of event was checked against it
+struct fingerprint_baseline {
+    int valid;
+    long long size;
+    long long mtime_ns;
+    long long checked_ns;
+    uint64_t hash[2];
+};
+
+struct file_fingerprint {
+    char* path;
+    struct fingerprint_baseline baselines[2]; // IN_MODIFY, IN_CLOSE_WRITE; each is only ever compared with its own kind
+    UT_hash_handle hh;
+};
+
+struct fingerprint_job {
+    int wd;
+    int forget;    // Drop the file's fingerprint rather than comparing against it
+    uint32_t mask; // The event to hand back, if the content changed or the file was forgotten; 0 for none
+    char name[1024];
+    char* path;
+    struct fingerprint_job* next;
+};
+
+// On-disk layout of a snapshot index: a header followed by entries sorted by (name_hash, name)
+struct snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+struct snapshot_entry {
+    uint64_t name_hash;
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime_ns;
+    char name[256]; // Kept so entries deleted while we weren't running can still be reported by name
+};
+
+struct snapshot_index {
+    int wd;
+    int fd;
+    struct snapshot_header* header;
+    size_t mapped_size;
+    uint64_t scan;          // The catch-up scan running without the lock, or 0 if there isn't one
+    uint64_t* touched;      // Name hashes events changed while it ran, so the scan doesn't overwrite or report them
+    size_t touched_count;
+    size_t touched_capacity;
+    pthread_mutex_t lock;
+    UT_hash_handle hh;
+};
+
+// A polled directory's last scan: entries sorted by (name_hash, name), with their names packed into one buffer
+struct poll_entry {
+    uint64_t name_hash;
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime_ns;
+    uint32_t name_offset;
+    uint32_t is_directory;
+};
+
+struct poll_state {
+    struct poll_entry* entries;
+    char* names;
+    size_t count;
+    size_t names_length;
+};
+
+// What the last polling cycle cost, for tuning the poll interval
+struct poller_stats {
+    uint64_t cycles;
+    uint64_t last_cycle_us;
+    uint64_t total_cycle_us;
+    uint64_t last_directories;
+    uint64_t last_entries;
+    uint64_t last_syscalls;
+};
+
+// Per-priority dispatch counters, reported by lanes_get_stats
+struct lane_stats {
+    uint64_t depth;
+    uint64_t max_depth;
+    uint64_t dispatched;
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+    uint32_t weight;
+};
+
+// Token bucket for a rate-limited watch, see ratelimit.h
+struct rate_limit {
+    int wd;
+    int policy;
+    int sample_every;
+    double rate;    // Tokens added per second
+    double burst;   // Most tokens the bucket holds
+    double tokens;
+    long long refilled_ns;
+    uint64_t passed;
+    uint64_t suppressed;
+    uint64_t unreported; // Suppressed since the last summary, when coalescing
+    uint64_t sample_counter;
+    long long reported_ms;
+    UT_hash_handle hh;
+};
+
+// Event recordings: a recording_header, then recording_records each followed by name_length bytes of name.
+// A record of kind RECORDING_PATH maps a watch id to the watched directory's path; it's written before the
+// first event for that watch.
+struct recording_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t started_ns; // CLOCK_REALTIME when the recording started
+};
+
+struct recording_record {
+    uint64_t timestamp_ns; // Since the recording started
+    uint32_t mask;
+    uint32_t cookie;
+    int32_t wd;
+    uint16_t name_length;
+    uint16_t kind;
+};
+
+struct recorded_watch {
+    int wd;
+    int replay_wd; // The watch the recorded one maps to while replaying, or -1 if its path isn't watched
+    UT_hash_handle hh;
+};
+
+// Where handle_events gets its event records from. The records read must be laid out like the kernel's.
+struct event_source {
+    int (*fd)(void* context);                                    // Polled for readability
+    long (*read)(void* context, char* buffer, size_t length);    // Returns bytes read, 0 for nothing, or -1 to stop
+    int kernel_wds;                                              // Whether records carry inotify wds that need translating to watch ids
+    void* context;
+};
+
+// Relative weights of each kind of record the synthetic source generates
+struct synthetic_mix {
+    uint32_t create;
+    uint32_t remove;
+    uint32_t modify;
+    uint32_t move;      // IN_MOVED_FROM immediately followed by its IN_MOVED_TO
+    uint32_t move_out;  // IN_MOVED_FROM with no IN_MOVED_TO, which expires into a move_from callback
+};
+
+// Shared-memory event ring: a shm_ring_header followed by slot_count slots of slot_size bytes, each a shm_ring_slot
+// followed by the directory path and then the name. Slot seq is 0 while the slot is being written, and the event's
+// sequence number plus one once it has been.
+struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    uint64_t write_seq;     // Sequence number of the next event to be published
+    uint32_t futex_word;    // Bumped on every publish, for subscribers waiting for events
+    uint32_t waiters;
+};
+
+struct shm_ring_slot {
+    uint64_t seq;
+    uint32_t mask;
+    uint32_t cookie;
+    uint16_t directory_length;
+    uint16_t name_length;
+    uint32_t reserved;
+};
+
+// A node of the subtree subscription trie; each edge is one path component
+struct subtree_node {
+    char* component;
+    struct subtree_node* children;
+    int* subscriptions;         // Ids of the subscriptions whose prefix ends here
+    int subscription_count;
+    int subscription_capacity;
+    struct subtree_node* parent;
+    UT_hash_handle hh;
+};
+
+struct subtree_subscription {
+    int id;
+    uint32_t mask;
+    struct subtree_node* node;
+    UT_hash_handle hh;
+};
+
+struct subtree_route {
+    int subscription;
+    uint32_t mask;
+};
+
+// The subscriptions a watched directory's events go to, valid while generation matches the trie's
+struct subtree_match {
+    int wd;
+    uint64_t generation;
+    int count;
+    struct subtree_route* routes;
+    UT_hash_handle hh;
+};
+
+// One (wd, name) in the changeset being accumulated. Names live in the changeset's name arena.
+struct changeset_entry {
+    uint64_t hash;
+    int wd;
+    uint32_t name_offset;
+    uint16_t name_length;
+    uint8_t state;          // CHANGE_* in changeset.h, or one of the internal states in changeset.c
+    uint8_t is_directory;
+    uint8_t modified;       // Whether the content was written within the window, kept across renames
+    int origin;             // For a renamed entry, the index of the entry it was originally renamed from
+    uint32_t cookie;        // For an entry that was moved away, the cookie of the move until its IN_MOVED_TO arrives
+};
+
+// A settled change handed to the changeset callback
+struct changeset_change {
+    int kind;               // CHANGE_CREATED, CHANGE_MODIFIED, CHANGE_DELETED or CHANGE_RENAMED
+    int is_directory;
+    int wd;
+    const char* name;
+    int old_wd;             // Only for CHANGE_RENAMED
+    const char* old_name;
+    int modified;           // For CHANGE_RENAMED, whether the content changed as well
+};
+
+// A space-saving counter. Counts decay exponentially, so they track recent activity rather than all-time totals.
+struct heavy_counter {
+    uint64_t hash;
+    int wd;
+    double count;
+    double error;           // How much of count may have been inherited from the key this counter replaced
+    int heap_position;
+};
+
+// A heavy hitter handed out by heavy_top
+struct heavy_hitter {
+    int wd;
+    char name[256];
+    double rate;            // Events per second
+    double error;           // Upper bound on how much rate is overestimated
+};
+
+// How much of each file in a watched directory is pulled into the page cache when it's opened or written
+struct warm_limit {
+    int wd;
+    long long max_bytes;
+    UT_hash_handle hh;
+};
+
+// A file waiting for the warming worker
+struct warm_job {
+    int wd;
+    char name[256];
+};
+
+// A recently warmed file, so opens (including the worker's own) don't warm it again while it's unchanged
+struct warm_recent {
+    uint64_t hash;
+    uint64_t inode;
+    long long size;
+    long long mtime_ns;
+    long long warmed_ms;
+};
+
+struct warm_stats {
+    uint64_t warmed;        // Files handed to readahead
+    uint64_t bytes;         // Bytes requested
+    uint64_t repeated;      // Skipped because they were warmed recently and haven't changed
+    uint64_t skipped;       // Skipped because they weren't regular files or had gone
+    uint64_t dropped;       // Not queued because the worker had fallen behind
+};
+
+// A run of bytes in a file that changed since it was last written, in whole blocks (the last one possibly short)
+struct delta_range {
+    long long offset;
+    long long length;
+};
+
+// A file's block hashes as of its last close-write
+struct delta_file {
+    char* path;
+    long long size;
+    size_t block_count;
+    uint64_t* hashes;
+    UT_hash_handle hh;
+};
+
+struct delta_job {
+    int wd;
+    int forget;             // Drop the file's hashes rather than comparing against them
+    char name[1024];
+    char* path;
+    struct delta_job* next;
+};
+
+// One name in a directory listing cache's open-addressing table; an empty slot has a NULL name
+struct listing_entry {
+    uint64_t hash;
+    char* name;
+    int is_directory;
+};
+
+// The entries of one watched directory, kept current from its events
+struct dir_listing {
+    int wd;
+    int stale;              // Events may have been lost (i.e. the queue overflowed); rescanned before it's next read
+    size_t count;
+    size_t capacity;        // Slots, always a power of two
+    struct listing_entry* slots;
+    UT_hash_handle hh;
+};
+
+// A file's cached attributes in the stat cache's open-addressing table; an empty slot has a NULL name
+struct stat_entry {
+    uint64_t hash;
+    char* name;
+    int wd;
+    uint32_t mode;
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime_ns;
+};
+
+// Attributes handed out by statcache_lookup
+struct cached_stat {
+    uint32_t mode;
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime_ns;
+};
+
+struct statcache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t entries;
+};
+
+// The inode a single-file watch's inotify watch is on, to tell when the path has been replaced by another file
+struct file_watch {
+    int wd;
+    uint64_t device;
+    uint64_t inode;
+    UT_hash_handle hh;
+};
+
+// A consumer of the context API. Events for its watches go to its callback if it has one, or are appended to pending
+// as inotify_event records (with the filtered mask) until it drains them.
+struct notify_context {
+    void (*callback)(void*, int, const char*, uint32_t, uint32_t); // userdata, watch, name, mask, cookie
+    void* userdata;
+    pthread_mutex_t lock;
+    char* pending;
+    size_t pending_length;
+    size_t pending_capacity;
+    char* drained;              // The batch handed out by the last drain, reused as the next pending buffer
+    size_t drained_capacity;
+    size_t max_pending;         // Records past this many bytes are dropped and counted
+    int pending_count;
+    uint64_t dropped;
+    int wake_fd;                // Readable while records are pending
+    int in_flight;              // Dispatches that have found the context and not yet finished with it
+};
+
+struct context_watch {
+    int wd;
+    struct notify_context* context;
+    UT_hash_handle hh;
+};
+
+// A drained run of records, valid until the context is drained again or destroyed
+struct notify_batch {
+    const char* records;
+    size_t length;
+    int count;
+};
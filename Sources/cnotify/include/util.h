@@ -2,4 +2,8 @@
 #include <stddef.h>
 
 long long get_current_time_millis();
+long long clock_millis();
+void clock_set_virtual(long long start_millis);
+void clock_advance(long long millis);
+void clock_set_real();
 void terminated_strncpy(char* restrict dest, const char* restrict src, size_t n);
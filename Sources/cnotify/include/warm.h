@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+#include <sys/inotify.h>
+#include "types.h"
+
+// Events that get a watch's files warmed
+#define WARM_EVENTS (IN_OPEN | IN_CLOSE_WRITE)
+
+int warm_set_limit(int wd, long long max_bytes);
+long long warm_limit(int wd);
+int warm_active();
+void warm_submit(int wd, const char* name);
+void warm_forget(int wd);
+void warm_stop();
+void warm_get_stats(struct warm_stats* stats);
@@ -0,0 +1,24 @@
+#pragma once
+#include <stddef.h>
+#include "types.h"
+
+int watch_table_add(int kernel_wd, const char* path, int flags);
+int watch_table_add_file(int kernel_wd, const char* path, int flags);
+void watch_table_add_all(int* wds, const char** paths, int count, int flags);
+void watch_table_remove(int wd);
+int watch_table_resolve(int kernel_wd);
+int watch_table_kernel_wd(int wd);
+void watch_table_set_kernel_wd(int wd, int kernel_wd);
+void watch_table_touch(int wd, int events);
+double watch_table_heat(int wd);
+void watch_table_set_unpollable(int wd);
+int watch_table_coldest(int* wds, int max);
+void watch_table_counts(int* kernel_count, int* polled_count);
+size_t watch_table_memory();
+int watch_table_path(int wd, char* path, size_t n);
+int watch_table_flags(int wd);
+void watch_table_set_flags(int wd, int flags);
+int watch_table_find(const char* path);
+int watch_table_priority(int wd);
+int watch_table_set_priority(int wd, int priority);
+int join_watch_path(int wd, const char* name, char* path, size_t n);
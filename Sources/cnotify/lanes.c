@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include "lanes.h"
+#include "types.h"
+
+// Recent IN_MOVED_FROM cookies and the lane they went to, so the matching IN_MOVED_TO is queued behind it
+#define COOKIE_ROUTES 64
+
+// Each record is queued with the time it was read, followed by the event itself
+struct lane_record {
+    long long enqueued_ns;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+// A FIFO of lane_records in one buffer. Only the notifier thread queues and dispatches; the stats are read from anywhere.
+struct lane {
+    char* data;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    struct lane_stats stats;
+};
+
+struct cookie_route {
+    uint32_t cookie;
+    int lane;
+};
+
+static struct lane lanes[LANE_COUNT] = {
+    [LANE_LOW] = { .stats = { .weight = 1 } },
+    [LANE_NORMAL] = { .stats = { .weight = 4 } },
+    [LANE_HIGH] = { .stats = { .weight = 16 } },
+};
+
+static int active = 0;
+static struct cookie_route cookie_routes[COOKIE_ROUTES];
+
+// Read without pump_lock (i.e. by notifier_next_timeout) while the notifier thread or pump queues and dispatches
+static size_t pending = 0;
+
+static long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Starts routing events through the lanes. Until a watch is given a priority other than normal, there's nothing to
+// reorder, so events skip the lanes entirely.
+void lanes_activate() {
+    __atomic_store_n(&active, 1, __ATOMIC_RELAXED);
+}
+
+int lanes_active() {
+    return __atomic_load_n(&active, __ATOMIC_RELAXED);
+}
+
+// Queues an event on a lane. An IN_MOVED_TO whose IN_MOVED_FROM is still queued goes on the same lane, so the
+// two are dispatched in order and still pair up as a rename.
+void lanes_enqueue(const struct inotify_event* event, int lane_index) {
+    if (lane_index < 0 || lane_index >= LANE_COUNT) {
+        lane_index = LANE_NORMAL;
+    }
+
+    struct cookie_route* route = &cookie_routes[event->cookie % COOKIE_ROUTES];
+    if (event->cookie != 0) {
+        if ((event->mask & IN_MOVED_TO) && route->cookie == event->cookie) {
+            lane_index = route->lane;
+        }
+        else if (event->mask & IN_MOVED_FROM) {
+            route->cookie = event->cookie;
+            route->lane = lane_index;
+        }
+    }
+
+    struct lane* lane = &lanes[lane_index];
+    size_t event_size = sizeof(struct inotify_event) + event->len;
+    size_t size = (sizeof(struct lane_record) + event_size + 7) & ~(size_t) 7;
+
+    if (lane->tail + size > lane->capacity) {
+        // Reclaim what's already been dispatched before growing
+        if (lane->head > 0) {
+            memmove(lane->data, lane->data + lane->head, lane->tail - lane->head);
+            lane->tail -= lane->head;
+            lane->head = 0;
+        }
+
+        if (lane->tail + size > lane->capacity) {
+            size_t capacity = lane->capacity ? lane->capacity * 2 : 16384;
+            while (capacity < lane->tail + size) {
+                capacity *= 2;
+            }
+
+            char* grown = (char*) realloc(lane->data, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "[SWNotify] Dropped an event: out of memory for the dispatch queue\n");
+                return;
+            }
+
+            lane->data = grown;
+            lane->capacity = capacity;
+        }
+    }
+
+    struct lane_record* record = (struct lane_record*) (lane->data + lane->tail);
+    record->enqueued_ns = monotonic_ns();
+    record->size = (uint32_t) size;
+    memcpy(lane->data + lane->tail + sizeof(struct lane_record), event, event_size);
+    lane->tail += size;
+
+    uint64_t depth = __atomic_add_fetch(&lane->stats.depth, 1, __ATOMIC_RELAXED);
+    if (depth > __atomic_load_n(&lane->stats.max_depth, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&lane->stats.max_depth, depth, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+}
+
+size_t lanes_pending() {
+    return __atomic_load_n(&pending, __ATOMIC_RELAXED);
+}
+
+// Dispatches up to budget queued events. Lanes are visited from highest to lowest in rounds, each lane dispatching up
+// to its weight per round, so busy low lanes still make progress without holding up the higher ones.
+void lanes_dispatch(size_t budget, void (*deliver)(const struct inotify_event*)) {
+    while (lanes_pending() > 0 && budget > 0) {
+        for (int lane_index = LANE_COUNT - 1; lane_index >= 0 && budget > 0; lane_index--) {
+            struct lane* lane = &lanes[lane_index];
+            uint32_t quota = __atomic_load_n(&lane->stats.weight, __ATOMIC_RELAXED);
+
+            for (; quota > 0 && budget > 0 && lane->head < lane->tail; quota--, budget--) {
+                struct lane_record* record = (struct lane_record*) (lane->data + lane->head);
+                const struct inotify_event* event = (const struct inotify_event*) (lane->data + lane->head + sizeof(struct lane_record));
+
+                uint64_t latency = (uint64_t) (monotonic_ns() - record->enqueued_ns);
+                __atomic_add_fetch(&lane->stats.total_latency_ns, latency, __ATOMIC_RELAXED);
+                if (latency > __atomic_load_n(&lane->stats.max_latency_ns, __ATOMIC_RELAXED)) {
+                    __atomic_store_n(&lane->stats.max_latency_ns, latency, __ATOMIC_RELAXED);
+                }
+
+                deliver(event);
+
+                lane->head += record->size;
+                __atomic_sub_fetch(&lane->stats.depth, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&lane->stats.dispatched, 1, __ATOMIC_RELAXED);
+                __atomic_sub_fetch(&pending, 1, __ATOMIC_RELAXED);
+            }
+
+            if (lane->head == lane->tail) {
+                lane->head = 0;
+                lane->tail = 0;
+            }
+        }
+    }
+}
+
+// Sets how many events a lane dispatches per round. Returns 0 on success, -1 if the lane or weight is invalid.
+int lanes_set_weight(int lane, int weight) {
+    if (lane < 0 || lane >= LANE_COUNT || weight < 1) {
+        return -1;
+    }
+
+    __atomic_store_n(&lanes[lane].stats.weight, (uint32_t) weight, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Copies a lane's counters into stats. Returns 0 on success, -1 if the lane is invalid.
+int lanes_get_stats(int lane, struct lane_stats* stats) {
+    if (lane < 0 || lane >= LANE_COUNT) {
+        return -1;
+    }
+
+    struct lane_stats* source = &lanes[lane].stats;
+    stats->depth = __atomic_load_n(&source->depth, __ATOMIC_RELAXED);
+    stats->max_depth = __atomic_load_n(&source->max_depth, __ATOMIC_RELAXED);
+    stats->dispatched = __atomic_load_n(&source->dispatched, __ATOMIC_RELAXED);
+    stats->total_latency_ns = __atomic_load_n(&source->total_latency_ns, __ATOMIC_RELAXED);
+    stats->max_latency_ns = __atomic_load_n(&source->max_latency_ns, __ATOMIC_RELAXED);
+    stats->weight = __atomic_load_n(&source->weight, __ATOMIC_RELAXED);
+    return 0;
+}
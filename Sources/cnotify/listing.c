@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "listing.h"
+#include "hashtable.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define MIN_CAPACITY 16
+#define GETDENTS_BUFFER_SIZE 32768
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Queries only take the read lock, so any number of threads can list at once; the notifier thread takes the write lock
+// to apply events, and a rescan holds it while it reads the directory so no event can slip between the two
+static struct dir_listing* listings = NULL;
+static int listing_count_total = 0;
+static pthread_rwlock_t listing_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Must be called with listing_lock held. Returns the slot holding name, or the empty slot it would go in.
+static size_t find_slot(const struct dir_listing* listing, uint64_t hash, const char* name) {
+    size_t mask = listing->capacity - 1;
+    size_t slot = (size_t) hash & mask;
+
+    while (listing->slots[slot].name != NULL && (listing->slots[slot].hash != hash || strcmp(listing->slots[slot].name, name) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static void clear_slots(struct dir_listing* listing) {
+    for (size_t i = 0; i < listing->capacity; i++) {
+        free(listing->slots[i].name);
+    }
+
+    free(listing->slots);
+    listing->slots = NULL;
+    listing->capacity = 0;
+    listing->count = 0;
+}
+
+static int resize(struct dir_listing* listing, size_t capacity) {
+    struct listing_entry* slots = (struct listing_entry*) calloc(capacity, sizeof(struct listing_entry));
+    if (slots == NULL) {
+        return -1;
+    }
+
+    struct listing_entry* previous = listing->slots;
+    size_t previous_capacity = listing->capacity;
+    listing->slots = slots;
+    listing->capacity = capacity;
+
+    for (size_t i = 0; i < previous_capacity; i++) {
+        if (previous[i].name != NULL) {
+            listing->slots[find_slot(listing, previous[i].hash, previous[i].name)] = previous[i];
+        }
+    }
+
+    free(previous);
+    return 0;
+}
+
+// Adding a name that's already there only updates whether it's a directory, so replaying an event is harmless
+static void add_name(struct dir_listing* listing, const char* name, int is_directory) {
+    // Kept at most half full, so probes stay short
+    if ((listing->count + 1) * 2 > listing->capacity && resize(listing, listing->capacity ? listing->capacity * 2 : MIN_CAPACITY) != 0) {
+        listing->stale = 1; // Couldn't keep up; read it fresh next time
+        return;
+    }
+
+    uint64_t hash = name_hash64(name);
+    struct listing_entry* entry = &listing->slots[find_slot(listing, hash, name)];
+
+    if (entry->name == NULL) {
+        entry->name = strdup(name);
+        if (entry->name == NULL) {
+            listing->stale = 1;
+            return;
+        }
+
+        entry->hash = hash;
+        listing->count++;
+    }
+
+    entry->is_directory = is_directory;
+}
+
+static int slot_hash_at(void* context, size_t slot, uint64_t* hash) {
+    struct dir_listing* listing = (struct dir_listing*) context;
+
+    if (listing->slots[slot].name == NULL) {
+        return 0;
+    }
+
+    *hash = listing->slots[slot].hash;
+    return 1;
+}
+
+static void slot_move(void* context, size_t from, size_t to) {
+    struct dir_listing* listing = (struct dir_listing*) context;
+    listing->slots[to] = listing->slots[from];
+    listing->slots[from].name = NULL;
+}
+
+static void remove_name(struct dir_listing* listing, const char* name) {
+    if (listing->capacity == 0) {
+        return;
+    }
+
+    size_t slot = find_slot(listing, name_hash64(name), name);
+    if (listing->slots[slot].name == NULL) {
+        return;
+    }
+
+    free(listing->slots[slot].name);
+    listing->slots[slot].name = NULL;
+    listing->count--;
+
+    struct probe_table table = { listing, listing->capacity - 1, slot_hash_at, slot_move };
+    table_backshift(&table, slot);
+}
+
+// Must be called with the write lock held. Rereads the directory with getdents64; d_type saves a stat per entry on
+// filesystems that fill it in. Returns 0 on success.
+static int scan(struct dir_listing* listing) {
+    char path[4096];
+    if (watch_table_path(listing->wd, path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    clear_slots(listing);
+    listing->stale = 0;
+
+    char buffer[GETDENTS_BUFFER_SIZE];
+    long length;
+
+    while ((length = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+        for (long offset = 0; offset < length;) {
+            struct linux_dirent64* dirent = (struct linux_dirent64*) (buffer + offset);
+            offset += dirent->d_reclen;
+
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            int is_directory = dirent->d_type == DT_DIR;
+            if (dirent->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_directory = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+
+            add_name(listing, name, is_directory);
+        }
+    }
+
+    close(fd);
+
+    if (length < 0) {
+        listing->stale = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Starts caching wd's entries. The listing starts out stale; listing_refresh reads it once the watch reports
+// LISTING_EVENTS. Returns 0 on success.
+int listing_track(int wd) {
+    pthread_rwlock_wrlock(&listing_lock);
+
+    struct dir_listing* listing;
+    HASH_FIND_INT(listings, &wd, listing);
+
+    if (listing == NULL) {
+        listing = (struct dir_listing*) calloc(1, sizeof(struct dir_listing));
+        if (listing == NULL) {
+            pthread_rwlock_unlock(&listing_lock);
+            return -1;
+        }
+
+        listing->wd = wd;
+        listing->stale = 1;
+        HASH_ADD_INT(listings, wd, listing);
+        __atomic_add_fetch(&listing_count_total, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_rwlock_unlock(&listing_lock);
+    return 0;
+}
+
+void listing_untrack(int wd) {
+    if (!listing_active()) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&listing_lock);
+
+    struct dir_listing* listing;
+    HASH_FIND_INT(listings, &wd, listing);
+
+    if (listing) {
+        HASH_DEL(listings, listing);
+        clear_slots(listing);
+        free(listing);
+        __atomic_sub_fetch(&listing_count_total, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_rwlock_unlock(&listing_lock);
+}
+
+int listing_tracked(int wd) {
+    if (!listing_active()) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&listing_lock);
+
+    struct dir_listing* listing;
+    HASH_FIND_INT(listings, &wd, listing);
+
+    pthread_rwlock_unlock(&listing_lock);
+    return listing != NULL;
+}
+
+int listing_active() {
+    return __atomic_load_n(&listing_count_total, __ATOMIC_RELAXED) > 0;
+}
+
+// Rereads wd's directory now. Returns 0 on success, -1 if it isn't cached or couldn't be read.
+int listing_refresh(int wd) {
+    pthread_rwlock_wrlock(&listing_lock);
+
+    struct dir_listing* listing;
+    HASH_FIND_INT(listings, &wd, listing);
+    int result = listing ? scan(listing) : -1;
+
+    pthread_rwlock_unlock(&listing_lock);
+    return result;
+}
+
+// Applies an event to its directory's listing. A rate limit only decides which callbacks run, so the listing takes in
+// events it sheds as well. A queue overflow means events were lost, so every listing is reread before it's next queried.
+void listing_record(const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        pthread_rwlock_wrlock(&listing_lock);
+        for (struct dir_listing* listing = listings; listing != NULL; listing = listing->hh.next) {
+            listing->stale = 1;
+        }
+        pthread_rwlock_unlock(&listing_lock);
+        return;
+    }
+
+    if (event->wd < 0 || event->len == 0 || event->name[0] == '\0' || !(event->mask & LISTING_EVENTS)) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&listing_lock);
+
+    struct dir_listing* listing;
+    HASH_FIND_INT(listings, &event->wd, listing);
+
+    // A stale listing is read from scratch anyway
+    if (listing && !listing->stale) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            add_name(listing, event->name, (event->mask & IN_ISDIR) != 0);
+        }
+        else {
+            remove_name(listing, event->name);
+        }
+    }
+
+    pthread_rwlock_unlock(&listing_lock);
+}
+
+// Takes the read lock on wd's listing, rereading it first if it's stale. Returns NULL (with no lock held) if wd isn't
+// cached or couldn't be reread.
+static struct dir_listing* lock_listing(int wd) {
+    struct dir_listing* listing;
+
+    pthread_rwlock_rdlock(&listing_lock);
+    HASH_FIND_INT(listings, &wd, listing);
+
+    if (listing && !listing->stale) {
+        return listing;
+    }
+
+    pthread_rwlock_unlock(&listing_lock);
+
+    if (listing == NULL || listing_refresh(wd) != 0) {
+        return NULL;
+    }
+
+    // Something may have removed it between the two locks
+    return lock_listing(wd);
+}
+
+// Returns how many entries wd's directory has, or -1 if it isn't cached
+long listing_count(int wd) {
+    struct dir_listing* listing = lock_listing(wd);
+    if (listing == NULL) {
+        return -1;
+    }
+
+    long count = (long) listing->count;
+    pthread_rwlock_unlock(&listing_lock);
+    return count;
+}
+
+// Returns 1 if wd's directory has an entry called name, 0 if not, or -1 if it isn't cached
+int listing_contains(int wd, const char* name) {
+    struct dir_listing* listing = lock_listing(wd);
+    if (listing == NULL) {
+        return -1;
+    }
+
+    int found = listing->capacity > 0 && listing->slots[find_slot(listing, name_hash64(name), name)].name != NULL;
+    pthread_rwlock_unlock(&listing_lock);
+    return found;
+}
+
+// Copies the names in wd's directory into a malloc'd buffer of NUL-terminated names, in no particular order, which the
+// caller frees. Returns how many names there are, or -1 if it isn't cached.
+long listing_names(int wd, char** names, size_t* length) {
+    struct dir_listing* listing = lock_listing(wd);
+    if (listing == NULL) {
+        return -1;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < listing->capacity; i++) {
+        if (listing->slots[i].name != NULL) {
+            total += strlen(listing->slots[i].name) + 1;
+        }
+    }
+
+    char* buffer = (char*) malloc(total > 0 ? total : 1);
+    if (buffer == NULL) {
+        pthread_rwlock_unlock(&listing_lock);
+        return -1;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < listing->capacity; i++) {
+        if (listing->slots[i].name != NULL) {
+            size_t name_length = strlen(listing->slots[i].name) + 1;
+            memcpy(buffer + used, listing->slots[i].name, name_length);
+            used += name_length;
+        }
+    }
+
+    long count = (long) listing->count;
+    pthread_rwlock_unlock(&listing_lock);
+
+    *names = buffer;
+    *length = used;
+    return count;
+}
+
+// Forgets every listing
+void listing_stop() {
+    pthread_rwlock_wrlock(&listing_lock);
+
+    struct dir_listing *current, *tmp;
+    HASH_ITER(hh, listings, current, tmp) {
+        HASH_DEL(listings, current);
+        clear_slots(current);
+        free(current);
+    }
+    __atomic_store_n(&listing_count_total, 0, __ATOMIC_RELAXED);
+
+    pthread_rwlock_unlock(&listing_lock);
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 #include "moveevents.h"
@@ -9,6 +10,9 @@
 int tracked_count = 0;
 struct move_event* move_events = NULL;
 
+// Moves are tracked and matched from the callback workers as well as the notifier thread
+static pthread_mutex_t move_events_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void track_event(uint32_t wd, uint32_t cookie, const char* name) {
     struct move_event* new_event = (struct move_event*) malloc(sizeof(struct move_event));
     if (new_event == NULL) {
@@ -17,15 +21,21 @@ void track_event(uint32_t wd, uint32_t cookie, const char* name) {
 
     new_event->wd = wd;
     new_event->cookie = cookie;
-    new_event->timestamp = get_current_time_millis();
+    new_event->timestamp = clock_millis();
     terminated_strncpy(new_event->name, name, 1024);
 
+    pthread_mutex_lock(&move_events_lock);
     HASH_ADD_INT(move_events, cookie, new_event);
-    tracked_count++;
+    __atomic_add_fetch(&tracked_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&move_events_lock);
 }
 
-int find_and_remove_event(uint32_t cookie, char* matched_name) {
+// Takes the move that cookie's IN_MOVED_FROM left, if it's still waiting, copying out its name and the watch it was
+// moved out of (which may not be the IN_MOVED_TO's). Returns 1 if there was one.
+int find_and_remove_event(uint32_t cookie, char* matched_name, int* matched_wd) {
     struct move_event* found_event;
+
+    pthread_mutex_lock(&move_events_lock);
     HASH_FIND_INT(move_events, &cookie, found_event);
 
     if (found_event) {
@@ -33,17 +43,80 @@ int find_and_remove_event(uint32_t cookie, char* matched_name) {
             terminated_strncpy(matched_name, found_event->name, 1024);
         }
 
+        if (matched_wd != NULL) {
+            *matched_wd = (int) found_event->wd;
+        }
+
         remove_event(found_event);
-        return 1;
     }
 
-    return 0;
+    pthread_mutex_unlock(&move_events_lock);
+    return found_event != NULL;
 }
 
+// Must be called with move_events_lock held
 void remove_event(struct move_event* event) {
     if (event) {
         HASH_DEL(move_events, event);
         free(event);
-        tracked_count--;
+        __atomic_sub_fetch(&tracked_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Removes every move that has waited longer than max_age milliseconds for its IN_MOVED_TO, and calls expired for each.
+// The callback runs after the lock is released.
+void expire_events(long long max_age, void (*expired)(const char*, int)) {
+    long long now = clock_millis();
+    struct move_event* expired_events = NULL;
+    struct move_event *current, *tmp;
+
+    pthread_mutex_lock(&move_events_lock);
+    HASH_ITER(hh, move_events, current, tmp) {
+        if (now - current->timestamp > max_age) {
+            HASH_DEL(move_events, current);
+            __atomic_sub_fetch(&tracked_count, 1, __ATOMIC_RELAXED);
+
+            current->hh.next = expired_events; // Reused as a plain list link once it's out of the table
+            expired_events = current;
+        }
     }
+    pthread_mutex_unlock(&move_events_lock);
+
+    while (expired_events) {
+        struct move_event* next = (struct move_event*) expired_events->hh.next;
+        if (expired) {
+            expired(expired_events->name, expired_events->wd);
+        }
+        free(expired_events);
+        expired_events = next;
+    }
+}
+
+// Returns how many milliseconds until the oldest tracked move has waited longer than max_age, or -1 if there are none
+long long move_events_timeout(long long max_age) {
+    long long timeout = -1;
+    struct move_event *current, *tmp;
+
+    pthread_mutex_lock(&move_events_lock);
+    if (move_events) {
+        long long oldest = move_events->timestamp;
+        HASH_ITER(hh, move_events, current, tmp) {
+            oldest = current->timestamp < oldest ? current->timestamp : oldest;
+        }
+
+        timeout = oldest + max_age + 1 - clock_millis();
+        timeout = timeout < 0 ? 0 : timeout;
+    }
+    pthread_mutex_unlock(&move_events_lock);
+
+    return timeout;
+}
+
+// Returns how many bytes the moves waiting for their IN_MOVED_TO take up
+size_t move_table_memory() {
+    pthread_mutex_lock(&move_events_lock);
+    size_t bytes = HASH_OVERHEAD(hh, move_events) + (move_events ? HASH_COUNT(move_events) * (sizeof(struct move_event) - sizeof(UT_hash_handle)) : 0);
+    pthread_mutex_unlock(&move_events_lock);
+
+    return bytes;
 }
@@ -1,17 +1,52 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/inotify.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include "util.h"
 #include "notify.h"
 #include "types.h"
 #include "moveevents.h"
+#include "watches.h"
+#include "dispatch.h"
+#include "snapshot.h"
+#include "budget.h"
+#include "poller.h"
+#include "executor.h"
+#include "lanes.h"
+#include "ratelimit.h"
+#include "recorder.h"
+#include "source.h"
+#include "shmring.h"
+#include "subtree.h"
+#include "changeset.h"
+#include "heavy.h"
+#include "warm.h"
+#include "delta.h"
+#include "listing.h"
+#include "statcache.h"
+#include "filewatch.h"
+#include "fingerprint.h"
 
 struct callback_collection callbacks = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
     NULL,
     NULL,
     NULL,
@@ -20,9 +55,56 @@ struct callback_collection callbacks = {
     NULL
 };
 
+// Events dispatched from the priority lanes between reads from the kernel
+#define LANE_DISPATCH_BUDGET 256
+
+// How long an IN_MOVED_FROM waits for its IN_MOVED_TO before it's dispatched as moved out of the watched directory
+#define MOVE_EXPIRY_MS 500
+
 static int inotify_fd = -1;
 static int initialized = 0;
 static pthread_t thread_id = -1;
+static int thread_running = 0;
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_stopped = PTHREAD_COND_INITIALIZER;
+
+// In pump mode there's no notifier thread; the host polls pump_fd (an epoll set of the source and wake_fd) and calls
+// notifier_process from its own loop
+static int pumping = 0;
+static int pump_fd = -1;
+static int pump_source_fd = -1;
+static pthread_mutex_t pump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// notifier_process runs callbacks without holding pump_lock, so they can call back into the pump. These say which thread
+// is in the middle of a turn; other threads wait for it to finish, and that thread's own callbacks can't start another.
+static int processing = 0;
+static pthread_t processing_thread;
+static int stop_after_processing = 0;
+static pthread_cond_t processing_done = PTHREAD_COND_INITIALIZER;
+
+// Records read from the source but not yet routed. Only a pump call with a limit stops partway through a read.
+static char read_buffer[65536]; // Large enough that a backlog moves onto the priority lanes, where high-priority events can get ahead of it
+static size_t read_offset = 0;
+static size_t read_length = 0;
+static int read_kernel_wds = 1;
+
+// Events produced outside of inotify (i.e. by the poller) are queued here and dispatched on the notifier thread
+static int wake_fd = -1;
+static char* injected = NULL;
+static size_t injected_length = 0;
+static size_t injected_capacity = 0;
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Injected records taken off the queue, being routed
+static char* taken = NULL;
+static size_t taken_offset = 0;
+static size_t taken_length = 0;
+
+// Watches the kernel has dropped, kept in the table until the events queued ahead of their IN_IGNORED are dispatched.
+// Only touched by whichever thread is routing records.
+static int* dropped = NULL;
+static size_t dropped_count = 0;
+static size_t dropped_capacity = 0;
 
 int notifier_init() {
     if (initialized) return 0;
@@ -34,28 +116,342 @@ int notifier_init() {
         return -1;
     }
 
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (wake_fd < 0) {
+        return -1;
+    }
+
+    budget_init();
     return 0;
 }
 
+int notifier_fd() {
+    return inotify_fd;
+}
+
+// Queues inotify_event records to be dispatched on the notifier thread as if they had been read from the kernel.
+// Records must already carry stable watch ids rather than inotify wds.
+void notifier_inject(const char* records, size_t length) {
+    pthread_mutex_lock(&inject_lock);
+
+    if (injected_length + length > injected_capacity) {
+        size_t capacity = injected_capacity ? injected_capacity : 4096;
+        while (capacity < injected_length + length) {
+            capacity *= 2;
+        }
+
+        char* grown = (char*) realloc(injected, capacity);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&inject_lock);
+            return;
+        }
+
+        injected = grown;
+        injected_capacity = capacity;
+    }
+
+    memcpy(injected + injected_length, records, length);
+    injected_length += length;
+    pthread_mutex_unlock(&inject_lock);
+
+    notifier_wake();
+}
+
+// Queues a single record built from its fields, for producers that hand back one event at a time
+void notifier_inject_event(int wd, uint32_t mask, uint32_t cookie, const char* name) {
+    size_t name_length = strlen(name);
+    // Padded like the kernel's records so the next one stays aligned
+    size_t padded = name_length == 0 ? 0 : (name_length + 1 + sizeof(struct inotify_event) - 1) & ~(sizeof(struct inotify_event) - 1);
+    union {
+        struct inotify_event event;
+        char bytes[sizeof(struct inotify_event) * 2 + NAME_MAX + 1];
+    } record;
+    struct inotify_event* event = &record.event;
+
+    if (name_length > NAME_MAX) {
+        return;
+    }
+
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = (uint32_t) padded;
+    memset(event->name, 0, padded);
+    memcpy(event->name, name, name_length);
+
+    notifier_inject(record.bytes, sizeof(struct inotify_event) + padded);
+}
+
+// Wakes the notifier thread, or makes the pump descriptor readable, so it takes another turn
+void notifier_wake() {
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "[SWNotify] Failed to wake notifier thread: %s\n", strerror(errno));
+    }
+}
+
+// Whether injected events are being taken off the queue without the caller's help: the notifier thread is running, and
+// isn't the caller. In pump mode nothing drains them until the host next calls notifier_process.
+int notifier_draining() {
+    pthread_mutex_lock(&thread_lock);
+    int draining = thread_running && !pthread_equal(pthread_self(), thread_id);
+    pthread_mutex_unlock(&thread_lock);
+    return draining;
+}
+
+// Returns how many bytes of injected events are waiting for the notifier thread
+size_t notifier_injected_backlog() {
+    pthread_mutex_lock(&inject_lock);
+    size_t length = injected_length;
+    pthread_mutex_unlock(&inject_lock);
+
+    return length;
+}
+
+// Returns the watch's id, or a negative error code. Watches over budget are polled rather than failing.
 int add_watch(const char* filepath, int flags) {
-    int watch = inotify_add_watch(inotify_fd, filepath, flags);
-
-    if (watch < 0) {
-        switch (errno) {
-            case ENOENT: // Directory doesn't exist
-                return -1;
-            case EACCES: // Permission denied
-                return -2;
-            default: // No idea what happened, but it isn't good.
-                return -3;
+    return budget_add_watch(filepath, flags);
+}
+
+// Like add_watch, but for a single file rather than a directory; see filewatch_add. Returns the watch's id, or a
+// negative error code (-4 if the path is a directory).
+int add_file_watch(const char* filepath, int flags) {
+    return filewatch_add(filepath, flags);
+}
+
+// Sets which lane a watch's events are dispatched from (LANE_LOW, LANE_NORMAL or LANE_HIGH). Returns 0 on success.
+int set_watch_priority(int watch, int priority) {
+    if (priority < 0 || priority >= LANE_COUNT || watch_table_set_priority(watch, priority) != 0) {
+        return -1;
+    }
+
+    if (priority != LANE_NORMAL) {
+        lanes_activate();
+    }
+
+    return 0;
+}
+
+// Has an inotify watch report what watch_wanted_flags says it needs after a feature was turned on or off for it
+static int update_kernel_flags(int watch, int kernel_wd) {
+    char path[PATH_MAX];
+    if (kernel_wd < 0 || watch_table_path(watch, path, sizeof(path)) != 0) {
+        return 0; // Polled watches pick up the change on their next scan
+    }
+
+    return inotify_add_watch(inotify_fd, path, watch_wanted_flags(watch)) < 0 ? -1 : 0;
+}
+
+// Warms up to max_bytes of each file in the watch's directory whenever it's opened or finished being written, so
+// readers that come after find it in the page cache. A max_bytes of 0 stops. The kernel watch reports WARM_EVENTS from
+// then on; dispatch keeps them from callbacks that didn't ask for them. The worker's own open shows up as an IN_OPEN and
+// IN_CLOSE_NOWRITE in the directory, so callbacks that did ask for those see it too. Returns 0 on success.
+int set_watch_warming(int watch, long long max_bytes) {
+    int kernel_wd = watch_table_kernel_wd(watch);
+    if (kernel_wd == -2 || warm_set_limit(watch, max_bytes) != 0) {
+        return -1;
+    }
+
+    if (update_kernel_flags(watch, kernel_wd) != 0) {
+        warm_set_limit(watch, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Keeps an in-memory copy of the watch's directory entries, read once and then kept current from its events, for
+// listing_count, listing_contains and listing_names. Returns 0 on success.
+int set_watch_listing(int watch, int enabled) {
+    int kernel_wd = watch_table_kernel_wd(watch);
+    if (kernel_wd == -2) {
+        return -1;
+    }
+
+    if (!enabled) {
+        listing_untrack(watch);
+        return update_kernel_flags(watch, kernel_wd);
+    }
+
+    // Read only once the watch reports the events that keep it current, so nothing falls between the two
+    if (listing_track(watch) != 0 || update_kernel_flags(watch, kernel_wd) != 0 || listing_refresh(watch) != 0) {
+        listing_untrack(watch);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Caches the attributes of files in the watch's directory as they're looked up with statcache_lookup, until an event
+// says they changed. Returns 0 on success.
+int set_watch_stat_cache(int watch, int enabled) {
+    int kernel_wd = watch_table_kernel_wd(watch);
+    if (kernel_wd == -2) {
+        return -1;
+    }
+
+    if (!enabled) {
+        statcache_untrack(watch);
+        return update_kernel_flags(watch, kernel_wd);
+    }
+
+    if (statcache_track(watch) != 0 || update_kernel_flags(watch, kernel_wd) != 0) {
+        statcache_untrack(watch);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Like add_watch, but the directory is always polled, never given an inotify watch. For filesystems where inotify
+// doesn't see remote changes (NFS, FUSE, some container mounts), or where the caller would rather not spend watches.
+int add_watch_polling(const char* filepath, int flags) {
+    return add_polled_watch(filepath, flags, 1);
+}
+
+// Like add_watch, but the directory's events come from the shared-memory ring this process is subscribed to, not from
+// the kernel. Watches are matched to the publisher's by resolved path. Returns the watch's id or an error code.
+int add_watch_subscribed(const char* filepath, int flags) {
+    char resolved[PATH_MAX];
+    if (realpath(filepath, resolved) == NULL) {
+        return watch_error_code(errno);
+    }
+
+    int wd = watch_table_add(-3, resolved, flags);
+    return wd < 0 ? -3 : wd;
+}
+
+// add_watches for a process subscribed to the shared-memory ring: every path is added with add_watch_subscribed, so no
+// kernel watches are created and nothing is heard twice. Non-directories are -4. Returns the number of watches added.
+int add_watches_subscribed(const char** filepaths, int count, int flags, int* results) {
+    int added = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        if (stat(filepaths[i], &st) != 0) {
+            results[i] = watch_error_code(errno);
         }
+        else if (!S_ISDIR(st.st_mode)) {
+            results[i] = -4;
+        }
+        else {
+            results[i] = add_watch_subscribed(filepaths[i], flags);
+        }
+
+        if (results[i] >= 0) {
+            added++;
+        }
+    }
+
+    return added;
+}
+
+// Adds a watch for every path in filepaths, writing each one's id (or add_watch's error code) to results.
+// IN_ONLYDIR has the kernel reject non-directories as part of the same syscall, so there's no separate stat per path.
+// Returns the number of watches that were added.
+int add_watches(const char** filepaths, int count, int flags, int* results) {
+    flags |= IN_ONLYDIR;
+    int kernel_flags = watch_kernel_flags(flags);
+    int room = budget_room();
+    int added = 0;
+    int i = 0;
+
+    // Straight to the kernel while there's room in the budget, then into the watch table in one pass
+    for (; i < count && i < room; i++) {
+        int watch = inotify_add_watch(inotify_fd, filepaths[i], kernel_flags);
+
+        if (watch < 0 && errno == ENOSPC) {
+            break;
+        }
+
+        results[i] = watch < 0 ? watch_error_code(errno) : watch;
+    }
+
+    watch_table_add_all(results, filepaths, i, flags);
+
+    // Out of room: the rest go through the budget manager, which demotes cold watches or falls back to polling
+    for (; i < count; i++) {
+        results[i] = budget_add_watch(filepaths[i], flags);
     }
 
-    return watch;
+    for (i = 0; i < count; i++) {
+        if (results[i] >= 0) {
+            added++;
+        }
+    }
+
+    return added;
+}
+
+// Drops everything kept for a watch once its kernel watch (if it had one) is gone
+static void forget_watch(int watch, int kernel_wd) {
+    if (kernel_wd == -1) {
+        poller_remove(watch, 0);
+    }
+
+    snapshot_untrack(watch);
+    ratelimit_remove(watch);
+    subtree_forget(watch);
+    heavy_forget(watch);
+    warm_forget(watch);
+    listing_untrack(watch);
+    statcache_untrack(watch);
+    filewatch_forget(watch);
+    watch_table_remove(watch);
+}
+
+// Forgets the watches the kernel has dropped once nothing is left on the lanes or with the workers that could still be
+// about them, or straight away if force is set
+static void forget_dropped(int force) {
+    if (dropped_count == 0 || (!force && (lanes_pending() > 0 || executor_pending() > 0))) {
+        return;
+    }
+
+    for (size_t i = 0; i < dropped_count; i++) {
+        // Unless it was removed (or watched again) in the meantime
+        if (watch_table_kernel_wd(dropped[i]) == -4) {
+            forget_watch(dropped[i], -4);
+        }
+    }
+
+    dropped_count = 0;
+}
+
+// The kernel has dropped the watch. It's taken off its kernel wd straight away, since the kernel can hand that out again,
+// but everything else is only forgotten once the events ahead of it have been dispatched.
+static void drop_watch(int watch) {
+    watch_table_set_kernel_wd(watch, -4);
+
+    if (dropped_count == dropped_capacity) {
+        size_t capacity = dropped_capacity ? dropped_capacity * 2 : 16;
+        int* grown = (int*) realloc(dropped, capacity * sizeof(int));
+
+        if (grown == NULL) {
+            forget_watch(watch, -4);
+            return;
+        }
+
+        dropped = grown;
+        dropped_capacity = capacity;
+    }
+
+    dropped[dropped_count++] = watch;
 }
 
 int remove_watch(int watch) {
-    return inotify_rm_watch(inotify_fd, watch);
+    int kernel_wd = watch_table_kernel_wd(watch);
+
+    if (kernel_wd == -2) { // Not ours
+        return -1;
+    }
+
+    if (kernel_wd >= 0 && inotify_rm_watch(inotify_fd, kernel_wd) != 0) {
+        return -1;
+    }
+
+    forget_watch(watch, kernel_wd);
+    return 0;
 }
 
 int set_callback(void (*callback)(const char*, int), int flag) {
@@ -75,6 +471,21 @@ int set_callback(void (*callback)(const char*, int), int flag) {
         case IN_MOVED_TO:
             callbacks.move_to = callback;
             break;
+        case IN_CLOSE_WRITE:
+            callbacks.close_write = callback;
+            break;
+        case IN_ATTRIB:
+            callbacks.attrib = callback;
+            break;
+        case IN_OPEN:
+            callbacks.open = callback;
+            break;
+        case IN_DELETE_SELF:
+            callbacks.delete_self = callback;
+            break;
+        case IN_MOVE_SELF:
+            callbacks.move_self = callback;
+            break;
         default:
             return -1;
     }
@@ -83,106 +494,503 @@ int set_callback(void (*callback)(const char*, int), int flag) {
 }
 
 // Separate function for rename callback because it has a different signature
-int set_rename_callback(void (*callback)(const char*, const char*, int)) {
+int set_rename_callback(void (*callback)(const char*, int, const char*, int)) {
     callbacks.rename = callback;
     return 0;
 }
 
-static void* handle_events(void* _vargp) {
-    char buf[4096];
-    ssize_t length;
-    struct pollfd fds[1];
+// Called once per event with the complete mask, so combined bits like IN_ISDIR aren't lost
+int set_event_callback(void (*callback)(const char*, int, uint32_t)) {
+    callbacks.event = callback;
+    return 0;
+}
 
-    fds[0].fd = inotify_fd;
-    fds[0].events = POLLIN;
+// Called with the number of events a coalescing rate limit shed since its last report
+int set_suppressed_callback(void (*callback)(int, uint64_t)) {
+    callbacks.suppressed = callback;
+    return 0;
+}
 
-    while (1) {
-        int ret = poll(fds, 1, 250); // 1 descriptor, 250ms timeout
+int set_subtree_callback(void (*callback)(int, const char*, int, uint32_t)) {
+    callbacks.subtree = callback;
+    return 0;
+}
 
-        // Something went wrong with poll
-        if (ret < 0) {
-            fprintf(stderr, "[SWNotify] Error when polling descriptor: %s\n", strerror(errno));
-            continue;
-        }
+int set_changeset_callback(void (*callback)(const struct changeset_change*, int)) {
+    callbacks.changeset = callback;
+    return 0;
+}
+
+// Called from the delta workers with the byte ranges of a file that changed since its last close-write
+int set_delta_callback(void (*callback)(const char*, int, const struct delta_range*, int, long long, long long)) {
+    callbacks.delta = callback;
+    return 0;
+}
+
+// Limits a watch to rate events per second with bursts of up to burst, shedding the rest according to policy
+// (RATE_LIMIT_DROP, RATE_LIMIT_COALESCE or RATE_LIMIT_SAMPLE). A rate of 0 removes the limit. Returns 0 on success.
+int set_rate_limit(int watch, double rate, int burst, int policy, int sample_every) {
+    if (watch_table_kernel_wd(watch) == -2) {
+        return -1;
+    }
+
+    return ratelimit_set(watch, rate, burst, policy, sample_every);
+}
+
+// Hands an event to the callback workers if there are any, or dispatches it here
+static void deliver_event(const struct inotify_event* event) {
+    if (!executor_submit(event)) {
+        dispatch_event(event);
+    }
+}
+
+// Queues the event on its watch's priority lane if any watch has a priority, or delivers it straight away
+static void queue_event(const struct inotify_event* event) {
+    if (lanes_active()) {
+        lanes_enqueue(event, event->wd >= 0 ? watch_table_priority(event->wd) : LANE_HIGH);
+    }
+    else {
+        deliver_event(event);
+    }
+}
+
+// Records the event if a recording is running, publishes it to subscribers, counts it towards the busiest directories
+// and files, and applies it to its directory's listing and stat caches. Then drops events over their watch's rate limit,
+// and queues the rest. Events the fingerprint workers hand back were through all of that the first time round.
+static void route_event(const struct inotify_event* event) {
+    if (event->mask & FINGERPRINT_CHECKED) {
+        queue_event(event);
+        return;
+    }
+
+    recorder_record(event);
+    shmring_publish(event);
+    heavy_record(event);
 
-        // Check for, dispatch, and remove any IN_MOVE_FROM events that need to be dispatched to Swift
-        // An event will be dispatched if it has been in tracked_events for more than 500ms
-        if (tracked_count > 0) {
-            long long now = get_current_time_millis();
-
-            for (struct move_event* current = move_events; current != NULL;) {
-                if (now - current->timestamp > 500) {
-                    if (callbacks.move_from) {
-                        callbacks.move_from(current->name, current->wd);
-                    }
-
-                    struct move_event* tmp = current;
-                    current = current->hh.next;
-                    remove_event(tmp);
-                }
-                else {
-                    current = current->hh.next;
-                }
+    if (listing_active()) {
+        listing_record(event);
+    }
+
+    if (statcache_active()) {
+        statcache_record(event);
+    }
+
+    if (snapshot_enabled() && event->wd >= 0) {
+        snapshot_record(event->wd, event->len > 0 ? event->name : "", event->mask & IN_ALL_EVENTS);
+    }
+
+    if (!ratelimit_admit(event)) { // Shed before it costs anything further
+        return;
+    }
+
+    queue_event(event);
+}
+
+// Routes the records in buffer from *offset on until length, or until budget of them have been routed. Records from the
+// kernel carry inotify wds, which are translated into watch ids first. Returns how many records were used up.
+static int route_records(char* buffer, size_t* offset, size_t length, int kernel_wds, int budget) {
+    int used = 0;
+
+    while (*offset < length && used < budget) {
+        struct inotify_event* event = (struct inotify_event*) (buffer + *offset);
+        *offset += sizeof(struct inotify_event) + event->len;
+        used++;
+
+        // The kernel's wd becomes the watch's stable id. Events for watches that were just moved to the poller are dropped;
+        // the poller took its first scan before the watch was removed, so it reports them instead.
+        int wd = event->wd < 0 || !kernel_wds ? event->wd : watch_table_resolve(event->wd);
+        if (wd >= 0 || !(event->mask & IN_ALL_EVENTS)) {
+            event->wd = wd;
+            uint32_t replaced = kernel_wds && filewatch_active() ? filewatch_record(event) : 0;
+            route_event(event);
+
+            // A watched file's path now leads to another file; reported as if it had been rewritten in place
+            if (replaced) {
+                struct inotify_event record = { .wd = wd, .mask = replaced, .cookie = 0, .len = 0 };
+                route_event(&record);
+            }
+
+            // The directory was deleted or unmounted and the kernel has dropped its watch. (Watches we removed or moved
+            // to the poller ourselves were already taken out of the table, so they don't resolve.)
+            if (kernel_wds && wd >= 0 && (event->mask & IN_IGNORED)) {
+                drop_watch(wd);
             }
         }
+    }
+
+    return used;
+}
+
+static int dispatch_injected(int budget) {
+    if (taken_offset >= taken_length) {
+        // Cleared before taking the queue, so anything injected after this point wakes us again
+        uint64_t count;
+        while (read(wake_fd, &count, sizeof(count)) > 0);
+
+        free(taken);
 
-        // No events to read, poll again
-        if (ret == 0) {
-            continue;
+        pthread_mutex_lock(&inject_lock);
+        taken = injected;
+        taken_length = injected_length;
+        taken_offset = 0;
+        injected = NULL;
+        injected_length = 0;
+        injected_capacity = 0;
+        pthread_mutex_unlock(&inject_lock);
+    }
+
+    return route_records(taken, &taken_offset, taken_length, 0, budget);
+}
+
+// Whether records have been read or taken off the injection queue but not routed yet
+static int records_waiting() {
+    return read_offset < read_length || taken_offset < taken_length;
+}
+
+// Moves that have waited this long for their IN_MOVED_TO are dispatched as moved out of the watched directory
+static void expire_moves() {
+    if (__atomic_load_n(&tracked_count, __ATOMIC_RELAXED) > 0) {
+        expire_events(MOVE_EXPIRY_MS, callbacks.move_from);
+    }
+}
+
+// One turn of the notifier: waits up to timeout milliseconds for the source or for injected events, runs whatever is
+// due, then routes up to budget records and dispatches a slice of the priority lanes. Returns how many records were
+// handled, or -1 once the source has ended.
+static int notifier_step(int timeout, int budget) {
+    // The source can be switched at any time (i.e. to the synthetic generator), so it's looked up every time round
+    const struct event_source* source = source_current();
+    struct pollfd fds[2];
+
+    fds[0].fd = source->fd(source->context);
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+
+    int ret = poll(fds, 2, records_waiting() ? 0 : timeout);
+
+    // Something went wrong with poll
+    if (ret < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "[SWNotify] Error when polling descriptor: %s\n", strerror(errno));
         }
+        return 0;
+    }
 
-        length = read(inotify_fd, buf, sizeof(buf));
+    // Check for, dispatch, and remove any IN_MOVE_FROM events that need to be dispatched to Swift
+    expire_moves();
+    ratelimit_report();
+    changeset_flush_due();
+    heavy_decay();
+    forget_dropped(0);
+
+    int handled = 0;
+
+    if (taken_offset < taken_length || (ret > 0 && (fds[1].revents & POLLIN))) {
+        handled += dispatch_injected(budget);
+    }
+
+    if (handled < budget && read_offset >= read_length && ret > 0 && (fds[0].revents & POLLIN)) {
+        long length = source->read(source->context, read_buffer, sizeof(read_buffer));
 
         if (length < 0) {
-            break;
+            return -1;
         }
 
-        for (char* ptr = buf; ptr < buf + length;) {
-            struct inotify_event* event = (struct inotify_event*) ptr;
+        read_offset = 0;
+        read_length = (size_t) length;
+        read_kernel_wds = source->kernel_wds;
+    }
 
-            if (event->mask & IN_CREATE && callbacks.create) {
-                callbacks.create(event->name, event->wd);
-            }
-            else if (event->mask & IN_DELETE && callbacks.remove) {
-                callbacks.remove(event->name, event->wd);
-            }
-            else if (event->mask & IN_MODIFY && callbacks.modify) {
-                callbacks.modify(event->name, event->wd);
-            }
-            else if (event->mask & IN_MOVED_FROM) {
-                // Track the event so we can dispatch it later
-                track_event(event->wd, event->cookie, event->name);
-            }
-            else if (event->mask & IN_MOVED_TO) {
-                char matched_name[1024];
-                if (find_and_remove_event(event->cookie, matched_name)) { // Check if this is a rename event - if it is, dispatch it
-                    if (callbacks.rename) {
-                        callbacks.rename(matched_name, event->name, event->wd);
-                    }
-                }
-                else if (callbacks.move_to) { // Otherwise, it's an IN_MOVE_TO event - dispatch it
-                    callbacks.move_to(event->name, event->wd);
-                }
-            }
+    handled += route_records(read_buffer, &read_offset, read_length, read_kernel_wds, budget - handled);
+
+    // Only a slice of the lanes at a time, so new events from the kernel are read (and high-priority ones
+    // get ahead) while a backlog is being worked through
+    size_t pending = lanes_pending();
+    if (pending > 0 && handled < budget) {
+        size_t slice = (size_t) (budget - handled) < LANE_DISPATCH_BUDGET ? (size_t) (budget - handled) : LANE_DISPATCH_BUDGET;
+        lanes_dispatch(slice, deliver_event);
+
+        size_t left = lanes_pending();
+        handled += pending > left ? (int) (pending - left) : 0;
+    }
 
-            ptr += sizeof(struct inotify_event) + event->len;
+    return handled;
+}
+
+static void* handle_events(void* _vargp) {
+    while (!__atomic_load_n(&pumping, __ATOMIC_ACQUIRE)) {
+        // Don't wait while events are still queued on the priority lanes, or past when the changeset settles
+        long long settles = changeset_timeout();
+        int timeout = lanes_pending() > 0 ? 0 : settles >= 0 && settles < 250 ? (int) settles : 250;
+
+        if (notifier_step(timeout, INT_MAX) < 0) {
+            break;
         }
     }
 
+    pthread_mutex_lock(&thread_lock);
+    thread_running = 0;
+    pthread_cond_broadcast(&thread_stopped);
+    pthread_mutex_unlock(&thread_lock);
+
     return NULL;
 }
 
 void start_notifier() {
+    pthread_mutex_lock(&thread_lock);
+
+    if (thread_running || __atomic_load_n(&pumping, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&thread_lock);
+        return;
+    }
+
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-    pthread_create(&thread_id, &attr, handle_events, NULL);
+    thread_running = pthread_create(&thread_id, &attr, handle_events, NULL) == 0;
+    pthread_attr_destroy(&attr);
+
+    pthread_mutex_unlock(&thread_lock);
 }
 
+// Must be called with pump_lock held. Keeps the pump fd following the current source, which can be switched at any time.
+static void pump_watch_source() {
+    const struct event_source* source = source_current();
+    int fd = source->fd(source->context);
+    if (fd == pump_source_fd) {
+        return;
+    }
+
+    if (pump_source_fd >= 0) {
+        epoll_ctl(pump_fd, EPOLL_CTL_DEL, pump_source_fd, NULL);
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+    pump_source_fd = epoll_ctl(pump_fd, EPOLL_CTL_ADD, fd, &event) == 0 ? fd : -1;
+}
+
+// Stops the notifier thread so events are only handled when notifier_process is called, on the caller's thread.
+// Returns a descriptor that polls readable whenever there's something to process, or -1 on failure. Can't be called
+// from a callback running on the notifier thread.
+int notifier_pump_start() {
+    if (!initialized || inotify_fd < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pump_lock);
+
+    if (pump_fd >= 0) {
+        pthread_mutex_unlock(&pump_lock);
+        return pump_fd;
+    }
+
+    pthread_mutex_lock(&thread_lock);
+    int on_notifier_thread = thread_running && pthread_equal(pthread_self(), thread_id);
+    pthread_mutex_unlock(&thread_lock);
+
+    if (on_notifier_thread) { // Would wait for itself to stop
+        pthread_mutex_unlock(&pump_lock);
+        return -1;
+    }
+
+    pump_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = wake_fd };
+
+    if (pump_fd < 0 || epoll_ctl(pump_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+        fprintf(stderr, "[SWNotify] Failed to create pump descriptor: %s\n", strerror(errno));
+        if (pump_fd >= 0) close(pump_fd);
+        pump_fd = -1;
+        pthread_mutex_unlock(&pump_lock);
+        return -1;
+    }
+
+    // The thread finishes the turn it's on, then sees the flag and exits
+    pthread_mutex_lock(&thread_lock);
+    __atomic_store_n(&pumping, 1, __ATOMIC_RELEASE);
+    notifier_wake();
+    while (thread_running) {
+        pthread_cond_wait(&thread_stopped, &thread_lock);
+    }
+    pthread_mutex_unlock(&thread_lock);
+
+    pump_source_fd = -1;
+    pump_watch_source();
+
+    // Anything left over from the thread's last turn still needs handling
+    if (records_waiting() || lanes_pending() > 0) {
+        notifier_wake();
+    }
+
+    int fd = pump_fd;
+    pthread_mutex_unlock(&pump_lock);
+    return fd;
+}
+
+// Must be called with pump_lock held and no turn in progress
+static void pump_stop_locked() {
+    if (pump_fd >= 0) {
+        close(pump_fd);
+        pump_fd = -1;
+        pump_source_fd = -1;
+        __atomic_store_n(&pumping, 0, __ATOMIC_RELEASE);
+        start_notifier();
+    }
+}
+
+// Whether the calling thread is inside notifier_process, i.e. running one of its callbacks. Must be called with pump_lock held.
+static int processing_here() {
+    return processing && pthread_equal(pthread_self(), processing_thread);
+}
+
+// Hands events back to the notifier thread. From a callback run by notifier_process, that happens once the turn ends.
+void notifier_pump_stop() {
+    pthread_mutex_lock(&pump_lock);
+
+    if (processing_here()) {
+        stop_after_processing = 1;
+        pthread_mutex_unlock(&pump_lock);
+        return;
+    }
+
+    while (processing) {
+        pthread_cond_wait(&processing_done, &pump_lock);
+    }
+
+    pump_stop_locked();
+    pthread_mutex_unlock(&pump_lock);
+}
+
+// Drains, pairs moves, runs timers and dispatches on the calling thread without blocking, handling at most max_events
+// records (0 for no limit). While anything is left over, the pump descriptor stays readable. Returns how many records
+// were handled, or -1 if the notifier isn't pumping, its source has ended, or this is called from one of the callbacks
+// it's running. Calls from other threads wait for the turn in progress.
+int notifier_process(int max_events) {
+    pthread_mutex_lock(&pump_lock);
+
+    if (processing_here()) {
+        pthread_mutex_unlock(&pump_lock);
+        return -1;
+    }
+
+    while (processing) {
+        pthread_cond_wait(&processing_done, &pump_lock);
+    }
+
+    if (pump_fd < 0) {
+        pthread_mutex_unlock(&pump_lock);
+        return -1;
+    }
+
+    pump_watch_source();
+    processing = 1;
+    processing_thread = pthread_self();
+    pthread_mutex_unlock(&pump_lock);
+
+    int handled = notifier_step(0, max_events > 0 ? max_events : INT_MAX);
+
+    pthread_mutex_lock(&pump_lock);
+    processing = 0;
+    pthread_cond_broadcast(&processing_done);
+
+    if (stop_after_processing) {
+        stop_after_processing = 0;
+        pump_stop_locked();
+    }
+    else if (records_waiting() || lanes_pending() > 0) {
+        notifier_wake();
+    }
+
+    pthread_mutex_unlock(&pump_lock);
+    return handled;
+}
+
+// How many milliseconds the host can wait on the pump descriptor before notifier_process has timers to run (pending
+// moves expiring, a changeset settling or a rate limit report), or -1 if nothing is due
+int notifier_next_timeout() {
+    pthread_mutex_lock(&pump_lock);
+
+    if (pump_fd >= 0 && !processing) {
+        pump_watch_source();
+    }
+
+    // Mid-turn, what's waiting is being worked through; asking again afterwards gives a real answer
+    int waiting = processing || records_waiting();
+    pthread_mutex_unlock(&pump_lock);
+
+    if (waiting || lanes_pending() > 0) {
+        return 0;
+    }
+
+    long long due[3] = { move_events_timeout(MOVE_EXPIRY_MS), changeset_timeout(), ratelimit_timeout() };
+    long long timeout = -1;
+
+    for (int i = 0; i < 3; i++) {
+        if (due[i] >= 0 && (timeout < 0 || due[i] < timeout)) {
+            timeout = due[i];
+        }
+    }
+
+    return timeout > INT_MAX ? INT_MAX : (int) timeout;
+}
+
+// Stops the notifier thread (or leaves pump mode) before anything is torn down, so nothing is still running that uses it.
+// Can't be called from a callback, which would wait for itself to finish.
 void stop_notifier() {
+    pthread_mutex_lock(&pump_lock);
+
+    if (processing_here()) { // Called from a callback notifier_process is running
+        pthread_mutex_unlock(&pump_lock);
+        return;
+    }
+
+    while (processing) {
+        pthread_cond_wait(&processing_done, &pump_lock);
+    }
+
+    pthread_mutex_lock(&thread_lock);
+    if (thread_running && pthread_equal(pthread_self(), thread_id)) {
+        pthread_mutex_unlock(&thread_lock);
+        pthread_mutex_unlock(&pump_lock);
+        return;
+    }
+
+    // The thread finishes the turn it's on, then sees the flag and exits. The flag stays set until everything is torn
+    // down, so start_notifier can't start another thread in the meantime.
+    __atomic_store_n(&pumping, 1, __ATOMIC_RELEASE);
+    notifier_wake();
+    while (thread_running) {
+        pthread_cond_wait(&thread_stopped, &thread_lock);
+    }
+    pthread_mutex_unlock(&thread_lock);
+
+    if (pump_fd >= 0) {
+        close(pump_fd);
+        pump_fd = -1;
+        pump_source_fd = -1;
+    }
+
+    pthread_mutex_unlock(&pump_lock);
+
+    poller_stop();
+    executor_disable();
+    fingerprint_disable();
+    forget_dropped(1);
+    recorder_stop();
+    shmring_publish_stop();
+    shmring_subscribe_stop();
+    changeset_disable();
+    warm_stop();
+    delta_disable();
+    listing_stop();
+    statcache_stop();
+    filewatch_stop();
     close(inotify_fd);
-    pthread_cancel(thread_id);
+
+    pthread_mutex_lock(&pump_lock);
     inotify_fd = -1;
     initialized = 0;
+    __atomic_store_n(&pumping, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pump_lock);
 }
@@ -0,0 +1,637 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "poller.h"
+#include "budget.h"
+#include "dirscan.h"
+#include "hashtable.h"
+#include "notify.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define POLLER_WORKERS 4
+#define DEFAULT_POLL_INTERVAL_MS 2000
+
+// Heat a polled directory needs before it's moved back to inotify
+#define PROMOTE_HEAT 16.0
+
+#define GETDENTS_BUFFER_SIZE 32768
+
+// Cookies for renames the poller pairs up itself; the high bit keeps them apart from the kernel's
+#define POLLER_COOKIE_BIT 0x80000000u
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct polled_directory {
+    int wd;
+    int pinned; // Polled because the caller asked for it, rather than for lack of inotify watches; never promoted
+    int gone;
+    int changes; // Changes seen in the current cycle
+    char* path;
+    struct poll_state state;
+    UT_hash_handle hh;
+};
+
+// Cost of one directory scan, summed into the cycle's totals
+struct scan_cost {
+    uint64_t entries;
+    uint64_t syscalls;
+};
+
+struct record_buffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+};
+
+static struct polled_directory* polled_directories = NULL;
+static uint32_t next_cookie = 0;
+
+static struct poller_stats stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t cycle_entries = 0;
+static uint64_t cycle_syscalls = 0;
+static pthread_rwlock_t poll_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static pthread_t coordinator;
+static pthread_t workers[POLLER_WORKERS];
+static int started = 0;
+static volatile int stopping = 0;
+static int interval_ms = DEFAULT_POLL_INTERVAL_MS;
+static pthread_mutex_t interval_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t interval_wake = PTHREAD_COND_INITIALIZER;
+
+// One scan cycle is split between the workers, which take directories off cycle_directories until it's exhausted
+static struct polled_directory** cycle_directories = NULL;
+static size_t cycle_count = 0;
+static size_t cycle_next = 0;
+static int cycle_pending = 0;
+static unsigned cycle_generation = 0;
+static pthread_mutex_t cycle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cycle_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cycle_done = PTHREAD_COND_INITIALIZER;
+
+static void append_record(struct record_buffer* buffer, int wd, uint32_t mask, uint32_t cookie, const char* name) {
+    size_t name_length = strlen(name) + 1;
+    // Padded like the kernel's records so the next one stays aligned
+    size_t padded = (name_length + sizeof(struct inotify_event) - 1) & ~(sizeof(struct inotify_event) - 1);
+    size_t size = sizeof(struct inotify_event) + padded;
+
+    if (buffer->length + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->length + size) {
+            capacity *= 2;
+        }
+
+        char* grown = (char*) realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            return;
+        }
+
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    struct inotify_event* event = (struct inotify_event*) (buffer->data + buffer->length);
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = (uint32_t) padded;
+    memset(event->name, 0, padded);
+    memcpy(event->name, name, name_length);
+
+    buffer->length += size;
+}
+
+static long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static const char* entry_name(const struct poll_state* state, const struct poll_entry* entry) {
+    return state->names + entry->name_offset;
+}
+
+static int compare_poll_entries(const void* a, const void* b, void* names) {
+    const struct poll_entry* left = (const struct poll_entry*) a;
+    const struct poll_entry* right = (const struct poll_entry*) b;
+
+    if (left->name_hash != right->name_hash) {
+        return left->name_hash < right->name_hash ? -1 : 1;
+    }
+    return strcmp((const char*) names + left->name_offset, (const char*) names + right->name_offset);
+}
+
+static int compare_across(const struct poll_state* left_state, const struct poll_entry* left, const struct poll_state* right_state, const struct poll_entry* right) {
+    if (left->name_hash != right->name_hash) {
+        return left->name_hash < right->name_hash ? -1 : 1;
+    }
+    return strcmp(entry_name(left_state, left), entry_name(right_state, right));
+}
+
+static void free_poll_state(struct poll_state* state) {
+    free(state->entries);
+    free(state->names);
+    state->entries = NULL;
+    state->names = NULL;
+    state->count = 0;
+    state->names_length = 0;
+}
+
+// Reads a directory with getdents64 and statx into a compact state sorted by (name_hash, name), for merge-diffing.
+// Returns 0 on success, or -1 with errno set.
+static int scan_poll_state(const char* path, struct poll_state* state, struct scan_cost* cost) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    cost->syscalls++;
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t capacity = 64;
+    size_t names_capacity = 1024;
+    state->count = 0;
+    state->names_length = 0;
+    state->entries = (struct poll_entry*) malloc(capacity * sizeof(struct poll_entry));
+    state->names = (char*) malloc(names_capacity);
+
+    if (state->entries == NULL || state->names == NULL) {
+        free_poll_state(state);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char buffer[GETDENTS_BUFFER_SIZE];
+
+    while (1) {
+        long length = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        cost->syscalls++;
+
+        if (length <= 0) {
+            break;
+        }
+
+        for (long offset = 0; offset < length;) {
+            struct linux_dirent64* dirent = (struct linux_dirent64*) (buffer + offset);
+            offset += dirent->d_reclen;
+
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            struct statx stx;
+            cost->syscalls++;
+            if (statx(fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) != 0) {
+                continue; // Gone already
+            }
+
+            size_t name_length = strlen(name) + 1;
+
+            if (state->count == capacity) {
+                capacity *= 2;
+                struct poll_entry* grown = (struct poll_entry*) realloc(state->entries, capacity * sizeof(struct poll_entry));
+                if (grown == NULL) {
+                    break;
+                }
+                state->entries = grown;
+            }
+
+            if (state->names_length + name_length > names_capacity) {
+                while (state->names_length + name_length > names_capacity) {
+                    names_capacity *= 2;
+                }
+                char* grown = (char*) realloc(state->names, names_capacity);
+                if (grown == NULL) {
+                    break;
+                }
+                state->names = grown;
+            }
+
+            struct poll_entry* entry = &state->entries[state->count++];
+            entry->name_hash = name_hash64(name);
+            entry->inode = stx.stx_ino;
+            entry->size = (int64_t) stx.stx_size;
+            entry->mtime_ns = (int64_t) stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+            entry->name_offset = (uint32_t) state->names_length;
+            entry->is_directory = S_ISDIR(stx.stx_mode) ? 1 : 0;
+
+            memcpy(state->names + state->names_length, name, name_length);
+            state->names_length += name_length;
+        }
+    }
+
+    close(fd);
+    cost->entries += state->count;
+
+    qsort_r(state->entries, state->count, sizeof(struct poll_entry), compare_poll_entries, state->names);
+    return 0;
+}
+
+static int compare_inodes(const void* a, const void* b) {
+    uint64_t left = (*(const struct poll_entry* const*) a)->inode;
+    uint64_t right = (*(const struct poll_entry* const*) b)->inode;
+    return left < right ? -1 : left > right;
+}
+
+static uint32_t isdir_bit(const struct poll_entry* entry) {
+    return entry->is_directory ? IN_ISDIR : 0;
+}
+
+// Rescans a directory and queues an event for everything that changed since the last scan.
+// Entries that disappeared under one name and appeared under another with the same inode are reported as a rename.
+static void poll_directory(struct polled_directory* directory, struct scan_cost* cost) {
+    int flags = watch_wanted_flags(directory->wd);
+    uint32_t modify_mask = (uint32_t) flags & (IN_MODIFY | IN_CLOSE_WRITE);
+    struct record_buffer records = { NULL, 0, 0 };
+
+    struct poll_state current = { NULL, NULL, 0, 0 };
+
+    if (scan_poll_state(directory->path, &current, cost) != 0) {
+        if (errno == ENOENT && !directory->gone) {
+            directory->gone = 1;
+            if (flags & IN_DELETE_SELF) {
+                append_record(&records, directory->wd, IN_DELETE_SELF, 0, "");
+            }
+        }
+    }
+    else {
+        struct poll_state* previous = &directory->state;
+        directory->gone = 0;
+
+        // Entries only on one side (or whose inode changed) are candidates for renames, paired up below
+        size_t removed_capacity = previous->count ? previous->count : 1;
+        size_t added_capacity = current.count ? current.count : 1;
+        struct poll_entry** removed = (struct poll_entry**) malloc(removed_capacity * sizeof(struct poll_entry*));
+        struct poll_entry** added = (struct poll_entry**) malloc(added_capacity * sizeof(struct poll_entry*));
+        size_t removed_count = 0;
+        size_t added_count = 0;
+
+        if (removed == NULL || added == NULL) {
+            free(removed);
+            free(added);
+            free_poll_state(&current);
+            return;
+        }
+
+        size_t i = 0;
+        size_t j = 0;
+
+        while (i < previous->count || j < current.count) {
+            int order = i >= previous->count ? 1 : j >= current.count ? -1
+                : compare_across(previous, &previous->entries[i], &current, &current.entries[j]);
+
+            if (order < 0) {
+                removed[removed_count++] = &previous->entries[i++];
+            }
+            else if (order > 0) {
+                added[added_count++] = &current.entries[j++];
+            }
+            else {
+                struct poll_entry* before = &previous->entries[i++];
+                struct poll_entry* after = &current.entries[j++];
+
+                if (before->inode != after->inode) { // Replaced by a different file with the same name
+                    removed[removed_count++] = before;
+                    added[added_count++] = after;
+                }
+                // A subdirectory's mtime moves when its own entries change, which inotify doesn't report on this directory
+                else if (!after->is_directory && (before->size != after->size || before->mtime_ns != after->mtime_ns)) {
+                    if (modify_mask) append_record(&records, directory->wd, modify_mask, 0, entry_name(&current, after));
+                    directory->changes++;
+                }
+            }
+        }
+
+        // Pair removed and added entries holding the same inode by walking both in inode order; paired ones are nulled out
+        qsort(removed, removed_count, sizeof(struct poll_entry*), compare_inodes);
+        qsort(added, added_count, sizeof(struct poll_entry*), compare_inodes);
+
+        struct poll_entry** renamed_from = (struct poll_entry**) calloc(added_count ? added_count : 1, sizeof(struct poll_entry*));
+        struct poll_entry** renamed_to = (struct poll_entry**) calloc(added_count ? added_count : 1, sizeof(struct poll_entry*));
+        size_t rename_count = 0;
+
+        for (size_t r = 0, a = 0; renamed_from && renamed_to && r < removed_count && a < added_count;) {
+            if (removed[r]->inode < added[a]->inode) {
+                r++;
+            }
+            else if (removed[r]->inode > added[a]->inode) {
+                a++;
+            }
+            else if (removed[r]->size != added[a]->size || removed[r]->mtime_ns != added[a]->mtime_ns) {
+                // A rename leaves size and mtime alone; a mismatch means the inode was freed and reused by a new file
+                r++;
+                a++;
+            }
+            else {
+                renamed_from[rename_count] = removed[r];
+                renamed_to[rename_count++] = added[a];
+                removed[r++] = NULL;
+                added[a++] = NULL;
+            }
+        }
+
+        // Deletes first, then renames, then creates, so a name that's reused within one scan ends up in its final state
+        for (size_t r = 0; r < removed_count; r++) {
+            if (removed[r] == NULL) continue;
+            if (flags & IN_DELETE) append_record(&records, directory->wd, IN_DELETE | isdir_bit(removed[r]), 0, entry_name(previous, removed[r]));
+            directory->changes++;
+        }
+
+        for (size_t m = 0; m < rename_count; m++) {
+            uint32_t cookie = __atomic_add_fetch(&next_cookie, 1, __ATOMIC_RELAXED) | POLLER_COOKIE_BIT;
+            if (flags & IN_MOVED_FROM) append_record(&records, directory->wd, IN_MOVED_FROM | isdir_bit(renamed_from[m]), cookie, entry_name(previous, renamed_from[m]));
+            if (flags & IN_MOVED_TO) append_record(&records, directory->wd, IN_MOVED_TO | isdir_bit(renamed_to[m]), cookie, entry_name(&current, renamed_to[m]));
+            directory->changes++;
+        }
+
+        for (size_t a = 0; a < added_count; a++) {
+            if (added[a] == NULL) continue;
+            if (flags & IN_CREATE) append_record(&records, directory->wd, IN_CREATE | isdir_bit(added[a]), 0, entry_name(&current, added[a]));
+            directory->changes++;
+        }
+
+        free(renamed_to);
+        free(renamed_from);
+        free(removed);
+        free(added);
+        free_poll_state(previous);
+        *previous = current;
+    }
+
+    if (records.length > 0) {
+        notifier_inject(records.data, records.length);
+    }
+    free(records.data);
+}
+
+static void* run_worker(void* _vargp) {
+    (void) _vargp;
+    unsigned seen_generation = 0;
+    struct scan_cost cost;
+
+    while (1) {
+        pthread_mutex_lock(&cycle_lock);
+        while (cycle_generation == seen_generation && !stopping) {
+            pthread_cond_wait(&cycle_start, &cycle_lock);
+        }
+        seen_generation = cycle_generation;
+        pthread_mutex_unlock(&cycle_lock);
+
+        if (stopping) break;
+
+        cost.entries = 0;
+        cost.syscalls = 0;
+
+        while (1) {
+            size_t index = __atomic_fetch_add(&cycle_next, 1, __ATOMIC_RELAXED);
+            if (index >= cycle_count) break;
+            poll_directory(cycle_directories[index], &cost);
+        }
+
+        __atomic_add_fetch(&cycle_entries, cost.entries, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&cycle_syscalls, cost.syscalls, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&cycle_lock);
+        if (--cycle_pending == 0) {
+            pthread_cond_signal(&cycle_done);
+        }
+        pthread_mutex_unlock(&cycle_lock);
+    }
+
+    return NULL;
+}
+
+static void run_cycle() {
+    long long started_us = monotonic_us();
+    pthread_rwlock_rdlock(&poll_lock);
+
+    size_t count = HASH_COUNT(polled_directories);
+    struct polled_directory** directories = (struct polled_directory**) malloc((count ? count : 1) * sizeof(struct polled_directory*));
+    if (directories == NULL) {
+        pthread_rwlock_unlock(&poll_lock);
+        return;
+    }
+
+    size_t n = 0;
+    for (struct polled_directory* current = polled_directories; current != NULL; current = current->hh.next) {
+        current->changes = 0;
+        directories[n++] = current;
+    }
+
+    __atomic_store_n(&cycle_entries, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cycle_syscalls, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&cycle_lock);
+    cycle_directories = directories;
+    cycle_count = count;
+    cycle_next = 0;
+    cycle_pending = POLLER_WORKERS;
+    cycle_generation++;
+    pthread_cond_broadcast(&cycle_start);
+
+    while (cycle_pending > 0) {
+        pthread_cond_wait(&cycle_done, &cycle_lock);
+    }
+    pthread_mutex_unlock(&cycle_lock);
+
+    uint64_t elapsed_us = (uint64_t) (monotonic_us() - started_us);
+    pthread_mutex_lock(&stats_lock);
+    stats.cycles++;
+    stats.last_cycle_us = elapsed_us;
+    stats.total_cycle_us += elapsed_us;
+    stats.last_directories = count;
+    stats.last_entries = __atomic_load_n(&cycle_entries, __ATOMIC_RELAXED);
+    stats.last_syscalls = __atomic_load_n(&cycle_syscalls, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&stats_lock);
+
+    // Collect directories busy enough to go back to inotify; promoting needs the write lock, so it happens after unlocking
+    int* promotions = (int*) malloc((count ? count : 1) * sizeof(int));
+    size_t promotion_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        struct polled_directory* directory = directories[i];
+        if (directory->changes > 0) {
+            watch_table_touch(directory->wd, directory->changes);
+
+            if (promotions && !directory->pinned && watch_table_heat(directory->wd) >= PROMOTE_HEAT) {
+                promotions[promotion_count++] = directory->wd;
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&poll_lock);
+
+    for (size_t i = 0; i < promotion_count; i++) {
+        budget_promote(promotions[i]);
+    }
+
+    free(promotions);
+    free(directories);
+}
+
+static void* run_coordinator(void* _vargp) {
+    (void) _vargp;
+
+    while (!stopping) {
+        pthread_mutex_lock(&interval_lock);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long long nanoseconds = deadline.tv_nsec + (long long) (interval_ms % 1000) * 1000000LL;
+        deadline.tv_sec += interval_ms / 1000 + nanoseconds / 1000000000LL;
+        deadline.tv_nsec = nanoseconds % 1000000000LL;
+
+        pthread_cond_timedwait(&interval_wake, &interval_lock, &deadline);
+        pthread_mutex_unlock(&interval_lock);
+
+        if (!stopping) {
+            run_cycle();
+        }
+    }
+
+    return NULL;
+}
+
+static void start_threads() {
+    stopping = 0;
+
+    for (int i = 0; i < POLLER_WORKERS; i++) {
+        pthread_create(&workers[i], NULL, run_worker, NULL);
+    }
+
+    pthread_create(&coordinator, NULL, run_coordinator, NULL);
+    started = 1;
+}
+
+static void free_directory(struct polled_directory* directory) {
+    free_poll_state(&directory->state);
+    free(directory->path);
+    free(directory);
+}
+
+// Starts polling a directory. The first scan happens immediately so changes from now on aren't missed.
+// Pinned directories stay polled however busy they get.
+int poller_add(int wd, const char* path, int pinned) {
+    struct polled_directory* directory = (struct polled_directory*) calloc(1, sizeof(struct polled_directory));
+    if (directory == NULL) {
+        return -1;
+    }
+
+    struct scan_cost cost = { 0, 0 };
+
+    directory->wd = wd;
+    directory->pinned = pinned;
+    directory->path = strdup(path);
+
+    if (directory->path == NULL || scan_poll_state(path, &directory->state, &cost) != 0) {
+        free_directory(directory);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&poll_lock);
+
+    struct polled_directory* existing;
+    HASH_FIND_INT(polled_directories, &wd, existing);
+    if (existing) {
+        HASH_DEL(polled_directories, existing);
+        free_directory(existing);
+    }
+
+    HASH_ADD_INT(polled_directories, wd, directory);
+
+    if (!started) {
+        start_threads();
+    }
+
+    pthread_rwlock_unlock(&poll_lock);
+    return 0;
+}
+
+// Stops polling a directory. If flush is set, it's scanned one last time so nothing between the last scan and now is lost.
+void poller_remove(int wd, int flush) {
+    pthread_rwlock_wrlock(&poll_lock);
+
+    struct polled_directory* directory;
+    HASH_FIND_INT(polled_directories, &wd, directory);
+
+    if (directory) {
+        if (flush) {
+            struct scan_cost cost = { 0, 0 };
+            poll_directory(directory, &cost);
+        }
+
+        HASH_DEL(polled_directories, directory);
+        free_directory(directory);
+    }
+
+    pthread_rwlock_unlock(&poll_lock);
+}
+
+// Returns whether a directory is polled because the caller asked for it
+int poller_pinned(int wd) {
+    pthread_rwlock_rdlock(&poll_lock);
+
+    struct polled_directory* directory;
+    HASH_FIND_INT(polled_directories, &wd, directory);
+    int pinned = directory ? directory->pinned : 0;
+
+    pthread_rwlock_unlock(&poll_lock);
+    return pinned;
+}
+
+struct poller_stats poller_get_stats() {
+    pthread_mutex_lock(&stats_lock);
+    struct poller_stats copy = stats;
+    pthread_mutex_unlock(&stats_lock);
+    return copy;
+}
+
+void poller_set_interval(int milliseconds) {
+    pthread_mutex_lock(&interval_lock);
+    interval_ms = milliseconds < 10 ? 10 : milliseconds;
+    pthread_cond_signal(&interval_wake);
+    pthread_mutex_unlock(&interval_lock);
+}
+
+int poller_interval() {
+    return interval_ms;
+}
+
+void poller_stop() {
+    if (!started) return;
+
+    pthread_mutex_lock(&cycle_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&cycle_start);
+    pthread_mutex_unlock(&cycle_lock);
+
+    pthread_mutex_lock(&interval_lock);
+    pthread_cond_signal(&interval_wake);
+    pthread_mutex_unlock(&interval_lock);
+
+    pthread_join(coordinator, NULL);
+    for (int i = 0; i < POLLER_WORKERS; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    started = 0;
+}
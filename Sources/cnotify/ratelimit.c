@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "ratelimit.h"
+#include "types.h"
+#include "util.h"
+#include "uthash.h"
+
+// How often a watch that's coalescing reports how many events it suppressed
+#define SUMMARY_INTERVAL_MS 1000
+
+extern struct callback_collection callbacks;
+
+static struct rate_limit* rate_limits = NULL;
+static int limited_count = 0;
+static pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Limits wd to rate events per second with bursts of up to burst events. Events over the limit are handled according to
+// policy; with RATE_LIMIT_SAMPLE, one in every sample_every of them is let through. A rate of 0 or less removes the limit.
+// Returns 0 on success.
+int ratelimit_set(int wd, double rate, int burst, int policy, int sample_every) {
+    if (policy < RATE_LIMIT_DROP || policy > RATE_LIMIT_SAMPLE) {
+        return -1;
+    }
+
+    if (rate <= 0) {
+        ratelimit_remove(wd);
+        return 0;
+    }
+
+    pthread_mutex_lock(&limit_lock);
+
+    struct rate_limit* limit;
+    HASH_FIND_INT(rate_limits, &wd, limit);
+
+    if (limit == NULL) {
+        limit = (struct rate_limit*) calloc(1, sizeof(struct rate_limit));
+        if (limit == NULL) {
+            pthread_mutex_unlock(&limit_lock);
+            return -1;
+        }
+
+        limit->wd = wd;
+        limit->tokens = burst < 1 ? 1 : burst;
+        limit->refilled_ns = monotonic_ns();
+        limit->reported_ms = get_current_time_millis();
+        HASH_ADD_INT(rate_limits, wd, limit);
+        __atomic_add_fetch(&limited_count, 1, __ATOMIC_RELAXED);
+    }
+
+    limit->rate = rate;
+    limit->burst = burst < 1 ? 1 : burst;
+    limit->policy = policy;
+    limit->sample_every = sample_every < 1 ? 1 : sample_every;
+
+    pthread_mutex_unlock(&limit_lock);
+    return 0;
+}
+
+void ratelimit_remove(int wd) {
+    pthread_mutex_lock(&limit_lock);
+
+    struct rate_limit* limit;
+    HASH_FIND_INT(rate_limits, &wd, limit);
+
+    if (limit) {
+        HASH_DEL(rate_limits, limit);
+        free(limit);
+        __atomic_sub_fetch(&limited_count, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&limit_lock);
+}
+
+// Returns 1 if the event should be dispatched, 0 if it's over its watch's limit and should be shed.
+// Events about the watch itself, and records that aren't events (IN_IGNORED, IN_Q_OVERFLOW), are never limited.
+int ratelimit_admit(const struct inotify_event* event) {
+    if (__atomic_load_n(&limited_count, __ATOMIC_RELAXED) == 0) {
+        return 1;
+    }
+
+    uint32_t bits = event->mask & IN_ALL_EVENTS;
+    if (bits == 0 || (bits & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+        return 1;
+    }
+
+    int admitted = 1;
+    int wd = event->wd;
+    pthread_mutex_lock(&limit_lock);
+
+    struct rate_limit* limit;
+    HASH_FIND_INT(rate_limits, &wd, limit);
+
+    if (limit) {
+        long long now = monotonic_ns();
+        limit->tokens += (double) (now - limit->refilled_ns) / 1e9 * limit->rate;
+        if (limit->tokens > limit->burst) {
+            limit->tokens = limit->burst;
+        }
+        limit->refilled_ns = now;
+
+        if (limit->tokens >= 1.0) {
+            limit->tokens -= 1.0;
+        }
+        else if (limit->policy == RATE_LIMIT_SAMPLE && ++limit->sample_counter % (uint64_t) limit->sample_every == 0) {
+            // Let a sample through without touching the bucket
+        }
+        else {
+            admitted = 0;
+            limit->suppressed++;
+            if (limit->policy == RATE_LIMIT_COALESCE) {
+                limit->unreported++;
+            }
+        }
+
+        if (admitted) {
+            limit->passed++;
+        }
+    }
+
+    pthread_mutex_unlock(&limit_lock);
+    return admitted;
+}
+
+// Calls the suppressed callback for every coalescing watch that has shed events since it last reported, at most once
+// per SUMMARY_INTERVAL_MS per watch. Called from the notifier thread's loop.
+void ratelimit_report() {
+    if (__atomic_load_n(&limited_count, __ATOMIC_RELAXED) == 0 || callbacks.suppressed == NULL) {
+        return;
+    }
+
+    long long now = get_current_time_millis();
+    int wds[64];
+    uint64_t counts[64];
+    int count = 0;
+
+    pthread_mutex_lock(&limit_lock);
+
+    for (struct rate_limit* limit = rate_limits; limit != NULL && count < 64; limit = limit->hh.next) {
+        if (limit->unreported > 0 && now - limit->reported_ms >= SUMMARY_INTERVAL_MS) {
+            wds[count] = limit->wd;
+            counts[count++] = limit->unreported;
+            limit->unreported = 0;
+            limit->reported_ms = now;
+        }
+    }
+
+    pthread_mutex_unlock(&limit_lock);
+
+    for (int i = 0; i < count; i++) {
+        callbacks.suppressed(wds[i], counts[i]);
+    }
+}
+
+// Returns how many milliseconds until ratelimit_report() next has something to report, or -1 if nothing is waiting
+long long ratelimit_timeout() {
+    if (__atomic_load_n(&limited_count, __ATOMIC_RELAXED) == 0 || callbacks.suppressed == NULL) {
+        return -1;
+    }
+
+    long long now = get_current_time_millis();
+    long long timeout = -1;
+
+    pthread_mutex_lock(&limit_lock);
+
+    for (struct rate_limit* limit = rate_limits; limit != NULL; limit = limit->hh.next) {
+        if (limit->unreported > 0) {
+            long long due = limit->reported_ms + SUMMARY_INTERVAL_MS - now;
+            due = due < 0 ? 0 : due;
+            timeout = timeout < 0 || due < timeout ? due : timeout;
+        }
+    }
+
+    pthread_mutex_unlock(&limit_lock);
+    return timeout;
+}
+
+// Copies how many of wd's events were let through and how many were shed. Returns 0 on success, -1 if wd has no limit.
+int ratelimit_stats(int wd, uint64_t* passed, uint64_t* suppressed) {
+    int result = -1;
+    pthread_mutex_lock(&limit_lock);
+
+    struct rate_limit* limit;
+    HASH_FIND_INT(rate_limits, &wd, limit);
+
+    if (limit) {
+        *passed = limit->passed;
+        *suppressed = limit->suppressed;
+        result = 0;
+    }
+
+    pthread_mutex_unlock(&limit_lock);
+    return result;
+}
@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "recorder.h"
+#include "notify.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define RECORDING_MAGIC 0x524e5753 // "SWNR"
+#define RECORDING_VERSION 1
+#define RECORDER_BUFFER_SIZE (1 << 20)
+
+// Injected events are handed to the notifier thread in batches of about this size while replaying
+#define REPLAY_BATCH_SIZE 65536
+
+// Replaying as fast as possible pauses while the notifier thread has this much left to dispatch. Without the thread
+// (i.e. pumping) there's nothing to wait for, so it doesn't pause.
+#define REPLAY_MAX_BACKLOG (4 << 20)
+
+// Records are only appended from the notifier thread; the lock is for starting and stopping from elsewhere
+static int recording = 0;
+static int record_fd = -1;
+static char* record_buffer = NULL;
+static size_t record_length = 0;
+static long long record_started_ns = 0;
+static struct recorded_watch* recorded_watches = NULL;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void flush_records() {
+    size_t written = 0;
+
+    while (written < record_length) {
+        ssize_t result = write(record_fd, record_buffer + written, record_length - written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[SWNotify] Failed to write event recording: %s\n", strerror(errno));
+            break;
+        }
+        written += (size_t) result;
+    }
+
+    record_length = 0;
+}
+
+static void append_record(uint16_t kind, long long timestamp_ns, uint32_t mask, uint32_t cookie, int wd, const char* name) {
+    size_t name_length = strnlen(name, UINT16_MAX);
+    size_t size = sizeof(struct recording_record) + name_length;
+
+    if (record_length + size > RECORDER_BUFFER_SIZE) {
+        flush_records();
+    }
+
+    struct recording_record record = {
+        (uint64_t) (timestamp_ns - record_started_ns),
+        mask,
+        cookie,
+        wd,
+        (uint16_t) name_length,
+        kind
+    };
+
+    memcpy(record_buffer + record_length, &record, sizeof(record));
+    memcpy(record_buffer + record_length + sizeof(record), name, name_length);
+    record_length += size;
+}
+
+static void free_recorded_watches(struct recorded_watch** watches) {
+    struct recorded_watch *current, *tmp;
+    HASH_ITER(hh, *watches, current, tmp) {
+        HASH_DEL(*watches, current);
+        free(current);
+    }
+}
+
+// Starts appending every event the notifier reads to a recording at path, replacing any recording in progress.
+// Returns 0 on success, or -1 if the file couldn't be created.
+int recorder_start(const char* path) {
+    recorder_stop();
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char* buffer = (char*) malloc(RECORDER_BUFFER_SIZE);
+    if (buffer == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct recording_header header = { RECORDING_MAGIC, RECORDING_VERSION, (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec };
+
+    if (write(fd, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+        free(buffer);
+        close(fd);
+        return -1;
+    }
+
+    pthread_mutex_lock(&record_lock);
+    record_fd = fd;
+    record_buffer = buffer;
+    record_length = 0;
+    record_started_ns = monotonic_ns();
+    __atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&record_lock);
+
+    return 0;
+}
+
+// Writes out anything buffered and closes the recording
+void recorder_stop() {
+    pthread_mutex_lock(&record_lock);
+
+    if (recording) {
+        __atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+        flush_records();
+        close(record_fd);
+        free(record_buffer);
+        free_recorded_watches(&recorded_watches);
+        record_fd = -1;
+        record_buffer = NULL;
+    }
+
+    pthread_mutex_unlock(&record_lock);
+}
+
+int recorder_active() {
+    return __atomic_load_n(&recording, __ATOMIC_ACQUIRE);
+}
+
+// Appends an event to the recording. Events are buffered and written out a megabyte at a time.
+void recorder_record(const struct inotify_event* event) {
+    if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    long long now = monotonic_ns();
+    pthread_mutex_lock(&record_lock);
+
+    if (recording) {
+        // The first event for each watch is preceded by the watch's path, so the recording can be replayed against
+        // whatever ids the same directories have in another process
+        int wd = event->wd;
+        struct recorded_watch* watch;
+        HASH_FIND_INT(recorded_watches, &wd, watch);
+
+        if (watch == NULL && wd >= 0) {
+            char path[4096];
+            watch = (struct recorded_watch*) malloc(sizeof(struct recorded_watch));
+
+            if (watch && watch_table_path(wd, path, sizeof(path)) == 0) {
+                watch->wd = wd;
+                watch->replay_wd = -1;
+                HASH_ADD_INT(recorded_watches, wd, watch);
+                append_record(RECORDING_PATH, now, 0, 0, wd, path);
+            }
+            else {
+                free(watch);
+            }
+        }
+
+        append_record(RECORDING_EVENT, now, event->mask, event->cookie, event->wd, event->len > 0 ? event->name : "");
+    }
+
+    pthread_mutex_unlock(&record_lock);
+}
+
+static void sleep_until(long long deadline_ns) {
+    long long remaining = deadline_ns - monotonic_ns();
+    if (remaining > 0) {
+        struct timespec ts = { remaining / 1000000000LL, remaining % 1000000000LL };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Builds the inotify_event record the notifier would have read, padded like the kernel's
+static size_t build_event(char* out, const struct recording_record* record, int wd, const char* name) {
+    size_t padded = record->name_length == 0 ? 0 : (record->name_length + 1 + sizeof(struct inotify_event) - 1) & ~(sizeof(struct inotify_event) - 1);
+    struct inotify_event* event = (struct inotify_event*) out;
+
+    event->wd = wd;
+    event->mask = record->mask;
+    event->cookie = record->cookie;
+    event->len = (uint32_t) padded;
+    memset(event->name, 0, padded);
+    memcpy(event->name, name, record->name_length);
+
+    return sizeof(struct inotify_event) + padded;
+}
+
+// Feeds a recording back through the notifier as if its events had just been read, so they go through the same rate
+// limits, lanes and callbacks. Recorded watches are matched to the current ones by path; events for directories that
+// aren't being watched are skipped. With original_timing set, events are spaced as they were recorded; otherwise they
+// are replayed as fast as the notifier takes them, or all at once in pump mode, where they're dispatched by the host's
+// next calls to notifier_process. Returns once every event has been handed over, with the number of events replayed,
+// or -1 if the recording couldn't be read.
+long replay_recording(const char* path, int original_timing) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    struct recording_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION) {
+        fclose(file);
+        return -1;
+    }
+
+    char* batch = (char*) malloc(REPLAY_BATCH_SIZE + sizeof(struct inotify_event) + UINT16_MAX + 1);
+    if (batch == NULL) {
+        fclose(file);
+        return -1;
+    }
+
+    struct recorded_watch* watches = NULL;
+    size_t batch_length = 0;
+    long replayed = 0;
+    long long started_ns = monotonic_ns();
+    struct recording_record record;
+    char name[UINT16_MAX + 1];
+
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.name_length > 0 && fread(name, record.name_length, 1, file) != 1) {
+            break;
+        }
+        name[record.name_length] = '\0';
+
+        if (record.kind == RECORDING_PATH) {
+            struct recorded_watch* watch = (struct recorded_watch*) malloc(sizeof(struct recorded_watch));
+            if (watch) {
+                watch->wd = record.wd;
+                watch->replay_wd = watch_table_find(name);
+                HASH_ADD_INT(watches, wd, watch);
+            }
+            continue;
+        }
+
+        int wd = record.wd;
+        if (wd >= 0) {
+            struct recorded_watch* watch;
+            HASH_FIND_INT(watches, &wd, watch);
+            if (watch == NULL || watch->replay_wd < 0) {
+                continue;
+            }
+            wd = watch->replay_wd;
+        }
+
+        if (original_timing) {
+            long long due_ns = started_ns + (long long) record.timestamp_ns;
+            if (due_ns > monotonic_ns() && batch_length > 0) { // Hand over what's due before waiting
+                notifier_inject(batch, batch_length);
+                batch_length = 0;
+            }
+            sleep_until(due_ns);
+        }
+
+        batch_length += build_event(batch + batch_length, &record, wd, name);
+        replayed++;
+
+        if (batch_length >= REPLAY_BATCH_SIZE) {
+            // Only waited for while the notifier thread is there to drain it; from a callback, or with a pump that may
+            // be this very thread, waiting would never end, so the backlog grows instead
+            while (!original_timing && notifier_injected_backlog() > REPLAY_MAX_BACKLOG && notifier_draining()) {
+                sleep_until(monotonic_ns() + 1000000);
+            }
+
+            notifier_inject(batch, batch_length);
+            batch_length = 0;
+        }
+    }
+
+    if (batch_length > 0) {
+        notifier_inject(batch, batch_length);
+    }
+
+    free_recorded_watches(&watches);
+    free(batch);
+    fclose(file);
+
+    return replayed;
+}
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include "shmring.h"
+#include "notify.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define SHM_RING_MAGIC 0x474e5253 // "SRNG"
+#define SHM_RING_VERSION 1
+#define SHM_SLOT_SIZE 1024
+#define DEFAULT_SLOT_COUNT 16384
+
+// A watched directory's absolute path, resolved once so subscribers can match it regardless of the publisher's cwd
+struct published_directory {
+    int wd;
+    char* path;
+    size_t length;
+    UT_hash_handle hh;
+};
+
+static struct shm_ring_header* publish_ring = NULL;
+static size_t publish_size = 0;
+static int publishing = 0;
+static struct published_directory* published_directories = NULL;
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct shm_ring_header* subscribe_ring = NULL;
+static size_t subscribe_size = 0;
+static pthread_t subscriber_thread;
+static volatile int subscriber_stopping = 0;
+static uint64_t subscribed_from = 0;
+static uint64_t overruns = 0;
+
+static int ring_path(const char* name, char* path, size_t n) {
+    if (name == NULL || *name == '\0' || strchr(name, '/') != NULL) {
+        return -1;
+    }
+
+    int length = snprintf(path, n, "/dev/shm/swnotify.%s", name);
+    return length < 0 || (size_t) length >= n ? -1 : 0;
+}
+
+static struct shm_ring_slot* ring_slot(struct shm_ring_header* ring, uint64_t seq) {
+    return (struct shm_ring_slot*) ((char*) ring + sizeof(struct shm_ring_header) + (seq % ring->slot_count) * ring->slot_size);
+}
+
+static void futex_wake(uint32_t* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void futex_wait(uint32_t* word, uint32_t expected, long timeout_ms) {
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static int ring_valid(const struct shm_ring_header* ring, size_t size) {
+    return size >= sizeof(struct shm_ring_header) && ring->magic == SHM_RING_MAGIC && ring->version == SHM_RING_VERSION
+        && ring->slot_size == SHM_SLOT_SIZE && ring->slot_count > 0
+        && size == sizeof(struct shm_ring_header) + (size_t) ring->slot_count * ring->slot_size;
+}
+
+static void free_published_directories() {
+    struct published_directory *current, *tmp;
+    HASH_ITER(hh, published_directories, current, tmp) {
+        HASH_DEL(published_directories, current);
+        free(current->path);
+        free(current);
+    }
+}
+
+// Starts publishing every event the notifier reads to the shared-memory ring called name, with room for slot_count
+// events. A ring left by an earlier publisher with the same geometry is reused, so its subscribers carry on.
+// Returns 0 on success.
+int shmring_publish_start(const char* name, int slot_count) {
+    char path[PATH_MAX];
+    if (ring_path(name, path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    shmring_publish_stop();
+
+    if (slot_count < 1) slot_count = DEFAULT_SLOT_COUNT;
+    size_t size = sizeof(struct shm_ring_header) + (size_t) slot_count * SHM_SLOT_SIZE;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    int reuse = 0;
+
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size == size) {
+        struct shm_ring_header* existing = (struct shm_ring_header*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (existing != MAP_FAILED) {
+            reuse = ring_valid(existing, size) && existing->slot_count == (uint32_t) slot_count;
+            munmap(existing, size);
+        }
+    }
+
+    if (!reuse) {
+        // Subscribers still mapping an old ring keep the old file; they need to subscribe again
+        close(fd);
+        unlink(path);
+
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t) size) != 0) {
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+    }
+
+    struct shm_ring_header* ring = (struct shm_ring_header*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+
+    if (!reuse) {
+        ring->slot_size = SHM_SLOT_SIZE;
+        ring->slot_count = (uint32_t) slot_count;
+        ring->write_seq = 0;
+        ring->futex_word = 0;
+        ring->waiters = 0;
+        ring->version = SHM_RING_VERSION;
+        __atomic_store_n(&ring->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&publish_lock);
+    publish_ring = ring;
+    publish_size = size;
+    __atomic_store_n(&publishing, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&publish_lock);
+
+    return 0;
+}
+
+// Stops publishing. The ring is left in place for subscribers to finish reading.
+void shmring_publish_stop() {
+    pthread_mutex_lock(&publish_lock);
+
+    if (publishing) {
+        __atomic_store_n(&publishing, 0, __ATOMIC_RELEASE);
+        munmap(publish_ring, publish_size);
+        publish_ring = NULL;
+        free_published_directories();
+    }
+
+    pthread_mutex_unlock(&publish_lock);
+}
+
+static struct published_directory* published_directory(int wd) {
+    struct published_directory* directory;
+    HASH_FIND_INT(published_directories, &wd, directory);
+
+    if (directory == NULL) {
+        char path[PATH_MAX];
+        char resolved[PATH_MAX];
+
+        int kernel_wd = watch_table_kernel_wd(wd);
+        if (kernel_wd == -2 || watch_table_path(wd, path, sizeof(path)) != 0) {
+            return NULL;
+        }
+
+        directory = (struct published_directory*) malloc(sizeof(struct published_directory));
+        if (directory == NULL) {
+            return NULL;
+        }
+
+        // Subscribed watches are left out, so a process that both publishes and subscribes doesn't feed itself.
+        // They keep a NULL path; ids are never reused, so that can't go stale.
+        directory->wd = wd;
+        directory->path = kernel_wd == -3 ? NULL : strdup(realpath(path, resolved) ? resolved : path);
+        directory->length = directory->path ? strlen(directory->path) : 0;
+
+        if (directory->path == NULL && kernel_wd != -3) {
+            free(directory);
+            return NULL;
+        }
+
+        HASH_ADD_INT(published_directories, wd, directory);
+    }
+
+    return directory;
+}
+
+// Writes an event into the next slot of the ring, overwriting the oldest if subscribers haven't kept up.
+// Only called from the notifier thread, so there's a single writer.
+void shmring_publish(const struct inotify_event* event) {
+    if (!__atomic_load_n(&publishing, __ATOMIC_ACQUIRE) || event->wd < 0 || !(event->mask & IN_ALL_EVENTS)) {
+        return;
+    }
+
+    pthread_mutex_lock(&publish_lock);
+
+    struct published_directory* directory = publishing ? published_directory(event->wd) : NULL;
+    const char* name = event->len > 0 ? event->name : "";
+    size_t name_length = strlen(name);
+
+    if (directory && directory->path && sizeof(struct shm_ring_slot) + directory->length + name_length <= publish_ring->slot_size) {
+        struct shm_ring_header* ring = publish_ring;
+        uint64_t seq = ring->write_seq;
+        struct shm_ring_slot* slot = ring_slot(ring, seq);
+
+        // Readers that see 0 (or a changed seq after copying) know the slot was being rewritten under them
+        __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        slot->mask = event->mask;
+        slot->cookie = event->cookie;
+        slot->directory_length = (uint16_t) directory->length;
+        slot->name_length = (uint16_t) name_length;
+        memcpy((char*) slot + sizeof(struct shm_ring_slot), directory->path, directory->length);
+        memcpy((char*) slot + sizeof(struct shm_ring_slot) + directory->length, name, name_length);
+
+        __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->write_seq, seq + 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&ring->futex_word, 1, __ATOMIC_RELEASE);
+
+        if (__atomic_load_n(&ring->waiters, __ATOMIC_ACQUIRE) > 0) {
+            futex_wake(&ring->futex_word);
+        }
+    }
+
+    pthread_mutex_unlock(&publish_lock);
+}
+
+static void append_subscribed(char** batch, size_t* length, size_t* capacity, int wd, uint32_t mask, uint32_t cookie, const char* name, size_t name_length) {
+    size_t padded = name_length == 0 ? 0 : (name_length + 1 + sizeof(struct inotify_event) - 1) & ~(sizeof(struct inotify_event) - 1);
+    size_t size = sizeof(struct inotify_event) + padded;
+
+    if (*length + size > *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 65536;
+        while (grown_capacity < *length + size) {
+            grown_capacity *= 2;
+        }
+
+        char* grown = (char*) realloc(*batch, grown_capacity);
+        if (grown == NULL) {
+            return;
+        }
+
+        *batch = grown;
+        *capacity = grown_capacity;
+    }
+
+    struct inotify_event* event = (struct inotify_event*) (*batch + *length);
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = (uint32_t) padded;
+    memset(event->name, 0, padded);
+    memcpy(event->name, name, name_length);
+
+    *length += size;
+}
+
+// Reads events off the ring as they're published, and injects the ones for subscribed directories into this
+// process's notifier so they reach the same callbacks
+static void* run_subscriber(void* _vargp) {
+    (void) _vargp;
+
+    struct shm_ring_header* ring = subscribe_ring;
+    uint64_t next = subscribed_from;
+    char slot_copy[SHM_SLOT_SIZE + 1];
+    char* batch = NULL;
+    size_t batch_length = 0;
+    size_t batch_capacity = 0;
+
+    while (!subscriber_stopping) {
+        uint32_t futex_word = __atomic_load_n(&ring->futex_word, __ATOMIC_ACQUIRE);
+        uint64_t written = __atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE);
+
+        if (written == next) {
+            __atomic_add_fetch(&ring->waiters, 1, __ATOMIC_ACQ_REL);
+            futex_wait(&ring->futex_word, futex_word, 250);
+            __atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_ACQ_REL);
+            continue;
+        }
+
+        // Fell a whole ring behind: everything older than the oldest slot is gone
+        if (written - next > ring->slot_count) {
+            uint64_t oldest = written - ring->slot_count;
+            __atomic_add_fetch(&overruns, oldest - next, __ATOMIC_RELAXED);
+            next = oldest;
+        }
+
+        for (; next < written; next++) {
+            struct shm_ring_slot* slot = ring_slot(ring, next);
+            uint64_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+            if (before == 0 || before < next + 1) { // Still being written
+                break;
+            }
+
+            if (before == next + 1) {
+                memcpy(slot_copy, slot, SHM_SLOT_SIZE);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            }
+
+            if (before != next + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != before) { // Overwritten while we read it
+                __atomic_add_fetch(&overruns, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            struct shm_ring_slot* copy = (struct shm_ring_slot*) slot_copy;
+            if (sizeof(struct shm_ring_slot) + copy->directory_length + copy->name_length > SHM_SLOT_SIZE) {
+                continue;
+            }
+
+            char* directory = slot_copy + sizeof(struct shm_ring_slot);
+            char* name = directory + copy->directory_length;
+            char saved = name[0];
+            name[0] = '\0';
+            int wd = watch_table_find(directory);
+            name[0] = saved;
+
+            if (wd < 0 || watch_table_kernel_wd(wd) != -3) { // Only subscribed watches are fed from the ring
+                continue;
+            }
+
+            // The publisher may watch for more than this process subscribed to
+            uint32_t bits = copy->mask & IN_ALL_EVENTS & (uint32_t) watch_table_flags(wd);
+            if (bits == 0) {
+                continue;
+            }
+
+            append_subscribed(&batch, &batch_length, &batch_capacity, wd, (copy->mask & ~IN_ALL_EVENTS) | bits, copy->cookie, name, copy->name_length);
+        }
+
+        if (batch_length > 0) {
+            notifier_inject(batch, batch_length);
+            batch_length = 0;
+        }
+
+        if (next < written) { // Caught up with a slot mid-write; give the publisher a moment
+            struct timespec pause = { 0, 100000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    free(batch);
+    return NULL;
+}
+
+// Starts reading events from the ring a publisher created under name, from the next event it publishes.
+// Events are delivered for directories added as subscribed watches. Returns 0 on success.
+int shmring_subscribe_start(const char* name) {
+    char path[PATH_MAX];
+    if (ring_path(name, path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    shmring_subscribe_stop();
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t) st.st_size;
+    struct shm_ring_header* ring = (struct shm_ring_header*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+
+    if (!ring_valid(ring, size)) {
+        munmap(ring, size);
+        return -1;
+    }
+
+    // Taken here rather than on the thread, so nothing published once this returns is missed
+    subscribe_ring = ring;
+    subscribe_size = size;
+    subscribed_from = __atomic_load_n(&ring->write_seq, __ATOMIC_ACQUIRE);
+    subscriber_stopping = 0;
+
+    if (pthread_create(&subscriber_thread, NULL, run_subscriber, NULL) != 0) {
+        munmap(ring, size);
+        subscribe_ring = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void shmring_subscribe_stop() {
+    if (subscribe_ring == NULL) {
+        return;
+    }
+
+    subscriber_stopping = 1;
+    pthread_join(subscriber_thread, NULL);
+
+    munmap(subscribe_ring, subscribe_size);
+    subscribe_ring = NULL;
+}
+
+int shmring_subscribed() {
+    return subscribe_ring != NULL;
+}
+
+// Returns how many events this subscriber lost because the publisher overwrote them before they were read
+uint64_t shmring_overruns() {
+    return __atomic_load_n(&overruns, __ATOMIC_RELAXED);
+}
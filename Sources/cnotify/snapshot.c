@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "snapshot.h"
+#include "types.h"
+#include "util.h"
+#include "watches.h"
+#include "dirscan.h"
+#include "hashtable.h"
+#include "notify.h"
+#include "uthash.h"
+
+#define SNAPSHOT_MAGIC 0x534E5753 // "SWNS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MIN_CAPACITY 64
+#define SNAPSHOT_SCAN_WORKERS 4
+
+struct snapshot_scan_job {
+    int wd;
+    int has_baseline;
+    long long tracked_ns;   // When the directory started being watched again; anything changed since has events of its own
+    char path[4096];
+    struct snapshot_scan_job* next;
+};
+
+struct snapshot_change {
+    uint32_t mask;
+    char name[256];
+};
+
+static char snapshot_directory[4096];
+static volatile int enabled = 0;
+
+static struct snapshot_index* indexes = NULL;
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Catch-up scans run on a small pool so registering many directories at once rescans them in parallel
+static pthread_t scan_workers[SNAPSHOT_SCAN_WORKERS];
+static int scan_workers_started = 0;
+static struct snapshot_scan_job* scan_head = NULL;
+static struct snapshot_scan_job* scan_tail = NULL;
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_wake = PTHREAD_COND_INITIALIZER;
+
+static struct snapshot_entry* entries_of(struct snapshot_index* index) {
+    return (struct snapshot_entry*) (index->header + 1);
+}
+
+// Lower bound of (hash, name) in the index; *found is set if the entry at the returned position matches
+static uint64_t find_position(struct snapshot_index* index, uint64_t hash, const char* name, int* found) {
+    struct snapshot_entry* entries = entries_of(index);
+    uint64_t low = 0;
+    uint64_t high = index->header->count;
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (compare_snapshot_key(hash, name, &entries[middle]) > 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    *found = low < index->header->count && compare_snapshot_key(hash, name, &entries[low]) == 0;
+    return low;
+}
+
+static int ensure_capacity(struct snapshot_index* index, uint64_t needed) {
+    if (needed <= index->header->capacity) {
+        return 0;
+    }
+
+    uint64_t capacity = index->header->capacity < SNAPSHOT_MIN_CAPACITY ? SNAPSHOT_MIN_CAPACITY : index->header->capacity;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    size_t size = sizeof(struct snapshot_header) + capacity * sizeof(struct snapshot_entry);
+    if (ftruncate(index->fd, (off_t) size) != 0) {
+        return -1;
+    }
+
+    void* mapped = mremap(index->header, index->mapped_size, size, MREMAP_MAYMOVE);
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+
+    index->header = (struct snapshot_header*) mapped;
+    index->mapped_size = size;
+    index->header->capacity = capacity;
+
+    return 0;
+}
+
+// Maps the index for a directory, creating it if needed. *has_baseline is set if it already held a previous snapshot.
+static struct snapshot_index* open_index(int wd, const char* path, int* has_baseline) {
+    char resolved[PATH_MAX];
+    if (realpath(path, resolved) == NULL) {
+        return NULL;
+    }
+
+    char filename[4096 + 32];
+    snprintf(filename, sizeof(filename), "%s/%016llx.snap", snapshot_directory, (unsigned long long) name_hash64(resolved));
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    *has_baseline = 1;
+
+    if (size < sizeof(struct snapshot_header)) {
+        size = sizeof(struct snapshot_header) + SNAPSHOT_MIN_CAPACITY * sizeof(struct snapshot_entry);
+        if (ftruncate(fd, (off_t) size) != 0) {
+            close(fd);
+            return NULL;
+        }
+        *has_baseline = 0;
+    }
+
+    void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    struct snapshot_header* header = (struct snapshot_header*) mapped;
+    uint64_t capacity = (size - sizeof(struct snapshot_header)) / sizeof(struct snapshot_entry);
+
+    // Fresh file, or one written by an incompatible version (or left before its first scan finished): start over without
+    // a baseline. The magic is only written once a scan has filled the index.
+    if (!*has_baseline || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION
+        || header->entry_size != sizeof(struct snapshot_entry) || header->count > capacity) {
+        header->magic = 0;
+        header->version = SNAPSHOT_VERSION;
+        header->entry_size = sizeof(struct snapshot_entry);
+        header->reserved = 0;
+        header->count = 0;
+        *has_baseline = 0;
+    }
+    header->capacity = capacity;
+
+    struct snapshot_index* index = (struct snapshot_index*) malloc(sizeof(struct snapshot_index));
+    if (index == NULL) {
+        munmap(mapped, size);
+        close(fd);
+        return NULL;
+    }
+
+    index->wd = wd;
+    index->fd = fd;
+    index->header = header;
+    index->mapped_size = size;
+    index->scan = 0;
+    index->touched = NULL;
+    index->touched_count = 0;
+    index->touched_capacity = 0;
+    pthread_mutex_init(&index->lock, NULL);
+
+    return index;
+}
+
+static void close_index(struct snapshot_index* index) {
+    msync(index->header, index->mapped_size, MS_ASYNC);
+    munmap(index->header, index->mapped_size);
+    close(index->fd);
+    pthread_mutex_destroy(&index->lock);
+    free(index->touched);
+    free(index);
+}
+
+static void add_change(struct snapshot_change** changes, size_t* count, size_t* capacity, uint32_t mask, const char* name) {
+    if (*count == *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 16;
+        struct snapshot_change* grown = (struct snapshot_change*) realloc(*changes, grown_capacity * sizeof(struct snapshot_change));
+        if (grown == NULL) {
+            return;
+        }
+        *changes = grown;
+        *capacity = grown_capacity;
+    }
+
+    (*changes)[*count].mask = mask;
+    terminated_strncpy((*changes)[*count].name, name, sizeof((*changes)[*count].name));
+    (*count)++;
+}
+
+static int compare_hashes(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*) a;
+    uint64_t right = *(const uint64_t*) b;
+    return left < right ? -1 : left > right;
+}
+
+// Must be called with index->lock held, and index->touched sorted
+static int touched_during_scan(const struct snapshot_index* index, uint64_t hash) {
+    return index->touched_count > 0 && bsearch(&hash, index->touched, index->touched_count, sizeof(uint64_t), compare_hashes) != NULL;
+}
+
+// Must be called with index->lock held. Notes a name an event changed while a catch-up scan is running.
+static void touch_during_scan(struct snapshot_index* index, uint64_t hash) {
+    if (index->touched_count == index->touched_capacity) {
+        size_t capacity = index->touched_capacity ? index->touched_capacity * 2 : 16;
+        uint64_t* grown = (uint64_t*) realloc(index->touched, capacity * sizeof(uint64_t));
+        if (grown == NULL) {
+            return;
+        }
+        index->touched = grown;
+        index->touched_capacity = capacity;
+    }
+
+    index->touched[index->touched_count++] = hash;
+}
+
+// Diffs the directory against its stored snapshot, replaces the snapshot, and queues what changed while nobody was
+// watching on the notifier, as create, delete and modify records. The directory is read without holding any lock, so
+// events keep being recorded meanwhile; names they touch keep the state the events gave them and aren't reported,
+// since the events themselves already were. The same goes for files written after the watch was added, whose events
+// may not have been read yet.
+static void catch_up(const struct snapshot_scan_job* job) {
+    static uint64_t next_scan = 0;
+    uint64_t scan = __atomic_add_fetch(&next_scan, 1, __ATOMIC_RELAXED);
+
+    pthread_rwlock_rdlock(&index_lock);
+
+    struct snapshot_index* index;
+    HASH_FIND_INT(indexes, &job->wd, index);
+
+    if (index == NULL) { // Untracked before the scan got to it
+        pthread_rwlock_unlock(&index_lock);
+        return;
+    }
+
+    // The baseline as it was before any of the scan, to report against
+    pthread_mutex_lock(&index->lock);
+    uint64_t previous_count = job->has_baseline ? index->header->count : 0;
+    struct snapshot_entry* previous = (struct snapshot_entry*) malloc((previous_count ? previous_count : 1) * sizeof(struct snapshot_entry));
+    if (previous) {
+        memcpy(previous, entries_of(index), previous_count * sizeof(struct snapshot_entry));
+        index->scan = scan;
+        index->touched_count = 0;
+    }
+    pthread_mutex_unlock(&index->lock);
+    pthread_rwlock_unlock(&index_lock);
+
+    struct snapshot_entry* current = NULL;
+    long current_count = previous ? scan_directory(job->path, &current) : -1;
+
+    pthread_rwlock_rdlock(&index_lock);
+    HASH_FIND_INT(indexes, &job->wd, index);
+
+    if (index) {
+        pthread_mutex_lock(&index->lock);
+
+        // Untracked (and maybe tracked again, with a scan of its own) while this one ran
+        if (index->scan != scan) {
+            pthread_mutex_unlock(&index->lock);
+            index = NULL;
+        }
+    }
+
+    if (index == NULL || current_count < 0) {
+        if (index) {
+            index->scan = 0;
+            pthread_mutex_unlock(&index->lock);
+        }
+        pthread_rwlock_unlock(&index_lock);
+        free(previous);
+        free(current);
+        return;
+    }
+
+    qsort(index->touched, index->touched_count, sizeof(uint64_t), compare_hashes);
+
+    struct snapshot_change* changes = NULL;
+    size_t change_count = 0;
+    size_t change_capacity = 0;
+    uint64_t i = 0;
+    long j = 0;
+
+    while (i < previous_count || j < current_count) {
+        int order = i >= previous_count ? 1 : j >= current_count ? -1 : compare_snapshot_entries(&previous[i], &current[j]);
+        const struct snapshot_entry* entry = order <= 0 ? &previous[i] : &current[j];
+
+        if (!job->has_baseline || touched_during_scan(index, entry->name_hash) || (order >= 0 && current[j].mtime_ns >= job->tracked_ns)) {
+            // Nothing to compare against, or reported by its own events
+        }
+        else if (order < 0) {
+            add_change(&changes, &change_count, &change_capacity, IN_DELETE, previous[i].name);
+        }
+        else if (order > 0) {
+            add_change(&changes, &change_count, &change_capacity, IN_CREATE, current[j].name);
+        }
+        else if (previous[i].inode != current[j].inode) { // Replaced by a different file with the same name
+            add_change(&changes, &change_count, &change_capacity, IN_DELETE, previous[i].name);
+            add_change(&changes, &change_count, &change_capacity, IN_CREATE, current[j].name);
+        }
+        else if (previous[i].size != current[j].size || previous[i].mtime_ns != current[j].mtime_ns) {
+            add_change(&changes, &change_count, &change_capacity, IN_MODIFY, current[j].name);
+        }
+
+        i += order <= 0;
+        j += order >= 0;
+    }
+
+    // The scan becomes the snapshot, except for the names events touched since it started, which the index already has
+    // right. Both are sorted the same way, so they merge in one pass.
+    struct snapshot_entry* live = entries_of(index);
+    uint64_t live_count = index->header->count;
+    struct snapshot_entry* merged = (struct snapshot_entry*) malloc((size_t) (live_count + (uint64_t) current_count + 1) * sizeof(struct snapshot_entry));
+    uint64_t merged_count = 0;
+
+    for (uint64_t l = 0, c = 0; merged && (l < live_count || c < (uint64_t) current_count);) {
+        int order = l >= live_count ? 1 : c >= (uint64_t) current_count ? -1 : compare_snapshot_entries(&live[l], &current[c]);
+        const struct snapshot_entry* entry = order <= 0 ? &live[l] : &current[c];
+        int touched = touched_during_scan(index, entry->name_hash);
+
+        if (touched && order <= 0) {
+            merged[merged_count++] = live[l];
+        }
+        else if (!touched && order >= 0) {
+            merged[merged_count++] = current[c];
+        }
+
+        l += order <= 0;
+        c += order >= 0;
+    }
+
+    if (merged && ensure_capacity(index, merged_count) == 0) {
+        memcpy(entries_of(index), merged, (size_t) merged_count * sizeof(struct snapshot_entry));
+        index->header->count = merged_count;
+        index->header->magic = SNAPSHOT_MAGIC;
+    }
+
+    index->scan = 0;
+    index->touched_count = 0;
+    pthread_mutex_unlock(&index->lock);
+    pthread_rwlock_unlock(&index_lock);
+
+    free(merged);
+    free(previous);
+    free(current);
+
+    // Routed like any other event, so they go through rate limits, lanes and every kind of callback. A watch that only
+    // asked for close-writes hears about modified files that way.
+    uint32_t modify_mask = (watch_table_flags(job->wd) & IN_MODIFY) ? IN_MODIFY : IN_CLOSE_WRITE;
+    for (size_t k = 0; k < change_count; k++) {
+        notifier_inject_event(job->wd, changes[k].mask == IN_MODIFY ? modify_mask : changes[k].mask, 0, changes[k].name);
+    }
+
+    free(changes);
+}
+
+static void* run_scan_worker(void* _vargp) {
+    (void) _vargp;
+
+    while (1) {
+        pthread_mutex_lock(&scan_lock);
+        while (scan_head == NULL) {
+            pthread_cond_wait(&scan_wake, &scan_lock);
+        }
+
+        struct snapshot_scan_job* job = scan_head;
+        scan_head = job->next;
+        if (scan_head == NULL) {
+            scan_tail = NULL;
+        }
+        pthread_mutex_unlock(&scan_lock);
+
+        catch_up(job);
+        free(job);
+    }
+
+    return NULL;
+}
+
+static void queue_scan(int wd, const char* path, int has_baseline) {
+    struct snapshot_scan_job* job = (struct snapshot_scan_job*) malloc(sizeof(struct snapshot_scan_job));
+    if (job == NULL) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    job->wd = wd;
+    job->has_baseline = has_baseline;
+    job->tracked_ns = (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+    job->next = NULL;
+    terminated_strncpy(job->path, path, sizeof(job->path));
+
+    pthread_mutex_lock(&scan_lock);
+
+    if (!scan_workers_started) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        for (int i = 0; i < SNAPSHOT_SCAN_WORKERS; i++) {
+            pthread_create(&scan_workers[i], &attr, run_scan_worker, NULL);
+        }
+
+        pthread_attr_destroy(&attr);
+        scan_workers_started = 1;
+    }
+
+    if (scan_tail) {
+        scan_tail->next = job;
+    }
+    else {
+        scan_head = job;
+    }
+    scan_tail = job;
+
+    pthread_cond_signal(&scan_wake);
+    pthread_mutex_unlock(&scan_lock);
+}
+
+// Sets the directory snapshot indexes are kept in and enables them, or disables them if directory is NULL
+int snapshot_set_directory(const char* directory) {
+    pthread_rwlock_wrlock(&index_lock);
+
+    struct snapshot_index *current, *tmp;
+    HASH_ITER(hh, indexes, current, tmp) {
+        HASH_DEL(indexes, current);
+        close_index(current);
+    }
+
+    enabled = 0;
+
+    if (directory != NULL) {
+        if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+            pthread_rwlock_unlock(&index_lock);
+            return -1;
+        }
+
+        terminated_strncpy(snapshot_directory, directory, sizeof(snapshot_directory));
+        enabled = 1;
+    }
+
+    pthread_rwlock_unlock(&index_lock);
+    return 0;
+}
+
+int snapshot_enabled() {
+    return enabled;
+}
+
+// Starts keeping a snapshot for a watched directory, reporting anything that changed since the last one was saved
+void snapshot_track(int wd, const char* path) {
+    if (!enabled) return;
+
+    pthread_rwlock_wrlock(&index_lock);
+
+    struct snapshot_index* index;
+    HASH_FIND_INT(indexes, &wd, index);
+
+    if (index != NULL) { // Already tracked, e.g. addNotifier called again to change the event mask
+        pthread_rwlock_unlock(&index_lock);
+        return;
+    }
+
+    int has_baseline = 0;
+    index = open_index(wd, path, &has_baseline);
+
+    if (index == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        fprintf(stderr, "[SWNotify] Failed to open snapshot index for %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    HASH_ADD_INT(indexes, wd, index);
+    pthread_rwlock_unlock(&index_lock);
+
+    queue_scan(wd, path, has_baseline);
+}
+
+void snapshot_untrack(int wd) {
+    pthread_rwlock_wrlock(&index_lock);
+
+    struct snapshot_index* index;
+    HASH_FIND_INT(indexes, &wd, index);
+
+    if (index) {
+        HASH_DEL(indexes, index);
+        close_index(index);
+    }
+
+    pthread_rwlock_unlock(&index_lock);
+}
+
+// Applies a single event to the snapshot of the directory it happened in, including ones a rate limit goes on to shed;
+// otherwise the next catch-up would report those changes again.
+void snapshot_record(int wd, const char* name, uint32_t mask) {
+    if (!enabled || name[0] == '\0') return;
+
+    int removal = mask & (IN_DELETE | IN_MOVED_FROM);
+    if (!removal && !(mask & (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO))) {
+        return;
+    }
+
+    pthread_rwlock_rdlock(&index_lock);
+
+    struct snapshot_index* index;
+    HASH_FIND_INT(indexes, &wd, index);
+
+    if (index == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        return;
+    }
+
+    struct stat st;
+    if (!removal) {
+        char path[4096];
+        removal = join_watch_path(wd, name, path, sizeof(path)) != 0 || lstat(path, &st) != 0;
+    }
+
+    uint64_t hash = name_hash64(name);
+    int found = 0;
+
+    pthread_mutex_lock(&index->lock);
+    uint64_t position = find_position(index, hash, name, &found);
+
+    if (index->scan != 0) {
+        touch_during_scan(index, hash);
+    }
+
+    if (removal) {
+        if (found) {
+            struct snapshot_entry* entries = entries_of(index);
+            memmove(&entries[position], &entries[position + 1], (index->header->count - position - 1) * sizeof(struct snapshot_entry));
+            index->header->count--;
+        }
+    }
+    else if (found) {
+        fill_snapshot_entry(&entries_of(index)[position], name, hash, &st);
+    }
+    else if (ensure_capacity(index, index->header->count + 1) == 0) {
+        struct snapshot_entry* entries = entries_of(index);
+        memmove(&entries[position + 1], &entries[position], (index->header->count - position) * sizeof(struct snapshot_entry));
+        fill_snapshot_entry(&entries[position], name, hash, &st);
+        index->header->count++;
+    }
+
+    pthread_mutex_unlock(&index->lock);
+    pthread_rwlock_unlock(&index_lock);
+}
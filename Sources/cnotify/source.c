@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "source.h"
+#include "notify.h"
+#include "types.h"
+
+#define MAX_SYNTHETIC_NAMES 65536
+#define SYNTHETIC_NAME_SIZE 16 // Room for the padded name of every synthetic record, so each one is the same size
+
+// Generates records in memory instead of reading them from the kernel. Its eventfd is kept readable until the limit
+// is reached, so the notifier thread reads from it as fast as it can dispatch.
+struct synthetic_source {
+    int event_fd;
+    int wd;
+    struct synthetic_mix mix;
+    uint32_t mix_total;
+    int name_count;
+    uint64_t limit; // 0 for no limit
+    uint64_t generated;
+    uint64_t rng;
+    uint32_t next_cookie;
+    pthread_mutex_t lock;
+};
+
+static int inotify_source_fd(void* context) {
+    (void) context;
+    return notifier_fd();
+}
+
+static long inotify_source_read(void* context, char* buffer, size_t length) {
+    (void) context;
+    return (long) read(notifier_fd(), buffer, length);
+}
+
+static struct event_source inotify_source = { inotify_source_fd, inotify_source_read, 1, NULL };
+
+static struct synthetic_source synthetic = { .event_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int synthetic_source_fd(void* context) {
+    return ((struct synthetic_source*) context)->event_fd;
+}
+
+// xorshift64*
+static uint64_t next_random(struct synthetic_source* source) {
+    source->rng ^= source->rng >> 12;
+    source->rng ^= source->rng << 25;
+    source->rng ^= source->rng >> 27;
+    return source->rng * 2685821657736338717ULL;
+}
+
+static size_t write_record(char* out, int wd, uint32_t mask, uint32_t cookie, uint32_t name_index) {
+    struct inotify_event* event = (struct inotify_event*) out;
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = SYNTHETIC_NAME_SIZE;
+    memset(event->name, 0, SYNTHETIC_NAME_SIZE);
+    snprintf(event->name, SYNTHETIC_NAME_SIZE, "f%u", name_index);
+
+    return sizeof(struct inotify_event) + SYNTHETIC_NAME_SIZE;
+}
+
+static long synthetic_source_read(void* context, char* buffer, size_t length) {
+    struct synthetic_source* source = (struct synthetic_source*) context;
+    const size_t record_size = sizeof(struct inotify_event) + SYNTHETIC_NAME_SIZE;
+    size_t used = 0;
+
+    pthread_mutex_lock(&source->lock);
+
+    // A move is two records, so always leave room for both
+    while (used + 2 * record_size <= length && (source->limit == 0 || source->generated < source->limit)) {
+        uint64_t random = next_random(source);
+        uint32_t name_index = (uint32_t) (random >> 32) % (uint32_t) source->name_count;
+        uint32_t pick = (uint32_t) random % source->mix_total;
+
+        if (pick < source->mix.create) {
+            used += write_record(buffer + used, source->wd, IN_CREATE, 0, name_index);
+        }
+        else if ((pick -= source->mix.create) < source->mix.remove) {
+            used += write_record(buffer + used, source->wd, IN_DELETE, 0, name_index);
+        }
+        else if ((pick -= source->mix.remove) < source->mix.modify) {
+            used += write_record(buffer + used, source->wd, IN_MODIFY, 0, name_index);
+        }
+        else if ((pick -= source->mix.modify) < source->mix.move) {
+            uint32_t cookie = ++source->next_cookie;
+            used += write_record(buffer + used, source->wd, IN_MOVED_FROM, cookie, name_index);
+            used += write_record(buffer + used, source->wd, IN_MOVED_TO, cookie, (name_index + 1) % (uint32_t) source->name_count);
+        }
+        else {
+            used += write_record(buffer + used, source->wd, IN_MOVED_FROM, ++source->next_cookie, name_index);
+        }
+
+        source->generated++;
+    }
+
+    if (source->limit != 0 && source->generated >= source->limit) {
+        uint64_t count;
+        while (read(source->event_fd, &count, sizeof(count)) > 0); // Exhausted; stop the notifier thread from spinning on it
+    }
+
+    pthread_mutex_unlock(&source->lock);
+    return (long) used;
+}
+
+static struct event_source synthetic_event_source = { synthetic_source_fd, synthetic_source_read, 0, &synthetic };
+
+static const struct event_source* current_source = &inotify_source;
+
+const struct event_source* source_current() {
+    return __atomic_load_n(&current_source, __ATOMIC_ACQUIRE);
+}
+
+void source_use_inotify() {
+    __atomic_store_n(&current_source, &inotify_source, __ATOMIC_RELEASE);
+    notifier_wake(); // So a host polling the pump descriptor picks up the switch
+}
+
+// Switches the notifier to generating records for watch wd, in proportions given by mix, with names drawn from
+// name_count distinct files. Stops after limit records (moves count as one), or never if limit is 0.
+// Returns 0 on success.
+int source_use_synthetic(int wd, const struct synthetic_mix* mix, int name_count, uint64_t limit, uint64_t seed) {
+    uint32_t total = mix->create + mix->remove + mix->modify + mix->move + mix->move_out;
+    if (total == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&synthetic.lock);
+
+    if (synthetic.event_fd < 0) {
+        synthetic.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (synthetic.event_fd < 0) {
+            pthread_mutex_unlock(&synthetic.lock);
+            return -1;
+        }
+    }
+
+    synthetic.wd = wd;
+    synthetic.mix = *mix;
+    synthetic.mix_total = total;
+    synthetic.name_count = name_count < 1 ? 1 : name_count > MAX_SYNTHETIC_NAMES ? MAX_SYNTHETIC_NAMES : name_count;
+    synthetic.limit = limit;
+    synthetic.generated = 0;
+    synthetic.rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+
+    uint64_t one = 1;
+    if (write(synthetic.event_fd, &one, sizeof(one)) < 0) {
+        fprintf(stderr, "[SWNotify] Failed to start synthetic events\n");
+    }
+
+    pthread_mutex_unlock(&synthetic.lock);
+
+    __atomic_store_n(&current_source, &synthetic_event_source, __ATOMIC_RELEASE);
+    notifier_wake();
+    return 0;
+}
+
+uint64_t source_synthetic_generated() {
+    pthread_mutex_lock(&synthetic.lock);
+    uint64_t generated = synthetic.generated;
+    pthread_mutex_unlock(&synthetic.lock);
+
+    return generated;
+}
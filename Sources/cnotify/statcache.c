@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "statcache.h"
+#include "hashtable.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+#define MIN_CAPACITY 1024
+
+// Past this many files, new ones are looked up without being cached rather than growing the table further
+#define MAX_ENTRIES 262144
+
+struct statcache_watch {
+    int wd;
+    UT_hash_handle hh;
+};
+
+// One table for every watched directory, keyed by (wd, name). Hits only take the read lock; misses stat outside
+// any lock and then insert under the write lock, unless something was invalidated in between.
+static struct stat_entry* slots = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+static struct statcache_watch* watched = NULL;
+static int watched_count = 0;
+static uint64_t generation = 0; // Bumped by every invalidation
+static pthread_rwlock_t statcache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct statcache_stats stats = { 0 };
+
+static uint64_t key_hash(int wd, const char* name) {
+    return watch_name_hash64(wd, name, strlen(name));
+}
+
+// Must be called with statcache_lock held. Returns the slot holding (wd, name), or the empty slot it would go in.
+static size_t find_slot(uint64_t hash, int wd, const char* name) {
+    size_t mask = capacity - 1;
+    size_t slot = (size_t) hash & mask;
+
+    while (slots[slot].name != NULL && (slots[slot].hash != hash || slots[slot].wd != wd || strcmp(slots[slot].name, name) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+// Rebuilds the table at new_capacity, leaving out wd's entries (pass -1 to keep them all)
+static int rebuild(size_t new_capacity, int dropped_wd) {
+    struct stat_entry* grown = (struct stat_entry*) calloc(new_capacity, sizeof(struct stat_entry));
+    if (grown == NULL) {
+        return -1;
+    }
+
+    struct stat_entry* previous = slots;
+    size_t previous_capacity = capacity;
+    slots = grown;
+    capacity = new_capacity;
+    count = 0;
+
+    for (size_t i = 0; i < previous_capacity; i++) {
+        if (previous[i].name == NULL) {
+            continue;
+        }
+
+        if (previous[i].wd == dropped_wd) {
+            free(previous[i].name);
+            continue;
+        }
+
+        slots[find_slot(previous[i].hash, previous[i].wd, previous[i].name)] = previous[i];
+        count++;
+    }
+
+    free(previous);
+    return 0;
+}
+
+static void clear() {
+    for (size_t i = 0; i < capacity; i++) {
+        free(slots[i].name);
+    }
+
+    free(slots);
+    slots = NULL;
+    capacity = 0;
+    count = 0;
+}
+
+static int slot_hash_at(void* context, size_t slot, uint64_t* hash) {
+    (void) context;
+
+    if (slots[slot].name == NULL) {
+        return 0;
+    }
+
+    *hash = slots[slot].hash;
+    return 1;
+}
+
+static void slot_move(void* context, size_t from, size_t to) {
+    (void) context;
+    slots[to] = slots[from];
+    slots[from].name = NULL;
+}
+
+// Must be called with the write lock held
+static void invalidate(int wd, const char* name) {
+    generation++;
+
+    if (capacity == 0) {
+        return;
+    }
+
+    size_t slot = find_slot(key_hash(wd, name), wd, name);
+    if (slots[slot].name == NULL) {
+        return;
+    }
+
+    free(slots[slot].name);
+    slots[slot].name = NULL;
+    count--;
+    __atomic_add_fetch(&stats.invalidations, 1, __ATOMIC_RELAXED);
+
+    struct probe_table table = { NULL, capacity - 1, slot_hash_at, slot_move };
+    table_backshift(&table, slot);
+}
+
+// Starts caching the attributes of files in wd's directory. Returns 0 on success.
+int statcache_track(int wd) {
+    pthread_rwlock_wrlock(&statcache_lock);
+
+    struct statcache_watch* watch;
+    HASH_FIND_INT(watched, &wd, watch);
+
+    if (watch == NULL) {
+        watch = (struct statcache_watch*) malloc(sizeof(struct statcache_watch));
+        if (watch == NULL) {
+            pthread_rwlock_unlock(&statcache_lock);
+            return -1;
+        }
+
+        watch->wd = wd;
+        HASH_ADD_INT(watched, wd, watch);
+        __atomic_add_fetch(&watched_count, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_rwlock_unlock(&statcache_lock);
+    return 0;
+}
+
+void statcache_untrack(int wd) {
+    if (!statcache_active()) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&statcache_lock);
+
+    struct statcache_watch* watch;
+    HASH_FIND_INT(watched, &wd, watch);
+
+    if (watch) {
+        HASH_DEL(watched, watch);
+        free(watch);
+        __atomic_sub_fetch(&watched_count, 1, __ATOMIC_RELAXED);
+
+        generation++;
+        if (capacity > 0 && rebuild(capacity, wd) != 0) {
+            clear();
+        }
+    }
+
+    pthread_rwlock_unlock(&statcache_lock);
+}
+
+int statcache_tracked(int wd) {
+    if (!statcache_active()) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&statcache_lock);
+
+    struct statcache_watch* watch;
+    HASH_FIND_INT(watched, &wd, watch);
+
+    pthread_rwlock_unlock(&statcache_lock);
+    return watch != NULL;
+}
+
+int statcache_active() {
+    return __atomic_load_n(&watched_count, __ATOMIC_RELAXED) > 0;
+}
+
+// Drops the cached attributes of the file an event is about. Even an event a rate limit sheds means the file changed,
+// so the entry has to go either way. A queue overflow means events were lost, so everything is dropped.
+void statcache_record(const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        pthread_rwlock_wrlock(&statcache_lock);
+        generation++;
+        clear();
+        pthread_rwlock_unlock(&statcache_lock);
+        return;
+    }
+
+    if (event->wd < 0 || event->len == 0 || event->name[0] == '\0' || !(event->mask & STATCACHE_EVENTS)) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&statcache_lock);
+    invalidate(event->wd, event->name);
+    pthread_rwlock_unlock(&statcache_lock);
+}
+
+static void copy_out(const struct stat_entry* entry, struct cached_stat* out) {
+    out->mode = entry->mode;
+    out->inode = entry->inode;
+    out->size = entry->size;
+    out->mtime_ns = entry->mtime_ns;
+}
+
+// Looks up the attributes of name in wd's directory (without following symlinks), from the cache if they're there and
+// with statx otherwise. Directories are never cached, since changes inside them don't reach this directory's watch.
+// Returns 0 on success, or a negative errno.
+int statcache_lookup(int wd, const char* name, struct cached_stat* out) {
+    uint64_t hash = key_hash(wd, name);
+
+    pthread_rwlock_rdlock(&statcache_lock);
+
+    struct statcache_watch* watch;
+    HASH_FIND_INT(watched, &wd, watch);
+
+    if (watch && capacity > 0) {
+        const struct stat_entry* entry = &slots[find_slot(hash, wd, name)];
+        if (entry->name != NULL) {
+            copy_out(entry, out);
+            pthread_rwlock_unlock(&statcache_lock);
+
+            __atomic_add_fetch(&stats.hits, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    int cached = watch != NULL;
+    uint64_t looked_up = generation;
+    pthread_rwlock_unlock(&statcache_lock);
+
+    char path[4096];
+    if (join_watch_path(wd, name, path, sizeof(path)) != 0) {
+        return -ENOENT;
+    }
+
+    struct statx stx;
+    if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) != 0) {
+        return -errno;
+    }
+
+    out->mode = stx.stx_mode;
+    out->inode = stx.stx_ino;
+    out->size = (int64_t) stx.stx_size;
+    out->mtime_ns = (int64_t) stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+
+    if (!cached) {
+        return 0;
+    }
+
+    __atomic_add_fetch(&stats.misses, 1, __ATOMIC_RELAXED);
+
+    if (S_ISDIR(stx.stx_mode)) {
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&statcache_lock);
+
+    // Anything invalidated since the statx may be what it saw, so it's only kept if nothing was
+    if (generation == looked_up && count < MAX_ENTRIES) {
+        if ((count + 1) * 2 > capacity && rebuild(capacity ? capacity * 2 : MIN_CAPACITY, -1) != 0) {
+            pthread_rwlock_unlock(&statcache_lock);
+            return 0;
+        }
+
+        struct stat_entry* entry = &slots[find_slot(hash, wd, name)];
+        if (entry->name == NULL && (entry->name = strdup(name)) != NULL) {
+            entry->hash = hash;
+            entry->wd = wd;
+            entry->mode = out->mode;
+            entry->inode = out->inode;
+            entry->size = out->size;
+            entry->mtime_ns = out->mtime_ns;
+            count++;
+        }
+    }
+
+    pthread_rwlock_unlock(&statcache_lock);
+    return 0;
+}
+
+void statcache_get_stats(struct statcache_stats* out) {
+    out->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    out->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+    out->invalidations = __atomic_load_n(&stats.invalidations, __ATOMIC_RELAXED);
+
+    pthread_rwlock_rdlock(&statcache_lock);
+    out->entries = count;
+    pthread_rwlock_unlock(&statcache_lock);
+}
+
+// Forgets every watch and cached file
+void statcache_stop() {
+    pthread_rwlock_wrlock(&statcache_lock);
+
+    struct statcache_watch *current, *tmp;
+    HASH_ITER(hh, watched, current, tmp) {
+        HASH_DEL(watched, current);
+        free(current);
+    }
+    __atomic_store_n(&watched_count, 0, __ATOMIC_RELAXED);
+
+    generation++;
+    clear();
+
+    pthread_rwlock_unlock(&statcache_lock);
+}
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "subtree.h"
+#include "types.h"
+#include "watches.h"
+#include "uthash.h"
+
+// Matches copied out of the lock on the stack; directories with more subscribers than this allocate
+#define INLINE_ROUTES 16
+
+extern struct callback_collection callbacks;
+
+// Subscriptions live in a trie keyed by path component, so finding every prefix of a directory is one walk down its
+// path however many subscriptions there are. The walk's result is cached per watch until a subscription changes.
+static struct subtree_node root = { 0 };
+static struct subtree_subscription* subscriptions = NULL;
+static struct subtree_match* matches = NULL;
+static uint64_t generation = 1;
+static int next_subscription = 1;
+static int subscription_count = 0;
+static pthread_mutex_t subtree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Resolves path for matching: symlinks, "." and ".." are resolved if it exists, and trailing slashes are dropped
+static void normalize_path(const char* path, char* out, size_t n) {
+    if (realpath(path, out) == NULL) {
+        snprintf(out, n, "%s", path);
+    }
+
+    size_t length = strlen(out);
+    while (length > 1 && out[length - 1] == '/') {
+        out[--length] = '\0';
+    }
+}
+
+// Calls visit for the trie node of each component of path, starting at the root, until a component has no node.
+// With create set, missing nodes are added instead. Returns the deepest node reached.
+static struct subtree_node* walk(const char* path, int create, void (*visit)(struct subtree_node*, void*), void* context) {
+    struct subtree_node* node = &root;
+    if (visit) visit(node, context);
+
+    for (const char* component = path; *component != '\0';) {
+        while (*component == '/') component++;
+        if (*component == '\0') break;
+
+        size_t length = strcspn(component, "/");
+        struct subtree_node* child;
+        HASH_FIND(hh, node->children, component, length, child);
+
+        if (child == NULL) {
+            if (!create) {
+                break;
+            }
+
+            child = (struct subtree_node*) calloc(1, sizeof(struct subtree_node));
+            if (child == NULL || (child->component = strndup(component, length)) == NULL) {
+                free(child);
+                return NULL;
+            }
+
+            child->parent = node;
+            HASH_ADD_KEYPTR(hh, node->children, child->component, length, child);
+        }
+
+        node = child;
+        if (visit) visit(node, context);
+        component += length;
+    }
+
+    return node;
+}
+
+// Frees nodes that no longer lead to a subscription, from node up towards the root
+static void prune(struct subtree_node* node) {
+    while (node != &root && node->subscription_count == 0 && node->children == NULL) {
+        struct subtree_node* parent = node->parent;
+        HASH_DEL(parent->children, node);
+        free(node->component);
+        free(node->subscriptions);
+        free(node);
+        node = parent;
+    }
+}
+
+// Adds a subscription to every event with a bit in mask from watched directories at or under prefix. Directories
+// still need to be watched; this only decides who hears about them. Returns the subscription's id, or -1 on failure.
+int subtree_subscribe(const char* prefix, uint32_t mask) {
+    char path[PATH_MAX];
+    normalize_path(prefix, path, sizeof(path));
+
+    struct subtree_subscription* subscription = (struct subtree_subscription*) malloc(sizeof(struct subtree_subscription));
+    if (subscription == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&subtree_lock);
+
+    struct subtree_node* node = walk(path, 1, NULL, NULL);
+
+    if (node && node->subscription_count == node->subscription_capacity) {
+        int capacity = node->subscription_capacity ? node->subscription_capacity * 2 : 4;
+        int* grown = (int*) realloc(node->subscriptions, (size_t) capacity * sizeof(int));
+
+        if (grown == NULL) {
+            prune(node);
+            node = NULL;
+        }
+        else {
+            node->subscriptions = grown;
+            node->subscription_capacity = capacity;
+        }
+    }
+
+    if (node == NULL) {
+        pthread_mutex_unlock(&subtree_lock);
+        free(subscription);
+        return -1;
+    }
+
+    subscription->id = next_subscription++;
+    subscription->mask = mask;
+    subscription->node = node;
+    node->subscriptions[node->subscription_count++] = subscription->id;
+    HASH_ADD_INT(subscriptions, id, subscription);
+
+    generation++;
+    __atomic_add_fetch(&subscription_count, 1, __ATOMIC_RELAXED);
+
+    int id = subscription->id;
+    pthread_mutex_unlock(&subtree_lock);
+
+    return id;
+}
+
+// Returns 0 on success, -1 if there's no subscription with that id
+int subtree_unsubscribe(int id) {
+    pthread_mutex_lock(&subtree_lock);
+
+    struct subtree_subscription* subscription;
+    HASH_FIND_INT(subscriptions, &id, subscription);
+
+    if (subscription == NULL) {
+        pthread_mutex_unlock(&subtree_lock);
+        return -1;
+    }
+
+    struct subtree_node* node = subscription->node;
+    for (int i = 0; i < node->subscription_count; i++) {
+        if (node->subscriptions[i] == id) {
+            node->subscriptions[i] = node->subscriptions[--node->subscription_count];
+            break;
+        }
+    }
+
+    prune(node);
+    HASH_DEL(subscriptions, subscription);
+    free(subscription);
+
+    generation++;
+    __atomic_sub_fetch(&subscription_count, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&subtree_lock);
+    return 0;
+}
+
+int subtree_active() {
+    return __atomic_load_n(&subscription_count, __ATOMIC_RELAXED) > 0;
+}
+
+static void collect_routes(struct subtree_node* node, void* context) {
+    struct subtree_match* match = (struct subtree_match*) context;
+
+    for (int i = 0; i < node->subscription_count; i++) {
+        struct subtree_subscription* subscription;
+        HASH_FIND_INT(subscriptions, &node->subscriptions[i], subscription);
+
+        struct subtree_route* grown = (struct subtree_route*) realloc(match->routes, (size_t) (match->count + 1) * sizeof(struct subtree_route));
+        if (subscription == NULL || grown == NULL) {
+            continue;
+        }
+
+        match->routes = grown;
+        match->routes[match->count].subscription = subscription->id;
+        match->routes[match->count++].mask = subscription->mask;
+    }
+}
+
+// Must be called with subtree_lock held. Returns wd's cached match, walking the trie again if a subscription has
+// changed since it was cached.
+static struct subtree_match* match_for(int wd) {
+    struct subtree_match* match;
+    HASH_FIND_INT(matches, &wd, match);
+
+    if (match && match->generation == generation) {
+        return match;
+    }
+
+    char path[PATH_MAX];
+    char resolved[PATH_MAX];
+    if (watch_table_path(wd, path, sizeof(path)) != 0) {
+        return NULL;
+    }
+    normalize_path(path, resolved, sizeof(resolved));
+
+    if (match == NULL) {
+        match = (struct subtree_match*) calloc(1, sizeof(struct subtree_match));
+        if (match == NULL) {
+            return NULL;
+        }
+
+        match->wd = wd;
+        HASH_ADD_INT(matches, wd, match);
+    }
+
+    free(match->routes);
+    match->routes = NULL;
+    match->count = 0;
+    walk(resolved, 0, collect_routes, match);
+    match->generation = generation;
+
+    return match;
+}
+
+// Calls the subtree callback once for every subscription covering wd's directory that wants one of mask's events
+void subtree_dispatch(int wd, const char* name, uint32_t mask) {
+    if (callbacks.subtree == NULL) {
+        return;
+    }
+
+    struct subtree_route inline_routes[INLINE_ROUTES];
+    struct subtree_route* routes = inline_routes;
+    int count = 0;
+
+    pthread_mutex_lock(&subtree_lock);
+
+    struct subtree_match* match = match_for(wd);
+    if (match && match->count > 0) {
+        if (match->count > INLINE_ROUTES) {
+            routes = (struct subtree_route*) malloc((size_t) match->count * sizeof(struct subtree_route));
+        }
+
+        if (routes) {
+            count = match->count;
+            memcpy(routes, match->routes, (size_t) count * sizeof(struct subtree_route));
+        }
+    }
+
+    pthread_mutex_unlock(&subtree_lock);
+
+    // Called outside the lock, so callbacks can subscribe and unsubscribe
+    for (int i = 0; i < count; i++) {
+        uint32_t bits = mask & routes[i].mask & IN_ALL_EVENTS;
+        if (bits) {
+            callbacks.subtree(routes[i].subscription, name, wd, (mask & ~IN_ALL_EVENTS) | bits);
+        }
+    }
+
+    if (routes != inline_routes) {
+        free(routes);
+    }
+}
+
+// Drops wd's cached match once it's no longer being watched
+void subtree_forget(int wd) {
+    pthread_mutex_lock(&subtree_lock);
+
+    struct subtree_match* match;
+    HASH_FIND_INT(matches, &wd, match);
+
+    if (match) {
+        HASH_DEL(matches, match);
+        free(match->routes);
+        free(match);
+    }
+
+    pthread_mutex_unlock(&subtree_lock);
+}
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "notify.h"
 #include <sys/time.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -10,6 +11,33 @@ long long get_current_time_millis() {
     return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+// While set, clock_millis() returns a virtual time that only moves when clock_advance() is called
+static int virtual_clock = 0;
+static long long virtual_millis = 0;
+
+// The notifier's notion of now, for timeouts like move expiry: real time unless a virtual clock is in use
+long long clock_millis() {
+    if (__atomic_load_n(&virtual_clock, __ATOMIC_ACQUIRE)) {
+        return __atomic_load_n(&virtual_millis, __ATOMIC_ACQUIRE);
+    }
+    return get_current_time_millis();
+}
+
+void clock_set_virtual(long long start_millis) {
+    __atomic_store_n(&virtual_millis, start_millis, __ATOMIC_RELEASE);
+    __atomic_store_n(&virtual_clock, 1, __ATOMIC_RELEASE);
+}
+
+// Wakes the notifier too, so anything the new time makes due (i.e. a move expiring) runs now rather than on its next turn
+void clock_advance(long long millis) {
+    __atomic_add_fetch(&virtual_millis, millis, __ATOMIC_ACQ_REL);
+    notifier_wake();
+}
+
+void clock_set_real() {
+    __atomic_store_n(&virtual_clock, 0, __ATOMIC_RELEASE);
+}
+
 // strncpy but the last character in dest is always NULL
 void terminated_strncpy(char* restrict dest, const char* restrict src, size_t n) {
     if (n < 1) return;
@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "warm.h"
+#include "hashtable.h"
+#include "types.h"
+#include "util.h"
+#include "watches.h"
+#include "uthash.h"
+
+// Files queued for warming beyond this are dropped rather than letting the worker fall further behind
+#define WARM_QUEUE_DEPTH 256
+
+// An unchanged file isn't warmed again for this long, which also keeps the worker's own opens from warming it again
+#define WARM_REPEAT_MS 30000
+#define RECENT_SLOTS 1024
+
+static struct warm_limit* limits = NULL;
+static int limit_count = 0;
+
+// A single worker takes files off a fixed ring, so warming never holds up the notifier thread and never grows unbounded
+static struct warm_job queue[WARM_QUEUE_DEPTH];
+static int queue_head = 0;
+static int queue_length = 0;
+static pthread_t worker;
+static int worker_running = 0;
+static int stopping = 0;
+static pthread_mutex_t warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warm_wake = PTHREAD_COND_INITIALIZER;
+
+// Only touched by the worker
+static struct warm_recent recent[RECENT_SLOTS];
+
+static struct warm_stats stats = { 0 };
+
+static void warm_file(const struct warm_job* job, long long max_bytes) {
+    char path[4096];
+    struct stat st;
+
+    if (join_watch_path(job->wd, job->name, path, sizeof(path)) != 0 || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        __atomic_add_fetch(&stats.skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t hash = name_hash64(path) | 1; // Never 0, so an empty slot never matches
+    long long mtime_ns = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    long long now = get_current_time_millis();
+    struct warm_recent* slot = &recent[hash % RECENT_SLOTS];
+
+    if (slot->hash == hash && slot->inode == (uint64_t) st.st_ino && slot->size == (long long) st.st_size
+        && slot->mtime_ns == mtime_ns && now - slot->warmed_ms < WARM_REPEAT_MS) {
+        __atomic_add_fetch(&stats.repeated, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // O_NONBLOCK in case it's been replaced by a FIFO since the stat
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        __atomic_add_fetch(&stats.skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Only the head of files bigger than the watch's limit
+    long long length = (long long) st.st_size < max_bytes ? (long long) st.st_size : max_bytes;
+
+    // readahead populates the page cache before returning; filesystems without it get the advisory hint instead
+    if (length > 0 && readahead(fd, 0, (size_t) length) != 0) {
+        posix_fadvise(fd, 0, (off_t) length, POSIX_FADV_WILLNEED);
+    }
+
+    close(fd);
+
+    slot->hash = hash;
+    slot->inode = (uint64_t) st.st_ino;
+    slot->size = (long long) st.st_size;
+    slot->mtime_ns = mtime_ns;
+    slot->warmed_ms = now;
+
+    __atomic_add_fetch(&stats.warmed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.bytes, (uint64_t) length, __ATOMIC_RELAXED);
+}
+
+static void* run_worker(void* _vargp) {
+    (void) _vargp;
+
+    while (1) {
+        pthread_mutex_lock(&warm_lock);
+        while (queue_length == 0 && !stopping) {
+            pthread_cond_wait(&warm_wake, &warm_lock);
+        }
+
+        if (stopping) {
+            pthread_mutex_unlock(&warm_lock);
+            break;
+        }
+
+        struct warm_job job = queue[queue_head];
+        queue_head = (queue_head + 1) % WARM_QUEUE_DEPTH;
+        queue_length--;
+
+        // Looked up again, since the watch may have stopped warming while the job waited
+        struct warm_limit* limit;
+        HASH_FIND_INT(limits, &job.wd, limit);
+        long long max_bytes = limit ? limit->max_bytes : 0;
+
+        pthread_mutex_unlock(&warm_lock);
+
+        if (max_bytes > 0) {
+            warm_file(&job, max_bytes);
+        }
+    }
+
+    return NULL;
+}
+
+// Warms up to max_bytes of each file in watch wd's directory when it's opened or finished being written, or stops
+// warming wd's files if max_bytes is 0. The worker is started with the first watch. Returns 0 on success.
+int warm_set_limit(int wd, long long max_bytes) {
+    pthread_mutex_lock(&warm_lock);
+
+    struct warm_limit* limit;
+    HASH_FIND_INT(limits, &wd, limit);
+
+    if (max_bytes <= 0) {
+        if (limit) {
+            HASH_DEL(limits, limit);
+            free(limit);
+            __atomic_sub_fetch(&limit_count, 1, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_unlock(&warm_lock);
+        return 0;
+    }
+
+    if (!worker_running) {
+        stopping = 0;
+        if (pthread_create(&worker, NULL, run_worker, NULL) != 0) {
+            pthread_mutex_unlock(&warm_lock);
+            return -1;
+        }
+        worker_running = 1;
+    }
+
+    if (limit == NULL) {
+        limit = (struct warm_limit*) malloc(sizeof(struct warm_limit));
+        if (limit == NULL) {
+            pthread_mutex_unlock(&warm_lock);
+            return -1;
+        }
+
+        limit->wd = wd;
+        HASH_ADD_INT(limits, wd, limit);
+        __atomic_add_fetch(&limit_count, 1, __ATOMIC_RELAXED);
+    }
+
+    limit->max_bytes = max_bytes;
+
+    pthread_mutex_unlock(&warm_lock);
+    return 0;
+}
+
+// Returns how much of each of wd's files is warmed, or 0 if they aren't
+long long warm_limit(int wd) {
+    if (!warm_active()) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&warm_lock);
+
+    struct warm_limit* limit;
+    HASH_FIND_INT(limits, &wd, limit);
+    long long max_bytes = limit ? limit->max_bytes : 0;
+
+    pthread_mutex_unlock(&warm_lock);
+    return max_bytes;
+}
+
+int warm_active() {
+    return __atomic_load_n(&limit_count, __ATOMIC_RELAXED) > 0;
+}
+
+// Queues a file that was just opened or written to be warmed, if its watch warms files. Called from dispatch, so it
+// only ever takes the lock for long enough to copy the name.
+void warm_submit(int wd, const char* name) {
+    if (name[0] == '\0') {
+        return;
+    }
+
+    pthread_mutex_lock(&warm_lock);
+
+    struct warm_limit* limit;
+    HASH_FIND_INT(limits, &wd, limit);
+
+    if (limit && worker_running) {
+        if (queue_length == WARM_QUEUE_DEPTH) {
+            stats.dropped++;
+        }
+        else {
+            struct warm_job* job = &queue[(queue_head + queue_length) % WARM_QUEUE_DEPTH];
+            job->wd = wd;
+            terminated_strncpy(job->name, name, sizeof(job->name));
+            queue_length++;
+            pthread_cond_signal(&warm_wake);
+        }
+    }
+
+    pthread_mutex_unlock(&warm_lock);
+}
+
+// Stops warming a watch that's been removed
+void warm_forget(int wd) {
+    if (warm_active()) {
+        warm_set_limit(wd, 0);
+    }
+}
+
+// Stops the worker and forgets every limit
+void warm_stop() {
+    pthread_mutex_lock(&warm_lock);
+
+    struct warm_limit *current, *tmp;
+    HASH_ITER(hh, limits, current, tmp) {
+        HASH_DEL(limits, current);
+        free(current);
+    }
+    __atomic_store_n(&limit_count, 0, __ATOMIC_RELAXED);
+
+    int running = worker_running;
+    worker_running = 0;
+    stopping = 1;
+    queue_length = 0;
+    pthread_cond_signal(&warm_wake);
+
+    pthread_mutex_unlock(&warm_lock);
+
+    if (running) {
+        pthread_join(worker, NULL);
+    }
+}
+
+void warm_get_stats(struct warm_stats* out) {
+    pthread_mutex_lock(&warm_lock);
+    out->dropped = stats.dropped;
+    pthread_mutex_unlock(&warm_lock);
+
+    out->warmed = __atomic_load_n(&stats.warmed, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&stats.bytes, __ATOMIC_RELAXED);
+    out->repeated = __atomic_load_n(&stats.repeated, __ATOMIC_RELAXED);
+    out->skipped = __atomic_load_n(&stats.skipped, __ATOMIC_RELAXED);
+}
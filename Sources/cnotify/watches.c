@@ -0,0 +1,435 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "watches.h"
+#include "lanes.h"
+#include "types.h"
+#include "util.h"
+#include "uthash.h"
+
+// Heat halves every minute without events
+#define HEAT_HALF_LIFE_MS 60000LL
+
+// Watches by stable id, by inotify wd and by path, so the C side can open files in watched directories without asking Swift
+// and so a directory can move between inotify and polling without callers noticing
+static struct watch_entry* watch_entries = NULL;
+static struct watch_entry* watches_by_kernel_wd = NULL;
+static struct watch_entry* watches_by_path = NULL;
+static pthread_rwlock_t watch_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int next_wd = 1;
+static int kernel_watch_count = 0;
+static int polled_watch_count = 0;
+
+static double decayed_heat(const struct watch_entry* entry, long long now) {
+    long long elapsed = now - entry->heat_updated;
+    if (elapsed <= 0) {
+        return entry->heat;
+    }
+
+    double heat = entry->heat;
+    for (long long half_lives = elapsed / HEAT_HALF_LIFE_MS; half_lives > 0 && heat > 0.0; half_lives--) {
+        heat /= 2;
+    }
+
+    // Linear between half-lives is close enough for picking the coldest directories
+    double fraction = (double) (elapsed % HEAT_HALF_LIFE_MS) / HEAT_HALF_LIFE_MS;
+    return heat * (1.0 - fraction / 2);
+}
+
+static void add_heat(struct watch_entry* entry, int events) {
+    long long now = get_current_time_millis();
+    entry->heat = decayed_heat(entry, now) + events;
+    entry->heat_updated = now;
+}
+
+// Must be called with watch_lock held for writing. Returns the watch's stable id, or -1 if it couldn't be allocated.
+static int insert_entry(int kernel_wd, const char* path, int flags) {
+    struct watch_entry* entry = NULL;
+
+    if (kernel_wd >= 0) { // inotify hands back the same wd when a path is watched again
+        HASH_FIND(hh_kernel, watches_by_kernel_wd, &kernel_wd, sizeof(int), entry);
+    }
+    if (entry == NULL) {
+        HASH_FIND(hh_path, watches_by_path, path, strlen(path), entry);
+    }
+
+    if (entry != NULL) {
+        entry->flags = flags;
+
+        if (entry->kernel_wd != kernel_wd) {
+            if (entry->kernel_wd >= 0) {
+                HASH_DELETE(hh_kernel, watches_by_kernel_wd, entry);
+                kernel_watch_count--;
+            }
+            else if (entry->kernel_wd == -1) {
+                polled_watch_count--;
+            }
+
+            entry->kernel_wd = kernel_wd;
+
+            if (kernel_wd >= 0) {
+                HASH_ADD(hh_kernel, watches_by_kernel_wd, kernel_wd, sizeof(int), entry);
+                kernel_watch_count++;
+            }
+            else if (kernel_wd == -1) {
+                polled_watch_count++;
+            }
+        }
+
+        return entry->wd;
+    }
+
+    entry = (struct watch_entry*) malloc(sizeof(struct watch_entry));
+    if (entry == NULL) {
+        return -1;
+    }
+
+    entry->path = strdup(path);
+    if (entry->path == NULL) {
+        free(entry);
+        return -1;
+    }
+
+    entry->wd = next_wd++;
+    entry->kernel_wd = kernel_wd;
+    entry->flags = flags;
+    entry->priority = LANE_NORMAL;
+    entry->is_file = 0;
+    entry->unpollable = 0;
+    entry->heat = 0.0;
+    entry->heat_updated = get_current_time_millis();
+
+    HASH_ADD_INT(watch_entries, wd, entry);
+    HASH_ADD_KEYPTR(hh_path, watches_by_path, entry->path, strlen(entry->path), entry);
+
+    if (kernel_wd >= 0) {
+        HASH_ADD(hh_kernel, watches_by_kernel_wd, kernel_wd, sizeof(int), entry);
+        kernel_watch_count++;
+    }
+    else if (kernel_wd == -1) {
+        polled_watch_count++;
+    }
+
+    return entry->wd;
+}
+
+// Records a watch on path: an inotify watch, a polled one if kernel_wd is -1, or a subscribed one if it is -3. Returns its stable id.
+int watch_table_add(int kernel_wd, const char* path, int flags) {
+    pthread_rwlock_wrlock(&watch_lock);
+    int wd = insert_entry(kernel_wd, path, flags);
+    pthread_rwlock_unlock(&watch_lock);
+
+    return wd;
+}
+
+// Records an inotify watch on a single file, which budget demotion leaves alone since the poller only scans directories
+int watch_table_add_file(int kernel_wd, const char* path, int flags) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    int wd = insert_entry(kernel_wd, path, flags);
+    if (wd >= 0) {
+        struct watch_entry* entry;
+        HASH_FIND_INT(watch_entries, &wd, entry);
+        entry->is_file = 1;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return wd;
+}
+
+// Adds every path with a non-negative inotify wd under a single lock acquisition, replacing each wd with its stable id
+void watch_table_add_all(int* wds, const char** paths, int count, int flags) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    for (int i = 0; i < count; i++) {
+        if (wds[i] >= 0) {
+            int wd = insert_entry(wds[i], paths[i], flags);
+            wds[i] = wd < 0 ? -3 : wd;
+        }
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+void watch_table_remove(int wd) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        if (entry->kernel_wd >= 0) {
+            HASH_DELETE(hh_kernel, watches_by_kernel_wd, entry);
+            kernel_watch_count--;
+        }
+        else if (entry->kernel_wd == -1) {
+            polled_watch_count--;
+        }
+
+        HASH_DEL(watch_entries, entry);
+        HASH_DELETE(hh_path, watches_by_path, entry);
+        free(entry->path);
+        free(entry);
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+// Translates an inotify wd into the watch's stable id and counts the event towards its heat. Returns -1 if it isn't ours (anymore).
+int watch_table_resolve(int kernel_wd) {
+    int wd = -1;
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND(hh_kernel, watches_by_kernel_wd, &kernel_wd, sizeof(int), entry);
+
+    if (entry) {
+        add_heat(entry, 1);
+        wd = entry->wd;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return wd;
+}
+
+// Returns the inotify wd behind a watch, -1 if it's being polled, -3 if it's fed by a shared-memory subscription,
+// -4 if the kernel has dropped it, or -2 if it doesn't exist
+int watch_table_kernel_wd(int wd) {
+    int kernel_wd = -2;
+    pthread_rwlock_rdlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        kernel_wd = entry->kernel_wd;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return kernel_wd;
+}
+
+// Moves a watch onto an inotify wd, onto polling if kernel_wd is -1, or off the kernel wd it had if -4
+void watch_table_set_kernel_wd(int wd, int kernel_wd) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        insert_entry(kernel_wd, entry->path, entry->flags);
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+// Counts activity seen by something other than inotify (i.e. the poller) towards a watch's heat
+void watch_table_touch(int wd, int events) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        add_heat(entry, events);
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+double watch_table_heat(int wd) {
+    double heat = 0.0;
+    pthread_rwlock_rdlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        heat = decayed_heat(entry, get_current_time_millis());
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return heat;
+}
+
+// Leaves a watch the poller couldn't take out of watch_table_coldest from then on
+void watch_table_set_unpollable(int wd) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        entry->unpollable = 1;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+// Fills wds with up to max inotify-backed directory watches that can be polled, coldest first. Returns how many were found.
+int watch_table_coldest(int* wds, int max) {
+    if (max <= 0) return 0;
+
+    double heats[max];
+    int found = 0;
+    long long now = get_current_time_millis();
+
+    pthread_rwlock_rdlock(&watch_lock);
+
+    for (struct watch_entry* entry = watches_by_kernel_wd; entry != NULL; entry = entry->hh_kernel.next) {
+        if (entry->is_file || entry->unpollable) {
+            continue;
+        }
+
+        double heat = decayed_heat(entry, now);
+        if (found == max && heat >= heats[max - 1]) {
+            continue;
+        }
+
+        // Insertion into the small sorted result
+        int position = found < max ? found++ : max - 1;
+        while (position > 0 && heats[position - 1] > heat) {
+            heats[position] = heats[position - 1];
+            wds[position] = wds[position - 1];
+            position--;
+        }
+
+        heats[position] = heat;
+        wds[position] = entry->wd;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return found;
+}
+
+void watch_table_counts(int* kernel_count, int* polled_count) {
+    pthread_rwlock_rdlock(&watch_lock);
+    *kernel_count = kernel_watch_count;
+    *polled_count = polled_watch_count;
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+// Bucket arrays and table headers of one of the watch table's indexes; the handles themselves are part of each entry
+#define INDEX_OVERHEAD(hh, head) ((head) ? HASH_OVERHEAD(hh, head) - (head)->hh.tbl->num_items * sizeof(UT_hash_handle) : 0)
+
+// Returns roughly how many bytes the watch table takes up: its entries, their paths and its three indexes
+size_t watch_table_memory() {
+    pthread_rwlock_rdlock(&watch_lock);
+
+    size_t bytes = INDEX_OVERHEAD(hh, watch_entries) + INDEX_OVERHEAD(hh_kernel, watches_by_kernel_wd) + INDEX_OVERHEAD(hh_path, watches_by_path);
+    for (struct watch_entry* entry = watch_entries; entry != NULL; entry = entry->hh.next) {
+        bytes += sizeof(struct watch_entry) + strlen(entry->path) + 1;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return bytes;
+}
+
+// Copies the path watched by wd into path. Returns 0 on success, -1 if wd isn't being watched.
+int watch_table_path(int wd, char* path, size_t n) {
+    int result = -1;
+    pthread_rwlock_rdlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        terminated_strncpy(path, entry->path, n);
+        result = 0;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return result;
+}
+
+// Returns the event mask wd was added with, or 0 if wd isn't being watched
+// Replaces the events the caller asked for on a watch that's being added again
+void watch_table_set_flags(int wd, int flags) {
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        entry->flags = flags;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+}
+
+int watch_table_flags(int wd) {
+    int flags = 0;
+    pthread_rwlock_rdlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        flags = entry->flags;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return flags;
+}
+
+// Returns the id of the watch on path, or -1 if path isn't being watched
+int watch_table_find(const char* path) {
+    int wd = -1;
+    pthread_rwlock_rdlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND(hh_path, watches_by_path, path, strlen(path), entry);
+
+    if (entry) {
+        wd = entry->wd;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return wd;
+}
+
+// Returns the dispatch lane of wd's events, LANE_NORMAL if wd isn't being watched
+int watch_table_priority(int wd) {
+    int priority = LANE_NORMAL;
+    pthread_rwlock_rdlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        priority = entry->priority;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return priority;
+}
+
+// Returns 0 on success, -1 if wd isn't being watched
+int watch_table_set_priority(int wd, int priority) {
+    int result = -1;
+    pthread_rwlock_wrlock(&watch_lock);
+
+    struct watch_entry* entry;
+    HASH_FIND_INT(watch_entries, &wd, entry);
+
+    if (entry) {
+        entry->priority = priority;
+        result = 0;
+    }
+
+    pthread_rwlock_unlock(&watch_lock);
+    return result;
+}
+
+// Builds "<watched directory>/<name>". Returns 0 on success, -1 if wd is unknown or the result doesn't fit.
+int join_watch_path(int wd, const char* name, char* path, size_t n) {
+    char directory[4096];
+    if (watch_table_path(wd, directory, sizeof(directory)) != 0) {
+        return -1;
+    }
+
+    int written = snprintf(path, n, "%s/%s", directory, name);
+    return (written < 0 || (size_t) written >= n) ? -1 : 0;
+}
@@ -0,0 +1,2 @@
+// The wrapper is header-only; this compiles it once with the package so it never goes stale unnoticed.
+#include "cnotify.hpp"
@@ -0,0 +1,229 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "context.h"
+}
+
+// Header-only C++ interface to the notifier, built on the context API in context.h. Each Context owns its watches and
+// sees only their events, either through a callback or by draining them in batches that are read in place.
+namespace cnotify {
+
+class Error : public std::runtime_error {
+public:
+    Error(const std::string& message, int code) : std::runtime_error(message), code_(code) {}
+
+    // The C API's error code: -1 no such path, -2 access denied, -3 anything else, -4 not a directory
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+// A view of one inotify_event record. The name points into the record, so it's only valid as long as the batch is
+// (or, in a callback, for the call).
+class Event {
+public:
+    explicit Event(const inotify_event* record) noexcept
+        : record_(record), name_(record->len > 0 ? std::string_view(record->name) : std::string_view()) {}
+
+    Event(const inotify_event* record, std::string_view name) noexcept : record_(record), name_(name) {}
+
+    int watch() const noexcept { return record_->wd; }
+    uint32_t mask() const noexcept { return record_->mask; }
+    uint32_t cookie() const noexcept { return record_->cookie; }
+    bool is_directory() const noexcept { return (record_->mask & IN_ISDIR) != 0; }
+
+    // Empty for events about the watched directory or file itself
+    std::string_view name() const noexcept { return name_; }
+
+private:
+    const inotify_event* record_;
+    std::string_view name_;
+};
+
+// The records handed over by one drain, iterated where they lie. Valid until the context is drained again or destroyed.
+class Batch {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Event;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Event;
+
+        iterator() noexcept = default;
+        explicit iterator(const char* position) noexcept : position_(position) {}
+
+        Event operator*() const noexcept { return Event(reinterpret_cast<const inotify_event*>(position_)); }
+
+        iterator& operator++() noexcept {
+            position_ += sizeof(inotify_event) + reinterpret_cast<const inotify_event*>(position_)->len;
+            return *this;
+        }
+
+        iterator operator++(int) noexcept {
+            iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const iterator& other) const noexcept { return position_ == other.position_; }
+        bool operator!=(const iterator& other) const noexcept { return position_ != other.position_; }
+
+    private:
+        const char* position_ = nullptr;
+    };
+
+    Batch() noexcept = default;
+    explicit Batch(const notify_batch& batch) noexcept : batch_(batch) {}
+
+    iterator begin() const noexcept { return iterator(batch_.records); }
+    iterator end() const noexcept { return iterator(batch_.records + batch_.length); }
+    std::size_t size() const noexcept { return static_cast<std::size_t>(batch_.count); }
+    bool empty() const noexcept { return batch_.count == 0; }
+
+private:
+    notify_batch batch_ = { nullptr, 0, 0 };
+};
+
+// A watch that's removed when it goes out of scope. Must not outlive the Context that added it.
+class Watch {
+public:
+    Watch() noexcept = default;
+    Watch(notify_context* context, int id) noexcept : context_(context), id_(id) {}
+
+    Watch(Watch&& other) noexcept : context_(std::exchange(other.context_, nullptr)), id_(std::exchange(other.id_, -1)) {}
+
+    Watch& operator=(Watch&& other) noexcept {
+        if (this != &other) {
+            reset();
+            context_ = std::exchange(other.context_, nullptr);
+            id_ = std::exchange(other.id_, -1);
+        }
+        return *this;
+    }
+
+    Watch(const Watch&) = delete;
+    Watch& operator=(const Watch&) = delete;
+
+    ~Watch() { reset(); }
+
+    // The id events for this watch carry
+    int id() const noexcept { return id_; }
+    explicit operator bool() const noexcept { return context_ != nullptr; }
+
+    void reset() noexcept {
+        if (context_ != nullptr) {
+            notify_context_remove_watch(context_, id_);
+            context_ = nullptr;
+            id_ = -1;
+        }
+    }
+
+private:
+    notify_context* context_ = nullptr;
+    int id_ = -1;
+};
+
+class Context {
+public:
+    using Callback = std::function<void(const Event&)>;
+
+    Context() : context_(notify_context_create()) {
+        if (context_ == nullptr) {
+            throw Error("Failed to create notifier context", -3);
+        }
+    }
+
+    Context(Context&& other) noexcept : context_(std::exchange(other.context_, nullptr)), callbacks_(std::move(other.callbacks_)) {}
+
+    Context& operator=(Context&& other) noexcept {
+        if (this != &other) {
+            if (context_ != nullptr) {
+                notify_context_destroy(context_);
+            }
+            context_ = std::exchange(other.context_, nullptr);
+            callbacks_ = std::move(other.callbacks_);
+        }
+        return *this;
+    }
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    // Removes every watch still open and waits for callbacks running on other threads. Don't destroy a context from
+    // its own callback.
+    ~Context() {
+        if (context_ != nullptr) {
+            notify_context_destroy(context_);
+        }
+    }
+
+    // Watches a directory, or a single file, for events in mask (IN_CREATE, IN_MODIFY, ...)
+    Watch watch(const std::string& path, uint32_t mask) {
+        int id = notify_context_add_watch(context_, path.c_str(), static_cast<int>(mask));
+        if (id < 0) {
+            throw Error("Failed to watch " + path, id);
+        }
+
+        return Watch(context_, id);
+    }
+
+    // Calls callback for every event, on the thread that dispatches it, instead of queueing events to be drained.
+    // The event's name is only valid during the call. An empty callback goes back to queueing.
+    void on_event(Callback callback) {
+        if (!callback) {
+            notify_context_set_callback(context_, nullptr, nullptr);
+            return;
+        }
+
+        // Callbacks that are replaced are kept until the context is destroyed, since another thread may be in one
+        callbacks_.push_back(std::make_unique<Callback>(std::move(callback)));
+        notify_context_set_callback(context_, &Context::trampoline, callbacks_.back().get());
+    }
+
+    // Takes every event queued since the last drain. Events were copied into the context as they were queued; the batch
+    // reads them there, without a further copy.
+    Batch drain() {
+        notify_batch batch;
+        notify_context_drain(context_, &batch);
+        return Batch(batch);
+    }
+
+    // Readable while events are waiting to be drained
+    int fd() const noexcept { return notify_context_fd(context_); }
+
+    void set_max_pending(std::size_t bytes) { notify_context_set_max_pending(context_, bytes); }
+    uint64_t dropped() const { return notify_context_dropped(context_); }
+
+    notify_context* handle() const noexcept { return context_; }
+
+private:
+    static void trampoline(void* userdata, int watch, const char* name, uint32_t mask, uint32_t cookie) {
+        // Rebuilt here since the C callback passes fields rather than the record
+        alignas(inotify_event) char storage[sizeof(inotify_event)];
+        inotify_event* header = reinterpret_cast<inotify_event*>(storage);
+        header->wd = watch;
+        header->mask = mask;
+        header->cookie = cookie;
+        header->len = 0;
+
+        (*static_cast<Callback*>(userdata))(Event(header, name));
+    }
+
+    notify_context* context_;
+    std::vector<std::unique_ptr<Callback>> callbacks_;
+};
+
+} // namespace cnotify
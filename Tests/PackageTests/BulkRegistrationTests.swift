@@ -0,0 +1,65 @@
+import XCTest
+import SWNotify
+
+class BulkRegistrationTests: XCTestCase {
+    private static let rootPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyBulkTestDirectory"
+    private static let directoryCount = 2000
+
+    private let directoryPaths = (0..<BulkRegistrationTests.directoryCount).map { "\(BulkRegistrationTests.rootPath)/\($0)" }
+
+    override class func setUp() {
+        for i in 0..<directoryCount {
+            try? FileManager.default.createDirectory(atPath: "\(rootPath)/\(i)", withIntermediateDirectories: true, attributes: nil)
+        }
+        Notifier.default.includeAbsolutePathsInEvents = true
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: rootPath)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    func testBulkRegistrationReportsPerPathErrors() throws {
+        let missingPath = "\(BulkRegistrationTests.rootPath)/\(UUID().uuidString)"
+        let filePath = "\(BulkRegistrationTests.rootPath)/\(UUID().uuidString)"
+        let _ = FileManager.default.createFile(atPath: filePath, contents: nil, attributes: nil)
+
+        let errors = Notifier.default.addNotifiers(for: Array(directoryPaths.prefix(10)) + [missingPath, filePath], events: [.create])
+
+        XCTAssertEqual(errors.count, 2)
+        XCTAssertEqual(errors[missingPath], .noSuchDirectory)
+        XCTAssertEqual(errors[filePath], .invalidTarget)
+
+        let createdFilePath = "\(directoryPaths[5])/\(UUID().uuidString)"
+        let expectation = self.expectation(description: "File creation callback in bulk-registered directory")
+
+        Notifier.default.addOnFileCreateCallback { path in
+            if path == createdFilePath {
+                expectation.fulfill()
+            }
+        }
+
+        try Data().write(to: URL(fileURLWithPath: createdFilePath))
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("File creation callback was not called: \(error)")
+            }
+        }
+    }
+
+    func testBulkRegistrationThroughput() throws {
+        measure {
+            let errors = Notifier.default.addNotifiers(for: directoryPaths, events: [.create, .delete, .modify])
+            XCTAssertTrue(errors.isEmpty)
+        }
+    }
+
+    func testIndividualRegistrationThroughput() throws {
+        measure {
+            for path in directoryPaths {
+                try? Notifier.default.addNotifier(for: path, events: [.create, .delete, .modify])
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+import XCTest
+import SWNotify
+
+class CacheWarmingTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyCacheWarmingTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? Notifier.default.setCacheWarming(for: directoryPath, maximumBytes: 0)
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testWrittenFilesAreWarmedWithoutExtraCallbacks() throws {
+        try Notifier.default.addNotifier(for: CacheWarmingTests.directoryPath, events: [.create])
+        try Notifier.default.setCacheWarming(for: CacheWarmingTests.directoryPath, maximumBytes: 4096)
+
+        let lock = NSLock()
+        var opened = 0
+        let callback = Notifier.default.addOnFileOpenCallback { _ in
+            lock.lock()
+            opened += 1
+            lock.unlock()
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        let before = Notifier.default.cacheWarmingStatistics
+
+        for i in 0..<5 {
+            FileManager.default.createFile(atPath: "\(CacheWarmingTests.directoryPath)/warm\(i)", contents: Data(count: 10_000), attributes: nil)
+        }
+
+        var after = Notifier.default.cacheWarmingStatistics
+        let deadline = Date().addingTimeInterval(2)
+        while after.filesWarmed - before.filesWarmed < 5 && Date() < deadline {
+            usleep(10_000)
+            after = Notifier.default.cacheWarmingStatistics
+        }
+
+        XCTAssertEqual(after.filesWarmed - before.filesWarmed, 5)
+        XCTAssertEqual(after.bytesWarmed - before.bytesWarmed, 5 * 4096, "Only the first maximumBytes of each file should be read ahead")
+
+        lock.lock()
+        XCTAssertEqual(opened, 0, "The directory wasn't added with .open")
+        lock.unlock()
+    }
+
+    func testWarmingNeedsAWatchedDirectory() {
+        XCTAssertThrowsError(try Notifier.default.setCacheWarming(for: "/definitely/not/watched", maximumBytes: 4096))
+    }
+}
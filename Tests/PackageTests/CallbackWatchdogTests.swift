@@ -0,0 +1,75 @@
+import XCTest
+import SWNotify
+
+class CallbackWatchdogTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyCallbackWatchdogTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        Notifier.default.callbackLatencyBudget = 0.1
+        Notifier.default.callbackIsolationThreshold = 3
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testSlowCallbackIsIsolated() throws {
+        let path = CallbackWatchdogTests.directoryPath
+        try Notifier.default.addNotifier(for: path, events: [.create])
+
+        Notifier.default.callbackLatencyBudget = 0.01
+        Notifier.default.callbackIsolationThreshold = 2
+
+        let lock = NSLock()
+        var fastCalls: [Date] = []
+        let fast = Notifier.default.addOnFileCreateCallback { _ in
+            lock.lock()
+            fastCalls.append(Date())
+            lock.unlock()
+        }
+        let slow = Notifier.default.addOnFileCreateCallback { _ in
+            usleep(50_000)
+        }
+        defer {
+            Notifier.default.removeCallback(forCallbackId: fast)
+            Notifier.default.removeCallback(forCallbackId: slow)
+        }
+
+        for i in 0..<10 {
+            FileManager.default.createFile(atPath: "\(path)/file\(i)", contents: nil, attributes: nil)
+        }
+
+        let deadline = Date().addingTimeInterval(5)
+        while (Notifier.default.callbackStatistics(forCallbackId: slow)?.invocations ?? 0) < 10 && Date() < deadline {
+            usleep(10_000)
+        }
+
+        let slowStatistics = try XCTUnwrap(Notifier.default.callbackStatistics(forCallbackId: slow))
+        XCTAssertEqual(slowStatistics.invocations, 10)
+        XCTAssertTrue(slowStatistics.isIsolated)
+        XCTAssertGreaterThanOrEqual(slowStatistics.overBudget, 2)
+        XCTAssertGreaterThanOrEqual(slowStatistics.averageDuration, 0.05)
+
+        let fastStatistics = try XCTUnwrap(Notifier.default.callbackStatistics(forCallbackId: fast))
+        XCTAssertEqual(fastStatistics.invocations, 10)
+        XCTAssertFalse(fastStatistics.isIsolated)
+
+        // Once the slow callback was moved off the notifier's thread, the rest of the creates reached the fast one
+        // without waiting 50ms apiece
+        lock.lock()
+        let lastCalls = fastCalls.suffix(5)
+        lock.unlock()
+        XCTAssertLessThan(lastCalls.last!.timeIntervalSince(lastCalls.first!), 0.1)
+    }
+
+    func testRemovedCallbackHasNoStatistics() {
+        let callback = Notifier.default.addOnFileModifyCallback { _ in }
+        XCTAssertEqual(Notifier.default.callbackStatistics(forCallbackId: callback)?.invocations, 0)
+
+        Notifier.default.removeCallback(forCallbackId: callback)
+        XCTAssertNil(Notifier.default.callbackStatistics(forCallbackId: callback))
+    }
+}
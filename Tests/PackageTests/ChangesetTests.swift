@@ -0,0 +1,110 @@
+import XCTest
+import SWNotify
+
+class ChangesetTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyChangesetTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+        Notifier.default.changesetQuietPeriod = 0.1
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        Notifier.default.changesetQuietPeriod = 0.2
+    }
+
+    func testBurstIsCollapsedIntoOneChangeset() throws {
+        try Notifier.default.addNotifier(for: ChangesetTests.directoryPath, events: [.create, .modify, .delete, .rename])
+
+        let firstName = UUID().uuidString
+        let finalName = UUID().uuidString
+        let temporaryName = UUID().uuidString
+        let lock = NSLock()
+        var changesets: [[FileChange]] = []
+
+        let expectation = self.expectation(description: "Changeset callback")
+
+        let callback = Notifier.default.addOnChangesetCallback { changes in
+            guard changes.contains(where: { $0.path == finalName }) else { return }
+            lock.lock()
+            changesets.append(changes)
+            lock.unlock()
+            expectation.fulfill()
+        }
+
+        let firstPath = "\(ChangesetTests.directoryPath)/\(firstName)"
+        try Data("a".utf8).write(to: URL(fileURLWithPath: firstPath))
+        try Data("ab".utf8).write(to: URL(fileURLWithPath: firstPath))
+        try FileManager.default.moveItem(atPath: firstPath, toPath: "\(ChangesetTests.directoryPath)/\(finalName)")
+        try Data().write(to: URL(fileURLWithPath: "\(ChangesetTests.directoryPath)/\(temporaryName)"))
+        try FileManager.default.removeItem(atPath: "\(ChangesetTests.directoryPath)/\(temporaryName)")
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Changeset callback was not called: \(error)")
+            }
+        }
+
+        lock.lock()
+        XCTAssertEqual(changesets.count, 1)
+        let changes = changesets.first ?? []
+        XCTAssertEqual(changes.filter { $0.path == finalName }.map { $0.kind }, [.created])
+        XCTAssertFalse(changes.contains { $0.path == firstName || $0.path == temporaryName })
+        lock.unlock()
+
+        Notifier.default.removeCallback(forCallbackId: callback)
+    }
+
+    func testRenamedFileKeepsItsModification() throws {
+        let directory = ChangesetTests.directoryPath
+        try Notifier.default.addNotifier(for: directory, events: [.create, .modify, .delete, .rename])
+
+        // Created before anything is accumulated, so each one starts out unchanged
+        let writtenThenRenamed = UUID().uuidString
+        let renamedThenWritten = UUID().uuidString
+        let onlyRenamed = UUID().uuidString
+        for name in [writtenThenRenamed, renamedThenWritten, onlyRenamed] {
+            try Data("a".utf8).write(to: URL(fileURLWithPath: "\(directory)/\(name)"))
+        }
+        usleep(100_000)
+
+        let lock = NSLock()
+        var changes: [FileChange] = []
+        let expectation = self.expectation(description: "Changeset callback")
+
+        let callback = Notifier.default.addOnChangesetCallback { settled in
+            guard settled.contains(where: { $0.path == "\(onlyRenamed).moved" }) else { return }
+            lock.lock()
+            changes = settled
+            lock.unlock()
+            expectation.fulfill()
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        try Data("b".utf8).write(to: URL(fileURLWithPath: "\(directory)/\(writtenThenRenamed)"))
+        XCTAssertEqual(rename("\(directory)/\(writtenThenRenamed)", "\(directory)/\(writtenThenRenamed).moved"), 0)
+
+        XCTAssertEqual(rename("\(directory)/\(renamedThenWritten)", "\(directory)/\(renamedThenWritten).moved"), 0)
+        try Data("c".utf8).write(to: URL(fileURLWithPath: "\(directory)/\(renamedThenWritten).moved"))
+
+        XCTAssertEqual(rename("\(directory)/\(onlyRenamed)", "\(directory)/\(onlyRenamed).moved"), 0)
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Changeset callback was not called: \(error)")
+            }
+        }
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        for name in [writtenThenRenamed, renamedThenWritten, onlyRenamed] {
+            let change = changes.first { $0.path == "\(name).moved" }
+            XCTAssertEqual(change?.kind, .renamed)
+            XCTAssertEqual(change?.oldPath, name)
+            XCTAssertEqual(change?.isModified, name != onlyRenamed, "\(name)")
+        }
+    }
+}
@@ -0,0 +1,92 @@
+import XCTest
+import SWNotify
+
+class CrossDirectoryMoveTests: XCTestCase {
+    private static let rootPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyCrossDirectoryMoveTestDirectory"
+    private static let sourcePath = "\(rootPath)/source"
+    private static let destinationPath = "\(rootPath)/destination"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: rootPath)
+        try? FileManager.default.createDirectory(atPath: sourcePath, withIntermediateDirectories: true, attributes: nil)
+        try? FileManager.default.createDirectory(atPath: destinationPath, withIntermediateDirectories: true, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? Notifier.default.removeNotifier(for: sourcePath)
+        try? Notifier.default.removeNotifier(for: destinationPath)
+        try? FileManager.default.removeItem(atPath: rootPath)
+    }
+
+    func testMoveBetweenWatchedDirectoriesIsOneEvent() throws {
+        let source = CrossDirectoryMoveTests.sourcePath
+        let destination = CrossDirectoryMoveTests.destinationPath
+        try Notifier.default.addNotifier(for: source, events: [.rename])
+        try Notifier.default.addNotifier(for: destination, events: [.rename])
+
+        let lock = NSLock()
+        var moves: [FileMove] = []
+        var renames: [String] = []
+        var halves = 0
+
+        let moveCallback = Notifier.default.addOnFileMoveCallback { move in
+            lock.lock()
+            moves.append(move)
+            lock.unlock()
+        }
+        let renameCallback = Notifier.default.addOnFileRenameCallback { oldPath, newPath in
+            lock.lock()
+            renames.append("\(oldPath) -> \(newPath)")
+            lock.unlock()
+        }
+        let fromCallback = Notifier.default.addOnFileMoveFromCallback { _ in
+            lock.lock()
+            halves += 1
+            lock.unlock()
+        }
+        let toCallback = Notifier.default.addOnFileMoveToCallback { _ in
+            lock.lock()
+            halves += 1
+            lock.unlock()
+        }
+        defer {
+            [moveCallback, renameCallback, fromCallback, toCallback].forEach { Notifier.default.removeCallback(forCallbackId: $0) }
+        }
+
+        FileManager.default.createFile(atPath: "\(source)/asset.bin", contents: Data("a".utf8), attributes: nil)
+        FileManager.default.createFile(atPath: "\(source)/draft.txt", contents: Data("b".utf8), attributes: nil)
+        XCTAssertEqual(rename("\(source)/asset.bin", "\(destination)/asset.bin"), 0)
+        XCTAssertEqual(rename("\(source)/draft.txt", "\(source)/final.txt"), 0)
+
+        let deadline = Date().addingTimeInterval(2)
+        var count = 0
+        while count < 2 && Date() < deadline {
+            usleep(10_000)
+            lock.lock()
+            count = moves.count
+            lock.unlock()
+        }
+
+        // Long enough for an unpaired IN_MOVED_FROM to have expired into a moveFrom
+        usleep(700_000)
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        XCTAssertEqual(moves.count, 2)
+        XCTAssertEqual(halves, 0, "Neither move is reported as a separate moveFrom and moveTo")
+        // Paths are relative, so only the directories tell the two moves apart
+        XCTAssertEqual(renames.sorted(), ["asset.bin -> asset.bin", "draft.txt -> final.txt"])
+
+        let crossing = moves.first { $0.newPath == "asset.bin" }
+        XCTAssertEqual(crossing?.oldPath, "asset.bin")
+        XCTAssertEqual(crossing?.sourceDirectory, source)
+        XCTAssertEqual(crossing?.destinationDirectory, destination)
+        XCTAssertEqual(crossing?.crossesDirectories, true)
+
+        let inPlace = moves.first { $0.newPath == "final.txt" }
+        XCTAssertEqual(inPlace?.oldPath, "draft.txt")
+        XCTAssertEqual(inPlace?.crossesDirectories, false)
+    }
+}
@@ -0,0 +1,78 @@
+import XCTest
+import SWNotify
+
+class FileDeltaTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyFileDeltaTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    private func write(_ bytes: Int, at offset: UInt64, to path: String) throws {
+        let handle = try XCTUnwrap(FileHandle(forWritingAtPath: path))
+        handle.seek(toFileOffset: offset)
+        handle.write(Data(repeating: UInt8.random(in: 1...255), count: bytes))
+        handle.closeFile()
+    }
+
+    func testOnlyRewrittenBlocksAreReported() throws {
+        let filePath = "\(FileDeltaTests.directoryPath)/image.bin"
+        FileManager.default.createFile(atPath: filePath, contents: Data(count: 1 << 20), attributes: nil)
+        try Notifier.default.addNotifier(for: FileDeltaTests.directoryPath, events: [.closeWrite])
+
+        let lock = NSLock()
+        var deltas: [FileDelta] = []
+        let callback = Notifier.default.addOnFileDeltaCallback { delta in
+            lock.lock()
+            deltas.append(delta)
+            lock.unlock()
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        func waitForDeltas(_ count: Int) {
+            let deadline = Date().addingTimeInterval(2)
+            while Date() < deadline {
+                lock.lock()
+                let received = deltas.count
+                lock.unlock()
+
+                if received >= count {
+                    return
+                }
+                usleep(10_000)
+            }
+        }
+
+        // The first write establishes the baseline, and is reported as a change throughout
+        try write(10, at: 0, to: filePath)
+        waitForDeltas(1)
+
+        // Inside the second block, then straddling the sixth and seventh, then appended
+        try write(10, at: 100_000, to: filePath)
+        waitForDeltas(2)
+        try write(1000, at: 6 * 65536 - 500, to: filePath)
+        waitForDeltas(3)
+        try write(1000, at: 1 << 20, to: filePath)
+        waitForDeltas(4)
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        XCTAssertEqual(deltas.count, 4)
+        guard deltas.count == 4 else { return }
+
+        XCTAssertEqual(deltas[0].path, "image.bin")
+        XCTAssertNil(deltas[0].previousSize)
+        XCTAssertEqual(deltas[0].changedRanges, [0..<(1 << 20)])
+        XCTAssertEqual(deltas[1].changedRanges, [65536..<131072])
+        XCTAssertEqual(deltas[2].changedRanges, [(5 * 65536)..<(7 * 65536)])
+        XCTAssertEqual(deltas[3].changedRanges, [(1 << 20)..<((1 << 20) + 1000)])
+        XCTAssertEqual(deltas[3].previousSize, 1 << 20)
+        XCTAssertEqual(deltas[3].size, (1 << 20) + 1000)
+    }
+}
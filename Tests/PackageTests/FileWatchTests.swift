@@ -0,0 +1,63 @@
+import XCTest
+import SWNotify
+
+class FileWatchTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyFileWatchTestDirectory"
+    private static let filePath = "\(directoryPath)/watched.conf"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        FileManager.default.createFile(atPath: filePath, contents: Data("a".utf8), attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? Notifier.default.removeNotifier(for: filePath)
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testFileWatchFollowsAtomicReplacement() throws {
+        let directory = FileWatchTests.directoryPath
+        let file = FileWatchTests.filePath
+        try Notifier.default.addNotifier(for: file, events: [.closeWrite])
+
+        let lock = NSLock()
+        var written: [String] = []
+        let callback = Notifier.default.addOnFileCloseWriteCallback { path in
+            lock.lock()
+            written.append(path)
+            lock.unlock()
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        // Neighbours aren't reported
+        try Data("x".utf8).write(to: URL(fileURLWithPath: "\(directory)/neighbour"))
+
+        // Written in place, then replaced the way most config writers do it, then written in place again
+        try Data("b".utf8).write(to: URL(fileURLWithPath: file))
+        try Data("c".utf8).write(to: URL(fileURLWithPath: "\(directory)/watched.conf.tmp"))
+        XCTAssertEqual(rename("\(directory)/watched.conf.tmp", file), 0)
+        usleep(100_000)
+        try Data("d".utf8).write(to: URL(fileURLWithPath: file))
+
+        let deadline = Date().addingTimeInterval(2)
+        var count = 0
+        while count < 3 && Date() < deadline {
+            usleep(10_000)
+            lock.lock()
+            count = written.count
+            lock.unlock()
+        }
+
+        lock.lock()
+        XCTAssertEqual(written, [file, file, file], "The write before, the replacement and the write to the new file")
+        lock.unlock()
+    }
+
+    func testPolledFileIsRejected() {
+        XCTAssertThrowsError(try Notifier.default.addNotifier(for: FileWatchTests.filePath, events: [.modify], backend: .polling)) { error in
+            XCTAssertEqual(error as? NotifierError, .invalidTarget)
+        }
+    }
+}
@@ -0,0 +1,41 @@
+import XCTest
+import SWNotify
+
+class HotSpotTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyHotSpotTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testBusiestFileIsReported() throws {
+        try Notifier.default.addNotifier(for: HotSpotTests.directoryPath, events: [.modify])
+
+        let filename = UUID().uuidString
+        let url = URL(fileURLWithPath: "\(HotSpotTests.directoryPath)/\(filename)")
+        try Data().write(to: url)
+
+        let handle = try FileHandle(forWritingTo: url)
+        for _ in 0..<500 {
+            handle.write(Data("x".utf8))
+        }
+        handle.closeFile()
+
+        let expectation = self.expectation(description: "Events counted")
+        DispatchQueue.global().asyncAfter(deadline: .now() + 0.5) {
+            expectation.fulfill()
+        }
+        wait(for: [expectation], timeout: 2)
+
+        let files = Notifier.default.hotFiles(top: 3)
+        XCTAssertEqual(files.first?.path, filename)
+        XCTAssertGreaterThan(files.first?.eventsPerSecond ?? 0, 0)
+
+        XCTAssertTrue(Notifier.default.hotDirectories(top: 3).contains { $0.path == HotSpotTests.directoryPath })
+    }
+}
@@ -0,0 +1,52 @@
+import XCTest
+import SWNotify
+
+class ListingCacheTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyListingCacheTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.createDirectory(atPath: "\(directoryPath)/nested", withIntermediateDirectories: true, attributes: nil)
+        FileManager.default.createFile(atPath: "\(directoryPath)/existing", contents: nil, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        Notifier.default.stopCachingListing(of: directoryPath)
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testListingFollowsEvents() throws {
+        let path = ListingCacheTests.directoryPath
+        try Notifier.default.addNotifier(for: path, events: [.modify])
+
+        XCTAssertNil(Notifier.default.cachedEntryCount(of: path))
+        try Notifier.default.startCachingListing(of: path)
+
+        XCTAssertEqual(Set(try XCTUnwrap(Notifier.default.cachedListing(of: path))), ["existing", "nested"])
+
+        for i in 0..<100 {
+            FileManager.default.createFile(atPath: "\(path)/file\(i)", contents: nil, attributes: nil)
+        }
+        for i in 0..<50 {
+            try FileManager.default.removeItem(atPath: "\(path)/file\(i)")
+        }
+        try FileManager.default.moveItem(atPath: "\(path)/existing", toPath: "\(path)/renamed")
+
+        let deadline = Date().addingTimeInterval(2)
+        while Notifier.default.cachedListing(of: path, contains: "renamed") != true && Date() < deadline {
+            usleep(10_000)
+        }
+
+        XCTAssertEqual(Notifier.default.cachedEntryCount(of: path), 52)
+        XCTAssertEqual(Notifier.default.cachedListing(of: path, contains: "file75"), true)
+        XCTAssertEqual(Notifier.default.cachedListing(of: path, contains: "file25"), false)
+        XCTAssertEqual(Notifier.default.cachedListing(of: path, contains: "existing"), false)
+
+        let onDisk = Set(try FileManager.default.contentsOfDirectory(atPath: path))
+        XCTAssertEqual(Set(try XCTUnwrap(Notifier.default.cachedListing(of: path))), onDisk)
+
+        Notifier.default.stopCachingListing(of: path)
+        XCTAssertNil(Notifier.default.cachedListing(of: path))
+    }
+}
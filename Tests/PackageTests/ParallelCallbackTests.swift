@@ -0,0 +1,67 @@
+import XCTest
+import SWNotify
+
+class ParallelCallbackTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyParallelTestDirectory"
+    private static let fileCount = 200
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+        Notifier.default.callbackThreads = 4
+    }
+
+    override class func tearDown() {
+        Notifier.default.callbackThreads = 0
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testEventsForEachFileStayInOrder() throws {
+        try Notifier.default.addNotifier(for: ParallelCallbackTests.directoryPath, events: [.create, .delete])
+
+        let prefix = UUID().uuidString
+        let lock = NSLock()
+        var created = Set<String>()
+        var outOfOrder = 0
+        var deletedCount = 0
+
+        let expectation = self.expectation(description: "Delete callback for every file")
+
+        let createCallback = Notifier.default.addOnFileCreateCallback { file in
+            guard file.hasPrefix(prefix) else { return }
+            lock.lock()
+            created.insert(file)
+            lock.unlock()
+        }
+
+        let deleteCallback = Notifier.default.addOnFileDeleteCallback { file in
+            guard file.hasPrefix(prefix) else { return }
+            lock.lock()
+            if !created.contains(file) {
+                outOfOrder += 1
+            }
+            deletedCount += 1
+            if deletedCount == ParallelCallbackTests.fileCount {
+                expectation.fulfill()
+            }
+            lock.unlock()
+        }
+
+        for i in 0..<ParallelCallbackTests.fileCount {
+            let filePath = "\(ParallelCallbackTests.directoryPath)/\(prefix)-\(i)"
+            try Data().write(to: URL(fileURLWithPath: filePath))
+            try FileManager.default.removeItem(atPath: filePath)
+        }
+
+        waitForExpectations(timeout: 5) { error in
+            if let error = error {
+                XCTFail("Not every delete callback was called: \(error)")
+            }
+        }
+
+        XCTAssertEqual(outOfOrder, 0)
+
+        Notifier.default.removeCallback(forCallbackId: createCallback)
+        Notifier.default.removeCallback(forCallbackId: deleteCallback)
+    }
+}
@@ -0,0 +1,64 @@
+import XCTest
+import SWNotify
+
+class PollingBackendTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyPollingTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+        Notifier.default.pollInterval = 0.1
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        Notifier.default.pollInterval = 2
+    }
+
+    func testPolledFileCreate() throws {
+        try Notifier.default.addNotifier(for: PollingBackendTests.directoryPath, events: [.create], backend: .polling)
+        let filename = UUID().uuidString
+
+        let expectation = self.expectation(description: "File creation callback from a polled directory")
+
+        Notifier.default.addOnFileCreateCallback { file in
+            if file == filename {
+                expectation.fulfill()
+            }
+        }
+
+        let _ = FileManager.default.createFile(atPath: "\(PollingBackendTests.directoryPath)/\(filename)", contents: nil, attributes: nil)
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("File creation callback was not called: \(error)")
+            }
+        }
+
+        XCTAssertGreaterThan(Notifier.default.pollStatistics.cycles, 0)
+    }
+
+    func testPolledRenameIsDetectedByInode() throws {
+        let oldName = UUID().uuidString
+        let newName = UUID().uuidString
+        let _ = FileManager.default.createFile(atPath: "\(PollingBackendTests.directoryPath)/\(oldName)", contents: Data("contents".utf8), attributes: nil)
+
+        try Notifier.default.addNotifier(for: PollingBackendTests.directoryPath, events: [.rename], backend: .polling)
+
+        let expectation = self.expectation(description: "File rename callback from a polled directory")
+
+        Notifier.default.addOnFileRenameCallback { from, to in
+            if from == oldName && to == newName {
+                expectation.fulfill()
+            }
+        }
+
+        try FileManager.default.moveItem(atPath: "\(PollingBackendTests.directoryPath)/\(oldName)", toPath: "\(PollingBackendTests.directoryPath)/\(newName)")
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("File rename callback was not called: \(error)")
+            }
+        }
+    }
+}
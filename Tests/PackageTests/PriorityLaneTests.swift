@@ -0,0 +1,107 @@
+import XCTest
+import SWNotify
+
+class PriorityLaneTests: XCTestCase {
+    private static let rootPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyPriorityTestDirectory"
+    private let highPath = "\(PriorityLaneTests.rootPath)/high"
+    private let lowPath = "\(PriorityLaneTests.rootPath)/low"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: "\(rootPath)/high", withIntermediateDirectories: true, attributes: nil)
+        try? FileManager.default.createDirectory(atPath: "\(rootPath)/low", withIntermediateDirectories: true, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = true
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: rootPath)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    // The lanes stay active once a watch has had a priority, but the watches and callbacks don't have to
+    override func tearDown() {
+        try? Notifier.default.removeNotifier(for: highPath)
+        try? Notifier.default.removeNotifier(for: lowPath)
+    }
+
+    func testEventsAreDispatchedFromTheirPriorityLane() throws {
+        try Notifier.default.addNotifier(for: highPath, events: [.create], priority: .high)
+        try Notifier.default.addNotifier(for: lowPath, events: [.create], priority: .low)
+
+        let highBefore = Notifier.default.laneStatistics(for: .high).dispatched
+        let lowBefore = Notifier.default.laneStatistics(for: .low).dispatched
+
+        let highFilePath = "\(highPath)/\(UUID().uuidString)"
+        let lowFilePath = "\(lowPath)/\(UUID().uuidString)"
+
+        let highExpectation = self.expectation(description: "Create callback in high priority directory")
+        let lowExpectation = self.expectation(description: "Create callback in low priority directory")
+
+        let callback = Notifier.default.addOnFileCreateCallback { path in
+            if path == highFilePath {
+                highExpectation.fulfill()
+            }
+            else if path == lowFilePath {
+                lowExpectation.fulfill()
+            }
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        try Data().write(to: URL(fileURLWithPath: lowFilePath))
+        try Data().write(to: URL(fileURLWithPath: highFilePath))
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Create callbacks were not called: \(error)")
+            }
+        }
+
+        XCTAssertGreaterThan(Notifier.default.laneStatistics(for: .high).dispatched, highBefore)
+        XCTAssertGreaterThan(Notifier.default.laneStatistics(for: .low).dispatched, lowBefore)
+    }
+
+    func testHighPriorityEventsOvertakeALowPriorityBacklog() throws {
+        try Notifier.default.addNotifier(for: highPath, events: [.create], priority: .high)
+        try Notifier.default.addNotifier(for: lowPath, events: [.create], priority: .low)
+
+        let lowCount = 2000
+        let highFilePath = "\(highPath)/\(UUID().uuidString)"
+
+        let lock = NSLock()
+        var lowDispatched = 0
+        var lowDispatchedBeforeHigh: Int?
+        let highExpectation = self.expectation(description: "Create callback in high priority directory")
+        let lowExpectation = self.expectation(description: "Create callback for every file in the low priority directory")
+
+        // Slow enough that the low lane backs up while the files are created
+        let callback = Notifier.default.addOnFileCreateCallback { path in
+            lock.lock()
+            defer { lock.unlock() }
+
+            if path == highFilePath {
+                lowDispatchedBeforeHigh = lowDispatched
+                highExpectation.fulfill()
+            }
+            else if path.hasPrefix(self.lowPath) {
+                usleep(1000)
+                lowDispatched += 1
+                if lowDispatched == lowCount {
+                    lowExpectation.fulfill()
+                }
+            }
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        for index in 0..<lowCount {
+            FileManager.default.createFile(atPath: "\(lowPath)/file\(index)", contents: nil, attributes: nil)
+        }
+        FileManager.default.createFile(atPath: highFilePath, contents: nil, attributes: nil)
+
+        wait(for: [highExpectation, lowExpectation], timeout: 20)
+
+        lock.lock()
+        defer { lock.unlock() }
+        XCTAssertNotNil(lowDispatchedBeforeHigh)
+        XCTAssertLessThan(lowDispatchedBeforeHigh ?? lowCount, lowCount, "The high priority event was dispatched ahead of the low priority backlog")
+        XCTAssertGreaterThan(Notifier.default.laneStatistics(for: .low).maximumDepth, 1)
+    }
+}
@@ -0,0 +1,87 @@
+import XCTest
+import SWNotify
+
+class PumpModeTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyPumpTestDirectory"
+    private static let outsidePath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyPumpTestOutside"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        try? FileManager.default.createDirectory(atPath: outsidePath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        Notifier.default.stopPumping()
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.removeItem(atPath: outsidePath)
+    }
+
+    private func waitUntilReadable(_ fd: Int32, timeout: TimeInterval) -> Bool {
+        var descriptor = pollfd(fd: fd, events: Int16(POLLIN), revents: 0)
+        return poll(&descriptor, 1, Int32(timeout * 1000)) > 0
+    }
+
+    func testEventsAreDispatchedOnTheCallingThread() throws {
+        try Notifier.default.addNotifier(for: PumpModeTests.directoryPath, events: [.create])
+        let fd = try Notifier.default.startPumping()
+        defer { Notifier.default.stopPumping() }
+
+        var created: [String] = []
+        var offThread = 0
+        let callback = Notifier.default.addOnFileCreateCallback { path in
+            created.append(path)
+            if !Thread.isMainThread {
+                offThread += 1
+            }
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        for i in 0..<10 {
+            FileManager.default.createFile(atPath: "\(PumpModeTests.directoryPath)/pumped\(i)", contents: nil, attributes: nil)
+        }
+
+        XCTAssertTrue(waitUntilReadable(fd, timeout: 1))
+        XCTAssertTrue(created.isEmpty, "Nothing should be dispatched until events are processed")
+
+        // Three at a time; whatever is left keeps the descriptor readable
+        var calls = 0
+        while waitUntilReadable(fd, timeout: 0.1) && calls < 100 {
+            XCTAssertLessThanOrEqual(Notifier.default.processPendingEvents(maxEvents: 3), 3)
+            calls += 1
+        }
+
+        XCTAssertEqual(created.count, 10)
+        XCTAssertGreaterThanOrEqual(calls, 4)
+        XCTAssertEqual(offThread, 0)
+    }
+
+    func testNextTimeoutCoversMoveExpiry() throws {
+        try Notifier.default.addNotifier(for: PumpModeTests.directoryPath, events: [.moveFrom, .moveTo])
+        let fd = try Notifier.default.startPumping()
+        defer { Notifier.default.stopPumping() }
+
+        var movedOut: [String] = []
+        let callback = Notifier.default.addOnFileMoveFromCallback { path in
+            movedOut.append(path)
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        FileManager.default.createFile(atPath: "\(PumpModeTests.directoryPath)/leaving", contents: nil, attributes: nil)
+        try FileManager.default.moveItem(atPath: "\(PumpModeTests.directoryPath)/leaving", toPath: "\(PumpModeTests.outsidePath)/leaving")
+
+        XCTAssertTrue(waitUntilReadable(fd, timeout: 1))
+        Notifier.default.processPendingEvents()
+        XCTAssertTrue(movedOut.isEmpty, "The move should wait for a matching move in")
+
+        let timeout = try XCTUnwrap(Notifier.default.nextTimeout())
+        XCTAssertGreaterThan(timeout, 0)
+        XCTAssertLessThanOrEqual(timeout, 0.6)
+
+        _ = waitUntilReadable(fd, timeout: timeout)
+        Notifier.default.processPendingEvents()
+
+        XCTAssertEqual(movedOut, ["leaving"])
+        XCTAssertNil(Notifier.default.nextTimeout())
+    }
+}
@@ -0,0 +1,59 @@
+import XCTest
+import SWNotify
+
+class RateLimitTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyRateLimitTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? Notifier.default.removeNotifier(for: directoryPath)
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testEventsOverTheLimitAreCoalesced() throws {
+        let directoryPath = RateLimitTests.directoryPath
+        try Notifier.default.addNotifier(for: directoryPath, events: [.create])
+        try Notifier.default.setRateLimit(for: directoryPath, eventsPerSecond: 1, burst: 5, overflow: .coalesce)
+
+        let prefix = UUID().uuidString
+        let lock = NSLock()
+        var created = 0
+
+        let expectation = self.expectation(description: "Suppressed events summary")
+
+        let createCallback = Notifier.default.addOnFileCreateCallback { file in
+            guard file.hasPrefix(prefix) else { return }
+            lock.lock()
+            created += 1
+            lock.unlock()
+        }
+
+        let suppressedCallback = Notifier.default.addOnEventsSuppressedCallback { directory, count in
+            if directory == directoryPath && count > 0 {
+                expectation.fulfill()
+            }
+        }
+
+        for i in 0..<50 {
+            try Data().write(to: URL(fileURLWithPath: "\(directoryPath)/\(prefix)-\(i)"))
+        }
+
+        waitForExpectations(timeout: 3) { error in
+            if let error = error {
+                XCTFail("Suppressed events callback was not called: \(error)")
+            }
+        }
+
+        lock.lock()
+        XCTAssertLessThan(created, 50)
+        lock.unlock()
+        XCTAssertGreaterThan(Notifier.default.suppressedEventCount(for: directoryPath), 0)
+
+        Notifier.default.removeCallback(forCallbackId: createCallback)
+        Notifier.default.removeCallback(forCallbackId: suppressedCallback)
+    }
+}
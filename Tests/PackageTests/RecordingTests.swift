@@ -0,0 +1,64 @@
+import XCTest
+import SWNotify
+
+class RecordingTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyRecordingTestDirectory"
+    private static let recordingPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyRecordingTest.rec"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.removeItem(atPath: recordingPath)
+    }
+
+    func testRecordedEventsAreReplayedThroughCallbacks() throws {
+        try Notifier.default.addNotifier(for: RecordingTests.directoryPath, events: [.create])
+
+        let filenames = (0..<10).map { _ in UUID().uuidString }
+        let lock = NSLock()
+        var seen: [String: Int] = [:]
+
+        let recordedExpectation = self.expectation(description: "Create callbacks while recording")
+        recordedExpectation.expectedFulfillmentCount = filenames.count
+
+        let callback = Notifier.default.addOnFileCreateCallback { file in
+            guard filenames.contains(file) else { return }
+            lock.lock()
+            seen[file, default: 0] += 1
+            let count = seen[file]!
+            lock.unlock()
+
+            if count == 1 {
+                recordedExpectation.fulfill()
+            }
+        }
+
+        try Notifier.default.startRecording(to: RecordingTests.recordingPath)
+
+        for filename in filenames {
+            try Data().write(to: URL(fileURLWithPath: "\(RecordingTests.directoryPath)/\(filename)"))
+        }
+
+        wait(for: [recordedExpectation], timeout: 2)
+        Notifier.default.stopRecording()
+
+        let replayed = try Notifier.default.replayRecording(from: RecordingTests.recordingPath, timing: .asFastAsPossible)
+        XCTAssertGreaterThanOrEqual(replayed, filenames.count)
+
+        let replayedExpectation = self.expectation(description: "Create callbacks while replaying")
+        DispatchQueue.global().asyncAfter(deadline: .now() + 0.5) {
+            replayedExpectation.fulfill()
+        }
+        wait(for: [replayedExpectation], timeout: 2)
+
+        lock.lock()
+        XCTAssertTrue(filenames.allSatisfy { seen[$0] == 2 })
+        lock.unlock()
+
+        Notifier.default.removeCallback(forCallbackId: callback)
+    }
+}
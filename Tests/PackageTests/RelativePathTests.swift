@@ -166,4 +166,49 @@ class RelativePathTests: XCTestCase {
             }
         }
     }
+
+    func testFileCloseWrite() throws {
+        try Notifier.default.addNotifier(for: directoryPath, events: [.closeWrite])
+
+        let filename = UUID().uuidString
+        let filePath = "\(directoryPath)/\(filename)"
+
+        let expectation = self.expectation(description: "File close write callback")
+
+        Notifier.default.addOnFileCloseWriteCallback { file in
+            if file == filename {
+                expectation.fulfill()
+            }
+        }
+
+        try "Hello world!".write(toFile: filePath, atomically: false, encoding: .utf8)
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("File close write callback was not called: \(error)")
+            }
+        }
+    }
+
+    func testDirectoryCreateEvent() throws {
+        try Notifier.default.addNotifier(for: directoryPath, events: [.create])
+
+        let directoryName = UUID().uuidString
+
+        let expectation = self.expectation(description: "Directory creation event callback")
+
+        Notifier.default.addOnEventCallback { info in
+            if info.path == directoryName && info.events == [.create] && info.isDirectory {
+                expectation.fulfill()
+            }
+        }
+
+        try FileManager.default.createDirectory(atPath: "\(directoryPath)/\(directoryName)", withIntermediateDirectories: false, attributes: nil)
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Directory creation event callback was not called: \(error)")
+            }
+        }
+    }
 }
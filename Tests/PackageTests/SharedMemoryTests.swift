@@ -0,0 +1,58 @@
+import XCTest
+import SWNotify
+
+class SharedMemoryTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifySharedMemoryTestDirectory"
+    private static let ringName = "SWNotifySharedMemoryTest"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        Notifier.default.stopSubscribing()
+        Notifier.default.stopPublishing()
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.removeItem(atPath: "/dev/shm/swnotify.\(ringName)")
+    }
+
+    func testSubscribingToAMissingRingThrows() {
+        XCTAssertThrowsError(try Notifier.default.startSubscribing(to: UUID().uuidString))
+        XCTAssertFalse(Notifier.default.isSubscriber)
+    }
+
+    func testPublishedEventsReachSubscribedDirectories() throws {
+        // Watched directly with a trailing slash, so the subscribed watch below is a separate watch on the same directory
+        try Notifier.default.addNotifier(for: "\(SharedMemoryTests.directoryPath)/", events: [.create])
+        try Notifier.default.startPublishing(as: SharedMemoryTests.ringName)
+        try Notifier.default.startSubscribing(to: SharedMemoryTests.ringName)
+        XCTAssertTrue(Notifier.default.isSubscriber)
+
+        try Notifier.default.addNotifier(for: SharedMemoryTests.directoryPath, events: [.create])
+
+        let filename = UUID().uuidString
+        let expectation = self.expectation(description: "Create callback from the watch and from the ring")
+        expectation.expectedFulfillmentCount = 2
+
+        let callback = Notifier.default.addOnFileCreateCallback { file in
+            if file == filename {
+                expectation.fulfill()
+            }
+        }
+
+        try Data().write(to: URL(fileURLWithPath: "\(SharedMemoryTests.directoryPath)/\(filename)"))
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Create callbacks were not called: \(error)")
+            }
+        }
+
+        XCTAssertEqual(Notifier.default.subscriberOverruns, 0)
+
+        Notifier.default.removeCallback(forCallbackId: callback)
+        Notifier.default.stopSubscribing()
+        Notifier.default.stopPublishing()
+    }
+}
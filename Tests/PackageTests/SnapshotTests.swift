@@ -0,0 +1,84 @@
+import XCTest
+import SWNotify
+
+class SnapshotTests: XCTestCase {
+    private static let rootPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifySnapshotTestDirectory"
+    private static let directoryPath = "\(rootPath)/watched"
+    private static let snapshotPath = "\(rootPath)/snapshots"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: rootPath)
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: true, attributes: nil)
+        for name in ["kept", "deleted", "appended"] {
+            FileManager.default.createFile(atPath: "\(directoryPath)/\(name)", contents: Data("a".utf8), attributes: nil)
+        }
+        Notifier.default.includeAbsolutePathsInEvents = false
+        Notifier.default.snapshotDirectory = snapshotPath
+    }
+
+    override class func tearDown() {
+        try? Notifier.default.removeNotifier(for: directoryPath)
+        Notifier.default.snapshotDirectory = nil
+        try? FileManager.default.removeItem(atPath: rootPath)
+    }
+
+    func testChangesWhileUnwatchedAreCaughtUp() throws {
+        let directory = SnapshotTests.directoryPath
+        let events: Set<FileSystemEvent> = [.create, .delete, .modify]
+
+        // The first time there's no snapshot to compare against, so this only records one
+        try Notifier.default.addNotifier(for: directory, events: events)
+        usleep(300_000)
+        try? Notifier.default.removeNotifier(for: directory)
+
+        try FileManager.default.removeItem(atPath: "\(directory)/deleted")
+        FileManager.default.createFile(atPath: "\(directory)/created", contents: Data("b".utf8), attributes: nil)
+        let handle = try FileHandle(forWritingTo: URL(fileURLWithPath: "\(directory)/appended"))
+        handle.seekToEndOfFile()
+        handle.write(Data("more".utf8))
+        handle.closeFile()
+
+        let lock = NSLock()
+        var created: [String] = []
+        var deleted: [String] = []
+        var modified: [String] = []
+        let expectation = self.expectation(description: "Catch-up callbacks")
+        expectation.expectedFulfillmentCount = 3
+
+        let callbacks = [
+            Notifier.default.addOnFileCreateCallback { path in
+                lock.lock()
+                created.append(path)
+                lock.unlock()
+                expectation.fulfill()
+            },
+            Notifier.default.addOnFileDeleteCallback { path in
+                lock.lock()
+                deleted.append(path)
+                lock.unlock()
+                expectation.fulfill()
+            },
+            Notifier.default.addOnFileModifyCallback { path in
+                lock.lock()
+                modified.append(path)
+                lock.unlock()
+                expectation.fulfill()
+            },
+        ]
+        defer { callbacks.forEach { Notifier.default.removeCallback(forCallbackId: $0) } }
+
+        try Notifier.default.addNotifier(for: directory, events: events)
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Catch-up callbacks were not called: \(error)")
+            }
+        }
+
+        lock.lock()
+        XCTAssertEqual(created, ["created"])
+        XCTAssertEqual(deleted, ["deleted"])
+        XCTAssertEqual(modified, ["appended"])
+        lock.unlock()
+    }
+}
@@ -0,0 +1,52 @@
+import XCTest
+import SWNotify
+
+class StatCacheTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyStatCacheTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        FileManager.default.createFile(atPath: "\(directoryPath)/file", contents: Data(count: 10), attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        Notifier.default.stopCachingAttributes(of: directoryPath)
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testCachedAttributesFollowWrites() throws {
+        let path = StatCacheTests.directoryPath
+        try Notifier.default.addNotifier(for: path, events: [.create])
+        try Notifier.default.startCachingAttributes(of: path)
+
+        let before = Notifier.default.statCacheStatistics
+        XCTAssertEqual(Notifier.default.cachedAttributes(ofFile: "file", in: path)?.size, 10)
+        XCTAssertEqual(Notifier.default.cachedAttributes(ofFile: "file", in: path)?.size, 10)
+
+        let cached = Notifier.default.statCacheStatistics
+        XCTAssertEqual(cached.misses - before.misses, 1)
+        XCTAssertEqual(cached.hits - before.hits, 1)
+
+        let handle = try XCTUnwrap(FileHandle(forWritingAtPath: "\(path)/file"))
+        handle.seekToEndOfFile()
+        handle.write(Data(count: 5))
+        handle.closeFile()
+
+        var size = Notifier.default.cachedAttributes(ofFile: "file", in: path)?.size
+        let deadline = Date().addingTimeInterval(2)
+        while size != 15 && Date() < deadline {
+            usleep(10_000)
+            size = Notifier.default.cachedAttributes(ofFile: "file", in: path)?.size
+        }
+
+        XCTAssertEqual(size, 15, "The write's events should have dropped the cached size")
+        XCTAssertGreaterThan(Notifier.default.statCacheStatistics.invalidations, before.invalidations)
+        XCTAssertNil(Notifier.default.cachedAttributes(ofFile: "missing", in: path))
+    }
+
+    func testAttributeCachingNeedsAWatchedDirectory() {
+        XCTAssertThrowsError(try Notifier.default.startCachingAttributes(of: "/definitely/not/watched"))
+    }
+}
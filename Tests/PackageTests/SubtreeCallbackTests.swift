@@ -0,0 +1,55 @@
+import XCTest
+import SWNotify
+
+class SubtreeCallbackTests: XCTestCase {
+    private static let rootPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifySubtreeTestDirectory"
+    private let innerPath = "\(SubtreeCallbackTests.rootPath)/inner/deeper"
+    private let outsidePath = "\(FileManager.default.temporaryDirectory.path)/SWNotifySubtreeTestDirectoryOutside"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: "\(rootPath)/inner/deeper", withIntermediateDirectories: true, attributes: nil)
+        try? FileManager.default.createDirectory(atPath: "\(rootPath)Outside", withIntermediateDirectories: true, attributes: nil)
+    }
+
+    override class func tearDown() {
+        try? FileManager.default.removeItem(atPath: rootPath)
+        try? FileManager.default.removeItem(atPath: "\(rootPath)Outside")
+    }
+
+    func testSubtreeCallbackHearsOnlyDirectoriesUnderItsPath() throws {
+        try Notifier.default.addNotifier(for: innerPath, events: [.create])
+        try Notifier.default.addNotifier(for: outsidePath, events: [.create])
+
+        let insideFilePath = "\(innerPath)/\(UUID().uuidString)"
+        let outsideFilePath = "\(outsidePath)/\(UUID().uuidString)"
+        let lock = NSLock()
+        var paths: [String] = []
+
+        let expectation = self.expectation(description: "Subtree callback for a file under the subtree")
+
+        let callback = try Notifier.default.addSubtreeCallback(under: SubtreeCallbackTests.rootPath, events: [.create]) { event in
+            lock.lock()
+            paths.append(event.path)
+            lock.unlock()
+
+            if event.path == insideFilePath {
+                expectation.fulfill()
+            }
+        }
+
+        try Data().write(to: URL(fileURLWithPath: outsideFilePath))
+        try Data().write(to: URL(fileURLWithPath: insideFilePath))
+
+        waitForExpectations(timeout: 2) { error in
+            if let error = error {
+                XCTFail("Subtree callback was not called: \(error)")
+            }
+        }
+
+        lock.lock()
+        XCTAssertFalse(paths.contains(outsideFilePath))
+        lock.unlock()
+
+        Notifier.default.removeCallback(forCallbackId: callback)
+    }
+}
@@ -0,0 +1,79 @@
+import XCTest
+import SWNotify
+
+class SyntheticSourceTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifySyntheticTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+    }
+
+    override class func tearDown() {
+        Notifier.default.stopSyntheticEvents()
+        Notifier.default.usesVirtualClock = false
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    func testSyntheticEventsReachCallbacks() throws {
+        try Notifier.default.addNotifier(for: SyntheticSourceTests.directoryPath, events: [.create])
+
+        let eventCount = 100_000
+        let lock = NSLock()
+        var created = 0
+
+        let expectation = self.expectation(description: "Create callback for every synthetic event")
+
+        let callback = Notifier.default.addOnFileCreateCallback { _ in
+            lock.lock()
+            created += 1
+            if created == eventCount {
+                expectation.fulfill()
+            }
+            lock.unlock()
+        }
+
+        try Notifier.default.startSyntheticEvents(in: SyntheticSourceTests.directoryPath, mix: SyntheticEventMix(create: 1, delete: 0, modify: 0, move: 0), limit: eventCount, seed: 1)
+
+        waitForExpectations(timeout: 10) { error in
+            if let error = error {
+                XCTFail("Not every synthetic event was dispatched: \(error)")
+            }
+        }
+
+        Notifier.default.stopSyntheticEvents()
+        Notifier.default.removeCallback(forCallbackId: callback)
+    }
+
+    func testMoveExpiryFollowsTheVirtualClock() throws {
+        try Notifier.default.addNotifier(for: SyntheticSourceTests.directoryPath, events: [.moveFrom, .moveTo])
+        Notifier.default.usesVirtualClock = true
+        defer { Notifier.default.usesVirtualClock = false }
+
+        let lock = NSLock()
+        var movedOut = 0
+        let expectation = self.expectation(description: "Move-from callback once the virtual clock passes the expiry")
+
+        let callback = Notifier.default.addOnFileMoveFromCallback { _ in
+            lock.lock()
+            movedOut += 1
+            lock.unlock()
+            expectation.fulfill()
+        }
+
+        try Notifier.default.startSyntheticEvents(in: SyntheticSourceTests.directoryPath, mix: SyntheticEventMix(create: 0, delete: 0, modify: 0, move: 0, moveOut: 1), limit: 1, seed: 1)
+
+        // Well past 500 ms of real time, but the virtual clock hasn't moved, so the move is still waiting for its IN_MOVED_TO
+        Thread.sleep(forTimeInterval: 0.8)
+        lock.lock()
+        XCTAssertEqual(movedOut, 0)
+        lock.unlock()
+
+        // Advancing wakes the notifier, so the move expires straight away rather than on its next turn
+        Notifier.default.advanceVirtualClock(by: 0.6)
+        wait(for: [expectation], timeout: 2)
+
+        Notifier.default.stopSyntheticEvents()
+        Notifier.default.removeCallback(forCallbackId: callback)
+    }
+}
@@ -0,0 +1,123 @@
+import XCTest
+import SWNotify
+
+class UnchangedModificationTests: XCTestCase {
+    private static let directoryPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyUnchangedModificationTestDirectory"
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: directoryPath)
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+        Notifier.default.suppressUnchangedModifications = true
+    }
+
+    override class func tearDown() {
+        Notifier.default.suppressUnchangedModifications = false
+        try? Notifier.default.removeNotifier(for: directoryPath)
+        try? FileManager.default.removeItem(atPath: directoryPath)
+    }
+
+    // Written in place rather than truncated first, so each write is a single modification
+    private func overwrite(_ path: String, with contents: String) {
+        let handle = FileHandle(forWritingAtPath: path)!
+        handle.write(Data(contents.utf8))
+        handle.closeFile()
+    }
+
+    func testIdenticalRewriteIsSuppressed() throws {
+        let directoryPath = UnchangedModificationTests.directoryPath
+        let name = UUID().uuidString
+        let path = "\(directoryPath)/\(name)"
+        FileManager.default.createFile(atPath: path, contents: nil, attributes: nil)
+        try Notifier.default.addNotifier(for: directoryPath, events: [.modify])
+
+        let lock = NSLock()
+        var modified = 0
+        let callback = Notifier.default.addOnFileModifyCallback { file in
+            guard file == name else { return }
+            lock.lock()
+            modified += 1
+            lock.unlock()
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        func waitForModifications(_ count: Int) -> Int {
+            let deadline = Date().addingTimeInterval(2)
+            var seen = 0
+            repeat {
+                usleep(10_000)
+                lock.lock()
+                seen = modified
+                lock.unlock()
+            } while seen < count && Date() < deadline
+            return seen
+        }
+
+        // Never seen before, so it counts as changed
+        overwrite(path, with: "abc")
+        XCTAssertEqual(waitForModifications(1), 1)
+
+        // The same bytes again: the modify is swallowed
+        usleep(100_000)
+        overwrite(path, with: "abc")
+        usleep(300_000)
+        XCTAssertEqual(waitForModifications(1), 1, "Rewriting identical bytes isn't reported")
+
+        // Different bytes of the same length
+        overwrite(path, with: "xyz")
+        XCTAssertEqual(waitForModifications(2), 2, "Changed bytes are reported")
+    }
+
+    func testChangedBytesReportBothModifyAndCloseWrite() throws {
+        // A directory of its own, so the other test's watch keeps the events it asked for
+        let directoryPath = "\(UnchangedModificationTests.directoryPath)/closeWrite"
+        try FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: false, attributes: nil)
+        let name = UUID().uuidString
+        let path = "\(directoryPath)/\(name)"
+        FileManager.default.createFile(atPath: path, contents: nil, attributes: nil)
+        try Notifier.default.addNotifier(for: directoryPath, events: [.modify, .closeWrite])
+        defer { try? Notifier.default.removeNotifier(for: directoryPath) }
+
+        let lock = NSLock()
+        var modified = 0
+        var closed = 0
+        let callbacks = [
+            Notifier.default.addOnFileModifyCallback { file in
+                guard file == name else { return }
+                lock.lock()
+                modified += 1
+                lock.unlock()
+            },
+            Notifier.default.addOnFileCloseWriteCallback { file in
+                guard file == name else { return }
+                lock.lock()
+                closed += 1
+                lock.unlock()
+            },
+        ]
+        defer { callbacks.forEach { Notifier.default.removeCallback(forCallbackId: $0) } }
+
+        func waitForCounts(_ count: Int) -> (Int, Int) {
+            let deadline = Date().addingTimeInterval(2)
+            var seen = (0, 0)
+            repeat {
+                usleep(10_000)
+                lock.lock()
+                seen = (modified, closed)
+                lock.unlock()
+            } while (seen.0 < count || seen.1 < count) && Date() < deadline
+            return seen
+        }
+
+        // The close-write that ends each write is checked against the last close-write, not the modify before it
+        overwrite(path, with: "abc")
+        var counts = waitForCounts(1)
+        XCTAssertEqual(counts.0, 1)
+        XCTAssertEqual(counts.1, 1)
+
+        overwrite(path, with: "xyz")
+        counts = waitForCounts(2)
+        XCTAssertEqual(counts.0, 2, "Changed bytes are reported as a modification")
+        XCTAssertEqual(counts.1, 2, "Changed bytes are reported as a close-write")
+    }
+}
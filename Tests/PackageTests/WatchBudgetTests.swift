@@ -0,0 +1,74 @@
+import XCTest
+import SWNotify
+
+class WatchBudgetTests: XCTestCase {
+    private static let rootPath = "\(FileManager.default.temporaryDirectory.path)/SWNotifyWatchBudgetTestDirectory"
+    private static let directoryPath = "\(rootPath)/busy"
+    private static var fillerPaths: [String] = []
+    private static var previousBudget = 0
+
+    override class func setUp() {
+        try? FileManager.default.removeItem(atPath: rootPath)
+        try? FileManager.default.createDirectory(atPath: directoryPath, withIntermediateDirectories: true, attributes: nil)
+        Notifier.default.includeAbsolutePathsInEvents = false
+        previousBudget = Notifier.default.watchBudget
+        Notifier.default.pollInterval = 0.2
+    }
+
+    override class func tearDown() {
+        for path in fillerPaths + [directoryPath] {
+            try? Notifier.default.removeNotifier(for: path)
+        }
+        Notifier.default.watchBudget = previousBudget
+        Notifier.default.pollInterval = 2
+        try? FileManager.default.removeItem(atPath: rootPath)
+    }
+
+    private func waitFor(timeout: TimeInterval = 5, _ condition: () -> Bool) -> Bool {
+        let deadline = Date().addingTimeInterval(timeout)
+        while !condition() && Date() < deadline {
+            usleep(20_000)
+        }
+        return condition()
+    }
+
+    func testDemotedDirectoryKeepsReportingAndIsPromotedBack() throws {
+        let directory = WatchBudgetTests.directoryPath
+        try Notifier.default.addNotifier(for: directory, events: [.create])
+        XCTAssertEqual(Notifier.default.backend(for: directory), .inotify)
+
+        // With a budget of one, every directory added moves the coldest (and, among equally cold ones, the oldest)
+        // watch to the poller, so quiet directories added after this one push it out
+        Notifier.default.watchBudget = 1
+        while Notifier.default.backend(for: directory) == .inotify && WatchBudgetTests.fillerPaths.count < 256 {
+            let filler = "\(WatchBudgetTests.rootPath)/filler\(WatchBudgetTests.fillerPaths.count)"
+            try FileManager.default.createDirectory(atPath: filler, withIntermediateDirectories: false, attributes: nil)
+            try Notifier.default.addNotifier(for: filler, events: [.create])
+            WatchBudgetTests.fillerPaths.append(filler)
+        }
+        XCTAssertEqual(Notifier.default.backend(for: directory), .polling)
+
+        let lock = NSLock()
+        var created = Set<String>()
+        let callback = Notifier.default.addOnFileCreateCallback { path in
+            lock.lock()
+            created.insert(path)
+            lock.unlock()
+        }
+        defer { Notifier.default.removeCallback(forCallbackId: callback) }
+
+        // Still reported while polled, and busy enough to be moved back to inotify
+        let names = (0..<40).map { "file\($0)" }
+        for name in names {
+            FileManager.default.createFile(atPath: "\(directory)/\(name)", contents: nil, attributes: nil)
+        }
+
+        XCTAssertTrue(waitFor {
+            lock.lock()
+            defer { lock.unlock() }
+            return created.isSuperset(of: names)
+        }, "Every file created in the demoted directory is reported")
+
+        XCTAssertTrue(waitFor { Notifier.default.backend(for: directory) == .inotify }, "The busy directory is promoted back to inotify")
+    }
+}